@@ -4885,9 +4885,14 @@ re_match_2_internal (bufp, string1, size1, string2, size2, pos, regs, stop)
 		  EXTRACT_NUMBER_AND_INCR (mcnt, p1);
 		  p1 += mcnt;
 
-		  if ((is_a_jump_n && (re_opcode_t) *p1 == succeed_n)
-		      || (!is_a_jump_n
-			  && (re_opcode_t) *p1 == on_failure_jump))
+		  /* Only a backward jump closes a loop.  The forward one
+		     that skips the body of an `x{0}' is an ordinary jump,
+		     and may well lead to the `on_failure_jump' of a
+		     following `y?'.  */
+		  if (mcnt < 0
+		      && ((is_a_jump_n && (re_opcode_t) *p1 == succeed_n)
+			  || (!is_a_jump_n
+			      && (re_opcode_t) *p1 == on_failure_jump)))
 		    goto fail;
 		  break;
 		default:
@@ -5282,6 +5287,788 @@ re_exec (s)
 
 #ifndef emacs
 
+#ifndef REGEX_NO_DFA
+
+/* DFA execution for regexec.
+
+   re_search tries the pattern at every starting position, and
+   re_match_2 backtracks within each try.  When regexec only needs to
+   know whether there is a match, we can do better: the compiled
+   pattern is turned into an NFA (every instruction which matches a
+   character is a node, jumps and on_failure_jumps are empty
+   transitions, intervals are unrolled), and the NFA is run as a DFA
+   whose states are built lazily and cached in the pattern buffer.
+   The string is then scanned once, one table lookup per character.
+
+   Back references and word boundaries can't be done this way; for
+   such patterns `dfa_compile' returns zero and regexec uses the
+   backtracking matcher.  The state cache is bounded.  When it is full
+   it is flushed; if it fills up again too soon the DFA is not worth it
+   and that string is left to the backtracking matcher, and after
+   DFA_MAX_BLOWUPS such strings the DFA is not used any more.
+
+   When the caller wants the registers, the DFA is still used to reject
+   strings which don't match before the backtracking matcher runs.  */
+
+#define DFA_MAX_NODES 4000
+#define DFA_MAX_STATES 256
+#define DFA_HASH_SIZE 256	/* Must be a power of two.  */
+#define DFA_MAX_BLOWUPS 8
+
+/* Node types.  */
+enum { dfa_char, dfa_jump, dfa_split, dfa_begline, dfa_endline,
+       dfa_begbuf, dfa_endbuf, dfa_match };
+
+struct dfa_node
+{
+  unsigned char type;
+  int out, out2;
+  unsigned char set[CHAR_SET_SIZE / BYTEWIDTH];	/* For dfa_char.  */
+};
+
+/* Which assertions hold at a position.  A state knows about the
+   characters before it (DFA_BOL, DFA_BOB); the ones about the
+   following characters are checked when it is left.  */
+#define DFA_BOL 1
+#define DFA_BOB 2
+#define DFA_EOL 4
+#define DFA_EOB 8
+
+/* A match ends at the state if the next character is not a newline,
+   is a newline, or if the string ends here (REG_NOTEOL or not).  */
+#define DFA_ACC_MID 1
+#define DFA_ACC_NL 2
+#define DFA_ACC_END_NOTEOL 4
+#define DFA_ACC_END 8
+
+struct dfa_state
+{
+  int kernel;		/* Offset of the node set in `kernels'.  */
+  int nkernel;
+  int hash_next;
+  unsigned char ctx;	/* DFA_BOL, DFA_BOB.  */
+  unsigned char acc;
+  short next[CHAR_SET_SIZE];	/* -1 if not built yet.  */
+};
+
+struct re_dfa
+{
+  struct dfa_node *node;
+  int nnodes, nodes_allocated;
+  int start;
+  int newline_anchor;
+
+  struct dfa_state *state;
+  int nstates, states_allocated;
+  int *kernels;
+  int nkernels, kernels_allocated;
+  int hash[DFA_HASH_SIZE];
+  int init[2];		/* Initial states, by REG_NOTBOL.  */
+  unsigned long scanned;	/* Characters since the last flush.  */
+  int blowups;
+
+  /* Scratch space.  */
+  int *stack, *list, *kernel_buf;
+  int nlist;
+  unsigned *mark, gen;
+};
+
+/* What dfa_compile needs to know about the compiled pattern.  */
+struct dfa_source
+{
+  unsigned char *buffer;
+  int used;
+  char *insn;		/* Nonzero where an instruction starts.  */
+  int *count;		/* Values stored there by set_number_at, or -1.  */
+  RE_TRANSLATE_TYPE translate;
+  reg_syntax_t syntax;
+};
+
+static int dfa_segment ();
+
+static int
+dfa_insn_len (p)
+    unsigned char *p;
+{
+  switch (SWITCH_ENUM_CAST ((re_opcode_t) *p))
+    {
+    case exactn:
+    case charset:
+    case charset_not:
+      return 2 + p[1];
+
+    case duplicate:
+      return 2;
+
+    case start_memory:
+    case stop_memory:
+    case jump:
+    case jump_past_alt:
+    case on_failure_jump:
+    case on_failure_keep_string_jump:
+    case pop_failure_jump:
+    case maybe_pop_jump:
+    case dummy_failure_jump:
+      return 3;
+
+    case succeed_n:
+    case jump_n:
+    case set_number_at:
+      return 5;
+
+    default:
+      return 1;
+    }
+}
+
+/* Where the jump-like instruction at PC goes.  */
+static int
+dfa_jump_target (src, pc)
+    struct dfa_source *src;
+    int pc;
+{
+  int mcnt;
+
+  EXTRACT_NUMBER (mcnt, src->buffer + pc + 1);
+  return pc + 3 + mcnt;
+}
+
+static int
+dfa_new_node (d, type)
+    struct re_dfa *d;
+    int type;
+{
+  struct dfa_node *node;
+
+  if (d->nnodes >= DFA_MAX_NODES)
+    return -1;
+  if (d->nnodes == d->nodes_allocated)
+    {
+      d->nodes_allocated = d->nodes_allocated * 2 + 16;
+      RETALLOC (d->node, d->nodes_allocated, struct dfa_node);
+      if (d->node == NULL)
+	return -1;
+    }
+  node = &d->node[d->nnodes];
+  bzero (node, sizeof (*node));
+  node->type = type;
+  node->out = node->out2 = -1;
+  return d->nnodes++;
+}
+
+/* The interval from the succeed_n at S to T (see `handle_interval' in
+   regex_compile), unrolled.  Returns its first node, or -1.  */
+static int
+dfa_interval (d, src, s, t, cont)
+    struct re_dfa *d;
+    struct dfa_source *src;
+    int s, t, cont;
+{
+  int lower = src->count[s + 3], upper = 1;
+  int end = t, entry, i;
+
+  if (t - 5 >= s + 5 && src->insn[t - 5]
+      && (re_opcode_t) src->buffer[t - 5] == jump_n
+      && dfa_jump_target (src, t - 5) == s)
+    {
+      end = t - 5;
+      upper = src->count[t - 5 + 3];
+      if (upper < 0)
+	return -1;
+      upper++;
+    }
+  if (lower < 0 || lower > upper)
+    return -1;
+
+  if (upper >= RE_DUP_MAX)
+    {
+      /* {n,} */
+      int body;
+
+      entry = dfa_new_node (d, dfa_split);
+      if (entry < 0)
+	return -1;
+      body = dfa_segment (d, src, s + 5, end, entry);
+      if (body < 0)
+	return -1;
+      d->node[entry].out = body;
+      d->node[entry].out2 = cont;
+    }
+  else
+    {
+      /* Optional repetitions, innermost first.  */
+      entry = cont;
+      for (i = lower; i < upper; i++)
+	{
+	  int split = dfa_new_node (d, dfa_split);
+	  int body;
+
+	  if (split < 0)
+	    return -1;
+	  body = dfa_segment (d, src, s + 5, end, entry);
+	  if (body < 0)
+	    return -1;
+	  d->node[split].out = body;
+	  d->node[split].out2 = cont;
+	  entry = split;
+	}
+    }
+
+  for (i = 0; i < lower && entry >= 0; i++)
+    entry = dfa_segment (d, src, s + 5, end, entry);
+  return entry;
+}
+
+/* Makes nodes for the instructions from A to B; the last continues at
+   node CONT.  Returns the first node, or -1 if the pattern can't be
+   done with a DFA.  Jumps must stay within [A,B].  */
+static int
+dfa_segment (d, src, a, b, cont)
+    struct re_dfa *d;
+    struct dfa_source *src;
+    int a, b, cont;
+{
+  unsigned char *buffer = src->buffer;
+  RE_TRANSLATE_TYPE translate = src->translate;
+  int *map;
+  int pc, len, ret = -1;
+
+  if (a == b)
+    return cont;
+  map = TALLOC (b - a, int);
+  if (map == NULL)
+    return -1;
+
+  /* First a node for every instruction, so that forward jumps can be
+     resolved.  */
+  for (pc = a; pc < b; pc++)
+    map[pc - a] = -1;
+  for (pc = a; pc < b; pc += len)
+    {
+      re_opcode_t op = (re_opcode_t) buffer[pc];
+      int n;
+
+      len = dfa_insn_len (buffer + pc);
+      if (op == succeed_n)
+	{
+	  /* The whole interval is one unit here.  */
+	  len = dfa_jump_target (src, pc) - pc;
+	  if (len < 5)
+	    goto out;
+	}
+      if (pc + len > b)
+	goto out;
+      if (op == exactn && buffer[pc + 1] > 0)
+	{
+	  map[pc - a] = dfa_new_node (d, dfa_char);
+	  for (n = 1; n < buffer[pc + 1]; n++)
+	    if (dfa_new_node (d, dfa_char) < 0)
+	      goto out;
+	}
+      else
+	map[pc - a] = dfa_new_node (d, dfa_jump);
+      if (map[pc - a] < 0)
+	goto out;
+    }
+
+#define DFA_TARGET(x) \
+  ((x) == b ? cont : (x) >= a && (x) < b ? map[(x) - a] : -1)
+
+  for (pc = a; pc < b; pc += len)
+    {
+      unsigned char *p = buffer + pc;
+      int m = map[pc - a];
+      int next, c;
+
+      len = dfa_insn_len (p);
+      if ((re_opcode_t) *p == succeed_n)
+	len = dfa_jump_target (src, pc) - pc;
+      next = DFA_TARGET (pc + len);
+      if (next < 0)
+	goto out;
+
+      switch (SWITCH_ENUM_CAST ((re_opcode_t) *p))
+	{
+	case no_op:
+	case start_memory:
+	case stop_memory:
+	case push_dummy_failure:
+	case set_number_at:
+	  d->node[m].out = next;
+	  break;
+
+	case succeed:
+	  d->node[m].type = dfa_match;
+	  break;
+
+	case jump:
+	case jump_past_alt:
+	case pop_failure_jump:
+	case maybe_pop_jump:
+	case dummy_failure_jump:
+	  d->node[m].out = DFA_TARGET (dfa_jump_target (src, pc));
+	  if (d->node[m].out < 0)
+	    goto out;
+	  break;
+
+	case on_failure_jump:
+	case on_failure_keep_string_jump:
+	  d->node[m].type = dfa_split;
+	  d->node[m].out = next;
+	  d->node[m].out2 = DFA_TARGET (dfa_jump_target (src, pc));
+	  if (d->node[m].out2 < 0)
+	    goto out;
+	  break;
+
+	case succeed_n:
+	  /* dfa_interval may move the nodes.  */
+	  c = dfa_interval (d, src, pc, pc + len, next);
+	  if (c < 0)
+	    goto out;
+	  d->node[m].out = c;
+	  break;
+
+	case exactn:
+	  {
+	    int n;
+
+	    for (n = 0; n < p[1]; n++)
+	      {
+		struct dfa_node *node = &d->node[m + n];
+
+		for (c = 0; c < CHAR_SET_SIZE; c++)
+		  if ((unsigned char) TRANSLATE (c) == p[2 + n])
+		    node->set[c / BYTEWIDTH] |= 1 << (c % BYTEWIDTH);
+		node->out = n + 1 < p[1] ? m + n + 1 : next;
+	      }
+	    if (p[1] == 0)
+	      d->node[m].out = next;
+	    break;
+	  }
+
+	case anychar:
+	  d->node[m].type = dfa_char;
+	  d->node[m].out = next;
+	  for (c = 0; c < CHAR_SET_SIZE; c++)
+	    if (!(!(src->syntax & RE_DOT_NEWLINE) && TRANSLATE (c) == '\n')
+		&& !((src->syntax & RE_DOT_NOT_NULL) && TRANSLATE (c) == '\000'))
+	      d->node[m].set[c / BYTEWIDTH] |= 1 << (c % BYTEWIDTH);
+	  break;
+
+	case charset:
+	case charset_not:
+	  d->node[m].type = dfa_char;
+	  d->node[m].out = next;
+	  for (c = 0; c < CHAR_SET_SIZE; c++)
+	    {
+	      unsigned char tc = TRANSLATE (c);
+	      boolean in = tc < (unsigned) (p[1] * BYTEWIDTH)
+			   && p[2 + tc / BYTEWIDTH] & (1 << (tc % BYTEWIDTH));
+
+	      if (in != ((re_opcode_t) *p == charset_not))
+		d->node[m].set[c / BYTEWIDTH] |= 1 << (c % BYTEWIDTH);
+	    }
+	  break;
+
+	case wordchar:
+	case notwordchar:
+	  d->node[m].type = dfa_char;
+	  d->node[m].out = next;
+	  for (c = 0; c < CHAR_SET_SIZE; c++)
+	    if ((SYNTAX (c) == Sword) == ((re_opcode_t) *p == wordchar))
+	      d->node[m].set[c / BYTEWIDTH] |= 1 << (c % BYTEWIDTH);
+	  break;
+
+	case begline:
+	  d->node[m].type = dfa_begline;
+	  d->node[m].out = next;
+	  break;
+
+	case endline:
+	  d->node[m].type = dfa_endline;
+	  d->node[m].out = next;
+	  break;
+
+	case begbuf:
+	  d->node[m].type = dfa_begbuf;
+	  d->node[m].out = next;
+	  break;
+
+	case endbuf:
+	  d->node[m].type = dfa_endbuf;
+	  d->node[m].out = next;
+	  break;
+
+	default:
+	  /* duplicate, word boundaries, or a jump_n which is not
+	     part of an interval.  */
+	  goto out;
+	}
+    }
+#undef DFA_TARGET
+
+  ret = map[0];
+ out:
+  free (map);
+  return ret;
+}
+
+static void
+dfa_free (d)
+    struct re_dfa *d;
+{
+  if (d == NULL)
+    return;
+  free (d->node);
+  free (d->state);
+  free (d->kernels);
+  free (d->stack);
+  free (d->list);
+  free (d->kernel_buf);
+  free (d->mark);
+  free (d);
+}
+
+static void
+dfa_reset (d)
+    struct re_dfa *d;
+{
+  int i;
+
+  d->nstates = 0;
+  d->nkernels = 0;
+  d->init[0] = d->init[1] = -1;
+  for (i = 0; i < DFA_HASH_SIZE; i++)
+    d->hash[i] = -1;
+  d->scanned = 0;
+}
+
+/* Returns the NFA for BUFP, or zero if BUFP can't be done with a DFA.  */
+static struct re_dfa *
+dfa_compile (bufp)
+    struct re_pattern_buffer *bufp;
+{
+  struct dfa_source src;
+  struct re_dfa *d;
+  int pc, match;
+
+  src.buffer = bufp->buffer;
+  src.used = bufp->used;
+  src.translate = bufp->translate;
+  src.syntax = bufp->syntax;
+  src.insn = calloc (src.used + 1, 1);
+  src.count = TALLOC (src.used + 1, int);
+  d = calloc (1, sizeof (*d));
+  if (src.insn == NULL || src.count == NULL || d == NULL)
+    goto fail;
+
+  /* Find instruction boundaries and the interval counts.  */
+  for (pc = 0; pc <= src.used; pc++)
+    src.count[pc] = -1;
+  for (pc = 0; pc < src.used; pc += dfa_insn_len (src.buffer + pc))
+    {
+      src.insn[pc] = 1;
+      if ((re_opcode_t) src.buffer[pc] == set_number_at)
+	{
+	  int where = dfa_jump_target (&src, pc), value;
+
+	  if (pc + 5 > src.used || where < 0 || where + 2 > src.used)
+	    goto fail;
+	  EXTRACT_NUMBER (value, src.buffer + pc + 3);
+	  src.count[where] = value;
+	}
+    }
+  if (pc != src.used)
+    goto fail;
+
+  match = dfa_new_node (d, dfa_match);
+  if (match < 0)
+    goto fail;
+  d->start = dfa_segment (d, &src, 0, src.used, match);
+  if (d->start < 0)
+    goto fail;
+
+  d->newline_anchor = bufp->newline_anchor;
+  dfa_reset (d);
+  d->stack = TALLOC (3 * d->nnodes + 2, int);
+  d->list = TALLOC (d->nnodes, int);
+  d->kernel_buf = TALLOC (d->nnodes, int);
+  d->mark = calloc (d->nnodes, sizeof (d->mark[0]));
+  if (d->stack == NULL || d->list == NULL || d->kernel_buf == NULL
+      || d->mark == NULL)
+    goto fail;
+
+  free (src.insn);
+  free (src.count);
+  return d;
+
+ fail:
+  free (src.insn);
+  free (src.count);
+  dfa_free (d);
+  return 0;
+}
+
+static unsigned
+dfa_next_gen (d)
+    struct re_dfa *d;
+{
+  if (++d->gen == 0)
+    {
+      bzero (d->mark, d->nnodes * sizeof (d->mark[0]));
+      d->gen = 1;
+    }
+  return d->gen;
+}
+
+/* Collects in D->list the character nodes reachable from the start
+   node and the nodes in KERNEL without consuming input, given the
+   assertions in FLAGS.  Returns nonzero if the match node is
+   reachable.  */
+static int
+dfa_closure (d, kernel, nkernel, flags)
+    struct re_dfa *d;
+    int *kernel;
+    int nkernel, flags;
+{
+  int *stack = d->stack;
+  unsigned gen = dfa_next_gen (d);
+  int sp = 0, matched = 0;
+
+  d->nlist = 0;
+  stack[sp++] = d->start;
+  while (nkernel)
+    stack[sp++] = kernel[--nkernel];
+  while (sp)
+    {
+      int n = stack[--sp];
+      struct dfa_node *node = &d->node[n];
+
+      if (d->mark[n] == gen)
+	continue;
+      d->mark[n] = gen;
+      switch (node->type)
+	{
+	case dfa_char:
+	  d->list[d->nlist++] = n;
+	  break;
+	case dfa_match:
+	  matched = 1;
+	  break;
+	case dfa_split:
+	  stack[sp++] = node->out2;
+	  /* Fall through.  */
+	case dfa_jump:
+	  stack[sp++] = node->out;
+	  break;
+	case dfa_begline:
+	  if (flags & DFA_BOL)
+	    stack[sp++] = node->out;
+	  break;
+	case dfa_endline:
+	  if (flags & DFA_EOL)
+	    stack[sp++] = node->out;
+	  break;
+	case dfa_begbuf:
+	  if (flags & DFA_BOB)
+	    stack[sp++] = node->out;
+	  break;
+	case dfa_endbuf:
+	  if (flags & DFA_EOB)
+	    stack[sp++] = node->out;
+	  break;
+	}
+    }
+  return matched;
+}
+
+/* Returns the state for the sorted node set KERNEL, making it if
+   needed, or -1 if the cache is full.  */
+static int
+dfa_state (d, kernel, nkernel, ctx)
+    struct re_dfa *d;
+    int *kernel;
+    int nkernel, ctx;
+{
+  struct dfa_state *st;
+  unsigned hash = ctx;
+  int i, s;
+
+  for (i = 0; i < nkernel; i++)
+    hash = hash * 31 + kernel[i];
+  hash &= DFA_HASH_SIZE - 1;
+  for (s = d->hash[hash]; s >= 0; s = d->state[s].hash_next)
+    {
+      st = &d->state[s];
+      if (st->ctx == ctx && st->nkernel == nkernel
+	  && memcmp (d->kernels + st->kernel, kernel,
+		     nkernel * sizeof (kernel[0])) == 0)
+	return s;
+    }
+
+  if (d->nstates == DFA_MAX_STATES)
+    return -1;
+  if (d->nstates == d->states_allocated)
+    {
+      d->states_allocated = d->states_allocated * 2 + 4;
+      RETALLOC (d->state, d->states_allocated, struct dfa_state);
+      if (d->state == NULL)
+	return -1;
+    }
+  if (d->nkernels + nkernel > d->kernels_allocated)
+    {
+      d->kernels_allocated = (d->nkernels + nkernel) * 2;
+      RETALLOC (d->kernels, d->kernels_allocated, int);
+      if (d->kernels == NULL)
+	return -1;
+    }
+
+  s = d->nstates++;
+  st = &d->state[s];
+  st->kernel = d->nkernels;
+  st->nkernel = nkernel;
+  memcpy (d->kernels + d->nkernels, kernel, nkernel * sizeof (kernel[0]));
+  d->nkernels += nkernel;
+  st->ctx = ctx;
+  st->acc = 0;
+  if (dfa_closure (d, kernel, nkernel, ctx))
+    st->acc |= DFA_ACC_MID;
+  if (dfa_closure (d, kernel, nkernel,
+		   ctx | (d->newline_anchor ? DFA_EOL : 0)))
+    st->acc |= DFA_ACC_NL;
+  if (dfa_closure (d, kernel, nkernel, ctx | DFA_EOB))
+    st->acc |= DFA_ACC_END_NOTEOL;
+  if (dfa_closure (d, kernel, nkernel, ctx | DFA_EOB | DFA_EOL))
+    st->acc |= DFA_ACC_END;
+  memset (st->next, 0xff, sizeof (st->next));
+  st->hash_next = d->hash[hash];
+  d->hash[hash] = s;
+  return s;
+}
+
+static int
+dfa_int_cmp (a, b)
+    const void *a, *b;
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/* The state after reading C in state S, or -1 if the cache is full.  */
+static int
+dfa_step (d, s, c)
+    struct re_dfa *d;
+    int s, c;
+{
+  int nl = c == '\n' && d->newline_anchor;
+  unsigned gen;
+  int i, n = 0, t;
+
+  dfa_closure (d, d->kernels + d->state[s].kernel, d->state[s].nkernel,
+	       d->state[s].ctx | (nl ? DFA_EOL : 0));
+  gen = dfa_next_gen (d);
+  for (i = 0; i < d->nlist; i++)
+    {
+      struct dfa_node *node = &d->node[d->list[i]];
+
+      if ((node->set[c / BYTEWIDTH] & (1 << (c % BYTEWIDTH)))
+	  && d->mark[node->out] != gen)
+	{
+	  d->mark[node->out] = gen;
+	  d->kernel_buf[n++] = node->out;
+	}
+    }
+  qsort (d->kernel_buf, n, sizeof (d->kernel_buf[0]), dfa_int_cmp);
+  t = dfa_state (d, d->kernel_buf, n, nl ? DFA_BOL : 0);
+  if (t >= 0)
+    d->state[s].next[c] = t;
+  return t;
+}
+
+/* Empties the cache but for state S.  Returns the new number of S.  */
+static int
+dfa_flush (d, s)
+    struct re_dfa *d;
+    int s;
+{
+  int n = d->state[s].nkernel;
+  int ctx = d->state[s].ctx;
+
+  memcpy (d->kernel_buf, d->kernels + d->state[s].kernel,
+	  n * sizeof (d->kernel_buf[0]));
+  dfa_reset (d);
+  return dfa_state (d, d->kernel_buf, n, ctx);
+}
+
+/* Returns 1 if STRING matches, 0 if not, -1 if the DFA gave up.  */
+static int
+dfa_exec (d, string, len, not_bol, not_eol)
+    struct re_dfa *d;
+    const char *string;
+    int len, not_bol, not_eol;
+{
+  const unsigned char *p = (const unsigned char *) string;
+  const unsigned char *end = p + len;
+  const unsigned char *flushed = p;
+  int s, t;
+
+  if (d->blowups >= DFA_MAX_BLOWUPS)
+    return -1;
+  s = d->init[not_bol];
+  if (s < 0)
+    {
+      int ctx = DFA_BOB | (not_bol ? 0 : DFA_BOL);
+
+      s = dfa_state (d, (int *) 0, 0, ctx);
+      if (s < 0)
+	{
+	  dfa_reset (d);
+	  s = dfa_state (d, (int *) 0, 0, ctx);
+	  if (s < 0)
+	    return -1;
+	}
+      d->init[not_bol] = s;
+    }
+
+  for (; p < end; p++)
+    {
+      int c = *p;
+
+      if (d->state[s].acc & (c == '\n' ? DFA_ACC_NL : DFA_ACC_MID))
+	goto matched;
+      t = d->state[s].next[c];
+      if (t < 0)
+	{
+	  t = dfa_step (d, s, c);
+	  if (t < 0)
+	    {
+	      /* Cache full.  If it filled up quickly, states are not
+		 being reused and the DFA only costs time.  */
+	      if (d->scanned + (p - flushed) < 10 * DFA_MAX_STATES)
+		{
+		  d->blowups++;
+		  d->scanned += p - flushed;
+		  return -1;
+		}
+	      s = dfa_flush (d, s);
+	      flushed = p;
+	      t = s < 0 ? -1 : dfa_step (d, s, c);
+	      if (t < 0)
+		return -1;
+	    }
+	}
+      s = t;
+    }
+  t = d->state[s].acc & (not_eol ? DFA_ACC_END_NOTEOL : DFA_ACC_END);
+  d->scanned += p - flushed;
+  return t != 0;
+
+ matched:
+  d->scanned += p - flushed;
+  return 1;
+}
+
+#endif /* not REGEX_NO_DFA */
+
 /* regcomp takes a regular expression as a string and compiles it.
 
    PREG is a regex_t *.	 We do not expect any fields to be initialized,
@@ -5333,6 +6120,7 @@ regcomp (preg, pattern, cflags)
   preg->buffer = 0;
   preg->allocated = 0;
   preg->used = 0;
+  preg->dfa = 0;
 
   /* Don't bother to use a fastmap when searching.  This simplifies the
      REG_NEWLINE case: if we used a fastmap, we'd have to put all the
@@ -5374,6 +6162,10 @@ regcomp (preg, pattern, cflags)
      can use strlen here in compiling the pattern.  */
   ret = regex_compile (pattern, strlen (pattern), syntax, preg);
 
+#ifndef REGEX_NO_DFA
+  preg->dfa = ret == REG_NOERROR ? dfa_compile (preg) : 0;
+#endif
+
   /* POSIX doesn't distinguish between an unmatched open-group and an
      unmatched close-group: both are REG_EPAREN.  */
   if (ret == REG_ERPAREN) ret = REG_EPAREN;
@@ -5412,6 +6204,20 @@ regexec (preg, string, nmatch, pmatch, eflags)
   int len = strlen (string);
   boolean want_reg_info = !preg->no_sub && nmatch > 0;
 
+#ifndef REGEX_NO_DFA
+  /* Even if registers are wanted, the DFA quickly finds out
+     whether there is anything to find.  */
+  if (preg->dfa)
+    {
+      ret = dfa_exec (preg->dfa, string, len,
+		      !!(eflags & REG_NOTBOL), !!(eflags & REG_NOTEOL));
+      if (ret == 0)
+	return (int) REG_NOMATCH;
+      if (ret > 0 && !want_reg_info)
+	return (int) REG_NOERROR;
+    }
+#endif
+
   private_preg = *preg;
 
   private_preg.not_bol = !!(eflags & REG_NOTBOL);
@@ -5532,6 +6338,11 @@ regfree (preg)
   if (preg->translate != NULL)
     free (preg->translate);
   preg->translate = NULL;
+
+#ifndef REGEX_NO_DFA
+  dfa_free (preg->dfa);
+  preg->dfa = NULL;
+#endif
 }
 
 #endif /* not emacs  */
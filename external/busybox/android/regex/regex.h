@@ -348,6 +348,10 @@ struct re_pattern_buffer
         /* If true, an anchor at a newline matches.  */
   unsigned newline_anchor : 1;
 
+        /* DFA used by `regexec', or zero if the pattern needs the
+           backtracking matcher.  */
+  struct re_dfa *dfa;
+
 /* [[[end pattern_buffer]]] */
 };
 
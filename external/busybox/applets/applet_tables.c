@@ -113,7 +113,7 @@ int main(int argc, char **argv)
 	for (i = 0; i < NUM_APPLETS; i++) {
 		printf("0x%04x,\n",
 			offset[i]
-#if ENABLE_FEATURE_PREFER_APPLETS
+#if ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK
 			+ (applets[i].nofork << 12)
 			+ (applets[i].noexec << 13)
 #endif
@@ -146,6 +146,52 @@ int FAST_FUNC bbunpack(char **argv,
 	return exitcode;
 }
 
+#if ENABLE_FEATURE_SEEK_INDEX
+/* --index IDX --seek N for gunzip and unxz */
+static const char seek_longopts[] ALIGN1 =
+	"index\0" Required_argument "\xfe"
+	"seek\0"  Required_argument "\xff"
+	;
+static const char *seek_index_file;
+static uint64_t seek_offset;
+
+/* arg: for the option which follows --seek in opts, if any */
+static unsigned getopt_seek(char **argv, const char *opts, void *arg)
+{
+	const char *seek_str = NULL;
+	unsigned opt;
+
+	applet_long_options = seek_longopts;
+	opt = getopt32(argv, opts, &seek_index_file, &seek_str, arg);
+	if (seek_str)
+		seek_offset = xatoull(seek_str);
+	/* One index can't describe several files */
+	if (seek_index_file && argv[optind] && argv[optind + 1])
+		bb_show_usage();
+	return opt;
+}
+
+static IF_DESKTOP(long long) int unpack_seek(int type,
+		IF_DESKTOP(long long) int FAST_FUNC (*unpacker)(int, int, seek_index_t *, uint64_t, uint64_t))
+{
+	seek_index_t *idx = NULL;
+	IF_DESKTOP(long long) int status;
+
+	if (seek_index_file)
+		idx = seek_index_open(seek_index_file, type);
+	status = unpacker(STDIN_FILENO, STDOUT_FILENO, idx, seek_offset, (uint64_t)-1);
+	if (idx) {
+		/* Don't leave a partial index behind */
+		if (status < 0 && idx->creating)
+			unlink(seek_index_file);
+		seek_index_close(idx);
+	}
+	return status;
+}
+#else
+# define getopt_seek(argv, opts, arg) getopt32(argv, opts, arg)
+#endif
+
 #if ENABLE_UNCOMPRESS || ENABLE_BUNZIP2 || ENABLE_UNLZMA || ENABLE_UNXZ
 static
 char* FAST_FUNC make_new_name_generic(char *filename, const char *expected_ext)
@@ -228,12 +274,16 @@ int uncompress_main(int argc UNUSED_PARAM, char **argv)
  */
 
 //usage:#define gunzip_trivial_usage
-//usage:       "[-cft] [FILE]..."
+//usage:       "[-cft] " IF_FEATURE_SEEK_INDEX("[--index IDX] [--seek N] ") "[FILE]..."
 //usage:#define gunzip_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-t	Test file integrity"
+//usage:	IF_FEATURE_SEEK_INDEX(
+//usage:     "\n	--index IDX	Use random access index IDX, create if missing"
+//usage:     "\n	--seek N	Skip first N bytes of output (fast with --index)"
+//usage:	)
 //usage:
 //usage:#define gunzip_example_usage
 //usage:       "$ ls -la /tmp/BusyBox*\n"
@@ -243,7 +293,7 @@ int uncompress_main(int argc UNUSED_PARAM, char **argv)
 //usage:       "-rw-rw-r--    1 andersen andersen  1761280 Apr 14 17:47 /tmp/BusyBox-0.43.tar\n"
 //usage:
 //usage:#define zcat_trivial_usage
-//usage:       "FILE"
+//usage:       IF_FEATURE_SEEK_INDEX("[--index IDX] [--seek N] ") "FILE"
 //usage:#define zcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
 
@@ -286,6 +336,11 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_gunzip(unpack_info_t *info)
 		if (ENABLE_FEATURE_SEAMLESS_Z && magic2 == 0x9d) {
 			status = unpack_Z_stream(STDIN_FILENO, STDOUT_FILENO);
 		} else if (magic2 == 0x8b) {
+#if ENABLE_FEATURE_SEEK_INDEX
+			if (seek_index_file || seek_offset)
+				status = unpack_seek(SEEK_INDEX_GZ, unpack_gz_stream_seek);
+			else
+#endif
 			status = unpack_gz_stream_with_info(STDIN_FILENO, STDOUT_FILENO, info);
 		} else {
 			goto bad_magic;
@@ -316,7 +371,7 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_gunzip(unpack_info_t *info)
 int gunzip_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int gunzip_main(int argc UNUSED_PARAM, char **argv)
 {
-	getopt32(argv, "cfvdtn");
+	getopt_seek(argv, "cfvdtn" IF_FEATURE_SEEK_INDEX("\xfe:\xff:"), NULL);
 	argv += optind;
 	/* if called as zcat */
 	if (applet_name[1] == 'c')
@@ -394,11 +449,18 @@ int bunzip2_main(int argc UNUSED_PARAM, char **argv)
 //usage:       "Decompress to stdout"
 //usage:
 //usage:#define unxz_trivial_usage
-//usage:       "[-cf] [FILE]..."
+//usage:       "[-cf] " IF_FEATURE_UNXZ_PARALLEL("[-T N] ") IF_FEATURE_SEEK_INDEX("[--index IDX] [--seek N] ") "[FILE]..."
 //usage:#define unxz_full_usage "\n\n"
 //usage:       "Decompress FILE (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n	-T N	Decompress up to N blocks at once (default: one per CPU)"
+//usage:	)
+//usage:	IF_FEATURE_SEEK_INDEX(
+//usage:     "\n	--index IDX	Use random access index IDX, create if missing"
+//usage:     "\n	--seek N	Skip first N bytes of output (fast with --index)"
+//usage:	)
 //usage:
 //usage:#define xz_trivial_usage
 //usage:       "-d [-cf] [FILE]..."
@@ -409,9 +471,12 @@ int bunzip2_main(int argc UNUSED_PARAM, char **argv)
 //usage:     "\n	-f	Force"
 //usage:
 //usage:#define xzcat_trivial_usage
-//usage:       "FILE"
+//usage:       IF_FEATURE_UNXZ_PARALLEL("[-T N] ") IF_FEATURE_SEEK_INDEX("[--index IDX] [--seek N] ") "FILE"
 //usage:#define xzcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n\n	-T N	Decompress up to N blocks at once (default: one per CPU)"
+//usage:	)
 
 #if ENABLE_UNLZMA
 static
@@ -439,6 +504,9 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 
 
 #if ENABLE_UNXZ
+/* -T N: decode up to N blocks at once, 0: one per CPU */
+static unsigned unxz_jobs;
+
 static
 IF_DESKTOP(long long) int FAST_FUNC unpack_unxz(unpack_info_t *info UNUSED_PARAM)
 {
@@ -451,12 +519,24 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_unxz(unpack_info_t *info UNUSED_PARAM
 		bb_error_msg("invalid magic");
 		return -1;
 	}
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (seek_index_file || seek_offset)
+		return unpack_seek(SEEK_INDEX_XZ, unpack_xz_stream_seek);
+#endif
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+	return unpack_xz_stream_jobs(STDIN_FILENO, STDOUT_FILENO, unxz_jobs);
+#else
 	return unpack_xz_stream(STDIN_FILENO, STDOUT_FILENO);
+#endif
 }
 int unxz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int unxz_main(int argc UNUSED_PARAM, char **argv)
 {
-	IF_XZ(int opts =) getopt32(argv, "cfvdt");
+	IF_XZ(int opts;)
+
+	IF_FEATURE_UNXZ_PARALLEL(opt_complementary = "T+";)
+	IF_XZ(opts =) getopt_seek(argv, "cfvdt" IF_FEATURE_SEEK_INDEX("\xfe:\xff:")
+			IF_FEATURE_UNXZ_PARALLEL("T:"), &unxz_jobs);
 # if ENABLE_XZ
 	/* xz without -d or -t? */
 	if (applet_name[2] == '\0' && !(opts & (OPT_DECOMPRESS|OPT_TEST)))
@@ -15,6 +15,9 @@
 //usage:     "\n	-d	Decompress"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
+//usage:	IF_FEATURE_BZIP2_PARALLEL(
+//usage:     "\n	-p N	Compress using N worker processes"
+//usage:	)
 
 #include "libbb.h"
 #include "archive.h"
@@ -62,6 +65,9 @@ enum {
 };
 
 static uint8_t level;
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+static unsigned bz_jobs;
+#endif
 
 /* NB: compressStream() has to return -1 on errors, not die.
  * bbunpack() will correctly clean up in this case
@@ -110,6 +116,130 @@ IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, vo
 	return 0 IF_DESKTOP( + strm->total_out );
 }
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+/* Parallel (-p N) compression, the pbzip2 way: input is cut into
+ * chunks of one block size, each chunk is compressed by a forked
+ * worker into a complete bzip2 stream. The parent concatenates
+ * the streams in input order. bunzip2 (ours and upstream one)
+ * decompresses such multi-stream files as a whole.
+ */
+struct bz_job {
+	pid_t pid;
+	int fd;		/* read end of the pipe with worker's bzip2 stream */
+};
+
+/* Copy the oldest worker's output and reap it.
+ * Returns -1 on errors, number of bytes copied otherwise.
+ */
+static off_t bz_finish_job(struct bz_job *job)
+{
+	off_t n = bb_copyfd_eof(job->fd, STDOUT_FILENO);
+
+	close(job->fd);
+	if (wait4pid(job->pid) != 0) {
+		bb_error_msg("worker process failed");
+		return -1;
+	}
+	return n;
+}
+
+static void bz_kill_job(struct bz_job *job)
+{
+	/* Don't leave workers blocked on full pipes */
+	close(job->fd);
+	kill(job->pid, SIGKILL);
+	wait4pid(job->pid);
+}
+
+static
+IF_DESKTOP(long long) int compressStream_parallel(void)
+{
+	IF_DESKTOP(long long) int total;
+	struct bz_job *jobs;
+	char *buf;
+	unsigned chunk, head_job, njobs;
+	smallint started;
+
+	jobs = xzalloc(bz_jobs * sizeof(jobs[0]));
+	/* RLE1 stage may slightly expand the chunk,
+	 * then it will be compressed as two blocks */
+	chunk = level * 100000;
+	buf = xmalloc(chunk);
+	head_job = njobs = 0;
+	total = 0;
+	started = 0;
+
+	for (;;) {
+		struct bz_job *job;
+		int pipefd[2];
+		ssize_t count;
+		off_t n;
+
+		count = full_read(STDIN_FILENO, buf, chunk);
+		if (count < 0) {
+			bb_perror_msg(bb_msg_read_error);
+			total = -1;
+			break;
+		}
+		/* Empty input still needs one (empty) stream */
+		if (count == 0 && started)
+			break;
+		started = 1;
+
+		if (njobs == bz_jobs) {
+			n = bz_finish_job(&jobs[head_job]);
+			if (n < 0) {
+				total = -1;
+				break;
+			}
+			total += n;
+			head_job = (head_job + 1) % bz_jobs;
+			njobs--;
+		}
+		job = &jobs[(head_job + njobs) % bz_jobs];
+		xpipe(pipefd);
+		job->pid = xfork();
+		if (job->pid == 0) {
+			/* child */
+			bz_stream bzs;
+			char *obuf = xmalloc(IOBUF_SIZE);
+
+			close(pipefd[0]);
+			xmove_fd(pipefd[1], STDOUT_FILENO);
+			BZ2_bzCompressInit(&bzs, level);
+			if (count != 0 && bz_write(&bzs, buf, count, obuf) < 0)
+				_exit(EXIT_FAILURE);
+			/* count == 0: finalize */
+			if (bz_write(&bzs, buf, 0, obuf) < 0)
+				_exit(EXIT_FAILURE);
+			_exit(EXIT_SUCCESS);
+		}
+		close(pipefd[1]);
+		job->fd = pipefd[0];
+		njobs++;
+		if (count == 0)
+			break;
+	}
+	while (njobs) {
+		if (total >= 0) {
+			off_t n = bz_finish_job(&jobs[head_job]);
+			if (n < 0)
+				total = -1;
+			else
+				total += n;
+		} else {
+			bz_kill_job(&jobs[head_job]);
+		}
+		head_job = (head_job + 1) % bz_jobs;
+		njobs--;
+	}
+
+	free(buf);
+	free(jobs);
+	return total;
+}
+#endif
+
 static
 IF_DESKTOP(long long) int FAST_FUNC compressStream(unpack_info_t *info UNUSED_PARAM)
 {
@@ -121,6 +251,11 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(unpack_info_t *info UNUSED_PA
 #define rbuf iobuf
 #define wbuf (iobuf + IOBUF_SIZE)
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	if (bz_jobs > 1)
+		return compressStream_parallel();
+#endif
+
 	iobuf = xmalloc(2 * IOBUF_SIZE);
 	BZ2_bzCompressInit(strm, level);
 
@@ -146,10 +281,12 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(unpack_info_t *info UNUSED_PA
 	return total;
 }
 
+
 int bzip2_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int bzip2_main(int argc UNUSED_PARAM, char **argv)
 {
 	unsigned opt;
+	unsigned jobs = 1;
 
 	/* standard bzip2 flags
 	 * -d --decompress force decompression
@@ -164,11 +301,16 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	 * -1 .. -9      set block size to 100k .. 900k
 	 * --fast        alias for -1
 	 * --best        alias for -9
+	 * -p N          (pbzip2) use N processes
 	 */
 
-	opt_complementary = "s2"; /* -s means -2 (compatibility) */
+	opt_complementary = "s2" IF_FEATURE_BZIP2_PARALLEL(":p+"); /* -s means -2 (compatibility) */
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
-	opt = getopt32(argv, "cfv" IF_BUNZIP2("dt") "123456789qzs");
+	opt = getopt32(argv, "cfv" IF_BUNZIP2("dt") "123456789qzs"
+			IF_FEATURE_BZIP2_PARALLEL("p:"), &jobs);
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	bz_jobs = jobs;
+#endif
 #if ENABLE_BUNZIP2 /* bunzip2_main may not be visible... */
 	if (opt & 0x18) // -d and/or -t
 		return bunzip2_main(argc, argv);
@@ -40,12 +40,15 @@ aa:      85.1% -- replaced with aa.gz
 */
 
 //usage:#define gzip_trivial_usage
-//usage:       "[-cfd] [FILE]..."
+//usage:       "[-cfd"IF_FEATURE_GZIP_PARALLEL(" -p N")"] [FILE]..."
 //usage:#define gzip_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin)\n"
 //usage:     "\n	-d	Decompress"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
+//usage:	IF_FEATURE_GZIP_PARALLEL(
+//usage:     "\n	-p N	Compress using N worker processes"
+//usage:	)
 //usage:
 //usage:#define gzip_example_usage
 //usage:       "$ ls -la /tmp/busybox*\n"
@@ -357,6 +360,13 @@ struct globals {
 
 	/*uint32_t *crc_32_tab;*/
 	uint32_t crc;	/* shift register contents */
+
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	unsigned pgz_jobs;	/* -p N: number of worker processes */
+	/* In a worker, input comes from memory instead of ifd */
+	const uch *mem_in;
+	unsigned mem_left;
+#endif
 };
 
 #define G1 (*(ptr_to_globals - 1))
@@ -425,6 +435,16 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.mem_in) {
+		/* Parallel worker: the parent does crc and isize */
+		len = MIN(size, G1.mem_left);
+		memcpy(buf, G1.mem_in, len);
+		G1.mem_in += len;
+		G1.mem_left -= len;
+		return len;
+	}
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -1816,6 +1836,19 @@ static ulg deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.mem_in) {
+		/* Parallel worker: this is not the end of the stream.
+		 * Terminate with an empty stored block, which leaves us
+		 * on a byte boundary, so that the parent can simply
+		 * concatenate our output with the next worker's one.
+		 */
+		FLUSH_BLOCK(0);
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+		return G2.compressed_len >> 3;
+	}
+#endif
 	return FLUSH_BLOCK(1);	/* eof */
 }
 
@@ -2005,6 +2038,159 @@ static void zip(ulg time_stamp)
 }
 
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * Parallel (-p N) compression, done the pigz way: input is cut into
+ * PGZ_BLOCK sized chunks, each chunk is deflated by a forked worker,
+ * which uses the last WSIZE bytes of input before the chunk as a preset
+ * dictionary. Workers end their output with an empty stored block (a
+ * "sync flush"), so the parent just concatenates their outputs in order
+ * and appends a final empty block. The result is a single ordinary
+ * gzip member. Each worker also checksums its own chunk, the parent
+ * merges these CRCs with crc32_combine().
+ */
+#define PGZ_BLOCK (128 * 1024)
+
+struct pgz_job {
+	pid_t pid;
+	int fd;		/* read end of the pipe with worker's crc + deflate data */
+	unsigned len;	/* uncompressed length of the chunk */
+};
+
+/* Worker side: deflate len bytes at dict+dlen, dict[0..dlen-1]
+ * is the preset dictionary. Output (crc of the chunk, then
+ * deflate data) goes to ofd.
+ */
+static void pgz_deflate_chunk(const uch *dict, unsigned dlen, unsigned len)
+{
+	IPos hash_head;
+	unsigned j;
+
+	G1.mem_in = dict + dlen;
+	G1.mem_left = len;
+
+	G1.outcnt = 0;
+	put_32bit(~crc32_block_endian0(~0, G1.mem_in, len, global_crc32_table));
+
+	bi_init();
+	ct_init();
+
+	/* Like lm_init(), but with the window primed by the dictionary */
+	memset(head, 0, HASH_SIZE * sizeof(*head));
+	memcpy(G1.window, dict, dlen);
+	G1.strstart = dlen;
+	G1.block_start = dlen;
+	G1.lookahead = file_read(G1.window + dlen, 2 * WSIZE - dlen);
+	G1.eofile = 0;
+	while (G1.lookahead < MIN_LOOKAHEAD && !G1.eofile)
+		fill_window();
+
+	G1.ins_h = 0;
+	for (j = 0; j < MIN_MATCH - 1; j++)
+		UPDATE_HASH(G1.ins_h, G1.window[j]);
+	/* Make dictionary strings available to longest_match() */
+	for (j = 0; j < dlen; j++)
+		INSERT_STRING(j, hash_head);
+
+	deflate();
+	flush_outbuf();
+}
+
+/* Parent side: copy the oldest worker's output and reap it */
+static void pgz_finish_job(struct pgz_job *job)
+{
+	uch crc[4];
+
+	xread(job->fd, crc, 4);
+	G1.crc = crc32_combine(G1.crc,
+			crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((ulg)crc[3] << 24),
+			job->len);
+	if (bb_copyfd_eof(job->fd, ofd) < 0)
+		xfunc_die();
+	close(job->fd);
+	if (wait4pid(job->pid) != 0)
+		bb_error_msg_and_die("worker process failed");
+}
+
+static void zip_parallel(ulg time_stamp)
+{
+	struct pgz_job *jobs;
+	uch *buf;
+	unsigned dlen, head_job, njobs;
+
+	jobs = xzalloc(G1.pgz_jobs * sizeof(jobs[0]));
+	/* buf[0..WSIZE-1]: dictionary, buf[WSIZE..]: current chunk */
+	buf = xmalloc(WSIZE + PGZ_BLOCK);
+	dlen = 0;
+	head_job = njobs = 0;
+
+	G1.outcnt = 0;
+	put_32bit(0x00088b1f);
+	put_32bit(time_stamp);
+	put_8bit(2);	/* extra flags: same as lm_init() sets */
+	put_8bit(3);	/* OS identifier = 3 (Unix) */
+	/* Must not leave anything in outbuf for workers to inherit */
+	flush_outbuf();
+
+	G1.crc = 0; /* crc of nothing, as finished (not ~'ed) value */
+	for (;;) {
+		struct pgz_job *job;
+		int pipefd[2];
+		ssize_t len;
+
+		len = full_read(ifd, buf + WSIZE, PGZ_BLOCK);
+		if (len < 0)
+			bb_perror_msg_and_die(bb_msg_read_error);
+		if (len == 0)
+			break;
+		G1.isize += len;
+
+		if (njobs == G1.pgz_jobs) {
+			pgz_finish_job(&jobs[head_job]);
+			head_job = (head_job + 1) % G1.pgz_jobs;
+			njobs--;
+		}
+		job = &jobs[(head_job + njobs) % G1.pgz_jobs];
+		xpipe(pipefd);
+		job->pid = xfork();
+		if (job->pid == 0) {
+			/* child */
+			close(pipefd[0]);
+			xmove_fd(pipefd[1], ofd);
+			pgz_deflate_chunk(buf + WSIZE - dlen, dlen, len);
+			_exit(EXIT_SUCCESS);
+		}
+		close(pipefd[1]);
+		job->fd = pipefd[0];
+		job->len = len;
+		njobs++;
+
+		/* Last WSIZE bytes of input become the next dictionary */
+		dlen += len;
+		if (dlen > WSIZE)
+			dlen = WSIZE;
+		memmove(buf + WSIZE - dlen, buf + WSIZE + len - dlen, dlen);
+	}
+	while (njobs) {
+		pgz_finish_job(&jobs[head_job]);
+		head_job = (head_job + 1) % G1.pgz_jobs;
+		njobs--;
+	}
+
+	/* Final block: static trees, containing only END_BLOCK */
+	put_8bit(0x03);
+	put_8bit(0x00);
+
+	put_32bit(G1.crc);
+	put_32bit(G1.isize);
+	flush_outbuf();
+
+	free(buf);
+	free(jobs);
+}
+#endif
+
+
 /* ======================================================================== */
 static
 IF_DESKTOP(long long) int FAST_FUNC pack_gzip(unpack_info_t *info UNUSED_PARAM)
@@ -2044,6 +2230,12 @@ IF_DESKTOP(long long) int FAST_FUNC pack_gzip(unpack_info_t *info UNUSED_PARAM)
 
 	s.st_ctime = 0;
 	fstat(STDIN_FILENO, &s);
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.pgz_jobs > 1) {
+		zip_parallel(s.st_ctime);
+		return 0;
+	}
+#endif
 	zip(s.st_ctime);
 	return 0;
 }
@@ -2062,6 +2254,9 @@ static const char gzip_longopts[] ALIGN1 =
 	"quiet\0"               No_argument       "q"
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	"processes\0"           Required_argument "p"
+#endif
 	;
 #endif
 
@@ -2087,12 +2282,15 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 #endif
 {
 	unsigned opt;
+	unsigned jobs = 1;
 
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
 	applet_long_options = gzip_longopts;
 #endif
+	IF_FEATURE_GZIP_PARALLEL(opt_complementary = "p+";)
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
-	opt = getopt32(argv, "cfv" IF_GUNZIP("dt") "q123456789n");
+	opt = getopt32(argv, "cfv" IF_GUNZIP("dt") "q123456789n"
+			IF_FEATURE_GZIP_PARALLEL("p:"), &jobs);
 #if ENABLE_GUNZIP /* gunzip_main may not be visible... */
 	if (opt & 0x18) // -d and/or -t
 		return gunzip_main(argc, argv);
@@ -2113,6 +2311,10 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 	ALLOC(uch, G1.window, 2L * WSIZE);
 	ALLOC(ush, G1.prev, 1L << BITS);
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	G1.pgz_jobs = jobs;
+#endif
+
 	/* Initialize the CRC32 table */
 	global_crc32_table = crc32_filltable(NULL, 0);
 
@@ -97,6 +97,11 @@ struct bunzip_data {
 	/* For I/O error handling */
 	jmp_buf jmpbuf;
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+	/* Parallel worker: stop after one block */
+	smallint single_block;
+#endif
+
 	/* Big things go last (register-relative addressing can be larger for big offsets) */
 	uint32_t crc32Table[256];
 	uint8_t selectors[32768];  /* nSelectors=15 bits */
@@ -624,7 +629,14 @@ int FAST_FUNC read_bunzip(bunzip_data *bd, char *outbuf, int len)
 
 	/* Refill the intermediate buffer by Huffman-decoding next block of input */
 	{
-		int r = get_next_block(bd);
+		int r;
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+		/* writeCount < 0: we did decode a block already */
+		if (bd->single_block && bd->writeCount < 0)
+			r = RETVAL_LAST_BLOCK;
+		else
+#endif
+		r = get_next_block(bd);
 		if (r) { /* error/end */
 			bd->writeCount = r;
 			return (r != RETVAL_LAST_BLOCK) ? r : len;
@@ -719,6 +731,355 @@ void FAST_FUNC dealloc_bunzip(bunzip_data *bd)
 }
 
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+/* Parallel decompression.
+ *
+ * Every block starts with 48-bit magic 0x314159265359, end of stream
+ * is marked by 0x177245385090. Neither is byte aligned. The parent
+ * reads input into a buffer and scans it for these magics at every bit
+ * offset. Each candidate block ("region" from one candidate to the next)
+ * is decoded by a forked worker, workers' outputs are copied in order.
+ *
+ * Magic can also occur inside compressed data. Then the region which
+ * contains such a false candidate is cut short, and its worker runs out
+ * of input while Huffman-decoding - before it outputs anything.
+ * When it happens with the oldest region, we merge it with the next
+ * one and retry. Since the oldest region always starts at a real block,
+ * by induction we never output anything from a false block.
+ *
+ * Input buffering is bounded: we don't read ahead more than
+ * (jobs + 2) * BZP_READAHEAD bytes.
+ */
+enum {
+	BZP_MAX_JOBS = 8,
+	BZP_READ_SIZE = 128 * 1024,
+	BZP_READAHEAD = 1024 * 1024, /* > compressed size of a 900k block */
+};
+#define BZP_BLOCK_MAGIC 0x314159265359ULL
+#define BZP_EOS_MAGIC   0x177245385090ULL
+
+struct bzp_region {
+	uint64_t bit;	/* absolute position of the magic */
+	smallint eos;	/* end-of-stream marker, not a block */
+	smallint dispatched;
+	pid_t pid;	/* worker, if any */
+	int fd;		/* read end of the pipe with worker's output */
+	unsigned dbufSize;
+};
+
+struct bzp_state {
+	uint8_t *buf;		/* buf[0] is input byte #buf_off */
+	uint64_t buf_off;
+	unsigned buf_len;
+	uint64_t scan_pos;	/* next input byte to scan */
+	uint64_t scan_bits;
+	struct bzp_region *reg;
+	unsigned nreg;
+	unsigned running;
+	smallint eof;
+};
+
+/* Worker: decode one block from p, starting skip bits into p[0] */
+static void NORETURN bzp_worker(const uint8_t *p, unsigned len,
+		unsigned skip, unsigned dbufSize, int out_fd)
+{
+	bunzip_data *bd;
+	char *outbuf;
+	int i;
+
+	xfunc_error_retval = -RETVAL_OUT_OF_MEMORY;
+	bd = xzalloc(sizeof(*bd));
+	bd->in_fd = -1;
+	bd->inbuf = (uint8_t*)p;
+	bd->inbufCount = len;
+	bd->dbufSize = dbufSize;
+	bd->dbuf = xmalloc(dbufSize * sizeof(bd->dbuf[0]));
+	bd->single_block = 1;
+	crc32_filltable(bd->crc32Table, 1);
+	outbuf = xmalloc(IOBUF_SIZE);
+
+	i = setjmp(bd->jmpbuf);
+	if (i == 0) {
+		get_bits(bd, skip);
+		while ((i = read_bunzip(bd, outbuf, IOBUF_SIZE)) >= 0) {
+			i = IOBUF_SIZE - i;
+			if (full_write(out_fd, outbuf, i) != i)
+				_exit(-RETVAL_SHORT_WRITE);
+		}
+	}
+	if (i == RETVAL_LAST_BLOCK && bd->headerCRC == bd->totalCRC)
+		_exit(EXIT_SUCCESS);
+	/* RETVAL_LAST_BLOCK here means bad CRC */
+	_exit(-i);
+}
+
+static void bzp_kill(struct bzp_state *st, struct bzp_region *r)
+{
+	if (r->pid > 0) {
+		close(r->fd);
+		kill(r->pid, SIGKILL);
+		wait4pid(r->pid);
+		r->pid = 0;
+		st->running--;
+	}
+	r->dispatched = 0;
+}
+
+static void bzp_remove(struct bzp_state *st, unsigned i)
+{
+	bzp_kill(st, &st->reg[i]);
+	st->nreg--;
+	memmove(&st->reg[i], &st->reg[i + 1], (st->nreg - i) * sizeof(st->reg[0]));
+}
+
+/* Fetch 32 bits starting at absolute bit position pos */
+static uint32_t bzp_peek32(struct bzp_state *st, uint64_t pos)
+{
+	const uint8_t *p = st->buf + (pos / 8 - st->buf_off);
+	uint64_t v;
+
+	/* buf has slack at the end, p[4] is always readable */
+	v = ((uint64_t)p[0] << 32) | ((uint32_t)p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+	return v >> (8 - (pos & 7));
+}
+
+/* Input bytes available after absolute byte position pos */
+static unsigned bzp_avail(struct bzp_state *st, uint64_t pos)
+{
+	uint64_t end = st->buf_off + st->buf_len;
+	return pos < end ? end - pos : 0;
+}
+
+static void bzp_read_more(struct bzp_state *st, int src_fd)
+{
+	uint64_t keep;
+	int n;
+
+	/* Drop input we don't need anymore. Magic which is not found yet
+	 * may start up to 6 bytes before scan_pos */
+	keep = st->nreg ? st->reg[0].bit / 8 : st->scan_pos - 7;
+	if ((int64_t)(keep - st->buf_off) >= BZP_READ_SIZE) {
+		unsigned drop = keep - st->buf_off;
+		st->buf_len -= drop;
+		memmove(st->buf, st->buf + drop, st->buf_len);
+		st->buf_off += drop;
+	}
+
+	st->buf = xrealloc(st->buf, st->buf_len + BZP_READ_SIZE + 8);
+	n = safe_read(src_fd, st->buf + st->buf_len, BZP_READ_SIZE);
+	if (n < 0)
+		bb_perror_msg_and_die(bb_msg_read_error);
+	if (n == 0) {
+		st->eof = 1;
+		return;
+	}
+	st->buf_len += n;
+	/* Keep bzp_peek32 from reading uninitialized bytes */
+	memset(st->buf + st->buf_len, 0, 8);
+
+	/* Look for magics ending in every newly read byte */
+	while (st->scan_pos < st->buf_off + st->buf_len) {
+		int k;
+
+		st->scan_bits = (st->scan_bits << 8) | st->buf[st->scan_pos - st->buf_off];
+		st->scan_pos++;
+		for (k = 7; k >= 0; k--) {
+			uint64_t m = (st->scan_bits >> k) & 0xffffffffffffULL;
+			struct bzp_region *r;
+
+			if (m != BZP_BLOCK_MAGIC && m != BZP_EOS_MAGIC)
+				continue;
+			if (st->scan_pos * 8 < 48 + k)
+				continue;
+			st->reg = xrealloc_vector(st->reg, 4, st->nreg);
+			r = &st->reg[st->nreg++];
+			memset(r, 0, sizeof(*r));
+			r->bit = st->scan_pos * 8 - k - 48;
+			r->eos = (m == BZP_EOS_MAGIC);
+		}
+	}
+}
+
+/* Is region i fully in the buffer? */
+static int bzp_complete(struct bzp_state *st, unsigned i)
+{
+	if (st->eof)
+		return 1;
+	if (st->reg[i].eos) {
+		/* Need stream CRC, and the next stream's "BZh9" */
+		return bzp_avail(st, (st->reg[i].bit + 80 + 7) / 8) >= 4;
+	}
+	return i + 1 < st->nreg;
+}
+
+static IF_DESKTOP(long long) int
+unpack_bz2_stream_parallel(int src_fd, int dst_fd, unsigned jobs)
+{
+	IF_DESKTOP(long long total_written = 0;)
+	struct bzp_state st;
+	uint64_t expect;
+	uint32_t totalCRC;
+	unsigned dbufSize;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	totalCRC = 0;
+
+	/* "BZ" is already eaten, the first block must follow "h9" */
+	do {
+		bzp_read_more(&st, src_fd);
+	} while (!st.eof && st.buf_len < 2);
+	i = RETVAL_NOT_BZIP_DATA;
+	if (st.buf_len < 2 || st.buf[0] != 'h' || (unsigned)(st.buf[1] - '1') >= 9)
+		goto err;
+	dbufSize = 100000 * (st.buf[1] - '0');
+	expect = 16;
+
+	while (1) {
+		struct bzp_region *r;
+		unsigned n;
+		int status;
+
+		/* Candidates in stream header or trailer are false */
+		while (st.nreg && st.reg[0].bit < expect)
+			bzp_remove(&st, 0);
+
+		/* Start workers for regions we have in full */
+		for (n = 0; n < st.nreg && st.running < jobs; n++) {
+			uint64_t end;
+
+			r = &st.reg[n];
+			if (r->dispatched)
+				continue;
+			if (!bzp_complete(&st, n))
+				break;
+			r->dispatched = 1;
+			if (r->eos) {
+				/* Block size of the next stream (if there is one) */
+				uint64_t hdr = (r->bit + 80 + 7) / 8;
+				if (bzp_avail(&st, hdr) >= 4) {
+					uint8_t *p = st.buf + (hdr - st.buf_off);
+					if ((unsigned)(p[3] - '1') < 9)
+						dbufSize = 100000 * (p[3] - '0');
+				}
+				continue;
+			}
+			if (!r->dbufSize)
+				r->dbufSize = dbufSize;
+			/* Huffman decoder may look up to MAX_HUFCODE_BITS past
+			 * the end of the block: give worker a few bytes more */
+			end = (n + 1 < st.nreg) ? st.reg[n + 1].bit + 32 : (uint64_t)-1;
+			end = MIN(end, (st.buf_off + st.buf_len) * 8);
+			{
+				int pipefd[2];
+				xpipe(pipefd);
+				r->pid = xfork();
+				if (r->pid == 0) {
+					/* child */
+					close(pipefd[0]);
+					bzp_worker(st.buf + (r->bit / 8 - st.buf_off),
+						(end + 7) / 8 - r->bit / 8,
+						r->bit & 7, r->dbufSize, pipefd[1]);
+				}
+				close(pipefd[1]);
+				r->fd = pipefd[0];
+			}
+			st.running++;
+		}
+
+		/* Oldest region can't be started yet? */
+		if (st.nreg == 0 || !st.reg[0].dispatched) {
+			i = RETVAL_UNEXPECTED_INPUT_EOF;
+			if (st.eof)
+				goto err;
+			i = RETVAL_DATA_ERROR;
+			if (st.nreg && bzp_avail(&st, st.reg[0].bit / 8) > (jobs + 2) * BZP_READAHEAD)
+				goto err;
+			bzp_read_more(&st, src_fd);
+			continue;
+		}
+		/* Read ahead, to keep all workers busy */
+		if (!st.eof && st.running < jobs
+		 && bzp_avail(&st, st.reg[0].bit / 8) < (jobs + 2) * BZP_READAHEAD
+		) {
+			bzp_read_more(&st, src_fd);
+			continue;
+		}
+
+		r = &st.reg[0];
+		if (r->eos) {
+			uint64_t next = (r->bit + 80 + 7) / 8;
+			uint8_t *p;
+
+			i = RETVAL_UNEXPECTED_INPUT_EOF;
+			if ((st.buf_off + st.buf_len) * 8 < r->bit + 80)
+				goto err;
+			if (bzp_peek32(&st, r->bit + 48) != totalCRC) {
+				bb_error_msg("CRC error");
+				i = RETVAL_DATA_ERROR;
+				goto release;
+			}
+			/* Successfully unpacked one BZ stream.
+			 * Do we have "BZ..." after it? pbzip2 makes such files.
+			 */
+			i = RETVAL_OK;
+			p = st.buf + (next - st.buf_off);
+			if (bzp_avail(&st, next) < 2 || p[0] != 'B' || p[1] != 'Z')
+				goto release;
+			i = RETVAL_NOT_BZIP_DATA;
+			if (bzp_avail(&st, next) < 4 || p[2] != 'h' || (unsigned)(p[3] - '1') >= 9)
+				goto err;
+			totalCRC = 0;
+			expect = (next + 4) * 8;
+			bzp_remove(&st, 0);
+			continue;
+		}
+
+		/* Copy output of the oldest worker */
+		{
+			off_t cnt = bb_copyfd_eof(r->fd, dst_fd);
+			close(r->fd);
+			status = wait4pid(r->pid);
+			r->pid = 0;
+			st.running--;
+			if (cnt < 0) {
+				i = RETVAL_SHORT_WRITE;
+				goto release;
+			}
+			IF_DESKTOP(total_written += cnt;)
+		}
+		if (status == -RETVAL_UNEXPECTED_INPUT_EOF && st.nreg > 1) {
+			/* Next candidate is a false one. It is inside our block,
+			 * so our worker had nothing to output. Merge and retry.
+			 */
+			r->dispatched = 0;
+			bzp_remove(&st, 1);
+			continue;
+		}
+		if (status != 0) {
+			i = -status;
+			if (status == -RETVAL_LAST_BLOCK) {
+				bb_error_msg("CRC error");
+				goto release;
+			}
+			goto err;
+		}
+		totalCRC = ((totalCRC << 1) | (totalCRC >> 31)) ^ bzp_peek32(&st, r->bit + 48);
+		bzp_remove(&st, 0);
+	}
+
+ err:
+	bb_error_msg("bunzip error %d", i);
+ release:
+	while (st.nreg)
+		bzp_remove(&st, 0);
+	free(st.reg);
+	free(st.buf);
+
+	return i ? i : IF_DESKTOP(total_written) + 0;
+}
+#endif
+
 /* Decompress src_fd to dst_fd.  Stops at end of bzip data, not end of file. */
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_bz2_stream(int src_fd, int dst_fd)
@@ -729,6 +1090,14 @@ unpack_bz2_stream(int src_fd, int dst_fd)
 	int i;
 	unsigned len;
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+	{
+		unsigned jobs = bb_online_cpus(BZP_MAX_JOBS);
+		if (jobs > 1)
+			return unpack_bz2_stream_parallel(src_fd, dst_fd, jobs);
+	}
+#endif
+
 	outbuf = xmalloc(IOBUF_SIZE);
 	len = 0;
 	while (1) { /* "Process one BZ... stream" loop */
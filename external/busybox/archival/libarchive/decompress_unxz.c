@@ -17,6 +17,16 @@
 
 #define XZ_DEC_DYNALLOC
 
+#if ENABLE_FEATURE_UNXZ_FAST
+/* lzma_main_fast() and dict_copy() in xz_dec_lzma2.c */
+# define XZ_DEC_FAST
+#endif
+
+#if ENABLE_FEATURE_SEEK_INDEX
+/* Resuming at a Block (see seek_index.c) */
+# define XZ_DEC_SEEK
+#endif
+
 /* Skip check (rather than fail) of unsupported hash functions */
 #define XZ_DEC_ANY_CHECK  1
 
@@ -37,13 +47,29 @@ static uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 #include "unxz/xz_dec_lzma2.c"
 #include "unxz/xz_dec_stream.c"
 
+#if ENABLE_FEATURE_SEEK_INDEX
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream_seek(int src_fd, int dst_fd, seek_index_t *idx, uint64_t offset, uint64_t len)
+#elif ENABLE_FEATURE_UNXZ_PARALLEL
+static IF_DESKTOP(long long) int
+unpack_xz_stream_serial(int src_fd, int dst_fd)
+#else
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_xz_stream(int src_fd, int dst_fd)
+#endif
 {
 	struct xz_buf iobuf;
 	struct xz_dec *state;
 	unsigned char *membuf;
 	IF_DESKTOP(long long) int total = 0;
+#if ENABLE_FEATURE_SEEK_INDEX
+	uint64_t in_ofs = 0;  /* file offset of membuf[0] */
+	uint64_t out_ofs = 0; /* uncompressed offset of iobuf.out[0] */
+	uint64_t end = offset + len;
+
+	if (end < offset)
+		end = (uint64_t)-1;
+#endif
 
 	if (!global_crc32_table)
 		global_crc32_table = crc32_filltable(NULL, /*endian:*/ 0);
@@ -59,6 +85,24 @@ unpack_xz_stream(int src_fd, int dst_fd)
 	/* Limit memory usage to about 64 MiB. */
 	state = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
 
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (idx && seek_index_usable(idx, src_fd)) {
+		const seek_point_t *pt = seek_index_find(idx, offset);
+		if (pt && pt->aux <= XZ_CHECK_MAX) {
+			/* Start at the Block, the Stream Header was seen
+			 * when the index was made */
+			xlseek(src_fd, pt->in, SEEK_SET);
+			xz_dec_resume(state, pt->aux);
+			iobuf.in_size = 0;
+			in_ofs = pt->in;
+			out_ofs = pt->out;
+		} else {
+			/* We may have been here already (tar --index) */
+			xlseek(src_fd, HEADER_MAGIC_SIZE, SEEK_SET);
+		}
+	}
+#endif
+
 	while (1) {
 		enum xz_ret r;
 
@@ -69,6 +113,7 @@ unpack_xz_stream(int src_fd, int dst_fd)
 				total = -1;
 				break;
 			}
+			IF_FEATURE_SEEK_INDEX(in_ofs += iobuf.in_size;)
 			iobuf.in_size = rd;
 			iobuf.in_pos = 0;
 		}
@@ -77,6 +122,43 @@ unpack_xz_stream(int src_fd, int dst_fd)
 		r = xz_dec_run(state, &iobuf);
 //		bb_error_msg("<in pos:%d size:%d out pos:%d size:%d r:%d",
 //				iobuf.in_pos, iobuf.in_size, iobuf.out_pos, iobuf.out_size, r);
+#if ENABLE_FEATURE_SEEK_INDEX
+		if (state->block_seen) {
+			state->block_seen = false;
+			if (idx && idx->creating
+			 && out_ofs + state->block_out_pos >= idx->next_point
+			) {
+				seek_point_t pt;
+				pt.out = out_ofs + state->block_out_pos;
+				pt.in = in_ofs + state->block_in_pos;
+				pt.aux = state->check_type;
+				seek_index_add_point(idx, &pt, NULL);
+			}
+		}
+		if (iobuf.out_pos) {
+			/* Write only the [offset, end) part */
+			size_t skip = 0;
+			size_t n = iobuf.out_pos;
+
+			if (out_ofs < offset)
+				skip = MIN(n, offset - out_ofs);
+			if (out_ofs + n > end)
+				n = end > out_ofs ? end - out_ofs : 0;
+			if (n > skip) {
+				xwrite(dst_fd, iobuf.out + skip, n - skip);
+				IF_DESKTOP(total += n - skip;)
+			}
+			out_ofs += iobuf.out_pos;
+			iobuf.out_pos = 0;
+			if (out_ofs >= end && !(idx && idx->creating))
+				break;
+		}
+		if (r == XZ_STREAM_END) {
+			if (idx && idx->creating)
+				seek_index_finish(idx, src_fd, in_ofs + iobuf.in_pos, out_ofs);
+			break;
+		}
+#else
 		if (iobuf.out_pos) {
 			xwrite(dst_fd, iobuf.out, iobuf.out_pos);
 			IF_DESKTOP(total += iobuf.out_pos;)
@@ -85,6 +167,7 @@ unpack_xz_stream(int src_fd, int dst_fd)
 		if (r == XZ_STREAM_END) {
 			break;
 		}
+#endif
 		if (r != XZ_OK && r != XZ_UNSUPPORTED_CHECK) {
 			bb_error_msg("corrupted data");
 			total = -1;
@@ -96,3 +179,388 @@ unpack_xz_stream(int src_fd, int dst_fd)
 
 	return total;
 }
+
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* Parallel decompression.
+ *
+ * Multi-threaded encoders ("xz -T N" etc) cut the input into Blocks,
+ * and the Index at the end of the Stream has compressed and uncompressed
+ * size of every Block. If the input is a regular file, we read the
+ * Indexes, walking back from the last Stream Footer to the Stream which
+ * starts where we are (the serial code decodes only that one Stream).
+ * Then Blocks are decoded by forked workers, workers' outputs are
+ * copied in order.
+ *
+ * A worker preads its Block and gives the decoder a complete one-Block
+ * Stream: the real Stream Header, the Block, and an Index and Stream
+ * Footer made for it from the Block's Index record. This way the decoder
+ * checks everything it checks in a normal Stream, including that the
+ * Block matches its Index record.
+ *
+ * At most "jobs" Blocks are in flight. Memory use is bounded by that:
+ * a worker which is done decoding waits on its pipe until we get to it.
+ */
+enum {
+	XZP_MAX_JOBS = 8,
+	XZP_READ_SIZE = 64 * 1024,
+	XZP_INDEX_MAX = 16 * 1024 * 1024,
+};
+
+struct xzp_block {
+	uint64_t in;		/* file offset of Block Header */
+	uint64_t unpadded;	/* size without Block Padding */
+	uint64_t out;		/* uncompressed size */
+	pid_t pid;		/* worker, if any */
+	int fd;			/* read end of the pipe with worker's output */
+};
+
+struct xzp_stream {
+	uint8_t header[STREAM_HEADER_SIZE];
+	struct xzp_block *blk;
+	unsigned nblk;
+};
+
+static int xzp_pread(int fd, void *buf, size_t count, uint64_t ofs)
+{
+	ssize_t n;
+
+	do
+		n = pread(fd, buf, count, ofs);
+	while (n < 0 && errno == EINTR);
+	return n == (ssize_t)count;
+}
+
+/* Decode a VLI at *pp, not going past end. Returns VLI_UNKNOWN on error */
+static vli_type xzp_get_vli(const uint8_t **pp, const uint8_t *end)
+{
+	const uint8_t *p = *pp;
+	vli_type v = 0;
+	unsigned shift = 0;
+
+	while (p < end && shift < VLI_BYTES_MAX * 7) {
+		uint8_t b = *p++;
+		v |= (vli_type)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			/* Multi-byte VLI can't end with 0x00 */
+			if (b == 0 && shift != 0)
+				break;
+			*pp = p;
+			return v;
+		}
+		shift += 7;
+	}
+	return VLI_UNKNOWN;
+}
+
+static uint8_t *xzp_put_vli(uint8_t *p, vli_type v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static void xzp_put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Parse the Stream which ends (without Stream Padding) at file offset
+ * *pos, store its Blocks in st and set *pos to its beginning.
+ * Returns 0 if it is not a valid Stream */
+static int xzp_read_stream(int fd, uint64_t *pos, struct xzp_stream *st)
+{
+	uint8_t footer[STREAM_HEADER_SIZE];
+	uint8_t header[STREAM_HEADER_SIZE];
+	uint8_t *index, *p;
+	const uint8_t *q;
+	uint64_t end = *pos;
+	uint64_t index_size, blocks_size;
+	vli_type count;
+	unsigned i;
+	int ok = 0;
+
+	if (end < 2 * STREAM_HEADER_SIZE + 8
+	 || !xzp_pread(fd, footer, STREAM_HEADER_SIZE, end - STREAM_HEADER_SIZE)
+	 || memcmp(footer + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE) != 0
+	 || xz_crc32(footer + 4, 6, 0) != get_unaligned_le32(footer)
+	) {
+		return 0;
+	}
+	index_size = ((uint64_t)get_unaligned_le32(footer + 4) + 1) * 4;
+	if (index_size > XZP_INDEX_MAX
+	 || index_size + 2 * STREAM_HEADER_SIZE > end
+	) {
+		return 0;
+	}
+	end -= STREAM_HEADER_SIZE + index_size;
+
+	index = xmalloc(index_size);
+	if (!xzp_pread(fd, index, index_size, end)
+	 || index[0] != 0
+	 || xz_crc32(index, index_size - 4, 0) != get_unaligned_le32(index + index_size - 4)
+	) {
+		goto ret;
+	}
+	q = index + 1;
+	p = index + index_size - 4;
+	count = xzp_get_vli(&q, p);
+	if (count == VLI_UNKNOWN || count > index_size / 2)
+		goto ret;
+	free(st->blk);
+	st->blk = xzalloc(count * sizeof(st->blk[0]));
+	st->nblk = count;
+	blocks_size = 0;
+	for (i = 0; i < st->nblk; i++) {
+		vli_type unpadded = xzp_get_vli(&q, p);
+		vli_type out = xzp_get_vli(&q, p);
+
+		if (unpadded == VLI_UNKNOWN || out == VLI_UNKNOWN
+		 || unpadded < 5 || unpadded > VLI_MAX - 3
+		) {
+			goto ret;
+		}
+		st->blk[i].in = blocks_size;
+		st->blk[i].unpadded = unpadded;
+		st->blk[i].out = out;
+		blocks_size += (unpadded + 3) & ~(uint64_t)3;
+		if (blocks_size > end)
+			goto ret;
+	}
+	/* Index Padding */
+	while (q < p)
+		if (*q++ != 0)
+			goto ret;
+	if (((q - index) & 3) || blocks_size + STREAM_HEADER_SIZE > end)
+		goto ret;
+	end -= blocks_size + STREAM_HEADER_SIZE;
+
+	if (!xzp_pread(fd, header, STREAM_HEADER_SIZE, end)
+	 || memcmp(header, HEADER_MAGIC, HEADER_MAGIC_SIZE) != 0
+	 || header[6] != footer[8] || header[7] != footer[9]
+	 || xz_crc32(header + 6, 2, 0) != get_unaligned_le32(header + 8)
+	) {
+		goto ret;
+	}
+	memcpy(st->header, header, STREAM_HEADER_SIZE);
+	for (i = 0; i < st->nblk; i++)
+		st->blk[i].in += end + STREAM_HEADER_SIZE;
+	*pos = end;
+	ok = 1;
+ ret:
+	free(index);
+	return ok;
+}
+
+/* Find the Stream which begins at file offset start, fill st */
+static int xzp_read_index(int fd, uint64_t start, struct xzp_stream *st)
+{
+	struct stat sb;
+	uint64_t pos;
+
+	if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+		return 0;
+	pos = sb.st_size;
+	while (pos > start + 2 * STREAM_HEADER_SIZE) {
+		uint8_t pad[4];
+
+		/* Stream Padding */
+		if (!xzp_pread(fd, pad, 4, pos - 4))
+			return 0;
+		if (!pad[0] && !pad[1] && !pad[2] && !pad[3]) {
+			pos -= 4;
+			continue;
+		}
+		if (!xzp_read_stream(fd, &pos, st) || pos < start)
+			return 0;
+		if (pos == start)
+			return 1;
+	}
+	return 0;
+}
+
+/* Worker: decode Block b as a one-Block Stream, write output to out_fd */
+static void NORETURN xzp_worker(int src_fd, const struct xzp_stream *st,
+		const struct xzp_block *b, int out_fd)
+{
+	struct xz_buf iobuf;
+	struct xz_dec *state;
+	uint8_t *buf;
+	/* Index: indicator, count, 2 VLIs, padding, CRC32; Stream Footer */
+	uint8_t trailer[1 + 1 + 2 * VLI_BYTES_MAX + 3 + 4 + STREAM_HEADER_SIZE];
+	uint8_t *p;
+	unsigned index_size;
+	uint64_t in = b->in;
+	uint64_t left = (b->unpadded + 3) & ~(uint64_t)3;
+
+	p = trailer;
+	*p++ = 0x00;
+	*p++ = 1;
+	p = xzp_put_vli(p, b->unpadded);
+	p = xzp_put_vli(p, b->out);
+	while ((p - trailer) & 3)
+		*p++ = 0;
+	xzp_put_le32(p, xz_crc32(trailer, p - trailer, 0));
+	p += 4;
+	index_size = p - trailer;
+	xzp_put_le32(p + 4, index_size / 4 - 1);
+	p[8] = st->header[6];
+	p[9] = st->header[7];
+	xzp_put_le32(p, xz_crc32(p + 4, 6, 0));
+	memcpy(p + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE);
+
+	buf = xmalloc(2 * XZP_READ_SIZE);
+	state = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
+	iobuf.in = st->header;
+	iobuf.in_pos = 0;
+	iobuf.in_size = STREAM_HEADER_SIZE;
+	iobuf.out = buf + XZP_READ_SIZE;
+	iobuf.out_pos = 0;
+	iobuf.out_size = XZP_READ_SIZE;
+
+	while (1) {
+		enum xz_ret r;
+
+		if (iobuf.in_pos == iobuf.in_size) {
+			if (left) {
+				unsigned n = MIN(left, XZP_READ_SIZE);
+				if (!xzp_pread(src_fd, buf, n, in))
+					_exit(EXIT_FAILURE);
+				in += n;
+				left -= n;
+				iobuf.in = buf;
+				iobuf.in_size = n;
+				iobuf.in_pos = 0;
+			} else if (iobuf.in != trailer) {
+				iobuf.in = trailer;
+				iobuf.in_size = index_size + STREAM_HEADER_SIZE;
+				iobuf.in_pos = 0;
+			}
+			/* else: no more input, xz_dec_run returns XZ_BUF_ERROR
+			 * if it can't finish with what it has */
+		}
+		r = xz_dec_run(state, &iobuf);
+		if (iobuf.out_pos) {
+			if (full_write(out_fd, iobuf.out, iobuf.out_pos) != (ssize_t)iobuf.out_pos)
+				_exit(EXIT_FAILURE);
+			iobuf.out_pos = 0;
+		}
+		if (r == XZ_STREAM_END)
+			_exit(EXIT_SUCCESS);
+		if (r != XZ_OK && r != XZ_UNSUPPORTED_CHECK)
+			_exit(EXIT_FAILURE);
+	}
+}
+
+static void xzp_kill(struct xzp_block *b)
+{
+	if (b->pid > 0) {
+		close(b->fd);
+		kill(b->pid, SIGKILL);
+		wait4pid(b->pid);
+		b->pid = 0;
+	}
+}
+
+static IF_DESKTOP(long long) int
+unpack_xz_stream_parallel(int src_fd, int dst_fd, struct xzp_stream *st, unsigned jobs)
+{
+	IF_DESKTOP(long long) int total = 0;
+	unsigned next = 0; /* next Block to start */
+	unsigned i;
+
+	for (i = 0; i < st->nblk; i++) {
+		struct xzp_block *b;
+		off_t cnt;
+		int status;
+
+		/* Keep "jobs" Blocks in flight */
+		while (next < st->nblk && next - i < jobs) {
+			int pipefd[2];
+
+			b = &st->blk[next++];
+			xpipe(pipefd);
+			b->pid = xfork();
+			if (b->pid == 0) {
+				/* child */
+				close(pipefd[0]);
+				xzp_worker(src_fd, st, b, pipefd[1]);
+			}
+			close(pipefd[1]);
+			b->fd = pipefd[0];
+		}
+
+		/* Copy output of the oldest worker */
+		b = &st->blk[i];
+		cnt = bb_copyfd_eof(b->fd, dst_fd);
+		close(b->fd);
+		status = wait4pid(b->pid);
+		b->pid = 0;
+		if (cnt < 0) {
+			total = -1;
+			break;
+		}
+		IF_DESKTOP(total += cnt;)
+		if (status != 0 || (uint64_t)cnt != b->out) {
+			bb_error_msg("corrupted data");
+			total = -1;
+			break;
+		}
+	}
+	while (next > i)
+		xzp_kill(&st->blk[--next]);
+
+	return total;
+}
+
+/* jobs: how many Blocks to decode at once, 0: one per CPU (up to 8) */
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream_jobs(int src_fd, int dst_fd, unsigned jobs)
+{
+	struct xzp_stream st;
+	off_t start;
+
+	if (jobs == 0)
+		jobs = bb_online_cpus(XZP_MAX_JOBS);
+	memset(&st, 0, sizeof(st));
+	if (jobs > 1) {
+		if (!global_crc32_table)
+			global_crc32_table = crc32_filltable(NULL, /*endian:*/ 0);
+		/* Our caller has read the magic */
+		start = lseek(src_fd, 0, SEEK_CUR) - HEADER_MAGIC_SIZE;
+		if (start >= 0
+		 && xzp_read_index(src_fd, start, &st)
+		 && st.nblk > 1
+		) {
+			IF_DESKTOP(long long) int total;
+
+			total = unpack_xz_stream_parallel(src_fd, dst_fd, &st, jobs);
+			free(st.blk);
+			return total;
+		}
+		free(st.blk);
+	}
+# if ENABLE_FEATURE_SEEK_INDEX
+	return unpack_xz_stream_seek(src_fd, dst_fd, NULL, 0, (uint64_t)-1);
+# else
+	return unpack_xz_stream_serial(src_fd, dst_fd);
+# endif
+}
+
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream(int src_fd, int dst_fd)
+{
+	return unpack_xz_stream_jobs(src_fd, dst_fd, 0);
+}
+#elif ENABLE_FEATURE_SEEK_INDEX
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream(int src_fd, int dst_fd)
+{
+	return unpack_xz_stream_seek(src_fd, dst_fd, NULL, 0, (uint64_t)-1);
+}
+#endif
@@ -105,6 +105,12 @@ typedef struct state_t {
 
 	smallint resume_copy;
 
+#if ENABLE_FEATURE_INFLATE_FAST
+	/* flat lookup tables of inflate_fast() */
+	uint32_t *inflate_fast_lt;
+	uint32_t *inflate_fast_dt;
+#endif
+
 	/* private data of inflate_get_next_window() */
 	smallint method; /* method == -1 for stored, -2 for codes */
 	smallint need_another_block;
@@ -116,6 +122,18 @@ typedef struct state_t {
 	unsigned inflate_stored_k;
 	unsigned inflate_stored_w;
 
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* unpack_gz_stream_seek() */
+	seek_index_t *seek_index;
+	off_t bytes_in;         /* file offset just past the read data */
+	uint64_t out_base;      /* uncompressed offset of member's start */
+	uint64_t seek_start;    /* output only this range */
+	uint64_t seek_end;
+	const seek_point_t *resume_point; /* start from here */
+	smallint member_resumed; /* can't check crc of this member */
+	smallint seek_done;
+#endif
+
 	const char *error_msg;
 	jmp_buf error_jmp;
 } state_t;
@@ -146,6 +164,8 @@ typedef struct state_t {
 #define inflate_codes_nn    (S()inflate_codes_nn   )
 #define inflate_codes_dd    (S()inflate_codes_dd   )
 #define resume_copy         (S()resume_copy        )
+#define inflate_fast_lt     (S()inflate_fast_lt    )
+#define inflate_fast_dt     (S()inflate_fast_dt    )
 #define method              (S()method             )
 #define need_another_block  (S()need_another_block )
 #define end_reached         (S()end_reached        )
@@ -153,6 +173,14 @@ typedef struct state_t {
 #define inflate_stored_b    (S()inflate_stored_b   )
 #define inflate_stored_k    (S()inflate_stored_k   )
 #define inflate_stored_w    (S()inflate_stored_w   )
+#define seek_index          (S()seek_index         )
+#define bytes_in            (S()bytes_in           )
+#define out_base            (S()out_base           )
+#define seek_start          (S()seek_start         )
+#define seek_end            (S()seek_end           )
+#define resume_point        (S()resume_point       )
+#define member_resumed      (S()member_resumed     )
+#define seek_done           (S()seek_done          )
 #define error_msg           (S()error_msg          )
 #define error_jmp           (S()error_jmp          )
 
@@ -265,6 +293,7 @@ static unsigned fill_bitbuffer(STATE_PARAM unsigned bitbuffer, unsigned *current
 				error_msg = "unexpected end of file";
 				abort_unzip(PASS_STATE_ONLY);
 			}
+			IF_FEATURE_SEEK_INDEX(bytes_in += bytebuffer_size;)
 			if (to_read >= 0) /* unzip only */
 				to_read -= bytebuffer_size;
 			bytebuffer_size += 4;
@@ -469,6 +498,246 @@ static int huft_build(const unsigned *b, const unsigned n,
 }
 
 
+#if ENABLE_FEATURE_INFLATE_FAST
+/*
+ * Fast path for the bulk of a deflated block, in the spirit of zlib's
+ * inflate_fast(). It runs while there are at least 8 input bytes in
+ * bytebuffer and room for a longest match in gunzip_window, so it needs
+ * no checks for either inside.
+ *
+ * Bits are kept in a 64-bit buffer, which is refilled 8 bytes at a time.
+ * Codes are decoded by single lookups in flat tables indexed by
+ * FAST_LBITS (FAST_DBITS) next input bits. An entry is:
+ * bits 0-7: code length, bits 8-15: op, bits 16-31: value.
+ * Literal/length table entry can hold two literals if both codes fit
+ * into FAST_LBITS bits. Longer codes (rare) are marked FAST_OP_SLOW,
+ * and are handled by huft_t tables.
+ */
+enum {
+	FAST_LBITS = 11,
+	FAST_DBITS = 10,
+	FAST_OP_LIT = 0x00,	/* value: literal */
+	FAST_OP_LIT2 = 0x01,	/* value: two literals, first in low byte */
+	FAST_OP_LEN = 0x10,	/* | extra bits; value: length base */
+	FAST_OP_EOB = 0x20,
+	FAST_OP_SLOW = 0x40,	/* long or invalid code */
+	/* distance table: op is extra bits (or FAST_OP_SLOW), value is base */
+};
+#define FAST_ENTRY(op, val, len) (((uint32_t)(val) << 16) | ((op) << 8) | (len))
+#define FAST_OP(e) (((e) >> 8) & 0xff)
+
+/* Build flat table from code lengths. s, d, e are as in huft_build() */
+static void inflate_fast_build(uint32_t *tbl, unsigned tbits,
+		const unsigned *b, unsigned n,
+		unsigned s, const unsigned short *d, const unsigned char *e)
+{
+	unsigned count[BMAX + 1], next[BMAX + 1];
+	unsigned i, code, len;
+
+	for (i = 0; i < (1u << tbits); i++)
+		tbl[i] = FAST_ENTRY(FAST_OP_SLOW, 0, 0);
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		count[b[i]]++;
+	count[0] = 0;
+	code = 0;
+	for (len = 1; len <= BMAX; len++) {
+		code = (code + count[len - 1]) << 1;
+		next[len] = code;
+	}
+
+	/* huft_build() already rejected oversubscribed sets */
+	for (i = 0; i < n; i++) {
+		uint32_t ent;
+		unsigned rev, j;
+
+		len = b[i];
+		if (len == 0)
+			continue;
+		code = next[len]++;
+		if (len > tbits)
+			continue;
+		if (i < s) {
+			ent = (i < 256) ? FAST_ENTRY(FAST_OP_LIT, i, len)
+			                : FAST_ENTRY(FAST_OP_EOB, 0, len);
+		} else if (e[i - s] == 99) {
+			continue; /* invalid code, leave it to huft tables */
+		} else {
+			ent = FAST_ENTRY((s ? FAST_OP_LEN : 0) | e[i - s], d[i - s], len);
+		}
+		/* Codes are stored MSB first, we index by LSB first bits */
+		rev = 0;
+		for (j = 0; j < len; j++)
+			rev |= ((code >> j) & 1) << (len - 1 - j);
+		for (j = rev; j < (1u << tbits); j += (1u << len))
+			tbl[j] = ent;
+	}
+
+	if (!s)
+		return;
+	/* Pair up literals. Going down, so that tbl[i >> len] is unmodified */
+	i = 1u << tbits;
+	while (i--) {
+		uint32_t e1 = tbl[i];
+		uint32_t e2;
+
+		len = e1 & 0xff;
+		if (FAST_OP(e1) != FAST_OP_LIT || len >= tbits)
+			continue;
+		e2 = tbl[i >> len];
+		if (FAST_OP(e2) != FAST_OP_LIT || len + (e2 & 0xff) > tbits)
+			continue;
+		tbl[i] = FAST_ENTRY(FAST_OP_LIT2, (e1 >> 16) | ((e2 >> 16) << 8), len + (e2 & 0xff));
+	}
+}
+
+/* Return values of inflate_fast() */
+enum {
+	FAST_CONTINUE, /* ran out of input or output room, or long code */
+	FAST_WINDOW_FULL,
+	FAST_EOB,
+	FAST_COPY, /* match source wraps around window, copy is set up in nn, dd */
+};
+
+static int inflate_fast(STATE_PARAM_ONLY)
+{
+	const uint32_t *lt = inflate_fast_lt;
+	const uint32_t *dt = inflate_fast_dt;
+	uint8_t *win = gunzip_window;
+	const uint8_t *in = bytebuffer + bytebuffer_offset;
+	const uint8_t *in_start = in;
+	const uint8_t *in_end = bytebuffer + bytebuffer_size - 8;
+	uint64_t hold = inflate_codes_bb;
+	unsigned bits = inflate_codes_k;
+	unsigned w = inflate_codes_w;
+	int ret = FAST_CONTINUE;
+
+	while (in <= in_end && w <= GUNZIP_WSIZE - 258) {
+		uint64_t v;
+		uint32_t e;
+		unsigned len, dist, op;
+		uint8_t *dst;
+		const uint8_t *src;
+
+		/* Refill to 56..63 bits */
+		memcpy(&v, in, 8);
+		hold |= SWAP_LE64(v) << bits;
+		in += (63 - bits) >> 3;
+		bits |= 56;
+
+		/* Up to five lookups before next refill, 2 literals each */
+		e = lt[hold & ((1 << FAST_LBITS) - 1)];
+		while (FAST_OP(e) <= FAST_OP_LIT2) {
+			hold >>= (e & 0xff);
+			bits -= (e & 0xff);
+			win[w++] = (uint8_t)(e >> 16);
+			if (e & (FAST_OP_LIT2 << 8))
+				win[w++] = (uint8_t)(e >> 24);
+			if (bits < FAST_LBITS)
+				goto next;
+			e = lt[hold & ((1 << FAST_LBITS) - 1)];
+		}
+		/* A match needs up to 11+5 + 15+13 bits, and room in window */
+		if (bits < 44)
+			continue;
+		if (w > GUNZIP_WSIZE - 258)
+			break;
+		op = FAST_OP(e);
+		if (op == FAST_OP_EOB) {
+			hold >>= (e & 0xff);
+			bits -= (e & 0xff);
+			ret = FAST_EOB;
+			break;
+		}
+		if (op == FAST_OP_SLOW)
+			break; /* let inflate_codes() decode it */
+
+		/* Length */
+		hold >>= (e & 0xff);
+		bits -= (e & 0xff);
+		op &= 0xf;
+		len = (e >> 16) + ((unsigned)hold & mask_bits[op]);
+		hold >>= op;
+		bits -= op;
+
+		/* Distance */
+		e = dt[hold & ((1 << FAST_DBITS) - 1)];
+		if (FAST_OP(e) != FAST_OP_SLOW) {
+			hold >>= (e & 0xff);
+			bits -= (e & 0xff);
+			op = FAST_OP(e);
+			dist = (e >> 16);
+		} else {
+			huft_t *t = inflate_codes_td + ((unsigned)hold & inflate_codes_md);
+			op = t->e;
+			while (op > 16) {
+				if (op == 99)
+					abort_unzip(PASS_STATE_ONLY);
+				hold >>= t->b;
+				bits -= t->b;
+				op -= 16;
+				t = t->v.t + ((unsigned)hold & mask_bits[op]);
+				op = t->e;
+			}
+			hold >>= t->b;
+			bits -= t->b;
+			dist = t->v.n;
+		}
+		dist += (unsigned)hold & mask_bits[op];
+		hold >>= op;
+		bits -= op;
+
+		if (dist > w) {
+			/* Source is in the previous round of the window */
+			inflate_codes_nn = len;
+			inflate_codes_dd = w - dist;
+			ret = FAST_COPY;
+			break;
+		}
+		dst = win + w;
+		src = dst - dist;
+		w += len;
+		if (dist >= 8) {
+			/* Word copies: source is always behind destination */
+			while (len >= 8) {
+				memcpy(&v, src, 8);
+				memcpy(dst, &v, 8);
+				src += 8;
+				dst += 8;
+				len -= 8;
+			}
+			while (len--)
+				*dst++ = *src++;
+		} else if (dist == 1) {
+			memset(dst, *src, len);
+		} else {
+			do
+				*dst++ = *src++;
+			while (--len);
+		}
+ next: ;
+	}
+
+	/* Return whole unused bytes to bytebuffer. Don't go back past
+	 * bytes we loaded ourself: older ones may be gone already */
+	{
+		unsigned u = bits >> 3;
+		if (u > (unsigned)(in - in_start))
+			u = in - in_start;
+		in -= u;
+		bits -= u * 8;
+	}
+	inflate_codes_bb = (unsigned)hold & ((1u << bits) - 1);
+	inflate_codes_k = bits;
+	inflate_codes_w = w;
+	bytebuffer_offset = in - bytebuffer;
+	if (ret == FAST_CONTINUE && w == GUNZIP_WSIZE)
+		ret = FAST_WINDOW_FULL;
+	return ret;
+}
+#endif
+
 /*
  * inflate (decompress) the codes in a deflated (compressed) block.
  * Return an error code or zero if it all goes ok.
@@ -512,6 +781,18 @@ static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 		goto do_copy;
 
 	while (1) {			/* do until end of block */
+#if ENABLE_FEATURE_INFLATE_FAST
+		switch (inflate_fast(PASS_STATE_ONLY)) {
+		case FAST_WINDOW_FULL:
+			gunzip_outbuf_count = w;
+			w = 0;
+			return 1;
+		case FAST_EOB:
+			goto eob;
+		case FAST_COPY:
+			goto do_copy;
+		}
+#endif
 		bb = fill_bitbuffer(PASS_STATE bb, &k, bl);
 		t = tl + ((unsigned) bb & ml);
 		e = t->e;
@@ -607,6 +888,9 @@ static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 		}
 	}
 
+#if ENABLE_FEATURE_INFLATE_FAST
+ eob:
+#endif
 	/* restore the globals from the locals */
 	gunzip_outbuf_count = w;	/* restore global gunzip_window pointer */
 	gunzip_bb = bb;			/* restore global bit buffer */
@@ -766,12 +1050,18 @@ static int inflate_block(STATE_PARAM smallint *e)
 		bl = 7;
 		huft_build(ll, 288, 257, cplens, cplext, &inflate_codes_tl, &bl);
 		/* huft_build() never return nonzero - we use known data */
+#if ENABLE_FEATURE_INFLATE_FAST
+		inflate_fast_build(inflate_fast_lt, FAST_LBITS, ll, 288, 257, cplens, cplext);
+#endif
 
 		/* set up distance table */
 		for (i = 0; i < 30; i++) /* make an incomplete code set */
 			ll[i] = 5;
 		bd = 5;
 		huft_build(ll, 30, 0, cpdist, cpdext, &inflate_codes_td, &bd);
+#if ENABLE_FEATURE_INFLATE_FAST
+		inflate_fast_build(inflate_fast_dt, FAST_DBITS, ll, 30, 0, cpdist, cpdext);
+#endif
 
 		/* set up data for inflate_codes() */
 		inflate_codes_setup(PASS_STATE bl, bd);
@@ -909,6 +1199,10 @@ static int inflate_block(STATE_PARAM smallint *e)
 		i = huft_build(ll + nl, nd, 0, cpdist, cpdext, &inflate_codes_td, &bd);
 		if (i != 0)
 			abort_unzip(PASS_STATE_ONLY);
+#if ENABLE_FEATURE_INFLATE_FAST
+		inflate_fast_build(inflate_fast_lt, FAST_LBITS, ll, nl, 257, cplens, cplext);
+		inflate_fast_build(inflate_fast_dt, FAST_DBITS, ll + nl, nd, 0, cpdist, cpdext);
+#endif
 
 		/* set up data for inflate_codes() */
 		inflate_codes_setup(PASS_STATE bl, bd);
@@ -929,6 +1223,30 @@ static void calculate_gunzip_crc(STATE_PARAM_ONLY)
 	gunzip_bytes_out += gunzip_outbuf_count;
 }
 
+#if ENABLE_FEATURE_SEEK_INDEX
+/* Called between deflate blocks while the index is being created */
+static void seek_index_checkpoint(STATE_PARAM_ONLY)
+{
+	seek_point_t pt;
+	uint64_t bit;
+	unsigned char *win;
+
+	pt.out = out_base + gunzip_bytes_out + gunzip_outbuf_count;
+	if (pt.out < seek_index->next_point)
+		return;
+	/* Position of the first bit not used yet */
+	bit = (uint64_t)(bytes_in - bytebuffer_size + bytebuffer_offset) * 8 - gunzip_bk;
+	pt.in = bit / 8;
+	pt.aux = bit % 8;
+	/* Last 32k of output, oldest byte first */
+	win = xmalloc(GUNZIP_WSIZE);
+	memcpy(win, gunzip_window + gunzip_outbuf_count, GUNZIP_WSIZE - gunzip_outbuf_count);
+	memcpy(win + GUNZIP_WSIZE - gunzip_outbuf_count, gunzip_window, gunzip_outbuf_count);
+	seek_index_add_point(seek_index, &pt, win);
+	free(win);
+}
+#endif
+
 /* One callsite in inflate_unzip_internal */
 static int inflate_get_next_window(STATE_PARAM_ONLY)
 {
@@ -944,6 +1262,10 @@ static int inflate_get_next_window(STATE_PARAM_ONLY)
 				/* NB: need_another_block is still set */
 				return 0; /* Last block */
 			}
+#if ENABLE_FEATURE_SEEK_INDEX
+			if (seek_index && seek_index->creating)
+				seek_index_checkpoint(PASS_STATE_ONLY);
+#endif
 			method = inflate_block(PASS_STATE &end_reached);
 			need_another_block = 0;
 		}
@@ -978,6 +1300,10 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
 
 	/* Allocate all global buffers (for DYN_ALLOC option) */
 	gunzip_window = xmalloc(GUNZIP_WSIZE);
+#if ENABLE_FEATURE_INFLATE_FAST
+	inflate_fast_lt = xmalloc(((1 << FAST_LBITS) + (1 << FAST_DBITS)) * sizeof(uint32_t));
+	inflate_fast_dt = inflate_fast_lt + (1 << FAST_LBITS);
+#endif
 	gunzip_outbuf_count = 0;
 	gunzip_bytes_out = 0;
 	gunzip_src_fd = in;
@@ -1000,15 +1326,51 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (resume_point) {
+		/* Continue at a block boundary: restore window and bit buffer */
+		unsigned k = 0;
+
+		seek_index_read_window(seek_index, resume_point, gunzip_window);
+		if (resume_point->aux) {
+			gunzip_bb = fill_bitbuffer(PASS_STATE 0, &k, 8) >> resume_point->aux;
+			gunzip_bk = 8 - resume_point->aux;
+		}
+		resume_point = NULL;
+	}
+#endif
+
 	while (1) {
 		int r = inflate_get_next_window(PASS_STATE_ONLY);
-		nwrote = full_write(out, gunzip_window, gunzip_outbuf_count);
-		if (nwrote != (ssize_t)gunzip_outbuf_count) {
+		unsigned char *p = gunzip_window;
+		unsigned count = gunzip_outbuf_count;
+#if ENABLE_FEATURE_SEEK_INDEX
+		/* Write only the [seek_start, seek_end) part */
+		uint64_t pos = out_base + gunzip_bytes_out - count;
+
+		if (pos + count > seek_end)
+			count = seek_end > pos ? seek_end - pos : 0;
+		if (pos < seek_start) {
+			unsigned skip = MIN((uint64_t)count, seek_start - pos);
+			p += skip;
+			count -= skip;
+		}
+#endif
+		nwrote = full_write(out, p, count);
+		if (nwrote != (ssize_t)count) {
 			bb_perror_msg("write");
 			n = -1;
 			goto ret;
 		}
 		IF_DESKTOP(n += nwrote;)
+#if ENABLE_FEATURE_SEEK_INDEX
+		if (out_base + gunzip_bytes_out >= seek_end
+		 && !(seek_index && seek_index->creating)
+		) {
+			seek_done = 1;
+			break;
+		}
+#endif
 		if (r == 0) break;
 	}
 
@@ -1024,6 +1386,7 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
  ret:
 	/* Cleanup */
 	free(gunzip_window);
+	IF_FEATURE_INFLATE_FAST(free(inflate_fast_lt);)
 	free(gunzip_crc_table);
 	return n;
 }
@@ -1042,6 +1405,7 @@ inflate_unzip(inflate_unzip_result *res, off_t compr_size, int in, int out)
 	ALLOC_STATE;
 
 	to_read = compr_size;
+	IF_FEATURE_SEEK_INDEX(seek_end = (uint64_t)-1;)
 //	bytebuffer_max = 0x8000;
 	bytebuffer_offset = 4;
 	bytebuffer = xmalloc(bytebuffer_max);
@@ -1072,6 +1436,7 @@ static int top_up(STATE_PARAM unsigned n)
 			bb_error_msg(bb_msg_read_error);
 			return 0;
 		}
+		IF_FEATURE_SEEK_INDEX(bytes_in += bytebuffer_size;)
 		bytebuffer_size += count;
 		if (bytebuffer_size < n)
 			return 0;
@@ -1181,8 +1546,9 @@ static int check_header_gzip(STATE_PARAM unpack_info_t *info)
 	return 1;
 }
 
-IF_DESKTOP(long long) int FAST_FUNC
-unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
+static IF_DESKTOP(long long) int
+unpack_gz(int in, int out, unpack_info_t *info
+		IF_FEATURE_SEEK_INDEX(, seek_index_t *idx, uint64_t offset, uint64_t len))
 {
 	uint32_t v32;
 	IF_DESKTOP(long long) int n;
@@ -1196,15 +1562,48 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 	bytebuffer = xmalloc(bytebuffer_max);
 	gunzip_src_fd = in;
 
+#if ENABLE_FEATURE_SEEK_INDEX
+	seek_index = idx;
+	seek_start = offset;
+	seek_end = offset + len;
+	if (seek_end < offset)
+		seek_end = (uint64_t)-1;
+	/* Checkpoints use file offsets. Magic is already read */
+	bytes_in = lseek(in, 0, SEEK_CUR);
+	if (bytes_in < 0)
+		bytes_in = 2;
+	if (idx && seek_index_usable(idx, in)) {
+		resume_point = seek_index_find(idx, offset);
+		if (resume_point) {
+			xlseek(in, resume_point->in, SEEK_SET);
+			bytes_in = resume_point->in;
+			out_base = resume_point->out;
+			member_resumed = 1;
+			goto inflate;
+		}
+		/* We may have been here already (tar --index) */
+		xlseek(in, 2, SEEK_SET);
+		bytes_in = 2;
+	}
+#endif
+
  again:
 	if (!check_header_gzip(PASS_STATE info)) {
 		bb_error_msg("corrupted data");
 		n = -1;
 		goto ret;
 	}
+#if ENABLE_FEATURE_SEEK_INDEX
+ inflate:
+#endif
 	n += inflate_unzip_internal(PASS_STATE in, out);
 	if (n < 0)
 		goto ret;
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (seek_done)
+		goto ret;
+	out_base += gunzip_bytes_out;
+#endif
 
 	if (!top_up(PASS_STATE 8)) {
 		bb_error_msg("corrupted data");
@@ -1214,7 +1613,7 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 
 	/* Validate decompression - crc */
 	v32 = buffer_read_le_u32(PASS_STATE_ONLY);
-	if ((~gunzip_crc) != v32) {
+	if ((~gunzip_crc) != v32 IF_FEATURE_SEEK_INDEX(&& !member_resumed)) {
 		bb_error_msg("crc error");
 		n = -1;
 		goto ret;
@@ -1222,13 +1621,14 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 
 	/* Validate decompression - size */
 	v32 = buffer_read_le_u32(PASS_STATE_ONLY);
-	if ((uint32_t)gunzip_bytes_out != v32) {
+	if ((uint32_t)gunzip_bytes_out != v32 IF_FEATURE_SEEK_INDEX(&& !member_resumed)) {
 		bb_error_msg("incorrect length");
 		n = -1;
 	}
+	IF_FEATURE_SEEK_INDEX(member_resumed = 0;)
 
 	if (!top_up(PASS_STATE 2))
-		goto ret; /* EOF */
+		goto end; /* EOF */
 
 	if (bytebuffer[bytebuffer_offset] == 0x1f
 	 && bytebuffer[bytebuffer_offset + 1] == 0x8b
@@ -1238,6 +1638,11 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 	}
 	/* GNU gzip says: */
 	/*bb_error_msg("decompression OK, trailing garbage ignored");*/
+ end:
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (idx && idx->creating && n >= 0)
+		seek_index_finish(idx, in, bytes_in - bytebuffer_size + bytebuffer_offset, out_base);
+#endif
 
  ret:
 	free(bytebuffer);
@@ -1245,8 +1650,22 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 	return n;
 }
 
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
+{
+	return unpack_gz(in, out, info IF_FEATURE_SEEK_INDEX(, NULL, 0, (uint64_t)-1));
+}
+
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_gz_stream(int in, int out)
 {
-	return unpack_gz_stream_with_info(in, out, NULL);
+	return unpack_gz(in, out, NULL IF_FEATURE_SEEK_INDEX(, NULL, 0, (uint64_t)-1));
 }
+
+#if ENABLE_FEATURE_SEEK_INDEX
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_gz_stream_seek(int in, int out, seek_index_t *idx, uint64_t offset, uint64_t len)
+{
+	return unpack_gz(in, out, NULL, idx, offset, len);
+}
+#endif
@@ -167,6 +167,11 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 # define p_linkname 0
 #endif
 
+#if ENABLE_FEATURE_TAR_INDEX
+	/* Longname/pax headers belong to the member too */
+	archive_handle->tar__member_start = (archive_handle->offset + 511) & ~(off_t)511;
+#endif
+
 #if ENABLE_FEATURE_TAR_GNU_EXTENSIONS || ENABLE_FEATURE_TAR_SELINUX
  again:
 #endif
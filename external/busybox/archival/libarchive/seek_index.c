@@ -0,0 +1,250 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Random access index for .gz and .xz streams
+ *
+ * The index is a sidecar file with decompressor checkpoints, taken
+ * every SEEK_INDEX_SPAN bytes of output while the stream is decoded
+ * once from the start. Later, decompression can be resumed from the
+ * last checkpoint before the wanted offset instead of from the start.
+ * A gzip checkpoint is the bit position of a deflate block boundary
+ * plus the 32k of output which precede it (the window the next blocks
+ * can refer back to), like zlib's examples/zran.c. An xz checkpoint
+ * is the start of an xz block; blocks are independent, no window
+ * is needed.
+ *
+ * File format, all numbers little endian:
+ * "BBZI" version:8 type:8 reserved:16
+ * then records, each starting with a tag byte:
+ * 'C' out:64 in:64 aux:32 [window:32k, gz only] - checkpoint
+ * 'M' offset:64 namelen:16 name - archive member (tar --index)
+ * 'E' in:64 out:64 - end of the compressed data / total output
+ * 'S' size:64 mtime:64 - the compressed file the index was made from
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+
+#include "libbb.h"
+#include "archive.h"
+
+#define INDEX_MAGIC   "BBZI"
+#define INDEX_VERSION 1
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, unsigned bytes)
+{
+	while (bytes--) {
+		*p++ = (uint8_t)v;
+		v >>= 8;
+	}
+	return p;
+}
+
+static uint64_t get_le(const uint8_t *p, unsigned bytes)
+{
+	uint64_t v = 0;
+	while (bytes--)
+		v = (v << 8) | p[bytes];
+	return v;
+}
+
+static NORETURN void bad_index(const seek_index_t *idx)
+{
+	bb_error_msg_and_die("%s: corrupted index", idx->filename);
+}
+
+static void read_or_die(const seek_index_t *idx, void *buf, size_t count)
+{
+	if (full_read(idx->fd, buf, count) != (ssize_t)count)
+		bad_index(idx);
+}
+
+/* Opens FILENAME. If it does not exist, it is created (empty)
+ * and is then filled by unpack_{gz,xz}_stream_seek() */
+seek_index_t* FAST_FUNC seek_index_open(const char *filename, int type)
+{
+	seek_index_t *idx;
+	uint8_t buf[8 + 8 + 4];
+
+	idx = xzalloc(sizeof(*idx));
+	idx->filename = filename;
+	idx->type = type;
+	idx->fd = open(filename, O_RDONLY);
+	if (idx->fd < 0) {
+		if (errno != ENOENT)
+			bb_simple_perror_msg_and_die(filename);
+		idx->fd = xopen3(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		idx->creating = 1;
+		idx->next_point = SEEK_INDEX_SPAN;
+		memcpy(buf, INDEX_MAGIC, 4);
+		buf[4] = INDEX_VERSION;
+		buf[5] = type;
+		buf[6] = buf[7] = 0;
+		xwrite(idx->fd, buf, 8);
+		return idx;
+	}
+
+	read_or_die(idx, buf, 8);
+	if (memcmp(buf, INDEX_MAGIC, 4) != 0 || buf[4] != INDEX_VERSION)
+		bad_index(idx);
+	if (buf[5] != type)
+		bb_error_msg_and_die("%s: index is not for this file type", filename);
+
+	while (1) {
+		uint8_t tag;
+		int r = safe_read(idx->fd, &tag, 1);
+		if (r == 0)
+			break;
+		if (r < 0)
+			bad_index(idx);
+		if (tag == 'C') {
+			seek_point_t *pt;
+
+			read_or_die(idx, buf, 8 + 8 + 4);
+			idx->points = xrealloc_vector(idx->points, 6, idx->point_cnt);
+			pt = &idx->points[idx->point_cnt++];
+			pt->out = get_le(buf, 8);
+			pt->in = get_le(buf + 8, 8);
+			pt->aux = get_le(buf + 16, 4);
+			pt->window_pos = 0;
+			if (type == SEEK_INDEX_GZ) {
+				pt->window_pos = lseek(idx->fd, 0, SEEK_CUR);
+				if (lseek(idx->fd, SEEK_INDEX_WINDOW, SEEK_CUR) < 0)
+					bad_index(idx);
+			}
+			/* seek_index_find() does binary search */
+			if (idx->point_cnt > 1 && pt->out <= pt[-1].out)
+				bad_index(idx);
+		} else if (tag == 'M') {
+			seek_member_t *m;
+			unsigned len;
+
+			read_or_die(idx, buf, 8 + 2);
+			len = get_le(buf + 8, 2);
+			idx->members = xrealloc_vector(idx->members, 6, idx->member_cnt);
+			m = &idx->members[idx->member_cnt++];
+			m->offset = get_le(buf, 8);
+			m->name = xzalloc(len + 1);
+			read_or_die(idx, m->name, len);
+		} else if (tag == 'E') {
+			read_or_die(idx, buf, 8 + 8);
+			idx->in_end = get_le(buf, 8);
+			idx->out_end = get_le(buf + 8, 8);
+		} else if (tag == 'S') {
+			read_or_die(idx, buf, 8 + 8);
+			idx->src_size = get_le(buf, 8);
+			idx->src_mtime = get_le(buf + 8, 8);
+		} else {
+			bad_index(idx);
+		}
+	}
+	return idx;
+}
+
+/* Creating: append a checkpoint */
+void FAST_FUNC seek_index_add_point(seek_index_t *idx, const seek_point_t *pt, const void *window)
+{
+	uint8_t buf[1 + 8 + 8 + 4];
+	uint8_t *p = buf;
+
+	*p++ = 'C';
+	p = put_le(p, pt->out, 8);
+	p = put_le(p, pt->in, 8);
+	put_le(p, pt->aux, 4);
+	xwrite(idx->fd, buf, sizeof(buf));
+	if (window)
+		xwrite(idx->fd, window, SEEK_INDEX_WINDOW);
+	idx->point_cnt++;
+	idx->next_point = pt->out + SEEK_INDEX_SPAN;
+}
+
+/* Creating: remember a member, they are written by seek_index_close() */
+void FAST_FUNC seek_index_add_member(seek_index_t *idx, uint64_t offset, const char *name)
+{
+	seek_member_t *m;
+
+	idx->members = xrealloc_vector(idx->members, 6, idx->member_cnt);
+	m = &idx->members[idx->member_cnt++];
+	m->offset = offset;
+	m->name = xstrdup(name);
+}
+
+/* Creating: the whole stream was decoded */
+void FAST_FUNC seek_index_finish(seek_index_t *idx, int src_fd, uint64_t in, uint64_t out)
+{
+	uint8_t buf[1 + 8 + 8];
+	struct stat st;
+
+	buf[0] = 'E';
+	put_le(put_le(buf + 1, in, 8), out, 8);
+	xwrite(idx->fd, buf, sizeof(buf));
+	/* Without it the index can't be used, see seek_index_usable() */
+	if (fstat(src_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		buf[0] = 'S';
+		put_le(put_le(buf + 1, st.st_size, 8), st.st_mtime, 8);
+		xwrite(idx->fd, buf, sizeof(buf));
+	}
+}
+
+/* Last checkpoint at or before uncompressed offset OUT, or NULL */
+const seek_point_t* FAST_FUNC seek_index_find(const seek_index_t *idx, uint64_t out)
+{
+	unsigned lo = 0, hi = idx->point_cnt;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (idx->points[mid].out <= out)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &idx->points[lo - 1] : NULL;
+}
+
+void FAST_FUNC seek_index_read_window(const seek_index_t *idx, const seek_point_t *pt, void *window)
+{
+	if (pread(idx->fd, window, SEEK_INDEX_WINDOW, pt->window_pos) != SEEK_INDEX_WINDOW)
+		bad_index(idx);
+}
+
+/* Checks that FD (the compressed file) is the one the index was made for,
+ * as far as it can be checked cheaply: by size and mtime. Data resumed
+ * from a checkpoint can't be CRC checked, a stale index would silently
+ * give wrong data. Returns 0 if it is not seekable or does not match */
+int FAST_FUNC seek_index_usable(const seek_index_t *idx, int fd)
+{
+	struct stat st;
+
+	if (idx->creating || idx->point_cnt == 0)
+		return 0;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+	if ((uint64_t)st.st_size != idx->src_size
+	 || (uint64_t)st.st_mtime != idx->src_mtime
+	) {
+		bb_error_msg("%s: index does not match, ignored", idx->filename);
+		return 0;
+	}
+	return 1;
+}
+
+void FAST_FUNC seek_index_close(seek_index_t *idx)
+{
+	unsigned i;
+
+	for (i = 0; i < idx->member_cnt; i++) {
+		seek_member_t *m = &idx->members[i];
+		if (idx->creating) {
+			uint8_t buf[1 + 8 + 2];
+			unsigned len = strnlen(m->name, 0xffff);
+
+			buf[0] = 'M';
+			put_le(put_le(buf + 1, m->offset, 8), len, 2);
+			xwrite(idx->fd, buf, sizeof(buf));
+			xwrite(idx->fd, m->name, len);
+		}
+		free(m->name);
+	}
+	close(idx->fd);
+	free(idx->members);
+	free(idx->points);
+	free(idx);
+}
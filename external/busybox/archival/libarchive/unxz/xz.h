@@ -232,6 +232,21 @@ XZ_EXTERN enum xz_ret XZ_FUNC xz_dec_run(struct xz_dec *s, struct xz_buf *b);
  */
 XZ_EXTERN void XZ_FUNC xz_dec_reset(struct xz_dec *s);
 
+#ifdef XZ_DEC_SEEK
+/**
+ * xz_dec_resume() - Start decoding in the middle of a Stream
+ * @s:          Decoder state allocated using xz_dec_init()
+ * @check_type: Check type from the Stream Header
+ *
+ * Resets the multi-call decoder so that the input it is given next
+ * starts with a Block Header instead of a Stream Header. The Index
+ * is not validated in this case, since the decoder has not seen
+ * all Blocks.
+ */
+XZ_EXTERN void XZ_FUNC xz_dec_resume(struct xz_dec *s,
+		unsigned int check_type);
+#endif
+
 /**
  * xz_dec_end() - Free the memory allocated for the decoder state
  * @s:          Decoder state allocated using xz_dec_init(). If s is NULL,
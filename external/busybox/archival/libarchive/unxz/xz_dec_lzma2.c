@@ -339,6 +339,63 @@ static inline void XZ_FUNC dict_put(struct dictionary *dict, uint8_t byte)
 		dict->full = dict->pos;
 }
 
+#ifdef XZ_DEC_FAST
+/*
+ * Copy len bytes from buf[back] to buf[pos] so that the result is the same
+ * as with a byte-by-byte copy which wraps back to buf[0] at buf[end]:
+ * if the source is less than len bytes behind pos, the bytes written
+ * at the beginning of the copy are repeated. The destination must not
+ * wrap (pos + len <= end).
+ */
+static void XZ_FUNC dict_copy(uint8_t *buf, size_t end,
+		size_t pos, size_t back, size_t len)
+{
+	size_t n;
+
+	if (back >= pos) {
+		/*
+		 * The source is the oldest data in the circular buffer,
+		 * ahead of pos. A forward byte-by-byte copy from a higher
+		 * to a lower address is what memmove() does.
+		 */
+		n = min(len, end - back);
+		memmove(buf + pos, buf + back, n);
+		len -= n;
+		if (len == 0)
+			return;
+		pos += n;
+		back = 0;
+	}
+
+	n = pos - back;
+	if (n >= len) {
+		memcpy(buf + pos, buf + back, len);
+		return;
+	}
+	if (n == 1) {
+		memset(buf + pos, buf[back], len);
+		return;
+	}
+
+	/*
+	 * Overlapping: repeat the last n bytes. With n >= 8, every 8-byte
+	 * chunk is read only after all of it has been written.
+	 */
+	if (n >= 8) {
+		do {
+			memcpy(buf + pos, buf + back, 8);
+			pos += 8;
+			back += 8;
+			len -= 8;
+		} while (len >= 8);
+	}
+	while (len > 0) {
+		buf[pos++] = buf[back++];
+		--len;
+	}
+}
+#endif
+
 /*
  * Repeat given number of bytes from the given distance. If the distance is
  * invalid, false is returned. On success, true is returned and *len is
@@ -360,11 +417,16 @@ static bool XZ_FUNC dict_repeat(
 	if (dist >= dict->pos)
 		back += dict->end;
 
+#ifdef XZ_DEC_FAST
+	dict_copy(dict->buf, dict->end, dict->pos, back, left);
+	dict->pos += left;
+#else
 	do {
 		dict->buf[dict->pos++] = dict->buf[back++];
 		if (back == dict->end)
 			back = 0;
 	} while (--left > 0);
+#endif
 
 	if (dict->full < dict->pos)
 		dict->full = dict->pos;
@@ -580,78 +642,123 @@ static uint16_t * XZ_FUNC lzma_literal_probs(struct xz_dec_lzma2 *s)
 	return s->lzma.literal[low + high];
 }
 
+/*
+ * Decode a literal which follows a match, using the byte at distance rep0
+ * (the match byte) as additional context.
+ */
+static __always_inline uint32_t XZ_FUNC rc_matched_literal(
+		struct rc_dec *rc, uint16_t *probs, uint32_t match_byte)
+{
+	uint32_t symbol = 1;
+	uint32_t match_bit;
+	uint32_t offset = 0x100;
+	uint32_t i;
+
+	match_byte <<= 1;
+	do {
+		match_bit = match_byte & offset;
+		match_byte <<= 1;
+		i = offset + match_bit + symbol;
+
+		if (rc_bit(rc, &probs[i])) {
+			symbol = (symbol << 1) + 1;
+			offset &= match_bit;
+		} else {
+			symbol <<= 1;
+			offset &= ~match_bit;
+		}
+	} while (symbol < 0x100);
+
+	return symbol;
+}
+
 /* Decode a literal (one 8-bit byte) */
 static void XZ_FUNC lzma_literal(struct xz_dec_lzma2 *s)
 {
 	uint16_t *probs;
 	uint32_t symbol;
-	uint32_t match_byte;
-	uint32_t match_bit;
-	uint32_t offset;
-	uint32_t i;
 
 	probs = lzma_literal_probs(s);
 
-	if (lzma_state_is_literal(s->lzma.state)) {
+	if (lzma_state_is_literal(s->lzma.state))
 		symbol = rc_bittree(&s->rc, probs, 0x100);
-	} else {
-		symbol = 1;
-		match_byte = dict_get(&s->dict, s->lzma.rep0) << 1;
-		offset = 0x100;
-
-		do {
-			match_bit = match_byte & offset;
-			match_byte <<= 1;
-			i = offset + match_bit + symbol;
-
-			if (rc_bit(&s->rc, &probs[i])) {
-				symbol = (symbol << 1) + 1;
-				offset &= match_bit;
-			} else {
-				symbol <<= 1;
-				offset &= ~match_bit;
-			}
-		} while (symbol < 0x100);
-	}
+	else
+		symbol = rc_matched_literal(&s->rc, probs,
+				dict_get(&s->dict, s->lzma.rep0));
 
 	dict_put(&s->dict, (uint8_t)symbol);
 	lzma_state_literal(&s->lzma.state);
 }
 
-/* Decode the length of the match into s->lzma.len. */
-static void XZ_FUNC lzma_len(struct xz_dec_lzma2 *s, struct lzma_len_dec *l,
-		uint32_t pos_state)
+/* Decode the length of a match. */
+static __always_inline uint32_t XZ_FUNC rc_len(struct rc_dec *rc,
+		struct lzma_len_dec *l, uint32_t pos_state)
 {
 	uint16_t *probs;
 	uint32_t limit;
+	uint32_t len;
 
-	if (!rc_bit(&s->rc, &l->choice)) {
+	if (!rc_bit(rc, &l->choice)) {
 		probs = l->low[pos_state];
 		limit = LEN_LOW_SYMBOLS;
-		s->lzma.len = MATCH_LEN_MIN;
+		len = MATCH_LEN_MIN;
 	} else {
-		if (!rc_bit(&s->rc, &l->choice2)) {
+		if (!rc_bit(rc, &l->choice2)) {
 			probs = l->mid[pos_state];
 			limit = LEN_MID_SYMBOLS;
-			s->lzma.len = MATCH_LEN_MIN + LEN_LOW_SYMBOLS;
+			len = MATCH_LEN_MIN + LEN_LOW_SYMBOLS;
 		} else {
 			probs = l->high;
 			limit = LEN_HIGH_SYMBOLS;
-			s->lzma.len = MATCH_LEN_MIN + LEN_LOW_SYMBOLS
+			len = MATCH_LEN_MIN + LEN_LOW_SYMBOLS
 					+ LEN_MID_SYMBOLS;
 		}
 	}
 
-	s->lzma.len += rc_bittree(&s->rc, probs, limit) - limit;
+	return len + rc_bittree(rc, probs, limit) - limit;
 }
 
-/* Decode a match. The distance will be stored in s->lzma.rep0. */
-static void XZ_FUNC lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
+/* Decode the length of the match into s->lzma.len. */
+static void XZ_FUNC lzma_len(struct xz_dec_lzma2 *s, struct lzma_len_dec *l,
+		uint32_t pos_state)
+{
+	s->lzma.len = rc_len(&s->rc, l, pos_state);
+}
+
+/* Decode the distance of a match of length len. */
+static __always_inline uint32_t XZ_FUNC rc_dist(struct rc_dec *rc,
+		struct lzma_dec *lzma, uint32_t len)
 {
 	uint16_t *probs;
 	uint32_t dist_slot;
 	uint32_t limit;
+	uint32_t dist;
+
+	probs = lzma->dist_slot[lzma_get_dist_state(len)];
+	dist_slot = rc_bittree(rc, probs, DIST_SLOTS) - DIST_SLOTS;
+
+	if (dist_slot < DIST_MODEL_START)
+		return dist_slot;
+
+	limit = (dist_slot >> 1) - 1;
+	dist = 2 + (dist_slot & 1);
 
+	if (dist_slot < DIST_MODEL_END) {
+		dist <<= limit;
+		probs = lzma->dist_special + dist - dist_slot - 1;
+		rc_bittree_reverse(rc, probs, &dist, limit);
+	} else {
+		rc_direct(rc, &dist, limit - ALIGN_BITS);
+		dist <<= ALIGN_BITS;
+		rc_bittree_reverse(rc, lzma->dist_align, &dist, ALIGN_BITS);
+	}
+
+	return dist;
+}
+
+/* Decode a match. The distance will be stored in s->lzma.rep0. */
+static void XZ_FUNC lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
+{
 	lzma_state_match(&s->lzma.state);
 
 	s->lzma.rep3 = s->lzma.rep2;
@@ -659,29 +766,7 @@ static void XZ_FUNC lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 	s->lzma.rep1 = s->lzma.rep0;
 
 	lzma_len(s, &s->lzma.match_len_dec, pos_state);
-
-	probs = s->lzma.dist_slot[lzma_get_dist_state(s->lzma.len)];
-	dist_slot = rc_bittree(&s->rc, probs, DIST_SLOTS) - DIST_SLOTS;
-
-	if (dist_slot < DIST_MODEL_START) {
-		s->lzma.rep0 = dist_slot;
-	} else {
-		limit = (dist_slot >> 1) - 1;
-		s->lzma.rep0 = 2 + (dist_slot & 1);
-
-		if (dist_slot < DIST_MODEL_END) {
-			s->lzma.rep0 <<= limit;
-			probs = s->lzma.dist_special + s->lzma.rep0
-					- dist_slot - 1;
-			rc_bittree_reverse(&s->rc, probs,
-					&s->lzma.rep0, limit);
-		} else {
-			rc_direct(&s->rc, &s->lzma.rep0, limit - ALIGN_BITS);
-			s->lzma.rep0 <<= ALIGN_BITS;
-			rc_bittree_reverse(&s->rc, s->lzma.dist_align,
-					&s->lzma.rep0, ALIGN_BITS);
-		}
-	}
+	s->lzma.rep0 = rc_dist(&s->rc, &s->lzma, s->lzma.len);
 }
 
 /*
@@ -721,6 +806,131 @@ static void XZ_FUNC lzma_rep_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 	lzma_len(s, &s->lzma.rep_len_dec, pos_state);
 }
 
+#ifdef XZ_DEC_FAST
+/*
+ * The main loop of lzma_main() for the common case where there is room
+ * for the longest possible match before dict.limit: no match has to be
+ * split across calls and no per-byte limit checks are needed. The range
+ * decoder, the dictionary position and the LZMA state live in local
+ * variables (that is, in registers) until the loop ends. Matches are
+ * copied with dict_copy(). Returns false if the input is corrupt.
+ */
+static bool XZ_FUNC lzma_main_fast(struct xz_dec_lzma2 *s)
+{
+	struct rc_dec rc = s->rc;
+	struct lzma_dec *lzma = &s->lzma;
+	uint8_t *buf = s->dict.buf;
+	size_t pos = s->dict.pos;
+	size_t full = s->dict.full;
+	const size_t end = s->dict.end;
+	const size_t limit = s->dict.limit - MATCH_LEN_MAX;
+	const uint32_t dict_size = s->dict.size;
+	const uint32_t lc = lzma->lc;
+	const uint32_t literal_pos_mask = lzma->literal_pos_mask;
+	const uint32_t pos_mask = lzma->pos_mask;
+	enum lzma_state state = lzma->state;
+	uint32_t rep0 = lzma->rep0;
+	uint32_t rep1 = lzma->rep1;
+	uint32_t rep2 = lzma->rep2;
+	uint32_t rep3 = lzma->rep3;
+	uint32_t pos_state;
+	uint32_t symbol;
+	uint32_t len;
+	uint32_t tmp;
+	uint16_t *probs;
+	size_t back;
+	bool ret = true;
+
+	/* dict.full is updated at the end: until then, max(full, pos) */
+	while (pos <= limit && rc.in_pos <= rc.in_limit) {
+		pos_state = pos & pos_mask;
+
+		if (!rc_bit(&rc, &lzma->is_match[state][pos_state])) {
+			/* The same as lzma_literal_probs() and dict_get() */
+			symbol = 0;
+			if (pos > 0)
+				symbol = buf[pos - 1];
+			else if (full > 0)
+				symbol = buf[end - 1];
+			probs = lzma->literal[(symbol >> (8 - lc))
+					+ ((pos & literal_pos_mask) << lc)];
+
+			if (lzma_state_is_literal(state)) {
+				symbol = rc_bittree(&rc, probs, 0x100);
+			} else {
+				back = pos - rep0 - 1;
+				if (rep0 >= pos)
+					back += end;
+				symbol = rc_matched_literal(&rc, probs,
+						(pos | full) ? buf[back] : 0);
+			}
+
+			buf[pos++] = (uint8_t)symbol;
+			lzma_state_literal(&state);
+			continue;
+		}
+
+		if (!rc_bit(&rc, &lzma->is_rep[state])) {
+			/* lzma_match() */
+			lzma_state_match(&state);
+			rep3 = rep2;
+			rep2 = rep1;
+			rep1 = rep0;
+			len = rc_len(&rc, &lzma->match_len_dec, pos_state);
+			rep0 = rc_dist(&rc, lzma, len);
+		} else {
+			/* lzma_rep_match() */
+			if (!rc_bit(&rc, &lzma->is_rep0[state])) {
+				if (!rc_bit(&rc, &lzma->is_rep0_long[
+						state][pos_state])) {
+					lzma_state_short_rep(&state);
+					len = 1;
+					goto copy;
+				}
+			} else {
+				if (!rc_bit(&rc, &lzma->is_rep1[state])) {
+					tmp = rep1;
+				} else {
+					if (!rc_bit(&rc, &lzma->is_rep2[state])) {
+						tmp = rep2;
+					} else {
+						tmp = rep3;
+						rep3 = rep2;
+					}
+					rep2 = rep1;
+				}
+				rep1 = rep0;
+				rep0 = tmp;
+			}
+			lzma_state_long_rep(&state);
+			len = rc_len(&rc, &lzma->rep_len_dec, pos_state);
+		}
+ copy:
+		/* dict_repeat() */
+		if ((rep0 >= full && rep0 >= pos) || rep0 >= dict_size) {
+			ret = false;
+			break;
+		}
+		back = pos - rep0 - 1;
+		if (rep0 >= pos)
+			back += end;
+		dict_copy(buf, end, pos, back, len);
+		pos += len;
+	}
+
+	s->rc = rc;
+	s->dict.pos = pos;
+	if (s->dict.full < pos)
+		s->dict.full = pos;
+	lzma->state = state;
+	lzma->rep0 = rep0;
+	lzma->rep1 = rep1;
+	lzma->rep2 = rep2;
+	lzma->rep3 = rep3;
+	return ret;
+}
+#endif
+
 /* LZMA decoder core */
 static bool XZ_FUNC lzma_main(struct xz_dec_lzma2 *s)
 {
@@ -733,6 +943,14 @@ static bool XZ_FUNC lzma_main(struct xz_dec_lzma2 *s)
 	if (dict_has_space(&s->dict) && s->lzma.len > 0)
 		dict_repeat(&s->dict, &s->lzma.len, s->lzma.rep0);
 
+#ifdef XZ_DEC_FAST
+	if (s->dict.limit - s->dict.pos >= MATCH_LEN_MAX
+	 && !lzma_main_fast(s)
+	) {
+		return false;
+	}
+#endif
+
 	/*
 	 * Decode more LZMA symbols. One iteration may consume up to
 	 * LZMA_IN_REQUIRED - 1 bytes.
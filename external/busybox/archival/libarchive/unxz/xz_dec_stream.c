@@ -134,6 +134,23 @@ struct xz_dec {
 	struct xz_dec_bcj *bcj;
 	bool bcj_active;
 #endif
+
+#ifdef XZ_DEC_SEEK
+	/*
+	 * Positions in the caller's buffers where the last Block Header
+	 * started, valid if block_seen is true. The caller resets
+	 * block_seen after looking at them.
+	 */
+	bool block_seen;
+	size_t block_in_pos;
+	size_t block_out_pos;
+
+	/*
+	 * True if decoding was started at a Block in the middle of
+	 * the Stream by xz_dec_resume(). The Index can't be validated.
+	 */
+	bool resumed;
+#endif
 };
 
 #ifdef XZ_DEC_ANY_CHECK
@@ -313,7 +330,11 @@ static enum xz_ret XZ_FUNC dec_index(struct xz_dec *s, struct xz_buf *b)
 			 * indicates the same number of Records as
 			 * there were Blocks in the Stream.
 			 */
-			if (s->index.count != s->block.count)
+			if (s->index.count != s->block.count
+#ifdef XZ_DEC_SEEK
+					&& !s->resumed
+#endif
+					)
 				return XZ_DATA_ERROR;
 
 			s->index.sequence = SEQ_INDEX_UNPADDED;
@@ -595,6 +616,12 @@ static enum xz_ret XZ_FUNC dec_main(struct xz_dec *s, struct xz_buf *b)
 				break;
 			}
 
+#ifdef XZ_DEC_SEEK
+			s->block_seen = true;
+			s->block_in_pos = b->in_pos;
+			s->block_out_pos = b->out_pos;
+#endif
+
 			/*
 			 * Calculate the size of the Block Header and
 			 * prepare to decode it.
@@ -682,7 +709,11 @@ static enum xz_ret XZ_FUNC dec_main(struct xz_dec *s, struct xz_buf *b)
 
 			/* Compare the hashes to validate the Index field. */
 			if (!memeq(&s->block.hash, &s->index.hash,
-					sizeof(s->block.hash)))
+					sizeof(s->block.hash))
+#ifdef XZ_DEC_SEEK
+					&& !s->resumed
+#endif
+					)
 				return XZ_DATA_ERROR;
 
 			s->sequence = SEQ_INDEX_CRC32;
@@ -808,7 +839,22 @@ XZ_EXTERN void XZ_FUNC xz_dec_reset(struct xz_dec *s)
 	memzero(&s->index, sizeof(s->index));
 	s->temp.pos = 0;
 	s->temp.size = STREAM_HEADER_SIZE;
+#ifdef XZ_DEC_SEEK
+	s->block_seen = false;
+	s->resumed = false;
+#endif
+}
+
+#ifdef XZ_DEC_SEEK
+XZ_EXTERN void XZ_FUNC xz_dec_resume(struct xz_dec *s,
+		unsigned int check_type)
+{
+	xz_dec_reset(s);
+	s->check_type = check_type;
+	s->sequence = SEQ_BLOCK_START;
+	s->resumed = true;
 }
+#endif
 
 XZ_EXTERN void XZ_FUNC xz_dec_end(struct xz_dec *s)
 {
@@ -620,7 +620,7 @@ static NOINLINE int writeTarFile(int tar_fd, int verboseFlag,
 
 	/* Read the directory/files and iterate over them one at a time */
 	while (include) {
-		if (!recursive_action(include->data, ACTION_RECURSE |
+		if (!recursive_action(include->data, ACTION_RECURSE | ACTION_PARALLEL |
 				(dereferenceFlag ? ACTION_FOLLOWLINKS : 0),
 				writeFileToTarball, writeFileToTarball, &tbInfo, 0)
 		) {
@@ -714,6 +714,123 @@ static char FAST_FUNC get_header_tar_Z(archive_handle_t *archive_handle)
 # define get_header_tar_Z NULL
 #endif
 
+#if ENABLE_FEATURE_TAR_INDEX
+/* tar -z --index IDX: when IDX is created, member start offsets are
+ * recorded in it (by a filter which wraps the real one) while gunzip
+ * child adds checkpoints. Existing IDX is used to decompress only
+ * the regions which hold the requested members */
+static seek_index_t *tar_index;
+static char FAST_FUNC (*tar_index_real_filter)(archive_handle_t *);
+static struct tar_index_region {
+	uint64_t start, len;
+} *tar_index_regions;
+static unsigned tar_index_region_cnt;
+
+static char FAST_FUNC filter_record_member(archive_handle_t *archive_handle)
+{
+	seek_index_add_member(tar_index, archive_handle->tar__member_start,
+			archive_handle->file_header->name);
+	return tar_index_real_filter(archive_handle);
+}
+
+static IF_DESKTOP(long long) int FAST_FUNC unpack_gz_make_index(int src_fd, int dst_fd)
+{
+	return unpack_gz_stream_seek(src_fd, dst_fd, tar_index, 0, (uint64_t)-1);
+}
+
+static IF_DESKTOP(long long) int FAST_FUNC unpack_gz_regions(int src_fd, int dst_fd)
+{
+	unsigned i;
+	char *zeros;
+
+	for (i = 0; i < tar_index_region_cnt; i++) {
+		struct tar_index_region *r = &tar_index_regions[i];
+		if (unpack_gz_stream_seek(src_fd, dst_fd, tar_index, r->start, r->len) < 0)
+			return -1;
+	}
+	/* Two zero blocks: end of archive */
+	zeros = xzalloc(2 * 512);
+	xwrite(dst_fd, zeros, 2 * 512);
+	free(zeros);
+	return 0;
+}
+
+/* Returns 0 if the index can't be used for this extraction */
+static int select_regions(archive_handle_t *archive_handle)
+{
+	unsigned i;
+
+	if (!archive_handle->accept || tar_index->member_cnt == 0
+	 || !seek_index_usable(tar_index, archive_handle->src_fd)
+	) {
+		return 0;
+	}
+	for (i = 0; i < tar_index->member_cnt; i++) {
+		const seek_member_t *m = &tar_index->members[i];
+		uint64_t end = (i + 1 < tar_index->member_cnt)
+				? tar_index->members[i + 1].offset : (uint64_t)-1;
+		struct tar_index_region *r;
+
+		/* Same test as filter_accept_reject_list() */
+		if (find_list_entry2(archive_handle->reject, m->name)
+		 || !find_list_entry2(archive_handle->accept, m->name)
+		) {
+			continue;
+		}
+		if (tar_index_region_cnt) {
+			r = &tar_index_regions[tar_index_region_cnt - 1];
+			if (r->start + r->len == m->offset) {
+				/* Adjacent to previous one */
+				r->len = end - r->start;
+				continue;
+			}
+		}
+		tar_index_regions = xrealloc_vector(tar_index_regions, 4, tar_index_region_cnt);
+		r = &tar_index_regions[tar_index_region_cnt++];
+		r->start = m->offset;
+		r->len = end - m->offset;
+	}
+	return 1;
+}
+
+static char FAST_FUNC get_header_tar_gz_indexed(archive_handle_t *archive_handle)
+{
+	IF_DESKTOP(long long) int FAST_FUNC (*unpacker)(int, int) = unpack_gz_stream;
+
+	/* Can't lseek over pipes */
+	archive_handle->seek = seek_by_read;
+
+	if (xread_char(archive_handle->src_fd) != 0x1f
+	 || xread_char(archive_handle->src_fd) != 0x8b
+	) {
+		bb_error_msg_and_die("invalid gzip magic");
+	}
+
+	if (tar_index->creating) {
+		tar_index_real_filter = archive_handle->filter;
+		archive_handle->filter = filter_record_member;
+		unpacker = unpack_gz_make_index;
+	} else if (select_regions(archive_handle)) {
+		unpacker = unpack_gz_regions;
+	}
+
+	open_transformer(archive_handle->src_fd, unpacker, "gunzip");
+	archive_handle->offset = 0;
+	while (get_header_tar(archive_handle) == EXIT_SUCCESS)
+		continue;
+
+	if (tar_index->creating) {
+		/* Child adds checkpoints, we add members after it */
+		close(archive_handle->src_fd);
+		wait(NULL);
+	}
+	seek_index_close(tar_index);
+
+	/* Can only do one file at a time */
+	return EXIT_FAILURE;
+}
+#endif
+
 #ifdef CHECK_FOR_CHILD_EXITCODE
 /* Looks like it isn't needed - tar detects malformed (truncated)
  * archive if e.g. bunzip2 fails */
@@ -787,6 +904,9 @@ static void handle_SIGCHLD(int status)
 //usage:     "\n	X	File with names to exclude"
 //usage:     "\n	T	File with names to include"
 //usage:	)
+//usage:	IF_FEATURE_TAR_INDEX(
+//usage:     "\n	index IDX	With z: use random access index IDX, create if missing"
+//usage:	)
 //usage:
 //usage:#define tar_example_usage
 //usage:       "$ zcat /tmp/tarball.tar.gz | tar -xf -\n"
@@ -893,6 +1013,9 @@ static const char tar_longopts[] ALIGN1 =
 	/* therefore we have to put it _after_ --no-same-permissions */
 # if ENABLE_FEATURE_TAR_FROM
 	"exclude\0"             Required_argument "\xff"
+# endif
+# if ENABLE_FEATURE_TAR_INDEX
+	"index\0"               Required_argument "\xfa"
 # endif
 	;
 #endif
@@ -909,6 +1032,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 	llist_t *excludes = NULL;
 #endif
+	IF_FEATURE_TAR_INDEX(const char *index_file = NULL;)
 
 	/* Initialise default values */
 	tar_handle = init_handle();
@@ -977,6 +1101,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 		, &excludes // --exclude
 #endif
+		IF_FEATURE_TAR_INDEX(, &index_file) // --index
 		, &verboseFlag // combined count for -t and -v
 		, &verboseFlag // combined count for -t and -v
 		);
@@ -1028,6 +1153,15 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	if (opt & OPT_COMPRESS)
 		get_header_ptr = get_header_tar_Z;
 
+#if ENABLE_FEATURE_TAR_INDEX
+	if (index_file) {
+		if (!(opt & OPT_GZIP) || (opt & OPT_CREATE))
+			bb_error_msg_and_die("--index works only with -tz or -xz");
+		tar_index = seek_index_open(index_file, SEEK_INDEX_GZ);
+		get_header_ptr = get_header_tar_gz_indexed;
+	}
+#endif
+
 	if (opt & OPT_NOPRESERVE_TIME)
 		tar_handle->ah_flags &= ~ARCHIVE_RESTORE_DATE;
 
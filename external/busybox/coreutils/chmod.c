@@ -125,7 +125,7 @@ int chmod_main(int argc UNUSED_PARAM, char **argv)
 	smode = *argv++;
 	do {
 		if (!recursive_action(*argv,
-			OPT_RECURSE,    // recurse
+			OPT_RECURSE | ACTION_PARALLEL, // recurse
 			fileAction,     // file action
 			fileAction,     // dir action
 			smode,          // user data
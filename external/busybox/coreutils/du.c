@@ -86,6 +86,8 @@ struct globals {
 	int slink_depth;
 	int du_depth;
 	dev_t dir_dev;
+	char *path; /* malloced, pathname of the file du() is looking at */
+	unsigned path_size;
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 
@@ -108,13 +110,18 @@ static void print(unsigned long size, const char *filename)
 #endif
 }
 
-/* tiny recursive du */
-static unsigned long du(const char *filename)
+/* tiny recursive du.
+ * G.path[0..name_ofs-1] is the directory part of the pathname,
+ * the file itself is looked up relative to DIR_FD by the rest of it.
+ */
+static unsigned long du(int dir_fd, unsigned name_ofs)
 {
 	struct stat statbuf;
 	unsigned long sum;
+	const char *filename = G.path;
+	const char *name = G.path + name_ofs;
 
-	if (lstat(filename, &statbuf) != 0) {
+	if (fstatat(dir_fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
 		bb_simple_perror_msg(filename);
 		G.status = EXIT_FAILURE;
 		return 0;
@@ -132,7 +139,7 @@ static unsigned long du(const char *filename)
 
 	if (S_ISLNK(statbuf.st_mode)) {
 		if (G.slink_depth > G.du_depth) { /* -H or -L */
-			if (stat(filename, &statbuf) != 0) {
+			if (fstatat(dir_fd, name, &statbuf, 0) != 0) {
 				bb_simple_perror_msg(filename);
 				G.status = EXIT_FAILURE;
 				return 0;
@@ -156,26 +163,49 @@ static unsigned long du(const char *filename)
 	}
 
 	if (S_ISDIR(statbuf.st_mode)) {
-		DIR *dir;
-		struct dirent *entry;
-		char *newfile;
+		struct bb_dirent *ents, *d, *end;
+		size_t size;
+		unsigned len, sub_ofs;
+		int fd;
 
-		dir = warn_opendir(filename);
-		if (!dir) {
+		/* Read the whole dir at once, then stat entries relative to it:
+		 * no readdir() per entry, no lookup of the full path per stat */
+		ents = NULL;
+		fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+		if (fd >= 0)
+			ents = xmalloc_read_dirents(fd, &size);
+		if (!ents) {
+			bb_perror_msg("can't open '%s'", filename);
+			if (fd >= 0)
+				close(fd);
 			G.status = EXIT_FAILURE;
 			return sum;
 		}
 
-		while ((entry = readdir(dir))) {
-			newfile = concat_subpath_file(filename, entry->d_name);
-			if (newfile == NULL)
+		len = strlen(G.path);
+		sub_ofs = len + !last_char_is(G.path, '/');
+		end = (struct bb_dirent *)((char*)ents + size);
+		for (d = ents; d < end; d = bb_next_dirent(d)) {
+			unsigned need;
+
+			if (DOT_OR_DOTDOT(d->d_name))
 				continue;
+			/* G.path = "filename/d_name" */
+			need = sub_ofs + strlen(d->d_name) + 1;
+			if (G.path_size < need) {
+				G.path_size = need + 256;
+				G.path = xrealloc(G.path, G.path_size);
+			}
+			G.path[len] = '/';
+			strcpy(G.path + sub_ofs, d->d_name);
 			++G.du_depth;
-			sum += du(newfile);
+			sum += du(fd, sub_ofs);
 			--G.du_depth;
-			free(newfile);
 		}
-		closedir(dir);
+		G.path[len] = '\0';
+		filename = G.path;
+		free(ents);
+		close(fd);
 	} else {
 		if (!(option_mask32 & OPT_a_files_too) && G.du_depth != 0)
 			return sum;
@@ -254,7 +284,10 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 	slink_depth_save = G.slink_depth;
 	total = 0;
 	do {
-		total += du(*argv);
+		G.path_size = strlen(*argv) + 1;
+		G.path = xstrdup(*argv);
+		total += du(AT_FDCWD, 0);
+		free(G.path);
 		/* otherwise du /dir /dir won't show /dir twice: */
 		reset_ino_dev_hashtable();
 		G.slink_depth = slink_depth_save;
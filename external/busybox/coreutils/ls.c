@@ -309,7 +309,6 @@ struct dnode {
 	const char *fullname;   /* full name (usable for stat etc) */
 	struct dnode *dn_next;  /* for linked list */
 	IF_SELINUX(security_context_t sid;)
-	smallint fname_allocated;
 
 	/* Used to avoid re-doing [l]stat at printout stage
 	 * if we already collected needed data in scan stage:
@@ -723,39 +722,33 @@ static void display_files(struct dnode **dn, unsigned nfiles)
 
 /*** Dir scanning code ***/
 
-static struct dnode *my_stat(const char *fullname, const char *name, int force_follow)
+/* [l]stat NAME relative to DIR_FD into CUR. Returns 0 on error */
+static int dn_stat(struct dnode *cur, int dir_fd, const char *name, int force_follow)
 {
 	struct stat statbuf;
-	struct dnode *cur;
-
-	cur = xzalloc(sizeof(*cur));
-	cur->fullname = fullname;
-	cur->name = name;
 
 	if ((option_mask32 & OPT_L) || force_follow) {
 #if ENABLE_SELINUX
 		if (is_selinux_enabled())  {
-			 getfilecon(fullname, &cur->sid);
+			 getfilecon(cur->fullname, &cur->sid);
 		}
 #endif
-		if (stat(fullname, &statbuf)) {
-			bb_simple_perror_msg(fullname);
+		if (fstatat(dir_fd, name, &statbuf, 0)) {
+			bb_simple_perror_msg(cur->fullname);
 			G.exit_code = EXIT_FAILURE;
-			free(cur);
-			return NULL;
+			return 0;
 		}
 		cur->dn_mode_stat = statbuf.st_mode;
 	} else {
 #if ENABLE_SELINUX
 		if (is_selinux_enabled()) {
-			lgetfilecon(fullname, &cur->sid);
+			lgetfilecon(cur->fullname, &cur->sid);
 		}
 #endif
-		if (lstat(fullname, &statbuf)) {
-			bb_simple_perror_msg(fullname);
+		if (fstatat(dir_fd, name, &statbuf, AT_SYMLINK_NOFOLLOW)) {
+			bb_simple_perror_msg(cur->fullname);
 			G.exit_code = EXIT_FAILURE;
-			free(cur);
-			return NULL;
+			return 0;
 		}
 		cur->dn_mode_lstat = statbuf.st_mode;
 	}
@@ -776,6 +769,20 @@ static struct dnode *my_stat(const char *fullname, const char *name, int force_f
 	cur->dn_rdev_maj = major(statbuf.st_rdev);
 	cur->dn_rdev_min = minor(statbuf.st_rdev);
 
+	return 1;
+}
+
+static struct dnode *my_stat(const char *fullname, const char *name, int force_follow)
+{
+	struct dnode *cur;
+
+	cur = xzalloc(sizeof(*cur));
+	cur->fullname = fullname;
+	cur->name = name;
+	if (!dn_stat(cur, AT_FDCWD, fullname, force_follow)) {
+		free(cur);
+		return NULL;
+	}
 	return cur;
 }
 
@@ -824,12 +831,8 @@ static void dfree(struct dnode **dnp)
 	if (dnp == NULL)
 		return;
 
-	for (i = 0; dnp[i]; i++) {
-		struct dnode *cur = dnp[i];
-		if (cur->fname_allocated)
-			free((char*)cur->fullname);
-		free(cur);
-	}
+	for (i = 0; dnp[i]; i++)
+		free(dnp[i]);
 	free(dnp);
 }
 #else
@@ -944,63 +947,115 @@ static void sort_and_display_files(struct dnode **dn, unsigned nfiles)
 # define sort_and_display_files(dn, nfiles) display_files(dn, nfiles)
 #endif
 
-/* Returns NULL-terminated malloced vector of pointers (or NULL) */
+/* Does plain listing need more than names and types (which
+ * getdents gives us for free) of the files? */
+static int need_stat(void)
+{
+	unsigned sort_opts = G.all_fmt & SORT_MASK;
+
+	return (G.all_fmt & (LIST_MASK & ~LIST_FILETYPE))
+		|| (G.all_fmt & STYLE_MASK) == STYLE_LONG
+		|| (sort_opts >= SORT_SIZE && sort_opts <= SORT_MTIME)
+		|| G_show_color;
+}
+
+/* Returns NULL-terminated malloced vector of pointers (or NULL).
+ * The dnodes and their names are in the same malloced block,
+ * free(vector) frees them all.
+ */
 static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 {
-	struct dnode *dn, *cur, **dnp;
-	struct dirent *entry;
-	DIR *dir;
-	unsigned i, nfiles;
+	struct dnode *dn, **dnp;
+	struct bb_dirent *ents, *d, *end;
+	size_t size, vecsize;
+	char *p;
+	int fd, slash, stat_all;
+	unsigned i, nfiles, namesize, pathlen;
 
 	*nfiles_p = 0;
-	dir = warn_opendir(path);
-	if (dir == NULL) {
+	ents = NULL;
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+		ents = xmalloc_read_dirents(fd, &size);
+	if (!ents) {
+		bb_perror_msg("can't open '%s'", path);
+		if (fd >= 0)
+			close(fd);
 		G.exit_code = EXIT_FAILURE;
 		return NULL;	/* could not open the dir */
 	}
-	dn = NULL;
-	nfiles = 0;
-	while ((entry = readdir(dir)) != NULL) {
-		char *fullname;
+	end = (struct bb_dirent *)((char*)ents + size);
 
+	/* count the files we are going to list, and size their full names */
+	pathlen = strlen(path);
+	slash = !last_char_is(path, '/');
+	dnp = NULL;
+	nfiles = 0;
+	namesize = 0;
+	for (d = ents; d < end; d = bb_next_dirent(d)) {
 		/* are we going to list the file- it may be . or .. or a hidden file */
-		if (entry->d_name[0] == '.') {
-			if ((!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2]))
+		if (d->d_name[0] == '.') {
+			if ((!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2]))
 			 && !(G.all_fmt & DISP_DOT)
 			) {
+				d->d_name[0] = '\0'; /* skip it below */
 				continue;
 			}
-			if (!(G.all_fmt & DISP_HIDDEN))
+			if (!(G.all_fmt & DISP_HIDDEN)) {
+				d->d_name[0] = '\0';
 				continue;
+			}
 		}
-		fullname = concat_path_file(path, entry->d_name);
-		cur = my_stat(fullname, bb_basename(fullname), 0);
-		if (!cur) {
-			free(fullname);
-			continue;
-		}
-		cur->fname_allocated = 1;
-		cur->dn_next = dn;
-		dn = cur;
+		namesize += pathlen + slash + strlen(d->d_name) + 1;
 		nfiles++;
 	}
-	closedir(dir);
+	if (nfiles == 0)
+		goto ret;
 
-	if (dn == NULL)
-		return NULL;
+	/* One block: vector of pointers, dnodes, names */
+	vecsize = ((nfiles + 1) * sizeof(dnp[0]) + 7) & ~(size_t)7;
+	dnp = xmalloc(vecsize + nfiles * sizeof(dn[0]) + namesize);
+	dn = (struct dnode *)((char*)dnp + vecsize);
+	p = (char*)(dn + nfiles);
 
-	/* now that we know how many files there are
-	 * allocate memory for an array to hold dnode pointers
-	 */
-	*nfiles_p = nfiles;
-	dnp = dnalloc(nfiles);
-	for (i = 0; /* i < nfiles - detected via !dn below */; i++) {
-		dnp[i] = dn;	/* save pointer to node in array */
-		dn = dn->dn_next;
-		if (!dn)
-			break;
-	}
+	stat_all = need_stat();
+	i = 0;
+	for (d = ents; d < end; d = bb_next_dirent(d)) {
+		struct dnode *cur;
 
+		if (!d->d_name[0])
+			continue;
+		cur = &dn[i];
+		memset(cur, 0, sizeof(*cur));
+		cur->fullname = p;
+		memcpy(p, path, pathlen);
+		p += pathlen;
+		if (slash)
+			*p++ = '/';
+		cur->name = p;
+		p = stpcpy(p, d->d_name) + 1;
+
+		if (stat_all
+		 || d->d_type == DT_UNKNOWN
+		 || (d->d_type == DT_LNK && (option_mask32 & OPT_L))
+		) {
+			if (!dn_stat(cur, fd, cur->name, 0))
+				continue;
+		} else {
+			cur->dn_mode = DTTOIF(d->d_type);
+			cur->dn_ino = d->d_ino;
+		}
+		dnp[i++] = cur;
+	}
+	dnp[i] = NULL;
+	if (i == 0) {
+		free(dnp);
+		dnp = NULL;
+	}
+	*nfiles_p = i;
+ ret:
+	free(ents);
+	close(fd);
 	return dnp;
 }
 
@@ -1070,7 +1125,7 @@ static void scan_and_display_dirs_recur(struct dnode **dn, int first)
 				}
 			}
 			/* free the dnodes and the fullname mem */
-			dfree(subdnp);
+			free(subdnp);
 		}
 	}
 }
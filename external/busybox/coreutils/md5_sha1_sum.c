@@ -7,13 +7,16 @@
  */
 
 //usage:#define md5sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]"IF_FEATURE_MD5_SHA1_SUM_PARALLEL(" -P N")"] ")"[FILE]..."
 //usage:#define md5sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " MD5 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-P N	Check N files at a time"
+//usage:	)
 //usage:	)
 //usage:
 //usage:#define md5sum_example_usage
@@ -27,33 +30,42 @@
 //usage:       "^D\n"
 //usage:
 //usage:#define sha1sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]"IF_FEATURE_MD5_SHA1_SUM_PARALLEL(" -P N")"] ")"[FILE]..."
 //usage:#define sha1sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA1 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-P N	Check N files at a time"
+//usage:	)
 //usage:	)
 //usage:
 //usage:#define sha256sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]"IF_FEATURE_MD5_SHA1_SUM_PARALLEL(" -P N")"] ")"[FILE]..."
 //usage:#define sha256sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA256 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-P N	Check N files at a time"
+//usage:	)
 //usage:	)
 //usage:
 //usage:#define sha512sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]"IF_FEATURE_MD5_SHA1_SUM_PARALLEL(" -P N")"] ")"[FILE]..."
 //usage:#define sha512sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA512 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-P N	Check N files at a time"
+//usage:	)
 //usage:	)
 
 #include "libbb.h"
@@ -72,6 +84,8 @@ enum {
 #define FLAG_CHECK   2
 #define FLAG_WARN    4
 
+#define HASH_BUFSIZE (64 * 1024)
+
 /* This might be useful elsewhere */
 static unsigned char *hash_bin_to_hex(unsigned char *hash_value,
 				unsigned hash_length)
@@ -129,8 +143,8 @@ static uint8_t *hash_file(const char *filename)
 	}
 
 	{
-		RESERVE_CONFIG_UBUFFER(in_buf, 4096);
-		while ((count = safe_read(src_fd, in_buf, 4096)) > 0) {
+		RESERVE_CONFIG_UBUFFER(in_buf, HASH_BUFSIZE);
+		while ((count = safe_read(src_fd, in_buf, HASH_BUFSIZE)) > 0) {
 			update(&context, in_buf, count);
 		}
 		hash_value = NULL;
@@ -148,15 +162,110 @@ static uint8_t *hash_file(const char *filename)
 	return hash_value;
 }
 
+/* Split "HASH  FILENAME" line. Returns filename, or NULL on bad format */
+static char *split_check_line(char *line)
+{
+	char *filename_ptr;
+
+	filename_ptr = strstr(line, "  ");
+	/* handle format for binary checksums */
+	if (filename_ptr == NULL) {
+		filename_ptr = strstr(line, " *");
+	}
+	if (filename_ptr == NULL) {
+		return NULL;
+	}
+	*filename_ptr = '\0';
+	return filename_ptr + 2;
+}
+
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* -c -P N: hash the files listed in lines[] in N worker processes.
+ * Worker k handles lines k, k+N, k+2N... and reports one result byte
+ * per line through its pipe; we read them back round-robin, so
+ * the output comes out in input order.
+ */
+static int check_parallel(char **lines, unsigned cnt, unsigned jobs, unsigned flags)
+{
+	int *fds;
+	unsigned i;
+	int count_failed = 0;
+
+	if (jobs > cnt)
+		jobs = cnt;
+	fds = xmalloc(jobs * sizeof(fds[0]));
+	for (i = 0; i < jobs; i++) {
+		int pipefd[2];
+
+		xpipe(pipefd);
+		if (xfork() == 0) {
+			/* child */
+			unsigned k;
+
+			close(pipefd[0]);
+			for (k = i; k < cnt; k += jobs) {
+				char *filename = split_check_line(lines[k]);
+				char res = 'X'; /* bad format */
+				if (filename) {
+					uint8_t *hash_value = hash_file(filename);
+					res = (hash_value && strcmp((char*)hash_value, lines[k]) == 0)
+						? 'Y' : 'N';
+					free(hash_value);
+				}
+				xwrite(pipefd[1], &res, 1);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+		close(pipefd[1]);
+		fds[i] = pipefd[0];
+	}
+
+	for (i = 0; i < cnt; i++) {
+		char res;
+		const char *filename;
+
+		if (safe_read(fds[i % jobs], &res, 1) != 1)
+			res = 'N'; /* worker died */
+		if (res == 'X') {
+			if (flags & FLAG_WARN) {
+				bb_error_msg("invalid format");
+			}
+			count_failed++;
+			continue;
+		}
+		/* worker split its copy of the line, do it for ours */
+		filename = split_check_line(lines[i]);
+		if (res == 'Y') {
+			if (!(flags & FLAG_SILENT))
+				printf("%s: OK\n", filename);
+		} else {
+			if (!(flags & FLAG_SILENT))
+				printf("%s: FAILED\n", filename);
+			count_failed++;
+		}
+	}
+
+	for (i = 0; i < jobs; i++) {
+		close(fds[i]);
+	}
+	while (wait(NULL) > 0)
+		continue;
+	free(fds);
+	return count_failed;
+}
+#endif
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
 	int return_value = EXIT_SUCCESS;
 	unsigned flags;
+	unsigned jobs = 1;
 
 	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK) {
 		/* -b "binary", -t "text" are ignored (shaNNNsum compat) */
-		flags = getopt32(argv, "scwbt");
+		IF_FEATURE_MD5_SHA1_SUM_PARALLEL(opt_complementary = "P+";)
+		flags = getopt32(argv, "scwbt" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("P:"), &jobs);
 		argv += optind;
 		//argc -= optind;
 	} else {
@@ -184,16 +293,31 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 
 			pre_computed_stream = xfopen_stdin(*argv);
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+			if (jobs > 1) {
+				char **lines = NULL;
+				int i;
+
+				/* Read the whole list, the loop below will see EOF */
+				while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
+					lines = xrealloc_vector(lines, 6, count_total);
+					lines[count_total++] = line;
+				}
+				if (count_total)
+					count_failed = check_parallel(lines, count_total, jobs, flags);
+				if (count_failed)
+					return_value = EXIT_FAILURE;
+				for (i = 0; i < count_total; i++)
+					free(lines[i]);
+				free(lines);
+			}
+#endif
 			while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
 				uint8_t *hash_value;
 				char *filename_ptr;
 
 				count_total++;
-				filename_ptr = strstr(line, "  ");
-				/* handle format for binary checksums */
-				if (filename_ptr == NULL) {
-					filename_ptr = strstr(line, " *");
-				}
+				filename_ptr = split_check_line(line);
 				if (filename_ptr == NULL) {
 					if (flags & FLAG_WARN) {
 						bb_error_msg("invalid format");
@@ -203,8 +327,6 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 					free(line);
 					continue;
 				}
-				*filename_ptr = '\0';
-				filename_ptr += 2;
 
 				hash_value = hash_file(filename_ptr);
 
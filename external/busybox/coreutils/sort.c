@@ -41,7 +41,15 @@
 //usage:     "\n	-u	Suppress duplicate lines"
 //usage:	IF_FEATURE_SORT_BIG(
 //usage:     "\n	-z	Lines are terminated by NUL, not newline"
-//usage:     "\n	-mST	Ignored for GNU compatibility")
+//usage:	IF_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-S SIZE	Memory to use (b,K,M,G or % of RAM), then sort via temp files"
+//usage:     "\n	-T DIR	Directory for temp files (default $TMPDIR or /tmp)"
+//usage:     "\n	-m	Ignored for GNU compatibility"
+//usage:	)
+//usage:	IF_NOT_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-mST	Ignored for GNU compatibility"
+//usage:	)
+//usage:	)
 //usage:
 //usage:#define sort_example_usage
 //usage:       "$ echo -e \"e\\nf\\nb\\nd\\nc\\na\" | sort\n"
@@ -60,6 +68,10 @@
 //usage:       ""
 
 #include "libbb.h"
+#if ENABLE_FEATURE_SORT_EXTERNAL
+# include <pthread.h>
+# include <sys/sysinfo.h>
+#endif
 
 /* This is a NOEXEC applet. Be very careful! */
 
@@ -87,8 +99,8 @@ enum {
 	FLAG_f  = 0x400,        /* Force uppercase */
 	FLAG_i  = 0x800,        /* Ignore !isprint() */
 	FLAG_m  = 0x1000,       /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 0x2000,       /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 0x4000,       /* ignored: -T, --temporary-directory=DIR */
+	FLAG_S  = 0x2000,       /* -S, --buffer-size=SIZE (ignored without FEATURE_SORT_EXTERNAL) */
+	FLAG_T  = 0x4000,       /* -T, --temporary-directory=DIR (ditto) */
 	FLAG_o  = 0x8000,
 	FLAG_k  = 0x10000,
 	FLAG_t  = 0x20000,
@@ -104,17 +116,23 @@ static struct sort_key {
 	unsigned flags;
 } *key_list;
 
+/* Number of keys cached with each line, 0 if all keys are whole lines */
+static unsigned cached_keys;
+
+static int key_is_whole_line(struct sort_key *key, int flags)
+{
+	return key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
+		&& !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb));
+}
+
 static char *get_key(char *str, struct sort_key *key, int flags)
 {
 	int start = 0, end = 0, len, j;
 	unsigned i;
 
 	/* Special case whole string, so we don't have to make a copy */
-	if (key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
-	 && !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb))
-	) {
+	if (key_is_whole_line(key, flags))
 		return str;
-	}
 
 	/* Find start of key on first pass, end on second pass */
 	len = strlen(str);
@@ -203,26 +221,83 @@ static struct sort_key *add_key(void)
 #define GET_LINE(fp) xmalloc_fgetline(fp)
 #endif
 
-/* Iterate through keys list and perform comparisons */
-static int compare_keys(const void *xarg, const void *yarg)
+#if ENABLE_FEATURE_SORT_BIG
+/* Unless all keys are whole lines, keys are extracted when a line is
+ * read, not twice per comparison. They are in the same memory block
+ * as the line, pointers to them just before its text */
+#define LINE_KEY(line, i) (((char **)(line))[-1 - (int)(i)])
+
+static char **new_keys;
+
+/* Takes ownership of TEXT */
+static char *new_line(char *text)
+{
+	struct sort_key *key;
+	char **block, *line, *p;
+	size_t size, len;
+	unsigned i;
+
+	if (!cached_keys)
+		return text;
+	len = strlen(text) + 1;
+	size = cached_keys * sizeof(block[0]) + len;
+	for (key = key_list, i = 0; i < cached_keys; key = key->next_key, i++) {
+		new_keys[i] = get_key(text, key, key->flags ? key->flags : option_mask32);
+		if (new_keys[i] != text)
+			size += strlen(new_keys[i]) + 1;
+	}
+	block = xmalloc(size);
+	line = memcpy(block + cached_keys, text, len);
+	p = line + len;
+	for (i = 0; i < cached_keys; i++) {
+		LINE_KEY(line, i) = line;
+		if (new_keys[i] != text) {
+			len = strlen(new_keys[i]) + 1;
+			LINE_KEY(line, i) = memcpy(p, new_keys[i], len);
+			p += len;
+			free(new_keys[i]);
+		}
+	}
+	free(text);
+	return line;
+}
+
+static void free_line(char *line)
+{
+	free(cached_keys ? (char *)&LINE_KEY(line, cached_keys - 1) : line);
+}
+#else
+#define new_line(text) (text)
+#define free_line(line) free(line)
+#endif
+
+/* Iterate through keys list and perform comparisons.
+ * OPTS is option_mask32, possibly with FLAG_s added */
+static int compare_lines(char *xline, char *yline, unsigned opts)
 {
-	int flags = option_mask32, retval = 0;
+	int flags = opts, retval = 0;
 	char *x, *y;
 
 #if ENABLE_FEATURE_SORT_BIG
 	struct sort_key *key;
+	unsigned i;
 
-	for (key = key_list; !retval && key; key = key->next_key) {
-		flags = key->flags ? key->flags : option_mask32;
-		/* Chop out and modify key chunks, handling -dfib */
-		x = get_key(*(char **)xarg, key, flags);
-		y = get_key(*(char **)yarg, key, flags);
+	for (key = key_list, i = 0; !retval && key; key = key->next_key, i++) {
+		flags = key->flags ? key->flags : opts;
+		if (cached_keys) {
+			x = LINE_KEY(xline, i);
+			y = LINE_KEY(yline, i);
+		} else {
+			/* Chop out and modify key chunks, handling -dfib */
+			x = get_key(xline, key, flags);
+			y = get_key(yline, key, flags);
+		}
 #else
 	/* This curly bracket serves no purpose but to match the nesting
 	   level of the for () loop we're not using */
 	{
-		x = *(char **)xarg;
-		y = *(char **)yarg;
+		x = xline;
+		y = yline;
 #endif
 		/* Perform actual comparison */
 		switch (flags & 7) {
@@ -289,8 +364,10 @@ static int compare_keys(const void *xarg, const void *yarg)
 		}
 		} /* switch */
 		/* Free key copies. */
-		if (x != *(char **)xarg) free(x);
-		if (y != *(char **)yarg) free(y);
+		if (!cached_keys) {
+			if (x != xline) free(x);
+			if (y != yline) free(y);
+		}
 		/* if (retval) break; - done by for () anyway */
 #else
 		/* Integer version of -n for tiny systems */
@@ -302,13 +379,18 @@ static int compare_keys(const void *xarg, const void *yarg)
 	} /* for */
 
 	/* Perform fallback sort if necessary */
-	if (!retval && !(option_mask32 & FLAG_s))
-		retval = strcmp(*(char **)xarg, *(char **)yarg);
+	if (!retval && !(opts & FLAG_s))
+		retval = strcmp(xline, yline);
 
 	if (flags & FLAG_r) return -retval;
 	return retval;
 }
 
+static int compare_keys(const void *xarg, const void *yarg)
+{
+	return compare_lines(*(char **)xarg, *(char **)yarg, option_mask32);
+}
+
 #if ENABLE_FEATURE_SORT_BIG
 static unsigned str2u(char **str)
 {
@@ -322,15 +404,400 @@ static unsigned str2u(char **str)
 }
 #endif
 
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* Lines are read until they take more memory than -S allows. Then they
+ * are sorted, by several threads, and written to a temporary file
+ * (a "run"). At the end, the runs and the lines still in memory are
+ * merged using a loser tree: a tournament tree where each node keeps
+ * the loser of the match played there, so that after the winner's line
+ * is taken, only the path from its leaf to the root is replayed.
+ */
+enum {
+	SORT_MAX_JOBS = 8,
+	/* Don't start a thread for fewer lines than this */
+	SORT_MIN_CHUNK = 16 * 1024,
+	/* Each run holds an fd; when there are this many, they are merged
+	 * into one */
+	SORT_MAX_RUNS = 64,
+	/* For -S accounting */
+	SORT_MALLOC_OVERHEAD = 2 * sizeof(size_t),
+	SORT_MIN_MEM = 64 * 1024,
+};
+
+static const struct suffix_mult sort_suffixes[] = {
+	{ "b", 1 },
+	{ "k", 1024 },
+	{ "K", 1024 },
+	{ "M", 1024*1024 },
+	{ "G", 1024*1024*1024 },
+	{ "", 0 }
+};
+
+static unsigned sort_jobs;
+static const char *tmp_dir;
+static FILE **runs;
+static unsigned run_cnt;
+
+/* Memory LINE takes, as far as -S is concerned */
+static size_t line_size(char *line)
+{
+	size_t size;
+	unsigned i;
+
+	size = (1 + cached_keys) * sizeof(line) + strlen(line) + 1 + SORT_MALLOC_OVERHEAD;
+	for (i = 0; i < cached_keys; i++)
+		if (LINE_KEY(line, i) != line)
+			size += strlen(LINE_KEY(line, i)) + 1;
+	return size;
+}
+
+/* Stable: of equal lines, ones from A come first */
+static void merge_lines(char **dst,
+		char **a, size_t na,
+		char **b, size_t nb)
+{
+	while (na && nb) {
+		if (compare_lines(*b, *a, option_mask32) < 0) {
+			*dst++ = *b++;
+			nb--;
+		} else {
+			*dst++ = *a++;
+			na--;
+		}
+	}
+	memcpy(dst, a, na * sizeof(a[0]));
+	memcpy(dst + na, b, nb * sizeof(b[0]));
+}
+
+/* Stable merge sort. TMP has room for N lines */
+static void merge_sort(char **v, char **tmp, size_t n)
+{
+	size_t half;
+
+	if (n < 8) {
+		size_t i, j;
+
+		for (i = 1; i < n; i++) {
+			char *line = v[i];
+			for (j = i; j && compare_lines(v[j - 1], line, option_mask32) > 0; j--)
+				v[j] = v[j - 1];
+			v[j] = line;
+		}
+		return;
+	}
+	half = n / 2;
+	merge_sort(v, tmp, half);
+	merge_sort(v + half, tmp, n - half);
+	/* Already in order? Often true for partly sorted input */
+	if (compare_lines(v[half - 1], v[half], option_mask32) <= 0)
+		return;
+	merge_lines(tmp, v, half, v + half, n - half);
+	memcpy(v, tmp, n * sizeof(v[0]));
+}
+
+struct sort_chunk {
+	char **v;
+	char **tmp;
+	size_t n;
+	size_t na;  /* if merging: v[0..na) and v[na..n) to tmp */
+	pthread_t tid;
+	smallint merge;
+	smallint started;
+};
+
+static void *sort_chunk(void *arg)
+{
+	struct sort_chunk *c = arg;
+
+	if (c->merge)
+		merge_lines(c->tmp, c->v, c->na, c->v + c->na, c->n - c->na);
+	else
+		merge_sort(c->v, c->tmp, c->n);
+	return NULL;
+}
+
+/* Does CNT chunks, first one in this thread */
+static void sort_chunks(struct sort_chunk *c, unsigned cnt)
+{
+	unsigned i;
+
+	for (i = 1; i < cnt; i++)
+		c[i].started = (pthread_create(&c[i].tid, NULL, sort_chunk, &c[i]) == 0);
+	sort_chunk(&c[0]);
+	for (i = 1; i < cnt; i++) {
+		if (c[i].started)
+			pthread_join(c[i].tid, NULL);
+		else
+			sort_chunk(&c[i]);
+	}
+}
+
+/* Each thread sorts a chunk, then neighbouring chunks are merged
+ * pairwise, also in parallel, until one is left */
+static void sort_lines(char **v, size_t n)
+{
+	struct sort_chunk c[SORT_MAX_JOBS];
+	size_t bound[SORT_MAX_JOBS + 1];
+	char **tmp, **src, **dst;
+	unsigned jobs, i, cnt;
+
+	if (n < 2)
+		return;
+	tmp = xmalloc(n * sizeof(tmp[0]));
+	jobs = MIN(sort_jobs, n / SORT_MIN_CHUNK);
+	if (jobs <= 1) {
+		merge_sort(v, tmp, n);
+		free(tmp);
+		return;
+	}
+
+	memset(c, 0, sizeof(c));
+	for (i = 0; i <= jobs; i++)
+		bound[i] = n / jobs * i;
+	bound[jobs] = n;
+	for (i = 0; i < jobs; i++) {
+		c[i].v = v + bound[i];
+		c[i].tmp = tmp + bound[i];
+		c[i].n = bound[i + 1] - bound[i];
+	}
+	sort_chunks(c, jobs);
+
+	src = v;
+	dst = tmp;
+	while (jobs > 1) {
+		char **t;
+
+		cnt = 0;
+		for (i = 0; i < jobs; i += 2) {
+			c[cnt].v = src + bound[i];
+			c[cnt].tmp = dst + bound[i];
+			c[cnt].na = bound[i + 1] - bound[i];
+			c[cnt].n = bound[i + 2 <= jobs ? i + 2 : i + 1] - bound[i];
+			c[cnt].merge = 1;
+			bound[cnt++] = bound[i];
+		}
+		bound[cnt] = n;
+		sort_chunks(c, cnt);
+		jobs = cnt;
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != v)
+		memcpy(v, src, n * sizeof(v[0]));
+	free(tmp);
+}
+
+static void write_line(FILE *fp, const char *line)
+{
+	fputs(line, fp);
+	putc((option_mask32 & FLAG_z) ? '\0' : '\n', fp);
+}
+
+struct merge_src {
+	FILE *fp;               /* NULL: lines are in memory */
+	char **v;
+	size_t n;
+	char *cur;  /* NULL: no more lines */
+};
+
+static void merge_next(struct merge_src *src)
+{
+	src->cur = NULL;
+	if (src->fp) {
+		char *text = GET_LINE(src->fp);
+		if (text) {
+			src->cur = new_line(text);
+			return;
+		}
+		if (ferror(src->fp))
+			bb_perror_msg_and_die(bb_msg_read_error);
+		fclose(src->fp);
+		src->fp = NULL;
+	} else if (src->n) {
+		src->n--;
+		src->cur = *src->v++;
+	}
+}
+
+/* Does line of source A go before line of source B? */
+static int merge_beats(const struct merge_src *src, unsigned a, unsigned b)
+{
+	int r;
+
+	if (!src[a].cur)
+		return 0;
+	if (!src[b].cur)
+		return 1;
+	r = compare_lines(src[a].cur, src[b].cur, option_mask32);
+	return r < 0 || (r == 0 && a < b);
+}
+
+/* Leaves are nodes k..2k-1, node i has children 2i and 2i+1.
+ * Returns the winner of the subtree at NODE */
+static unsigned loser_tree_init(const struct merge_src *src, unsigned *tree,
+		unsigned k, unsigned node)
+{
+	unsigned a, b;
+
+	if (node >= k)
+		return node - k;
+	a = loser_tree_init(src, tree, k, 2 * node);
+	b = loser_tree_init(src, tree, k, 2 * node + 1);
+	if (merge_beats(src, a, b)) {
+		tree[node] = b;
+		return a;
+	}
+	tree[node] = a;
+	return b;
+}
+
+/* Merges K sources to OUT, frees the lines read from files
+ * (lines in memory are left to the caller).
+ * If UNIQUE, only the first of lines with equal keys is written */
+static void merge(struct merge_src *src, unsigned k, FILE *out, int unique)
+{
+	char *prev = NULL;
+	smallint prev_from_file = 0;
+	unsigned *tree;
+	unsigned i, w;
+
+	tree = xmalloc(k * sizeof(tree[0]));
+	for (i = 0; i < k; i++)
+		merge_next(&src[i]);
+	tree[0] = loser_tree_init(src, tree, k, 1);
+
+	while (src[w = tree[0]].cur) {
+		char *line = src[w].cur;
+
+		if (unique && prev && compare_lines(prev, line, option_mask32 | FLAG_s) == 0) {
+			if (src[w].fp)
+				free_line(line);
+		} else {
+			write_line(out, line);
+			if (prev_from_file)
+				free_line(prev);
+			prev = line;
+			prev_from_file = (src[w].fp != NULL);
+		}
+		merge_next(&src[w]);
+		for (i = (w + k) / 2; i; i /= 2) {
+			if (merge_beats(src, tree[i], w)) {
+				unsigned t = tree[i];
+				tree[i] = w;
+				w = t;
+			}
+		}
+		tree[0] = w;
+	}
+	if (prev_from_file)
+		free_line(prev);
+	free(tree);
+	if (fflush(out) != 0 || ferror(out))
+		bb_perror_msg_and_die(bb_msg_write_error);
+}
+
+static FILE *new_run(void)
+{
+	char *name;
+	FILE *fp;
+	int fd;
+
+	name = concat_path_file(tmp_dir, "sortXXXXXX");
+	fd = xmkstemp(name);
+	unlink(name);
+	free(name);
+	fp = fdopen(fd, "w+");
+	if (!fp)
+		bb_perror_msg_and_die("fdopen");
+	return fp;
+}
+
+/* Merges runs, and LINES if N > 0, to OUT */
+static void merge_runs(char **lines, size_t n, FILE *out, int unique)
+{
+	struct merge_src *src;
+	unsigned i;
+
+	src = xzalloc((run_cnt + 1) * sizeof(src[0]));
+	for (i = 0; i < run_cnt; i++) {
+		rewind(runs[i]);
+		src[i].fp = runs[i];
+	}
+	/* In memory lines were read last: stable order needs them last */
+	src[i].v = lines;
+	src[i].n = n;
+	i = run_cnt + (n != 0);
+	if (i)
+		merge(src, i, out, unique);
+	free(src);
+	run_cnt = 0;
+}
+
+/* Sorts N lines, writes them to a new run and frees them */
+static void spill_lines(char **lines, size_t n)
+{
+	FILE *fp;
+	size_t i;
+
+	sort_lines(lines, n);
+	fp = new_run();
+	for (i = 0; i < n; i++) {
+		write_line(fp, lines[i]);
+		free_line(lines[i]);
+	}
+	if (fflush(fp) != 0 || ferror(fp))
+		bb_perror_msg_and_die(bb_msg_write_error);
+	runs = xrealloc_vector(runs, 4, run_cnt);
+	runs[run_cnt++] = fp;
+	if (run_cnt == SORT_MAX_RUNS) {
+		fp = new_run();
+		merge_runs(NULL, 0, fp, 0);
+		runs[run_cnt++] = fp;
+	}
+}
+
+static unsigned long long total_ram(void)
+{
+	struct sysinfo info;
+
+	if (sysinfo(&info) != 0)
+		return 0;
+	return (unsigned long long)info.totalram * info.mem_unit;
+}
+
+static unsigned long long parse_mem_size(char *str)
+{
+	char *p = last_char_is(str, '%');
+	size_t len;
+
+	if (p) {
+		*p = '\0';
+		return total_ram() / 100 * xatou_range(str, 1, 100);
+	}
+	/* No suffix: kilobytes, as in coreutils */
+	len = strlen(str);
+	if (len && isdigit(str[len - 1]))
+		return xatoull(str) * 1024;
+	return xatoull_sfx(str, sort_suffixes);
+}
+#endif
+
 int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
 	char *line, **lines;
-	char *str_ignored, *str_o, *str_t;
+	char *str_S, *str_T, *str_o, *str_t;
 	llist_t *lst_k = NULL;
 	int i, flag;
 	int linecount;
 	unsigned opts;
+#if ENABLE_FEATURE_SORT_BIG
+	struct sort_key *key;
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	unsigned long long mem_budget, mem_used;
+#endif
 
 	xfunc_error_retval = 2;
 
@@ -338,7 +805,7 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	/* -o and -t can be given at most once */
 	opt_complementary = "o--o:t--t:" /* -t, -o: at most one of each */
 			"k::"; /* -k takes list */
-	opts = getopt32(argv, OPT_STR, &str_ignored, &str_ignored, &str_o, &lst_k, &str_t);
+	opts = getopt32(argv, OPT_STR, &str_S, &str_T, &str_o, &lst_k, &str_t);
 	/* global b strips leading and trailing spaces */
 	if (opts & FLAG_b)
 		option_mask32 |= FLAG_bb;
@@ -365,9 +832,9 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 				FLAG_i | /* Ignore !isprint() */
 			0
 		};
-		struct sort_key *key = add_key();
 		char *str_k = llist_pop(&lst_k);
 
+		key = add_key();
 		i = 0; /* i==0 before comma, 1 after (-k3,6) */
 		while (*str_k) {
 			/* Start of range */
@@ -399,6 +866,35 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+
+	/* if no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
+	/* Extract keys once per line, unless they are whole lines */
+	for (key = key_list, i = 0; key; key = key->next_key, i++)
+		if (!key_is_whole_line(key, key->flags ? key->flags : option_mask32))
+			cached_keys = 1;
+	if (cached_keys) {
+		cached_keys = i;
+		new_keys = xmalloc(i * sizeof(new_keys[0]));
+	}
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	mem_budget = (option_mask32 & FLAG_S) ? parse_mem_size(str_S) : total_ram() / 2;
+	if (mem_budget < SORT_MIN_MEM)
+		mem_budget = SORT_MIN_MEM;
+	mem_used = 0;
+	tmp_dir = str_T;
+	if (!(option_mask32 & FLAG_T)) {
+		tmp_dir = getenv("TMPDIR");
+		if (!tmp_dir || !tmp_dir[0])
+			tmp_dir =
+#ifdef __BIONIC__
+				"/data/local"
+#endif
+				"/tmp";
+	}
+	sort_jobs = bb_online_cpus(SORT_MAX_JOBS);
 #endif
 
 	/* Open input files and read data */
@@ -416,15 +912,23 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			if (!line)
 				break;
 			lines = xrealloc_vector(lines, 6, linecount);
-			lines[linecount++] = line;
+			lines[linecount] = new_line(line);
+#if ENABLE_FEATURE_SORT_EXTERNAL
+			/* -c needs all lines in memory */
+			mem_used += line_size(lines[linecount]);
+			if (mem_used > mem_budget && !(option_mask32 & FLAG_c)) {
+				spill_lines(lines, linecount + 1);
+				linecount = 0;
+				mem_used = 0;
+				continue;
+			}
+#endif
+			linecount++;
 		}
 		fclose_if_not_stdin(fp);
 	} while (*++argv);
 
 #if ENABLE_FEATURE_SORT_BIG
-	/* if no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
 	/* handle -c */
 	if (option_mask32 & FLAG_c) {
 		int j = (option_mask32 & FLAG_u) ? -1 : 0;
@@ -436,6 +940,15 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 		}
 		return EXIT_SUCCESS;
 	}
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	sort_lines(lines, linecount);
+	/* Open output file _after_ we read all input ones */
+	if (option_mask32 & FLAG_o)
+		xmove_fd(xopen3(str_o, O_WRONLY|O_CREAT|O_TRUNC, 0666), STDOUT_FILENO);
+	/* Merge with runs if there are any, handle -u, print it */
+	merge_runs(lines, linecount, stdout, option_mask32 & FLAG_u);
+	fflush_stdout_and_exit(EXIT_SUCCESS);
 #endif
 	/* Perform the actual sort */
 	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
@@ -447,7 +960,7 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 		option_mask32 |= FLAG_s;
 		for (i = 1; i < linecount; i++) {
 			if (compare_keys(&lines[flag], &lines[i]) == 0)
-				free(lines[i]);
+				free_line(lines[i]);
 			else
 				lines[++flag] = lines[i];
 		}
@@ -133,6 +133,9 @@ typedef struct node_s {
 	union {
 		struct node_s *n;
 	} a;
+#if ENABLE_FEATURE_AWK_COMPILE
+	struct awk_code_s *code;        /* bytecode of the expression */
+#endif
 } node;
 
 /* Block of temporary variables */
@@ -424,6 +427,11 @@ struct globals {
 	int nfields;
 	int maxfields; /* used in fsrealloc() only */
 	var *Fields;
+	/* Fields[i] for i < nlazy_fields is not set yet if
+	 * fstart[i] >= 0, $(i+1) is at fstrings + fstart[i] then */
+	int nlazy_fields;
+	int *fstart;
+	int fstart_size;
 	nvblock *g_cb;
 	char *g_pos;
 	char *g_buf;
@@ -444,6 +452,7 @@ struct globals2 {
 
 	/* former statics from various functions */
 	char *split_f0__fstrings;
+	int split_f0__fstrings_size;
 
 	uint32_t next_token__save_tclass;
 	uint32_t next_token__save_info;
@@ -488,6 +497,9 @@ struct globals2 {
 #define nfields      (G1.nfields     )
 #define maxfields    (G1.maxfields   )
 #define Fields       (G1.Fields      )
+#define nlazy_fields (G1.nlazy_fields)
+#define fstart       (G1.fstart      )
+#define fstart_size  (G1.fstart_size )
 #define g_cb         (G1.g_cb        )
 #define g_pos        (G1.g_pos       )
 #define g_buf        (G1.g_buf       )
@@ -1591,6 +1603,8 @@ static void fsrealloc(int size)
 		clrvar(Fields + i);
 	}
 	nfields = size;
+	if (nlazy_fields > size)
+		nlazy_fields = size;
 }
 
 static int awk_split(const char *s, node *spl, char **slist)
@@ -1674,33 +1688,116 @@ static int awk_split(const char *s, node *spl, char **slist)
 	return n;
 }
 
-static void split_f0(void)
+#define fstrings      (G.split_f0__fstrings)
+#define fstrings_size (G.split_f0__fstrings_size)
+
+/* remember that field #n starts at fstrings + ofs */
+static void add_field(int n, int ofs)
 {
-/* static char *fstrings; */
-#define fstrings (G.split_f0__fstrings)
+	if (n >= fstart_size) {
+		fstart_size = n + (n >> 1) + 16;
+		fstart = xrealloc(fstart, fstart_size * sizeof(fstart[0]));
+	}
+	fstart[n] = ofs;
+}
 
-	int i, n;
+/* Split $0 into fields. Only field positions are recorded here, the
+ * Fields[] variables are set by field_at() when they are used: most
+ * programs look at a few fields of a line */
+static void split_f0(void)
+{
+	const char *s0;
 	char *s;
+	int i, n, sep;
 
 	if (is_f0_split)
 		return;
 
 	is_f0_split = TRUE;
-	free(fstrings);
-	fsrealloc(0);
-	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
-	fsrealloc(n);
-	s = fstrings;
-	for (i = 0; i < n; i++) {
-		Fields[i].string = nextword(&s);
-		Fields[i].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+	nlazy_fields = 0;
+	s0 = getvar_s(intvar[F0]);
+	sep = fsplitter.n.info;
+	n = 0;
+	if ((sep & OPCLSMASK) == OC_REGEXP || (char)sep == '\0') {
+		/* fields are not in place in $0, let awk_split() copy them */
+		free(fstrings);
+		fstrings_size = 0;
+		n = awk_split(s0, &fsplitter.n, &fstrings);
+		s = fstrings;
+		for (i = 0; i < n; i++) {
+			add_field(i, s - fstrings);
+			nextword(&s);
+		}
+	} else {
+		/* a copy of $0 with NULs at field ends, reused for every record */
+		int len = strlen(s0);
+		fstrings = qrealloc(fstrings, len, &fstrings_size);
+		s = memcpy(fstrings, s0, len + 1);
+		if ((char)sep == ' ') {
+			while (1) {
+				s = skip_whitespace(s);
+				if (!*s)
+					break;
+				add_field(n++, s - fstrings);
+				while (*s && !isspace(*s))
+					s++;
+				if (!*s)
+					break;
+				*s++ = '\0';
+			}
+		} else if (*s) {
+			/* same separators as awk_split() */
+			char c[4];
+			c[0] = c[1] = (char)sep;
+			c[2] = c[3] = '\0';
+			if (*getvar_s(intvar[RS]) == '\0')
+				c[2] = '\n';
+			if (icase) {
+				c[0] = toupper(c[0]);
+				c[1] = tolower(c[1]);
+			}
+			add_field(n++, 0);
+			while ((s = strpbrk(s, c)) != NULL) {
+				*s++ = '\0';
+				add_field(n++, s - fstrings);
+			}
+		}
 	}
+	fsrealloc(n);
+	nlazy_fields = n;
 
 	/* set NF manually to avoid side effects */
 	clrvar(intvar[NF]);
 	intvar[NF]->type = VF_NUMBER | VF_SPECIAL;
 	intvar[NF]->number = nfields;
+}
+
+/* Fields[i], set from the split record if it was not used yet */
+static var *field_at(int i)
+{
+	var *v = &Fields[i];
+
+	if (i < nlazy_fields && fstart[i] >= 0) {
+		clrvar(v);
+		v->string = fstrings + fstart[i];
+		v->type |= (VF_FSTR | VF_USER | VF_DIRTY);
+		fstart[i] = -1;
+	}
+	return v;
+}
+
 #undef fstrings
+#undef fstrings_size
+
+/* variable for $i */
+static var *field_var(int i)
+{
+	if (i == 0)
+		return intvar[F0];
+	split_f0();
+	if (i > nfields)
+		fsrealloc(i);
+	return field_at(i - 1);
 }
 
 /* perform additional actions when some internal variables changed */
@@ -1724,7 +1821,7 @@ static void handle_special(var *v)
 		b = NULL;
 		len = 0;
 		for (i = 0; i < n; i++) {
-			s = getvar_s(&Fields[i]);
+			s = getvar_s(field_at(i));
 			l = strlen(s);
 			if (b) {
 				memcpy(b+len, sep, sl);
@@ -2330,6 +2427,773 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 #undef tspl
 }
 
+/* result of binary arithmetic operator opn */
+static double arith(int opn, double L_d, double R_d)
+{
+	switch (opn) {
+	case '+':
+		L_d += R_d;
+		break;
+	case '-':
+		L_d -= R_d;
+		break;
+	case '*':
+		L_d *= R_d;
+		break;
+	case '/':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d /= R_d;
+		break;
+	case '&':
+		if (ENABLE_FEATURE_AWK_LIBM)
+			L_d = pow(L_d, R_d);
+		else
+			syntax_error(EMSG_NO_MATH);
+		break;
+	case '%':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d -= (int)(L_d / R_d) * R_d;
+		break;
+	}
+	return L_d;
+}
+
+/* <0, 0 or >0: numeric comparison if both are numbers, else string one */
+static double cmpvars(var *l, var *r)
+{
+	if (is_numeric(l) && is_numeric(r))
+		return getvar_i(l) - getvar_i(r);
+	else {
+		const char *ls = getvar_s(l);
+		const char *rs = getvar_s(r);
+		return icase ? strcasecmp(ls, rs) : strcmp(ls, rs);
+	}
+}
+
+/* apply comparison operator opn to the result of cmpvars() */
+static int compare(int opn, double Ld)
+{
+	int i = i; /* for compiler */
+
+	switch (opn & 0xfe) {
+	case 0:
+		i = (Ld > 0);
+		break;
+	case 2:
+		i = (Ld >= 0);
+		break;
+	case 4:
+		i = (Ld == 0);
+		break;
+	}
+	return (i == 0) ^ (opn & 1);
+}
+
+#if ENABLE_FEATURE_AWK_COMPILE
+/*
+ * Expression compiler.
+ *
+ * The first time evaluate() sees an expression node, the subtree
+ * is translated into code for a small stack machine, which is then
+ * run instead of walking the tree. Operands on the stack are either
+ * numbers or var pointers; the compiler knows which one every
+ * instruction leaves, so numbers never have to be put into temporary
+ * variables in between. Operators the machine has no instruction for
+ * are compiled into a call to evaluate() for that subtree.
+ *
+ * Like evaluate(), the code leaves its result either in a variable
+ * of the program (lvalues) or in one of its temporaries, and temporary
+ * 0 is the "res" evaluate() was called with.
+ */
+
+enum {
+	VM_NUM, VM_VAR
+};
+
+/* Order must match labels[] in vm_exec() */
+enum {
+	I_VAR,     /* -> v */
+	I_VARNUM,  /* -> number of v */
+	I_NUM,     /* -> d */
+	I_NF,      /* -> NF */
+	I_FNARG,   /* -> function argument #arg */
+	I_ELEM,    /* subscript -> v[subscript] */
+	I_ELEMFN,  /* subscript -> argument #arg [subscript] */
+	I_FIELDC,  /* -> $arg */
+	I_FIELD,   /* i -> $i */
+	I_EVAL,    /* -> evaluate(n, temp #arg) */
+	I_TOVAR,   /* number -> temp #arg */
+	I_TOVAR2,  /* same, for operand under the top */
+	I_TONUM,   /* var -> number */
+	I_TONUM2,  /* same, for operand under the top */
+	I_ADD,     /* l r -> l + r */
+	I_SUB,
+	I_MUL,
+	I_ARITH,   /* l r -> l <arg> r */
+	I_NEG,
+	I_NOT,
+	I_TRUE,    /* var -> 1 if it is true, else 0 */
+	I_BOOL,    /* number -> 1 if non-zero, else 0 */
+	I_PREINC,  /* var -> var += arg */
+	I_POSTINC, /* var -> (var += arg) - arg */
+	I_REPL,    /* var r -> (var <arg>= r) */
+	I_MOVE,    /* var var2 -> (var = var2) */
+	I_MOVEN,   /* var r -> (var = r) */
+	I_CMP,     /* var var2 -> var <arg> var2 */
+	I_CMPN,    /* l r -> l <arg> r */
+	I_CONCAT,  /* var var2 -> temp #arg = var var2 */
+	I_JOIN,    /* var var2 -> temp #arg = var SUBSEP var2 */
+	I_JZ,      /* number -> ; jump to arg if it is 0 */
+	I_JZK,     /* 0 -> 0, jump to arg; else pop it */
+	I_JNZK,    /* x -> x, jump to arg if non-zero; else pop it */
+	I_JMP,
+	I_MATCH,   /* var -> var ~ n (var !~ n if arg is '!') */
+	I_MATCHD,  /* same, n is an expression */
+	I_REGEXP,  /* -> $0 ~ n */
+	I_IN,      /* var array -> var in array */
+	I_INT,
+	I_LENGTH,  /* var -> length(var) */
+	I_LENGTH0, /* -> length($0) */
+	I_RETN,    /* number -> ; return it in res */
+	I_RETV,    /* var -> ; return it */
+};
+
+/* deepest stack an expression may need to be compiled */
+#define VM_STACK 32
+
+typedef struct vm_insn {
+	unsigned op;
+	int arg;
+	union {
+		var *v;
+		node *n;
+		double d;
+	} u;
+} vm_insn;
+
+typedef struct awk_code_s {
+	int ntemps;
+	vm_insn insn[1];
+} awk_code;
+
+typedef union vm_cell {
+	double d;
+	var *v;
+} vm_cell;
+
+struct vm_compiler {
+	vm_insn *insn;
+	int len;
+	int ntemps;
+	int sp, maxsp;
+};
+
+/* node->code of expressions which are left to evaluate() */
+static awk_code vm_none;
+
+static int vm_expr(struct vm_compiler *c, node *n, int dst);
+
+static vm_insn *vm_emit(struct vm_compiler *c, int op, int arg, int delta)
+{
+	vm_insn *i;
+
+	c->insn = xrealloc_vector(c->insn, 4, c->len);
+	i = &c->insn[c->len++];
+	i->op = op;
+	i->arg = arg;
+	c->sp += delta;
+	if (c->maxsp < c->sp)
+		c->maxsp = c->sp;
+	return i;
+}
+
+static int vm_tmp(struct vm_compiler *c, int dst)
+{
+	return dst >= 0 ? dst : c->ntemps++;
+}
+
+/* numeric and string constants in the program text are variables
+ * which are not in vhash. They are never changed */
+static int vm_literal(var *v)
+{
+	hash_item *hi;
+	unsigned i;
+
+	for (i = 0; i < vhash->csize; i++)
+		for (hi = vhash->items[i]; hi; hi = hi->next)
+			if (&hi->data.v == v)
+				return FALSE;
+	return TRUE;
+}
+
+static int vm_lvalue(node *n)
+{
+	uint32_t info;
+
+	if (!n)
+		return FALSE;
+	info = n->info & OPCLSMASK;
+	return info == OC_VAR || info == OC_FNARG || info == OC_FIELD;
+}
+
+/* can n be compiled to instructions other than I_EVAL? */
+static int vm_native(node *n)
+{
+	int opn;
+
+	if (!n)
+		return FALSE;
+	opn = n->info & OPNMASK;
+	switch (n->info & OPCLSMASK) {
+	case OC_VAR:
+	case OC_FNARG:
+	case OC_BINARY:
+	case OC_COMPARE:
+	case OC_CONCAT:
+	case OC_COMMA:
+	case OC_LAND:
+	case OC_LOR:
+	case OC_FIELD:
+	case OC_IN:
+	case OC_REGEXP:
+	case OC_MATCH:
+		return TRUE;
+	case OC_MOVE:
+	case OC_REPLACE:
+		return vm_lvalue(n->l.n);
+	case OC_UNARY:
+		if (opn == '-' || opn == '+' || opn == '!')
+			return TRUE;
+		return vm_lvalue(n->r.n);
+	case OC_TERNARY:
+		return (n->r.n->info & OPCLSMASK) == OC_COLON;
+	case OC_FBLTIN:
+		return opn == F_in || opn == F_le;
+	}
+	return FALSE;
+}
+
+/* what vm_expr() leaves on the stack for n */
+static int vm_type(node *n)
+{
+	if (!vm_native(n))
+		return VM_VAR;
+	switch (n->info & OPCLSMASK) {
+	case OC_VAR:
+	case OC_FNARG:
+	case OC_CONCAT:
+	case OC_COMMA:
+	case OC_FIELD:
+	case OC_MOVE:
+	case OC_REPLACE:
+		return VM_VAR;
+	case OC_TERNARY:
+		if (vm_type(n->r.n->l.n) == VM_NUM && vm_type(n->r.n->r.n) == VM_NUM)
+			return VM_NUM;
+		return VM_VAR;
+	}
+	return VM_NUM;
+}
+
+/* does evaluating n leave all variables unchanged? */
+static int vm_pure(node *n)
+{
+	int opn;
+
+	if (!n)
+		return TRUE;
+	opn = n->info & OPNMASK;
+	switch (n->info & OPCLSMASK) {
+	case OC_VAR:
+	case OC_FNARG:
+	case OC_FIELD:
+		return vm_pure(n->r.n);
+	case OC_REGEXP:
+		return TRUE;
+	case OC_MATCH:
+		return (n->r.n->info & OPCLSMASK) == OC_REGEXP && vm_pure(n->l.n);
+	case OC_UNARY:
+		return (opn == '-' || opn == '+' || opn == '!') && vm_pure(n->r.n);
+	case OC_FBLTIN:
+		return (opn == F_in || opn == F_le) && vm_pure(n->l.n);
+	case OC_BINARY:
+	case OC_COMPARE:
+	case OC_CONCAT:
+	case OC_COMMA:
+	case OC_LAND:
+	case OC_LOR:
+	case OC_IN:
+	case OC_TERNARY:
+	case OC_COLON:
+		return vm_pure(n->l.n) && vm_pure(n->r.n);
+	}
+	return FALSE;
+}
+
+/* compile n, converting the result to type */
+static void vm_want(struct vm_compiler *c, node *n, int dst, int type)
+{
+	int t = vm_expr(c, n, dst);
+
+	if (t == VM_VAR && type == VM_NUM)
+		vm_emit(c, I_TONUM, 0, 0);
+	if (t == VM_NUM && type == VM_VAR)
+		vm_emit(c, I_TOVAR, vm_tmp(c, dst), 0);
+}
+
+/* compile n for its numeric value */
+static void vm_num(struct vm_compiler *c, node *n)
+{
+	if (n && (n->info & OPCLSMASK) == OC_VAR && !n->r.n
+	 && n->l.v != intvar[NF]
+	) {
+		var *v = n->l.v;
+		if ((v->type & VF_NUMBER) && vm_literal(v))
+			vm_emit(c, I_NUM, 0, 1)->u.d = v->number;
+		else
+			vm_emit(c, I_VARNUM, 0, 1)->u.v = v;
+		return;
+	}
+	vm_want(c, n, -1, VM_NUM);
+}
+
+/* compile n for its truth value */
+static void vm_truth(struct vm_compiler *c, node *n)
+{
+	if (vm_expr(c, n, -1) == VM_VAR)
+		vm_emit(c, I_TRUE, 0, 0);
+	else
+		vm_emit(c, I_BOOL, 0, 0);
+}
+
+static int vm_expr(struct vm_compiler *c, node *n, int dst)
+{
+	node *l, *r;
+	int opn, t, j, j2;
+
+	if (!vm_native(n)) {
+		/* evaluate(NULL) yields an empty string, too */
+		vm_emit(c, I_EVAL, vm_tmp(c, dst), 1)->u.n = n;
+		return VM_VAR;
+	}
+
+	l = n->l.n;
+	r = n->r.n;
+	opn = n->info & OPNMASK;
+	switch (n->info & OPCLSMASK) {
+	case OC_VAR:
+		if (r) {
+			vm_want(c, r, -1, VM_VAR);
+			vm_emit(c, I_ELEM, 0, 0)->u.v = n->l.v;
+		} else if (n->l.v == intvar[NF]) {
+			vm_emit(c, I_NF, 0, 1);
+		} else {
+			vm_emit(c, I_VAR, 0, 1)->u.v = n->l.v;
+		}
+		return VM_VAR;
+
+	case OC_FNARG:
+		if (r) {
+			vm_want(c, r, -1, VM_VAR);
+			vm_emit(c, I_ELEMFN, n->l.aidx, 0);
+		} else {
+			vm_emit(c, I_FNARG, n->l.aidx, 1);
+		}
+		return VM_VAR;
+
+	case OC_FIELD:
+		if ((r->info & OPCLSMASK) == OC_VAR && !r->r.n
+		 && (r->l.v->type & VF_NUMBER) && vm_literal(r->l.v)
+		 && r->l.v->number >= 0 && r->l.v->number < 0x8000
+		) {
+			vm_emit(c, I_FIELDC, (int)r->l.v->number, 1);
+		} else {
+			vm_num(c, r);
+			vm_emit(c, I_FIELD, 0, 0);
+		}
+		return VM_VAR;
+
+	case OC_BINARY:
+		/* evaluate() takes the value of the left operand
+		 * after the right one is evaluated */
+		t = VM_NUM;
+		if (vm_pure(r))
+			vm_num(c, l);
+		else
+			t = vm_expr(c, l, -1);
+		vm_num(c, r);
+		if (t == VM_VAR)
+			vm_emit(c, I_TONUM2, 0, 0);
+		switch (opn) {
+		case '+':
+			vm_emit(c, I_ADD, 0, -1);
+			break;
+		case '-':
+			vm_emit(c, I_SUB, 0, -1);
+			break;
+		case '*':
+			vm_emit(c, I_MUL, 0, -1);
+			break;
+		default:
+			vm_emit(c, I_ARITH, opn, -1);
+		}
+		return VM_NUM;
+
+	case OC_REPLACE:
+		vm_expr(c, l, -1);
+		vm_num(c, r);
+		vm_emit(c, I_REPL, opn, -1);
+		return VM_VAR;
+
+	case OC_MOVE:
+		vm_expr(c, l, -1);
+		if (vm_type(r) == VM_NUM) {
+			vm_expr(c, r, -1);
+			vm_emit(c, I_MOVEN, 0, -1);
+		} else {
+			vm_expr(c, r, -1);
+			vm_emit(c, I_MOVE, 0, -1);
+		}
+		return VM_VAR;
+
+	case OC_COMPARE:
+		/* numbers compare as numbers to numbers and numeric
+		 * constants, else they have to become variables */
+		t = vm_expr(c, l, -1);
+		if (t == VM_NUM && (r->info & OPCLSMASK) == OC_VAR && !r->r.n
+		 && (r->l.v->type & VF_NUMBER) && vm_literal(r->l.v)
+		) {
+			vm_num(c, r);
+		} else if (vm_expr(c, r, -1) == VM_VAR) {
+			if (t == VM_NUM)
+				vm_emit(c, I_TOVAR2, vm_tmp(c, -1), 0);
+			t = VM_VAR;
+		} else if (t == VM_VAR) {
+			vm_emit(c, I_TOVAR, vm_tmp(c, -1), 0);
+		}
+		vm_emit(c, t == VM_NUM ? I_CMPN : I_CMP, opn, -1);
+		return VM_NUM;
+
+	case OC_CONCAT:
+	case OC_COMMA:
+		vm_want(c, l, -1, VM_VAR);
+		vm_want(c, r, -1, VM_VAR);
+		vm_emit(c, (n->info & OPCLSMASK) == OC_CONCAT ? I_CONCAT : I_JOIN,
+				vm_tmp(c, dst), -1);
+		return VM_VAR;
+
+	case OC_LAND:
+	case OC_LOR:
+		/* jump targets are patched by index: c->insn may move */
+		vm_truth(c, l);
+		vm_emit(c, (n->info & OPCLSMASK) == OC_LAND ? I_JZK : I_JNZK, 0, -1);
+		j = c->len - 1;
+		vm_truth(c, r);
+		c->insn[j].arg = c->len;
+		return VM_NUM;
+
+	case OC_TERNARY:
+		t = vm_type(n);
+		vm_truth(c, l);
+		vm_emit(c, I_JZ, 0, -1);
+		j = c->len - 1;
+		vm_want(c, r->l.n, dst, t);
+		/* the other branch starts from the same depth */
+		vm_emit(c, I_JMP, 0, -1);
+		j2 = c->len - 1;
+		c->insn[j].arg = c->len;
+		vm_want(c, r->r.n, dst, t);
+		c->insn[j2].arg = c->len;
+		return t;
+
+	case OC_UNARY:
+		switch (opn) {
+		case '-':
+			vm_num(c, r);
+			vm_emit(c, I_NEG, 0, 0);
+			break;
+		case '+':
+			vm_num(c, r);
+			break;
+		case '!':
+			vm_truth(c, r);
+			vm_emit(c, I_NOT, 0, 0);
+			break;
+		default:
+			vm_expr(c, r, -1);
+			vm_emit(c, (opn == 'P' || opn == 'M') ? I_PREINC : I_POSTINC,
+					(opn == 'P' || opn == 'p') ? 1 : -1, 0);
+		}
+		return VM_NUM;
+
+	case OC_IN:
+		vm_want(c, l, -1, VM_VAR);
+		vm_want(c, r, -1, VM_VAR);
+		vm_emit(c, I_IN, 0, -1);
+		return VM_NUM;
+
+	case OC_REGEXP:
+		vm_emit(c, I_REGEXP, 0, 1)->u.n = n;
+		return VM_NUM;
+
+	case OC_MATCH:
+		vm_want(c, l, -1, VM_VAR);
+		vm_emit(c, (r->info & OPCLSMASK) == OC_REGEXP ? I_MATCH : I_MATCHD,
+				opn, 0)->u.n = r;
+		return VM_NUM;
+
+	case OC_FBLTIN:
+		if (opn == F_in) {
+			vm_num(c, l);
+			vm_emit(c, I_INT, 0, 0);
+		} else if (l) {
+			vm_want(c, l, -1, VM_VAR);
+			vm_emit(c, I_LENGTH, 0, 0);
+		} else {
+			vm_emit(c, I_LENGTH0, 0, 1);
+		}
+		return VM_NUM;
+	}
+	/* not reached: vm_native() lists the cases above */
+	return VM_VAR;
+}
+
+static awk_code *vm_compile(node *op)
+{
+	struct vm_compiler c;
+	awk_code *code;
+	int t;
+
+	switch (op->info & OPCLSMASK) {
+	case OC_VAR:
+	case OC_FNARG:
+		/* evaluate() does these as fast */
+		return &vm_none;
+	}
+	if (!vm_native(op))
+		return &vm_none;
+
+	memset(&c, 0, sizeof(c));
+	c.ntemps = 1; /* #0 is res */
+	t = vm_expr(&c, op, 0);
+	vm_emit(&c, t == VM_NUM ? I_RETN : I_RETV, 0, -1);
+	if (c.maxsp > VM_STACK) {
+		free(c.insn);
+		return &vm_none;
+	}
+
+	code = xmalloc(sizeof(*code) + (c.len - 1) * sizeof(code->insn[0]));
+	code->ntemps = c.ntemps - 1;
+	memcpy(code->insn, c.insn, c.len * sizeof(code->insn[0]));
+	free(c.insn);
+	return code;
+}
+
+static var *vm_exec(awk_code *code, var *res)
+{
+	static const void *const labels[] = {
+		&&i_var,    &&i_varnum, &&i_num,     &&i_nf,
+		&&i_fnarg,  &&i_elem,   &&i_elemfn,  &&i_fieldc,
+		&&i_field,  &&i_eval,   &&i_tovar,   &&i_tovar2,
+		&&i_tonum,  &&i_tonum2, &&i_add,     &&i_sub,
+		&&i_mul,    &&i_arith,  &&i_neg,     &&i_not,
+		&&i_true,   &&i_bool,   &&i_preinc,  &&i_postinc,
+		&&i_repl,   &&i_move,   &&i_moven,   &&i_cmp,
+		&&i_cmpn,   &&i_concat, &&i_join,    &&i_jz,
+		&&i_jzk,    &&i_jnzk,   &&i_jmp,     &&i_match,
+		&&i_matchd, &&i_regexp, &&i_in,      &&i_int,
+		&&i_length, &&i_length0, &&i_retn,   &&i_retv,
+	};
+	vm_cell stack[VM_STACK];
+	vm_cell *sp = stack - 1;
+	const vm_insn *pc = code->insn;
+	var *tmp = NULL;
+	var *v;
+
+/* temp #0 is res, #1.. are allocated here */
+#define T(i)   ((i) ? tmp + (i) - 1 : res)
+#define NEXT() goto *labels[(++pc)->op]
+#define JUMP() do { pc = code->insn + pc->arg; goto *labels[pc->op]; } while (0)
+
+	if (code->ntemps)
+		tmp = nvalloc(code->ntemps);
+	goto *labels[pc->op];
+
+ i_var:
+	(++sp)->v = pc->u.v;
+	NEXT();
+ i_varnum:
+	(++sp)->d = getvar_i(pc->u.v);
+	NEXT();
+ i_num:
+	(++sp)->d = pc->u.d;
+	NEXT();
+ i_nf:
+	split_f0();
+	(++sp)->v = intvar[NF];
+	NEXT();
+ i_fnarg:
+	(++sp)->v = &G.evaluate__fnargs[pc->arg];
+	NEXT();
+ i_elem:
+	sp->v = findvar(iamarray(pc->u.v), getvar_s(sp->v));
+	NEXT();
+ i_elemfn:
+	sp->v = findvar(iamarray(&G.evaluate__fnargs[pc->arg]), getvar_s(sp->v));
+	NEXT();
+ i_fieldc:
+	(++sp)->v = field_var(pc->arg);
+	NEXT();
+ i_field:
+	sp->v = field_var((int)sp->d);
+	NEXT();
+ i_eval:
+	(++sp)->v = evaluate(pc->u.n, T(pc->arg));
+	NEXT();
+ i_tovar:
+	sp->v = setvar_i(T(pc->arg), sp->d);
+	NEXT();
+ i_tovar2:
+	sp[-1].v = setvar_i(T(pc->arg), sp[-1].d);
+	NEXT();
+ i_tonum:
+	sp->d = getvar_i(sp->v);
+	NEXT();
+ i_tonum2:
+	sp[-1].d = getvar_i(sp[-1].v);
+	NEXT();
+ i_add:
+	sp--;
+	sp->d += sp[1].d;
+	NEXT();
+ i_sub:
+	sp--;
+	sp->d -= sp[1].d;
+	NEXT();
+ i_mul:
+	sp--;
+	sp->d *= sp[1].d;
+	NEXT();
+ i_arith:
+	sp--;
+	sp->d = arith(pc->arg, sp->d, sp[1].d);
+	NEXT();
+ i_neg:
+	sp->d = -sp->d;
+	NEXT();
+ i_not:
+	sp->d = (sp->d == 0);
+	NEXT();
+ i_true:
+	sp->d = istrue(sp->v);
+	NEXT();
+ i_bool:
+	sp->d = (sp->d != 0);
+	NEXT();
+ i_preinc:
+	v = sp->v;
+	sp->d = getvar_i(v) + pc->arg;
+	setvar_i(v, sp->d);
+	NEXT();
+ i_postinc:
+	v = sp->v;
+	sp->d = getvar_i(v);
+	setvar_i(v, sp->d + pc->arg);
+	NEXT();
+ i_repl:
+	sp--;
+	v = sp->v;
+	sp->v = setvar_i(v, arith(pc->arg, getvar_i(v), sp[1].d));
+	NEXT();
+ i_move:
+	sp--;
+	sp->v = copyvar(sp->v, sp[1].v);
+	NEXT();
+ i_moven:
+	sp--;
+	sp->v = setvar_i(sp->v, sp[1].d);
+	NEXT();
+ i_cmp:
+	sp--;
+	sp->d = compare(pc->arg, cmpvars(sp->v, sp[1].v));
+	NEXT();
+ i_cmpn:
+	sp--;
+	sp->d = compare(pc->arg, sp->d - sp[1].d);
+	NEXT();
+ i_concat:
+	sp--;
+	sp->v = setvar_p(T(pc->arg), xasprintf("%s%s",
+			getvar_s(sp->v), getvar_s(sp[1].v)));
+	NEXT();
+ i_join:
+	sp--;
+	sp->v = setvar_p(T(pc->arg), xasprintf("%s%s%s",
+			getvar_s(sp->v), getvar_s(intvar[SUBSEP]), getvar_s(sp[1].v)));
+	NEXT();
+ i_jz:
+	if ((sp--)->d == 0)
+		JUMP();
+	NEXT();
+ i_jzk:
+	if (sp->d == 0)
+		JUMP();
+	sp--;
+	NEXT();
+ i_jnzk:
+	if (sp->d != 0)
+		JUMP();
+	sp--;
+	NEXT();
+ i_jmp:
+	JUMP();
+ i_match:
+	sp->d = (regexec(icase ? pc->u.n->r.ire : pc->u.n->l.re,
+			getvar_s(sp->v), 0, NULL, 0) == 0) ^ (pc->arg == '!');
+	NEXT();
+ i_matchd: {
+	regex_t *re = as_regex(pc->u.n, &G.evaluate__sreg);
+	int i = regexec(re, getvar_s(sp->v), 0, NULL, 0);
+	if (re == &G.evaluate__sreg)
+		regfree(re);
+	sp->d = (i == 0) ^ (pc->arg == '!');
+	NEXT();
+ }
+ i_regexp:
+	(++sp)->d = (regexec(icase ? pc->u.n->r.ire : pc->u.n->l.re,
+			getvar_s(intvar[F0]), 0, NULL, 0) == 0);
+	NEXT();
+ i_in:
+	sp--;
+	v = sp[1].v;
+	sp->d = hash_search(iamarray(v), getvar_s(sp->v)) ? 1 : 0;
+	NEXT();
+ i_int:
+	sp->d = (int)sp->d;
+	NEXT();
+ i_length:
+	sp->d = strlen(getvar_s(sp->v));
+	NEXT();
+ i_length0:
+	(++sp)->d = strlen(getvar_s(intvar[F0]));
+	NEXT();
+ i_retn:
+	res = setvar_i(res, sp->d);
+	goto done;
+ i_retv:
+	res = sp->v;
+ done:
+	if (tmp)
+		nvfree(tmp);
+	return res;
+#undef T
+#undef NEXT
+#undef JUMP
+}
+#endif /* FEATURE_AWK_COMPILE */
+
 /*
  * Evaluate node - the heart of the program. Supplied with subtree
  * and place where to store result. returns ptr to result.
@@ -2349,6 +3213,17 @@ static var *evaluate(node *op, var *res)
 	if (!op)
 		return setvar_s(res, NULL);
 
+#if ENABLE_FEATURE_AWK_COMPILE
+	if ((op->info & OPCLSMASK) >= RECUR_FROM_THIS) {
+		if (!op->code)
+			op->code = vm_compile(op);
+		if (op->code != &vm_none) {
+			g_lineno = op->lineno;
+			return vm_exec(op->code, res);
+		}
+	}
+#endif
+
 	debug_printf_eval("entered %s()\n", __func__);
 
 	v1 = nvalloc(2);
@@ -2790,18 +3665,9 @@ static var *evaluate(node *op, var *res)
 			break;
 		}
 
-		case XC( OC_FIELD ): {
-			int i = (int)getvar_i(R.v);
-			if (i == 0) {
-				res = intvar[F0];
-			} else {
-				split_f0();
-				if (i > nfields)
-					fsrealloc(i);
-				res = &Fields[i - 1];
-			}
+		case XC( OC_FIELD ):
+			res = field_var((int)getvar_i(R.v));
 			break;
-		}
 
 		/* concatenation (" ") and index joining (",") */
 		case XC( OC_CONCAT ):
@@ -2825,63 +3691,15 @@ static var *evaluate(node *op, var *res)
 		case XC( OC_REPLACE ): {
 			double R_d = getvar_i(R.v);
 			debug_printf_eval("BINARY/REPLACE: R_d:%f opn:%c\n", R_d, opn);
-			switch (opn) {
-			case '+':
-				L_d += R_d;
-				break;
-			case '-':
-				L_d -= R_d;
-				break;
-			case '*':
-				L_d *= R_d;
-				break;
-			case '/':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d /= R_d;
-				break;
-			case '&':
-				if (ENABLE_FEATURE_AWK_LIBM)
-					L_d = pow(L_d, R_d);
-				else
-					syntax_error(EMSG_NO_MATH);
-				break;
-			case '%':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d -= (int)(L_d / R_d) * R_d;
-				break;
-			}
+			L_d = arith(opn, L_d, R_d);
 			debug_printf_eval("BINARY/REPLACE result:%f\n", L_d);
 			res = setvar_i(((opinfo & OPCLSMASK) == OC_BINARY) ? res : L.v, L_d);
 			break;
 		}
 
-		case XC( OC_COMPARE ): {
-			int i = i; /* for compiler */
-			double Ld;
-
-			if (is_numeric(L.v) && is_numeric(R.v)) {
-				Ld = getvar_i(L.v) - getvar_i(R.v);
-			} else {
-				const char *l = getvar_s(L.v);
-				const char *r = getvar_s(R.v);
-				Ld = icase ? strcasecmp(l, r) : strcmp(l, r);
-			}
-			switch (opn & 0xfe) {
-			case 0:
-				i = (Ld > 0);
-				break;
-			case 2:
-				i = (Ld >= 0);
-				break;
-			case 4:
-				i = (Ld == 0);
-				break;
-			}
-			setvar_i(res, (i == 0) ^ (opn & 1));
+		case XC( OC_COMPARE ):
+			setvar_i(res, compare(opn, cmpvars(L.v, R.v)));
 			break;
-		}
 
 		default:
 			syntax_error(EMSG_POSSIBLE_ERROR);
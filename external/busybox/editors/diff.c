@@ -77,7 +77,7 @@
  */
 
 //usage:#define diff_trivial_usage
-//usage:       "[-abBdiNqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
+//usage:       "[-abBd"IF_FEATURE_DIFF_MYERS("H")"iNqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
 //usage:#define diff_full_usage "\n\n"
 //usage:       "Compare files line by line and output the differences between them.\n"
 //usage:       "This implementation supports unified diffs only.\n"
@@ -85,6 +85,9 @@
 //usage:     "\n	-b	Ignore changes in the amount of whitespace"
 //usage:     "\n	-B	Ignore changes whose lines are all blank"
 //usage:     "\n	-d	Try hard to find a smaller set of changes"
+//usage:	IF_FEATURE_DIFF_MYERS(
+//usage:     "\n	-H	Use the faster algorithm even on small files"
+//usage:	)
 //usage:     "\n	-i	Ignore case differences"
 //usage:     "\n	-L	Use LABEL instead of the filename in the unified header"
 //usage:     "\n	-N	Treat absent files as empty"
@@ -130,6 +133,7 @@ enum {                  /* Commandline flags */
 	FLAG_p,         /* not implemented */
 	FLAG_B,
 	FLAG_E,         /* not implemented */
+	FLAG_H,
 };
 #define FLAG(x) (1 << FLAG_##x)
 
@@ -580,6 +584,421 @@ start:
 	return J;
 }
 
+#if ENABLE_FEATURE_DIFF_MYERS
+/*
+ * Alternative to create_J(): Myers' O(ND) algorithm ("An O(ND)
+ * Difference Algorithm and Its Variations", 1986) in linear space,
+ * splitting the problem at the middle snake of the edit graph.
+ * Used with -H, or when the files together are MYERS_MIN_SIZE
+ * or bigger: on small files create_J() is as fast and uses less memory.
+ *
+ * Files are mapped (or read) into memory whole. Each line is
+ * interned in a hash table, so that the algorithm works on small
+ * integers and equal numbers mean really equal lines: there is no
+ * rescan for hash collisions. -b, -i and -w apply when lines are
+ * interned, with the same rules as read_token().
+ */
+
+#define MYERS_MIN_SIZE (64 * 1024)
+
+struct myers {
+	const int *a, *b;  /* line classes, 0-based */
+	int *fdiag, *bdiag;
+	int *J;
+	int too_expensive;
+};
+
+/* Finds a point on a shortest edit path of a[xoff..xlim), b[yoff..ylim):
+ * the middle snake of section 4b of the paper. The search runs from both
+ * corners, one edit at a time: fv[k] is the largest x reached from the top
+ * left corner on diagonal k (the points with x - y == k), bv[k] the smallest
+ * one reached from the bottom right corner. The first diagonal where they
+ * meet is on the path. If that takes more than too_expensive edits,
+ * settles for the point which got farthest from its corner, like GNU diff
+ * does. Written from the paper, no GNU code here */
+static void myers_midpoint(struct myers *m, int xoff, int xlim, int yoff, int ylim,
+		int *px, int *py)
+{
+	const int *a = m->a, *b = m->b;
+	int *fv = m->fdiag, *bv = m->bdiag;
+	const int kf = xoff - yoff;    /* forward search starts on it */
+	const int kb = xlim - ylim;    /* backward search starts on it */
+	const int kmin = xoff - ylim;  /* diagonals which cross the box */
+	const int kmax = xlim - yoff;
+	const int odd = (kb - kf) & 1;
+	int flo = 1, fhi = 0;          /* diagonals done by the last step */
+	int blo = 1, bhi = 0;
+	int D, k;
+
+	for (D = 0;; D++) {
+		int lo, hi;
+
+		/* Forward. D edits reach every other diagonal in kf-D..kf+D */
+		lo = kf - D;
+		if (lo < kmin)
+			lo = kmin + ((kmin - lo) & 1);
+		hi = kf + D;
+		if (hi > kmax)
+			hi = kmax - ((hi - kmax) & 1);
+		for (k = lo; k <= hi; k += 2) {
+			int x, y;
+
+			if (D == 0)
+				x = xoff;
+			else if (k - 1 < flo || (k + 1 <= fhi && fv[k + 1] > fv[k - 1]))
+				x = fv[k + 1];      /* down from k+1 */
+			else
+				x = fv[k - 1] + 1;  /* right from k-1 */
+			/* a step out of the box is taken along its edge instead */
+			if (x > xlim)
+				x = xlim;
+			if (x - k > ylim)
+				x = ylim + k;
+			y = x - k;
+			while (x < xlim && y < ylim && a[x] == b[y]) {
+				x++;
+				y++;
+			}
+			fv[k] = x;
+			/* backward search is one edit behind */
+			if (odd && blo <= k && k <= bhi && bv[k] <= x) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+		flo = lo;
+		fhi = hi;
+
+		/* Backward, the same way */
+		lo = kb - D;
+		if (lo < kmin)
+			lo = kmin + ((kmin - lo) & 1);
+		hi = kb + D;
+		if (hi > kmax)
+			hi = kmax - ((hi - kmax) & 1);
+		for (k = lo; k <= hi; k += 2) {
+			int x, y;
+
+			if (D == 0)
+				x = xlim;
+			else if (k + 1 > bhi || (k - 1 >= blo && bv[k - 1] < bv[k + 1] - 1))
+				x = bv[k - 1];      /* up from k-1 */
+			else
+				x = bv[k + 1] - 1;  /* left from k+1 */
+			if (x < xoff)
+				x = xoff;
+			if (x - k < yoff)
+				x = yoff + k;
+			y = x - k;
+			while (x > xoff && y > yoff && a[x - 1] == b[y - 1]) {
+				x--;
+				y--;
+			}
+			bv[k] = x;
+			if (!odd && flo <= k && k <= fhi && x <= fv[k]) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+		blo = lo;
+		bhi = hi;
+
+		if (D >= m->too_expensive) {
+			int best = -1;
+
+			for (k = flo; k <= fhi; k += 2) {
+				int x = fv[k];
+				if (x + (x - k) - (xoff + yoff) > best) {
+					best = x + (x - k) - (xoff + yoff);
+					*px = x;
+					*py = x - k;
+				}
+			}
+			for (k = blo; k <= bhi; k += 2) {
+				int x = bv[k];
+				if ((xlim + ylim) - (x + (x - k)) > best) {
+					best = (xlim + ylim) - (x + (x - k));
+					*px = x;
+					*py = x - k;
+				}
+			}
+			return;
+		}
+	}
+}
+
+/* Records the matching lines of a[xoff..xlim) and b[yoff..ylim) in J */
+static void myers_compare(struct myers *m, int xoff, int xlim, int yoff, int ylim)
+{
+	while (1) {
+		int x, y;
+
+		while (xoff < xlim && yoff < ylim && m->a[xoff] == m->b[yoff])
+			m->J[++xoff] = ++yoff;
+		while (xlim > xoff && ylim > yoff && m->a[xlim - 1] == m->b[ylim - 1])
+			m->J[xlim--] = ylim--;
+		if (xoff == xlim || yoff == ylim)
+			return;
+
+		myers_midpoint(m, xoff, xlim, yoff, ylim, &x, &y);
+		myers_compare(m, xoff, x, yoff, y);
+		/* the second half iteratively */
+		xoff = x;
+		yoff = y;
+	}
+}
+
+/* Line in canonical form: what read_token() would return for it */
+struct myers_text {
+	const char *p;
+	unsigned len;
+	unsigned eof;  /* line ended with EOF token, not '\n' */
+};
+
+/* Interned line */
+struct myers_class {
+	unsigned hash;
+	unsigned len;
+	unsigned eof;
+	const char *p; /* line in the file, or... */
+	size_t ofs;    /* ...its canonical form in the arena (-b/-i/-w) */
+};
+
+/* Applies -b/-i/-w to line P of LEN bytes into OUT (LEN + 1 bytes) */
+static void myers_canon(struct myers_text *t, const char *p, unsigned len, int nl, char *out)
+{
+	unsigned i, n = 0;
+	int prev_space = 0;
+
+	t->eof = 0;
+	for (i = 0; i <= len; i++) {
+		int c = (i < len) ? (unsigned char)p[i] : (nl ? '\n' : EOF);
+		int is_space = (c == EOF || isspace(c));
+
+		if (option_mask32 & FLAG(i))
+			c = (c >= 'A' && c <= 'Z') ? c - ('A' - 'a') : c;
+		if ((option_mask32 & FLAG(w)) && is_space)
+			continue;
+		if (option_mask32 & FLAG(b)) {
+			if (prev_space) {
+				if (is_space)
+					continue;
+				prev_space = 0;
+			} else if (is_space) {
+				c = ' ';
+				prev_space = 1;
+			}
+		}
+		if (c == EOF)
+			t->eof = 1;
+		else
+			out[n++] = c;
+	}
+	t->p = out;
+	t->len = n;
+}
+
+static unsigned myers_hash(const struct myers_text *t)
+{
+	/* same hash as in create_J() */
+	unsigned hash = t->eof;
+	unsigned i;
+
+	for (i = 0; i < t->len; i++)
+		hash = hash * 127 + (unsigned char)t->p[i];
+	return hash;
+}
+
+/* Maps or reads the file behind FT */
+static char *myers_load(FILE_and_pos_t *ft, size_t *size, bool *mapped)
+{
+	int fd = fileno(ft->ft_fp);
+	struct stat st;
+	char *p;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	 && st.st_size == (size_t)st.st_size
+	) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			*size = st.st_size;
+			*mapped = true;
+			return p;
+		}
+	}
+	/* /proc files, char devices... */
+	*mapped = false;
+	xlseek(fd, 0, SEEK_SET);
+	*size = INT_MAX;
+	return xmalloc_read(fd, size);
+}
+
+static bool use_myers(FILE_and_pos_t ft[2])
+{
+	struct stat st;
+	off_t size = 0;
+	int i;
+
+	if (option_mask32 & FLAG(H))
+		return true;
+	/* diffreg() has copied pipes to temp files, these are regular */
+	for (i = 0; i < 2; i++)
+		if (fstat(fileno(ft[i].ft_fp), &st) == 0)
+			size += st.st_size;
+	return size >= MYERS_MIN_SIZE;
+}
+
+static NOINLINE int *create_J_myers(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
+{
+	struct myers m;
+	const bool canon = option_mask32 & (FLAG(b) | FLAG(i) | FLAG(w));
+	char *data[2];
+	size_t size[2];
+	bool mapped[2];
+	int *class[2];
+	struct myers_class *cls = NULL;
+	int *htab;
+	unsigned hmask;
+	char *arena = NULL;
+	size_t arena_len = 0, arena_size = 0;
+	char *scratch = NULL;
+	size_t scratch_size = 0;
+	int nclasses = 0;
+	int pref, suff, i, j;
+
+	for (i = 0; i < 2; i++) {
+		off_t ofs;
+		int n;
+
+		data[i] = myers_load(&ft[i], &size[i], &mapped[i]);
+		/* fetch() will read the lines with stdio */
+		ft[i].ft_pos = 0;
+		fseeko(ft[i].ft_fp, 0, SEEK_SET);
+
+		/* Line i ends at ix[i] (after its '\n'). Like create_J() does,
+		 * a last line without '\n' ends one byte after EOF */
+		n = 0;
+		ix[i] = xmalloc(2 * sizeof(ix[i][0]));
+		ix[i][0] = 0;
+		ofs = 0;
+		while ((size_t)ofs < size[i]) {
+			const char *nl = memchr(data[i] + ofs, '\n', size[i] - ofs);
+			ofs = nl ? nl - data[i] + 1 : size[i] + 1;
+			if ((n & 0xfff) == 0)
+				ix[i] = xrealloc(ix[i], (n + 0x1000 + 2) * sizeof(ix[i][0]));
+			ix[i][++n] = ofs;
+		}
+		nlen[i] = n;
+	}
+
+	hmask = 1;
+	while (hmask < 2 * (unsigned)(nlen[0] + nlen[1]))
+		hmask <<= 1;
+	htab = xzalloc(hmask * sizeof(htab[0]));
+	hmask--;
+
+	for (i = 0; i < 2; i++) {
+		class[i] = xmalloc((nlen[i] + 1) * sizeof(class[i][0]));
+		for (j = 1; j <= nlen[i]; j++) {
+			struct myers_text t;
+			const char *p = data[i] + ix[i][j - 1];
+			unsigned len = ix[i][j] - ix[i][j - 1] - 1;
+			int nl = (size_t)ix[i][j] <= size[i];
+			unsigned hash, h;
+
+			if (canon) {
+				if (len + 1 > scratch_size) {
+					scratch_size = len + 1 + 256;
+					scratch = xrealloc(scratch, scratch_size);
+				}
+				myers_canon(&t, p, len, nl, scratch);
+			} else {
+				t.p = p;
+				t.len = len;
+				t.eof = !nl;
+			}
+			hash = myers_hash(&t);
+			for (h = hash;; h++) {
+				struct myers_class *e;
+				int c = htab[h & hmask] - 1;
+
+				if (c < 0) {
+					/* new line */
+					c = nclasses++;
+					cls = xrealloc_vector(cls, 10, c);
+					e = &cls[c];
+					e->hash = hash;
+					e->len = t.len;
+					e->eof = t.eof;
+					e->p = t.p;
+					if (canon) {
+						/* scratch is reused, keep a copy */
+						if (arena_len + t.len > arena_size) {
+							arena_size = (arena_len + t.len) * 2 + 4096;
+							arena = xrealloc(arena, arena_size);
+						}
+						memcpy(arena + arena_len, t.p, t.len);
+						e->ofs = arena_len;
+						arena_len += t.len;
+					}
+					htab[h & hmask] = c + 1;
+					class[i][j - 1] = c;
+					break;
+				}
+				e = &cls[c];
+				if (e->hash == hash && e->len == t.len && e->eof == t.eof
+				 && memcmp(canon ? arena + e->ofs : e->p, t.p, t.len) == 0
+				) {
+					class[i][j - 1] = c;
+					break;
+				}
+			}
+		}
+	}
+	free(htab);
+	free(cls);
+	free(arena);
+	free(scratch);
+
+	m.J = xzalloc((nlen[0] + 2) * sizeof(m.J[0]));
+	m.a = class[0];
+	m.b = class[1];
+
+	/* Common prefix and suffix need no diagonals */
+	for (pref = 0; pref < nlen[0] && pref < nlen[1] && m.a[pref] == m.b[pref]; pref++)
+		m.J[pref + 1] = pref + 1;
+	for (suff = 0; suff < nlen[0] - pref && suff < nlen[1] - pref
+	     && m.a[nlen[0] - suff - 1] == m.b[nlen[1] - suff - 1]; suff++)
+		m.J[nlen[0] - suff] = nlen[1] - suff;
+
+	if (pref + suff < nlen[0] && pref + suff < nlen[1]) {
+		/* diagonals are xoff - ylim .. xlim - yoff, plus one on each side */
+		int ndiags = nlen[0] + nlen[1] - 2 * (pref + suff) + 3;
+		int dofs = nlen[1] - suff + 1;
+		m.fdiag = xmalloc(2 * ndiags * sizeof(m.fdiag[0]));
+		m.bdiag = m.fdiag + ndiags;
+		m.fdiag += dofs - pref;
+		m.bdiag += dofs - pref;
+		m.too_expensive = (option_mask32 & FLAG(d)) ? INT_MAX
+				: MAX(4096, (int)isqrt(ndiags));
+		myers_compare(&m, pref, nlen[0] - suff, pref, nlen[1] - suff);
+		free(m.fdiag - dofs + pref);
+	}
+	m.J[nlen[0] + 1] = nlen[1] + 1;
+
+	for (i = 0; i < 2; i++) {
+		free(class[i]);
+		if (mapped[i])
+			munmap(data[i], size[i]);
+		else
+			free(data[i]);
+	}
+	return m.J;
+}
+#endif
+
 static bool diff(FILE* fp[2], char *file[2])
 {
 	int nlen[2];
@@ -595,7 +1014,12 @@ static bool diff(FILE* fp[2], char *file[2])
 	ft[1].ft_fp = fp[1];
 	/* note that ft[i].ft_pos is unintitalized, create_J()
 	 * must not assume otherwise */
-	J = create_J(ft, nlen, ix);
+#if ENABLE_FEATURE_DIFF_MYERS
+	if (use_myers(ft))
+		J = create_J_myers(ft, nlen, ix);
+	else
+#endif
+		J = create_J(ft, nlen, ix);
 
 	do {
 		bool nonempty = false;
@@ -850,7 +1274,7 @@ static void diffdir(char *p[2], const char *s_start)
 		 * Using list.len to specify its length,
 		 * add_to_dirlist will remove it. */
 		list[i].len = strlen(p[i]);
-		recursive_action(p[i], ACTION_RECURSE | ACTION_FOLLOWLINKS,
+		recursive_action(p[i], ACTION_RECURSE | ACTION_FOLLOWLINKS | ACTION_PARALLEL,
 		                 add_to_dirlist, skip_dir, &list[i], 0);
 		/* Sort dl alphabetically.
 		 * GNU diff does this ignoring any number of trailing dots.
@@ -947,6 +1371,9 @@ static const char diff_longopts[] ALIGN1 =
 	"report-identical-files\0"   No_argument       "s"
 	"starting-file\0"            Required_argument "S"
 	"minimal\0"                  No_argument       "d"
+	IF_FEATURE_DIFF_MYERS(
+	"speed-large-files\0"        No_argument       "H"
+	)
 	;
 #endif
 
@@ -964,7 +1391,7 @@ int diff_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_DIFF_LONG_OPTIONS
 	applet_long_options = diff_longopts;
 #endif
-	getopt32(argv, "abdiL:NqrsS:tTU:wupBE",
+	getopt32(argv, "abdiL:NqrsS:tTU:wupBE" IF_FEATURE_DIFF_MYERS("H"),
 			&L_arg, &s_start, &opt_U_context);
 	argv += optind;
 	while (L_arg)
@@ -137,6 +137,15 @@
 //config:	  Support the 'find -exec' option for executing commands based upon
 //config:	  the files matched.
 //config:
+//config:config FEATURE_FIND_EXEC_PLUS
+//config:	bool "Enable -exec ... {} +"
+//config:	default y
+//config:	depends on FEATURE_FIND_EXEC
+//config:	help
+//config:	  Support the 'find -exec ... {} +' option for executing commands
+//config:	  for all matched files at once (as many as fit in one
+//config:	  command line), instead of once per file.
+//config:
 //config:config FEATURE_FIND_USER
 //config:	bool "Enable -user: username/uid matching"
 //config:	default y
@@ -318,6 +327,10 @@
 //usage:     "\n	-exec CMD ARG ;	Run CMD with all instances of {} replaced by"
 //usage:     "\n			file name. Fails if CMD exits with nonzero"
 //usage:	)
+//usage:	IF_FEATURE_FIND_EXEC_PLUS(
+//usage:     "\n	-exec CMD ARG {} +	Run CMD with {} replaced by list of file names."
+//usage:     "\n			Always true, find fails if CMD exits with nonzero"
+//usage:	)
 //usage:	IF_FEATURE_FIND_DELETE(
 //usage:     "\n	-delete		Delete current file/directory. Turns on -depth option"
 //usage:	)
@@ -374,7 +387,16 @@ IF_FEATURE_FIND_CONTEXT(ACTS(context, security_context_t context;))
 IF_FEATURE_FIND_PAREN(  ACTS(paren, action ***subexpr;))
 IF_FEATURE_FIND_PRUNE(  ACTS(prune))
 IF_FEATURE_FIND_DELETE( ACTS(delete))
-IF_FEATURE_FIND_EXEC(   ACTS(exec,  char **exec_argv; unsigned *subst_count; int exec_argc;))
+IF_FEATURE_FIND_EXEC(   ACTS(exec,  char **exec_argv; unsigned *subst_count; int exec_argc;
+	IF_FEATURE_FIND_EXEC_PLUS(
+		/* "-exec CMD {} +": file names collected so far, NUL separated.
+		 * file_max is 0 for "-exec CMD ;" */
+		char *file_buf;
+		unsigned file_len, file_buf_size, file_max;
+		int file_cnt;
+		void *next_plus;
+	)
+))
 IF_FEATURE_FIND_GROUP(  ACTS(group, gid_t gid;))
 IF_FEATURE_FIND_LINKS(  ACTS(links, char links_char; int links_count;))
 
@@ -385,6 +407,8 @@ struct globals {
 	int minmaxdepth[2];
 #endif
 	action ***actions;
+	IF_FEATURE_FIND_EXEC_PLUS(action_exec *exec_plus;) /* list of "-exec {} +", in command line order */
+	IF_FEATURE_FIND_EXEC_PLUS(smallint exec_plus_failed;)
 	smallint need_print;
 	smallint xdev_on;
 	recurse_flags_t recurse_flags;
@@ -398,7 +422,7 @@ struct globals {
 	memset(&G, 0, sizeof(G)); \
 	IF_FEATURE_FIND_MAXDEPTH(G.minmaxdepth[1] = INT_MAX;) \
 	G.need_print = 1; \
-	G.recurse_flags = ACTION_RECURSE; \
+	G.recurse_flags = ACTION_RECURSE | ACTION_PARALLEL; \
 } while (0)
 
 #if ENABLE_FEATURE_FIND_EXEC
@@ -605,13 +629,76 @@ ACTF(inum)
 }
 #endif
 #if ENABLE_FEATURE_FIND_EXEC
+# if ENABLE_FEATURE_FIND_EXEC_PLUS
+/* Run "-exec CMD {} +" with the file names collected so far */
+static void flush_exec_plus(action_exec *ap)
+{
+	char **argv;
+	char *p;
+	int i, rc;
+
+	if (ap->file_cnt == 0)
+		return;
+	argv = xmalloc((ap->exec_argc + ap->file_cnt + 1) * sizeof(argv[0]));
+	memcpy(argv, ap->exec_argv, ap->exec_argc * sizeof(argv[0]));
+	p = ap->file_buf;
+	for (i = ap->exec_argc; i < ap->exec_argc + ap->file_cnt; i++) {
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	argv[i] = NULL;
+
+	rc = spawn_and_wait(argv);
+	if (rc < 0)
+		bb_simple_perror_msg(argv[0]);
+	/* "-exec {} +" is always true, but find's exit code is not */
+	if (rc != 0)
+		G.exec_plus_failed = 1;
+
+	free(argv);
+	ap->file_cnt = 0;
+	ap->file_len = 0;
+}
+
+static void flush_all_exec_plus(void)
+{
+	action_exec *ap;
+
+	for (ap = G.exec_plus; ap; ap = ap->next_plus)
+		flush_exec_plus(ap);
+}
+# endif
+
 ACTF(exec)
 {
 	int i, rc;
 #if ENABLE_USE_PORTABLE_CODE
-	char **argv = alloca(sizeof(char*) * (ap->exec_argc + 1));
+	char **argv;
 #else /* gcc 4.3.1 generates smaller code: */
 	char *argv[ap->exec_argc + 1];
+#endif
+# if ENABLE_FEATURE_FIND_EXEC_PLUS
+	if (ap->file_max) {
+		/* Each name costs its bytes and an argv[] pointer */
+		unsigned len = strlen(fileName) + 1;
+		unsigned need = ap->file_len + len;
+
+		if (need + (ap->file_cnt + 1) * sizeof(char*) > ap->file_max) {
+			flush_exec_plus(ap);
+			need = len;
+		}
+		if (need > ap->file_buf_size) {
+			ap->file_buf_size = need + 4096;
+			ap->file_buf = xrealloc(ap->file_buf, ap->file_buf_size);
+		}
+		memcpy(ap->file_buf + ap->file_len, fileName, len);
+		ap->file_len = need;
+		ap->file_cnt++;
+		return 1;
+	}
+# endif
+#if ENABLE_USE_PORTABLE_CODE
+	argv = alloca(sizeof(char*) * (ap->exec_argc + 1));
 #endif
 	for (i = 0; i < ap->exec_argc; i++)
 		argv[i] = subst(ap->exec_argv[i], ap->subst_count[i], fileName);
@@ -1025,17 +1112,52 @@ static action*** parse_params(char **argv)
 					bb_error_msg_and_die(bb_msg_requires_arg, "-exec");
 				// find -exec echo Foo ">{}<" ";"
 				// executes "echo Foo >FILENAME<",
-				// find -exec echo Foo ">{}<" "+"
+				// find -exec echo Foo "{}" "+"
 				// executes "echo Foo FILENAME1 FILENAME2 FILENAME3...".
-				// TODO (so far we treat "+" just like ";")
-				if ((argv[0][0] == ';' || argv[0][0] == '+')
-				 && argv[0][1] == '\0'
-				) {
+				if (LONE_CHAR(argv[0], ';'))
 					break;
+				if (LONE_CHAR(argv[0], '+')) {
+					if (!ENABLE_FEATURE_FIND_EXEC_PLUS)
+						break; /* treat "+" just like ";" */
+					/* "+" ends -exec only after lone "{}" */
+					if (ap->exec_argc && strcmp(argv[-1], "{}") == 0)
+						break;
 				}
 				argv++;
 				ap->exec_argc++;
 			}
+#if ENABLE_FEATURE_FIND_EXEC_PLUS
+			if (LONE_CHAR(argv[0], '+')) {
+				unsigned max;
+
+				/* "{}" is not part of the fixed arguments */
+				ap->exec_argc--;
+				/* Room for file names: what exec allows,
+				 * less our environment and fixed arguments.
+				 * Capped: it's pointless to make it huge */
+				max = bb_arg_max();
+				for (i = 0; environ[i]; i++)
+					max -= strlen(environ[i]) + 1 + sizeof(char*);
+				for (i = 0; i < ap->exec_argc; i++) {
+					/* Only the last argument may be "{}" */
+					if (strstr(ap->exec_argv[i], "{}"))
+						bb_error_msg_and_die("only one {} is supported with -exec ... +");
+					max -= strlen(ap->exec_argv[i]) + 1 + sizeof(char*);
+				}
+				if ((int)max > 128 * 1024)
+					max = 128 * 1024;
+				if ((int)max < 1024)
+					max = 1024;
+				ap->file_max = max;
+				/* Append: flush in command line order */
+				{
+					void **pp = (void**)&G.exec_plus;
+					while (*pp)
+						pp = &((action_exec*)*pp)->next_plus;
+					*pp = ap;
+				}
+			}
+#endif
 			if (ap->exec_argc == 0)
 				bb_error_msg_and_die(bb_msg_requires_arg, arg);
 			ap->subst_count = xmalloc(ap->exec_argc * sizeof(int));
@@ -1285,6 +1407,11 @@ int find_main(int argc UNUSED_PARAM, char **argv)
 			status = EXIT_FAILURE;
 		}
 	}
+#if ENABLE_FEATURE_FIND_EXEC_PLUS
+	flush_all_exec_plus();
+	if (G.exec_plus_failed)
+		status = EXIT_FAILURE;
+#endif
 
 	return status;
 }
@@ -56,6 +56,16 @@
 //config:	  Print the specified number of leading (-B) and/or trailing (-A)
 //config:	  context surrounding our matching lines.
 //config:	  Print the specified number of context lines (-C).
+//config:
+//config:config FEATURE_GREP_FAST
+//config:	bool "Search whole blocks of input for fixed strings"
+//config:	default y
+//config:	depends on GREP && !EXTRA_COMPAT
+//config:	help
+//config:	  Unless -v or context lines are requested, read input in big
+//config:	  blocks and search them for the -F patterns (or for a string
+//config:	  every match of the regex must contain) instead of testing
+//config:	  every line. Much faster on big files with few matches.
 
 #include "libbb.h"
 #include "xregex.h"
@@ -197,6 +207,9 @@ struct globals {
 	/* globals used internally */
 	llist_t *pattern_head;   /* growable list of patterns to match */
 	const char *cur_file;    /* the current file we are reading */
+#if ENABLE_FEATURE_GREP_FAST
+	struct grep_fast *fast;  /* NULL if every line must be tested */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -304,6 +317,404 @@ static ssize_t FAST_FUNC bb_getline(char **line_ptr, size_t *line_alloc_len, FIL
 }
 #endif
 
+#if ENABLE_FEATURE_GREP_FAST
+/* Without -v and context lines, lines which do not match are simply
+ * skipped. Every matching line contains one of a few literal strings:
+ * the -F patterns themselves, or for regexes a string every match
+ * must contain. The input is read in big blocks which are searched
+ * for these strings, and only lines with a hit are returned to
+ * grep_file(). One string is searched for with Boyer-Moore-Horspool,
+ * several with an Aho-Corasick automaton.
+ */
+#define FAST_BUFSIZE (64 * 1024)
+
+struct ac_node {
+	int child;    /* first child, 0: none (root is never a child) */
+	int next;     /* next sibling */
+	int fail;     /* longest proper suffix which is in the trie */
+	uint8_t c;
+	uint8_t out;  /* a string ends here or at a suffix */
+};
+
+struct grep_fast {
+	uint8_t fold[256];
+	/* Boyer-Moore-Horspool, for one string */
+	unsigned skip[256];
+	uint8_t *needle;
+	unsigned needle_len;
+	/* Aho-Corasick, for several */
+	struct ac_node *ac;
+	int root[256];
+	/* A hit is a match (-F): patterns need not be tested */
+	smallint exact;
+	smallint verified;  /* for the line just returned */
+	smallint icase;
+	smallint eof;
+	/* [start,lim) - whole lines not yet searched,
+	 * [lim,end) - incomplete last line */
+	char *buf;
+	size_t size, start, lim, end;
+};
+
+static const char *skip_bracket(const char *p)
+{
+	p++;
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	while (*p != ']') {
+		if (!*p)
+			return NULL;
+		if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			char d = p[1];
+			p += 2;
+			while (!(p[0] == d && p[1] == ']')) {
+				if (!*p)
+					return NULL;
+				p++;
+			}
+			p++;
+		}
+		p++;
+	}
+	return p + 1;
+}
+
+/* Longest string every match of the regex PAT must contain.
+ * Errs on the safe side: NULL if unsure, or if PAT has alternatives
+ * or groups */
+static char *required_literal(const char *pat)
+{
+	int ere = (reflags & REG_EXTENDED);
+	char *best = NULL;
+	char *cur = xmalloc(strlen(pat) + 1);
+	unsigned len = 0, best_len = 0;
+
+	while (1) {
+		const char *next = pat + 1;
+		int c = (unsigned char)*pat;
+
+		if (c == '\\') {
+			c = (unsigned char)pat[1];
+			next = pat + 2;
+			if (!ere && (c == '(' || c == ')' || c == '|'))
+				goto bail;
+			if (!ere && c == '{') {
+				next = strstr(next, "\\}");
+				if (!next)
+					goto bail;
+				next += 2;
+				c = -1;
+			} else if (!c || !(strchr(".[]*^$\\/-", c) || (ere && strchr("+?{}()|", c)))) {
+				/* \<, \w, \1, trailing \ ... */
+				if (!c)
+					next--;
+				c = -1;
+			}
+		} else if (c == '[') {
+			next = skip_bracket(pat);
+			if (!next)
+				goto bail;
+			c = -1;
+		} else if (ere && (c == '(' || c == ')' || c == '|')) {
+			goto bail;
+		} else if (ere && c == '{') {
+			next = strchr(next, '}');
+			if (!next)
+				goto bail;
+			next++;
+			c = -1;
+		} else if (c == '.' || c == '*' || c == '^' || c == '$'
+		 || (ere && (c == '+' || c == '?'))
+		 || (ENABLE_LOCALE_SUPPORT && c >= 0x80) /* may be part of a multibyte char */
+		) {
+			c = -1;
+		}
+		/* Repeat operator after it makes it optional */
+		if (c > 0 && (*next == '*'
+		 || (ere && (*next == '?' || *next == '+' || *next == '{'))
+		 || (!ere && next[0] == '\\' && (next[1] == '?' || next[1] == '+' || next[1] == '{')))
+		) {
+			c = -1;
+		}
+		if (c > 0) {
+			cur[len++] = c;
+		} else {
+			if (len > best_len) {
+				free(best);
+				best = xstrndup(cur, len);
+				best_len = len;
+			}
+			len = 0;
+			if (!*pat)
+				break;
+		}
+		pat = next;
+	}
+	free(cur);
+	return best;
+ bail:
+	free(cur);
+	free(best);
+	return NULL;
+}
+
+static int ac_child(const struct ac_node *ac, int s, unsigned c)
+{
+	for (s = ac[s].child; s; s = ac[s].next)
+		if (ac[s].c == c)
+			break;
+	return s;
+}
+
+static void ac_build(struct grep_fast *f, char **lit, unsigned cnt)
+{
+	struct ac_node *ac = NULL;
+	int *queue;
+	unsigned n, i, head;
+
+	ac = xrealloc_vector(ac, 8, 0); /* root */
+	n = 1;
+	for (i = 0; i < cnt; i++) {
+		const uint8_t *p = (uint8_t *)lit[i];
+		int s = 0;
+		while (*p) {
+			int t = ac_child(ac, s, *p);
+			if (!t) {
+				ac = xrealloc_vector(ac, 8, n);
+				t = n++;
+				ac[t].c = *p;
+				ac[t].next = ac[s].child;
+				ac[s].child = t;
+			}
+			s = t;
+			p++;
+		}
+		ac[s].out = 1;
+	}
+
+	/* Breadth first, fail links of shallower nodes are known */
+	queue = xmalloc(n * sizeof(queue[0]));
+	queue[0] = 0;
+	head = 0;
+	i = 1;
+	while (head < i) {
+		int u = queue[head++];
+		int v;
+		for (v = ac[u].child; v; v = ac[v].next) {
+			int t = 0;
+			if (u != 0) {
+				int s = ac[u].fail;
+				while ((t = ac_child(ac, s, ac[v].c)) == 0 && s != 0)
+					s = ac[s].fail;
+			}
+			ac[v].fail = t;
+			ac[v].out |= ac[t].out;
+			queue[i++] = v;
+		}
+	}
+	free(queue);
+
+	for (i = 0; i < 256; i++)
+		f->root[i] = ac_child(ac, 0, i);
+	f->ac = ac;
+}
+
+/* Returns pointer to the last byte of the first hit in [p,end) */
+static char *fast_search(const uint8_t *p, const uint8_t *end)
+{
+	struct grep_fast *f = G.fast;
+	const uint8_t *fold = f->fold;
+
+	if (!f->ac) {
+		const uint8_t *nd = f->needle;
+		unsigned last = f->needle_len - 1;
+
+		if (last == 0 && !f->icase)
+			return memchr(p, nd[0], end - p);
+		p += last;
+		while (p < end) {
+			unsigned c = fold[*p];
+			if (c == nd[last]) {
+				const uint8_t *s = p - last;
+				unsigned i = 0;
+				while (i < last && fold[s[i]] == nd[i])
+					i++;
+				if (i == last)
+					return (char *)p;
+			}
+			p += f->skip[c];
+		}
+	} else {
+		const struct ac_node *ac = f->ac;
+		int s = 0;
+
+		for (; p < end; p++) {
+			unsigned c = fold[*p];
+			int t;
+			while (s != 0 && (t = ac_child(ac, s, c)) == 0)
+				s = ac[s].fail;
+			s = s ? t : f->root[c];
+			if (ac[s].out)
+				return (char *)p;
+		}
+	}
+	return NULL;
+}
+
+static void fast_init(void)
+{
+	struct grep_fast *f;
+	llist_t *cur;
+	char **lit = NULL;
+	unsigned cnt = 0, i;
+
+	if (invert_search IF_FEATURE_GREP_CONTEXT(|| lines_before || lines_after))
+		return;
+	for (cur = pattern_head; cur; cur = cur->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+		char *s = FGREP_FLAG ? xstrdup(gl->pattern) : required_literal(gl->pattern);
+		uint8_t *p;
+
+		if (!s)
+			goto ret;
+		lit = xrealloc_vector(lit, 4, cnt);
+		lit[cnt++] = s;
+		/* Empty string matches everywhere.
+		 * Neither -F nor regex can match a newline */
+		if (!s[0] || strchr(s, '\n'))
+			goto ret;
+		if (option_mask32 & OPT_i) {
+			for (p = (uint8_t *)s; *p; p++) {
+				if (*p >= 0x80)
+					goto ret;
+				*p = tolower(*p);
+			}
+		}
+	}
+
+	f = G.fast = xzalloc(sizeof(*f));
+	f->icase = (option_mask32 & OPT_i) != 0;
+	for (i = 0; i < 256; i++)
+		f->fold[i] = f->icase && i < 0x80 ? tolower(i) : i;
+	/* strcasestr() may fold more than ASCII in other locales */
+	f->exact = FGREP_FLAG && !(option_mask32 & OPT_o)
+		&& (!f->icase || !ENABLE_LOCALE_SUPPORT);
+	if (cnt == 1) {
+		f->needle = (uint8_t *)lit[0];
+		f->needle_len = strlen(lit[0]);
+		for (i = 0; i < 256; i++)
+			f->skip[i] = f->needle_len;
+		for (i = 0; i < f->needle_len - 1; i++)
+			f->skip[f->needle[i]] = f->needle_len - 1 - i;
+		cnt = 0; /* don't free it */
+	} else {
+		ac_build(f, lit, cnt);
+	}
+	f->size = FAST_BUFSIZE;
+	f->buf = xmalloc(f->size);
+ ret:
+	while (cnt)
+		free(lit[--cnt]);
+	free(lit);
+}
+
+/* Reads more input. Returns 0 at end of file */
+static int fast_fill(FILE *file)
+{
+	struct grep_fast *f = G.fast;
+
+	while (1) {
+		size_t n;
+		ssize_t r;
+		char *nl;
+
+		if (f->eof) {
+			if (f->lim == f->end)
+				return 0;
+			/* Last line has no newline */
+			f->lim = f->end;
+			return 1;
+		}
+		/* Move the incomplete line to the start */
+		n = f->end - f->start;
+		memmove(f->buf, f->buf + f->start, n);
+		f->start = f->lim = 0;
+		f->end = n;
+		if (n == f->size) {
+			f->size *= 2;
+			f->buf = xrealloc(f->buf, f->size);
+		}
+		/* Not fread: it would wait for a full buffer from a pipe */
+		r = safe_read(fileno(file), f->buf + n, f->size - n);
+		if (r <= 0) {
+			f->eof = 1;
+			continue;
+		}
+		f->end = n + r;
+		nl = memrchr(f->buf + n, '\n', r);
+		if (nl) {
+			f->lim = nl + 1 - f->buf;
+			return 1;
+		}
+	}
+}
+
+/* xmalloc_fgetline() ends lines at NUL too */
+static int count_lines(const char *p, const char *end)
+{
+	const char *q = p;
+	int n = 0;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		p++;
+		n++;
+	}
+	while ((q = memchr(q, '\0', end - q)) != NULL) {
+		q++;
+		n++;
+	}
+	return n;
+}
+
+/* Next line with a hit, lines skipped over are added to *LINENUM */
+static char *fast_next_line(FILE *file, int *linenum)
+{
+	struct grep_fast *f = G.fast;
+
+	while (f->start != f->lim || fast_fill(file)) {
+		char *start = f->buf + f->start;
+		char *lim = f->buf + f->lim;
+		char *hit, *ls, *le, *nul;
+
+		hit = fast_search((uint8_t *)start, (uint8_t *)lim);
+		if (!hit) {
+			if (PRINT_LINE_NUM)
+				*linenum += count_lines(start, lim);
+			f->start = f->lim;
+			continue;
+		}
+		ls = memrchr(start, '\n', hit - start);
+		ls = ls ? ls + 1 : start;
+		while ((nul = memchr(ls, '\0', hit - ls)) != NULL)
+			ls = nul + 1;
+		le = memchr(hit, '\n', lim - hit);
+		if (!le)
+			le = lim;
+		nul = memchr(hit, '\0', le - hit);
+		if (nul)
+			le = nul;
+		if (PRINT_LINE_NUM)
+			*linenum += count_lines(start, ls);
+		f->start = le - f->buf + (le != lim);
+		f->verified = f->exact;
+		return xstrndup(ls, le - ls);
+	}
+	return NULL;
+}
+#endif
+
 static int grep_file(FILE *file)
 {
 	smalluint found;
@@ -326,9 +737,16 @@ static int grep_file(FILE *file)
 	enum { print_n_lines_after = 0 };
 #endif
 
+#if ENABLE_FEATURE_GREP_FAST
+	if (G.fast) {
+		G.fast->start = G.fast->lim = G.fast->end = 0;
+		G.fast->eof = 0;
+	}
+#endif
 	while (
 #if !ENABLE_EXTRA_COMPAT
-		(line = xmalloc_fgetline(file)) != NULL
+		(line = IF_FEATURE_GREP_FAST(G.fast ? fast_next_line(file, &linenum) :)
+			xmalloc_fgetline(file)) != NULL
 #else
 		(line_len = bb_getline(&line, &line_alloc_len, file)) >= 0
 #endif
@@ -338,6 +756,12 @@ static int grep_file(FILE *file)
 
 		linenum++;
 		found = 0;
+#if ENABLE_FEATURE_GREP_FAST
+		if (G.fast && G.fast->verified) {
+			found = 1;
+			goto do_found;
+		}
+#endif
 		while (pattern_ptr) {
 			gl = (grep_list_data_t *)pattern_ptr->data;
 			if (FGREP_FLAG) {
@@ -601,7 +1025,7 @@ static int grep_dir(const char *dir)
 {
 	int matched = 0;
 	recursive_action(dir,
-		/* recurse=yes */ ACTION_RECURSE |
+		/* recurse=yes */ ACTION_RECURSE | ACTION_PARALLEL |
 		/* followLinks=no */
 		/* depthFirst=yes */ ACTION_DEPTHFIRST,
 		/* fileAction= */ file_action_grep,
@@ -716,6 +1140,7 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		pattern = new_grep_list_data(*argv++, 0);
 		llist_add_to(&pattern_head, pattern);
 	}
+	IF_FEATURE_GREP_FAST(fast_init();)
 
 	/* argv[0..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames. */
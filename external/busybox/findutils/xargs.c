@@ -53,6 +53,14 @@
 //config:	  Support -0: input items are terminated by a NUL character
 //config:	  instead of whitespace, and the quotes and backslash
 //config:	  are not special.
+//config:
+//config:config FEATURE_XARGS_SUPPORT_PARALLEL
+//config:	bool "Enable -P N: run up to N commands in parallel"
+//config:	default y
+//config:	depends on XARGS
+//config:	help
+//config:	  Support -P N: keep up to N commands running at once,
+//config:	  starting a new one whenever one exits.
 
 //applet:IF_XARGS(APPLET_NOEXEC(xargs, xargs, BB_DIR_USR_BIN, BB_SUID_DROP, xargs))
 
@@ -68,6 +76,9 @@
 
 
 #ifdef TEST
+# ifndef ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+#  define ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL 1
+# endif
 # ifndef ENABLE_FEATURE_XARGS_SUPPORT_CONFIRMATION
 #  define ENABLE_FEATURE_XARGS_SUPPORT_CONFIRMATION 1
 # endif
@@ -87,38 +98,90 @@ struct globals {
 	char **args;
 	const char *eof_str;
 	int idx;
+	int child_error; /* the worst exit code of all commands so far */
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	int max_procs;
+	int running_procs;
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { \
-	G.eof_str = NULL; /* need to clear by hand because we are NOEXEC applet */ \
+	/* need to clear by hand because we are NOEXEC applet */ \
+	G.eof_str = NULL; \
+	G.child_error = 0; \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.max_procs = 1;) \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.running_procs = 0;) \
 } while (0)
 
 
-/*
- * This function has special algorithm.
- * Don't use fork and include to main!
+/* Account for status of a finished command (as wait4pid returns it).
+ * Exit codes are ordered by severity, we remember the worst one:
+ * which command finished first does not matter with -P.
  */
-static int xargs_exec(void)
+static void xargs_status(int status)
 {
-	int status;
+	int code = 0;
 
-	status = spawn_and_wait(G.args);
 	if (status < 0) {
 		bb_simple_perror_msg(G.args[0]);
-		return errno == ENOENT ? 127 : 126;
-	}
-	if (status == 255) {
+		code = (errno == ENOENT ? 127 : 126);
+	} else if (status == 255) {
 		bb_error_msg("%s: exited with status 255; aborting", G.args[0]);
-		return 124;
-	}
-	if (status >= 0x180) {
+		code = 124;
+	} else if (status >= 0x180) {
 		bb_error_msg("%s: terminated by signal %d",
 			G.args[0], status - 0x180);
-		return 125;
+		code = 125;
+	} else if (status) {
+		code = 123;
+	}
+	if (G.child_error < code)
+		G.child_error = code;
+}
+
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+/* Wait for any of our commands to finish */
+static void xargs_wait_any(void)
+{
+	int status;
+
+	if (safe_waitpid(-1, &status, 0) < 0) {
+		/* ECHILD: no children left (should not happen) */
+		G.running_procs = 0;
+		return;
+	}
+	G.running_procs--;
+	if (WIFSIGNALED(status))
+		status = WTERMSIG(status) + 0x180;
+	else
+		status = WEXITSTATUS(status);
+	xargs_status(status);
+}
+#endif
+
+/*
+ * This function has special algorithm.
+ * Don't use fork and include to main!
+ */
+static void xargs_exec(void)
+{
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	if (G.max_procs != 1) {
+		pid_t pid;
+
+		while (G.running_procs >= G.max_procs)
+			xargs_wait_any();
+		/* spawn() returns after child's exec, G.args can be reused */
+		pid = spawn(G.args);
+		if (pid > 0) {
+			G.running_procs++;
+			return;
+		}
+		xargs_status(-1);
+		return;
 	}
-	if (status)
-		return 123;
-	return 0;
+#endif
+	xargs_status(spawn_and_wait(G.args));
 }
 
 /* In POSIX/C locale isspace is only these chars: "\t\n\v\f\r" and space.
@@ -363,6 +426,9 @@ static int xargs_ask_confirmation(void)
 //usage:	IF_FEATURE_XARGS_SUPPORT_TERMOPT(
 //usage:     "\n	-x	Exit if size is exceeded"
 //usage:	)
+//usage:	IF_FEATURE_XARGS_SUPPORT_PARALLEL(
+//usage:     "\n	-P N	Run up to N PROGs in parallel (0: no limit)"
+//usage:	)
 //usage:#define xargs_example_usage
 //usage:       "$ ls | xargs gzip\n"
 //usage:       "$ find . -name '*.c' -print | xargs rm\n"
@@ -378,6 +444,7 @@ enum {
 	IF_FEATURE_XARGS_SUPPORT_CONFIRMATION(OPTBIT_INTERACTIVE,)
 	IF_FEATURE_XARGS_SUPPORT_TERMOPT(     OPTBIT_TERMINATE  ,)
 	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   OPTBIT_ZEROTERM   ,)
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    OPTBIT_PARALLEL   ,)
 
 	OPT_VERBOSE     = 1 << OPTBIT_VERBOSE    ,
 	OPT_NO_EMPTY    = 1 << OPTBIT_NO_EMPTY   ,
@@ -388,19 +455,21 @@ enum {
 	OPT_INTERACTIVE = IF_FEATURE_XARGS_SUPPORT_CONFIRMATION((1 << OPTBIT_INTERACTIVE)) + 0,
 	OPT_TERMINATE   = IF_FEATURE_XARGS_SUPPORT_TERMOPT(     (1 << OPTBIT_TERMINATE  )) + 0,
 	OPT_ZEROTERM    = IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   (1 << OPTBIT_ZEROTERM   )) + 0,
+	OPT_PARALLEL    = IF_FEATURE_XARGS_SUPPORT_PARALLEL(    (1 << OPTBIT_PARALLEL   )) + 0,
 };
 #define OPTION_STR "+trn:s:e::E:" \
 	IF_FEATURE_XARGS_SUPPORT_CONFIRMATION("p") \
 	IF_FEATURE_XARGS_SUPPORT_TERMOPT(     "x") \
-	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   "0")
+	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   "0") \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    "P:")
 
 int xargs_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int xargs_main(int argc, char **argv)
 {
 	int i;
-	int child_error = 0;
 	char *max_args;
 	char *max_chars;
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(char *max_procs;)
 	char *buf;
 	unsigned opt;
 	int n_max_chars;
@@ -419,7 +488,8 @@ int xargs_main(int argc, char **argv)
 		"no-run-if-empty\0" No_argument "r"
 		;
 #endif
-	opt = getopt32(argv, OPTION_STR, &max_args, &max_chars, &G.eof_str, &G.eof_str);
+	opt = getopt32(argv, OPTION_STR, &max_args, &max_chars, &G.eof_str, &G.eof_str
+			IF_FEATURE_XARGS_SUPPORT_PARALLEL(, &max_procs));
 
 	/* -E ""? You may wonder why not just omit -E?
 	 * This is used for portability:
@@ -429,6 +499,13 @@ int xargs_main(int argc, char **argv)
 
 	if (opt & OPT_ZEROTERM)
 		IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(read_args = process0_stdin);
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	if (opt & OPT_PARALLEL) {
+		G.max_procs = xatou_range(max_procs, 0, INT_MAX);
+		if (G.max_procs == 0)
+			G.max_procs = INT_MAX;
+	}
+#endif
 
 	argv += optind;
 	argc -= optind;
@@ -443,24 +520,9 @@ int xargs_main(int argc, char **argv)
 	 * growable buffer instead of fixed one.
 	 */
 	n_max_chars = 32 * 1024;
-	/* Make smaller if system does not allow our default value.
-	 * The Open Group Base Specifications Issue 6:
-	 * "The xargs utility shall limit the command line length such that
-	 * when the command line is invoked, the combined argument
-	 * and environment lists (see the exec family of functions
-	 * in the System Interfaces volume of IEEE Std 1003.1-2001)
-	 * shall not exceed {ARG_MAX}-2048 bytes".
-	 */
-	{
-		long arg_max = 0;
-#if defined _SC_ARG_MAX
-		arg_max = sysconf(_SC_ARG_MAX) - 2048;
-#elif defined ARG_MAX
-		arg_max = ARG_MAX - 2048;
-#endif
-		if (arg_max > 0 && n_max_chars > arg_max)
-			n_max_chars = arg_max;
-	}
+	/* Make smaller if system does not allow our default value */
+	if (n_max_chars > bb_arg_max())
+		n_max_chars = bb_arg_max();
 	if (opt & OPT_UPTO_SIZE) {
 		n_max_chars = xatou_range(max_chars, 1, INT_MAX);
 	}
@@ -528,22 +590,27 @@ int xargs_main(int argc, char **argv)
 		}
 
 		if (!(opt & OPT_INTERACTIVE) || xargs_ask_confirmation()) {
-			child_error = xargs_exec();
+			xargs_exec();
 		}
 
-		if (child_error > 0 && child_error != 123) {
+		if (G.child_error > 0 && G.child_error != 123) {
 			break;
 		}
 
 		overlapping_strcpy(buf, rem);
 	} /* while */
 
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	while (G.running_procs)
+		xargs_wait_any();
+#endif
+
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(G.args);
 		free(buf);
 	}
 
-	return child_error;
+	return G.child_error;
 }
 
 
@@ -292,6 +292,14 @@
 #define ENABLE_MD5_SIZE_VS_SPEED 1
 #define IF_MD5_SIZE_VS_SPEED(...) __VA_ARGS__
 #define IF_NOT_MD5_SIZE_VS_SPEED(...)
+#define CONFIG_FEATURE_FAST_CRC32 1
+#define ENABLE_FEATURE_FAST_CRC32 1
+#define IF_FEATURE_FAST_CRC32(...) __VA_ARGS__
+#define IF_NOT_FEATURE_FAST_CRC32(...)
+#define CONFIG_FEATURE_SHA_HW 1
+#define ENABLE_FEATURE_SHA_HW 1
+#define IF_FEATURE_SHA_HW(...) __VA_ARGS__
+#define IF_NOT_FEATURE_SHA_HW(...)
 #define CONFIG_FEATURE_FAST_TOP 1
 #define ENABLE_FEATURE_FAST_TOP 1
 #define IF_FEATURE_FAST_TOP(...) __VA_ARGS__
@@ -356,6 +364,14 @@
 #define ENABLE_FEATURE_COPYBUF_KB 1
 #define IF_FEATURE_COPYBUF_KB(...) __VA_ARGS__
 #define IF_NOT_FEATURE_COPYBUF_KB(...)
+#define CONFIG_FEATURE_COPYFD_ZEROCOPY 1
+#define ENABLE_FEATURE_COPYFD_ZEROCOPY 1
+#define IF_FEATURE_COPYFD_ZEROCOPY(...) __VA_ARGS__
+#define IF_NOT_FEATURE_COPYFD_ZEROCOPY(...)
+#undef CONFIG_FEATURE_RECURSIVE_ACTION_THREADS
+#define ENABLE_FEATURE_RECURSIVE_ACTION_THREADS 0
+#define IF_FEATURE_RECURSIVE_ACTION_THREADS(...)
+#define IF_NOT_FEATURE_RECURSIVE_ACTION_THREADS(...) __VA_ARGS__
 #define CONFIG_FEATURE_SKIP_ROOTFS 1
 #define ENABLE_FEATURE_SKIP_ROOTFS 1
 #define IF_FEATURE_SKIP_ROOTFS(...) __VA_ARGS__
@@ -400,6 +416,22 @@
 #define ENABLE_FEATURE_SEAMLESS_Z 0
 #define IF_FEATURE_SEAMLESS_Z(...)
 #define IF_NOT_FEATURE_SEAMLESS_Z(...) __VA_ARGS__
+#define CONFIG_FEATURE_INFLATE_FAST 1
+#define ENABLE_FEATURE_INFLATE_FAST 1
+#define IF_FEATURE_INFLATE_FAST(...) __VA_ARGS__
+#define IF_NOT_FEATURE_INFLATE_FAST(...)
+#define CONFIG_FEATURE_UNXZ_FAST 1
+#define ENABLE_FEATURE_UNXZ_FAST 1
+#define IF_FEATURE_UNXZ_FAST(...) __VA_ARGS__
+#define IF_NOT_FEATURE_UNXZ_FAST(...)
+#undef CONFIG_FEATURE_UNXZ_PARALLEL
+#define ENABLE_FEATURE_UNXZ_PARALLEL 0
+#define IF_FEATURE_UNXZ_PARALLEL(...)
+#define IF_NOT_FEATURE_UNXZ_PARALLEL(...) __VA_ARGS__
+#undef CONFIG_FEATURE_SEEK_INDEX
+#define ENABLE_FEATURE_SEEK_INDEX 0
+#define IF_FEATURE_SEEK_INDEX(...)
+#define IF_NOT_FEATURE_SEEK_INDEX(...) __VA_ARGS__
 #undef CONFIG_AR
 #define ENABLE_AR 0
 #define IF_AR(...)
@@ -416,10 +448,18 @@
 #define ENABLE_BUNZIP2 1
 #define IF_BUNZIP2(...) __VA_ARGS__
 #define IF_NOT_BUNZIP2(...)
+#undef CONFIG_FEATURE_BUNZIP2_PARALLEL
+#define ENABLE_FEATURE_BUNZIP2_PARALLEL 0
+#define IF_FEATURE_BUNZIP2_PARALLEL(...)
+#define IF_NOT_FEATURE_BUNZIP2_PARALLEL(...) __VA_ARGS__
 #define CONFIG_BZIP2 1
 #define ENABLE_BZIP2 1
 #define IF_BZIP2(...) __VA_ARGS__
 #define IF_NOT_BZIP2(...)
+#undef CONFIG_FEATURE_BZIP2_PARALLEL
+#define ENABLE_FEATURE_BZIP2_PARALLEL 0
+#define IF_FEATURE_BZIP2_PARALLEL(...)
+#define IF_NOT_FEATURE_BZIP2_PARALLEL(...) __VA_ARGS__
 #define CONFIG_CPIO 1
 #define ENABLE_CPIO 1
 #define IF_CPIO(...) __VA_ARGS__
@@ -456,6 +496,10 @@
 #define ENABLE_FEATURE_GZIP_LONG_OPTIONS 1
 #define IF_FEATURE_GZIP_LONG_OPTIONS(...) __VA_ARGS__
 #define IF_NOT_FEATURE_GZIP_LONG_OPTIONS(...)
+#undef CONFIG_FEATURE_GZIP_PARALLEL
+#define ENABLE_FEATURE_GZIP_PARALLEL 0
+#define IF_FEATURE_GZIP_PARALLEL(...)
+#define IF_NOT_FEATURE_GZIP_PARALLEL(...) __VA_ARGS__
 #define CONFIG_LZOP 1
 #define ENABLE_LZOP 1
 #define IF_LZOP(...) __VA_ARGS__
@@ -508,6 +552,10 @@
 #define ENABLE_FEATURE_TAR_TO_COMMAND 0
 #define IF_FEATURE_TAR_TO_COMMAND(...)
 #define IF_NOT_FEATURE_TAR_TO_COMMAND(...) __VA_ARGS__
+#undef CONFIG_FEATURE_TAR_INDEX
+#define ENABLE_FEATURE_TAR_INDEX 0
+#define IF_FEATURE_TAR_INDEX(...)
+#define IF_NOT_FEATURE_TAR_INDEX(...) __VA_ARGS__
 #undef CONFIG_FEATURE_TAR_UNAME_GNAME
 #define ENABLE_FEATURE_TAR_UNAME_GNAME 0
 #define IF_FEATURE_TAR_UNAME_GNAME(...)
@@ -932,6 +980,10 @@
 #define ENABLE_FEATURE_SORT_BIG 0
 #define IF_FEATURE_SORT_BIG(...)
 #define IF_NOT_FEATURE_SORT_BIG(...) __VA_ARGS__
+#undef CONFIG_FEATURE_SORT_EXTERNAL
+#define ENABLE_FEATURE_SORT_EXTERNAL 0
+#define IF_FEATURE_SORT_EXTERNAL(...)
+#define IF_NOT_FEATURE_SORT_EXTERNAL(...) __VA_ARGS__
 #define CONFIG_SPLIT 1
 #define ENABLE_SPLIT 1
 #define IF_SPLIT(...) __VA_ARGS__
@@ -1064,6 +1116,10 @@
 #define ENABLE_FEATURE_MD5_SHA1_SUM_CHECK 1
 #define IF_FEATURE_MD5_SHA1_SUM_CHECK(...) __VA_ARGS__
 #define IF_NOT_FEATURE_MD5_SHA1_SUM_CHECK(...)
+#undef CONFIG_FEATURE_MD5_SHA1_SUM_PARALLEL
+#define ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL 0
+#define IF_FEATURE_MD5_SHA1_SUM_PARALLEL(...)
+#define IF_NOT_FEATURE_MD5_SHA1_SUM_PARALLEL(...) __VA_ARGS__
 
 /*
  * Console Utilities
@@ -1272,6 +1328,10 @@
 #define ENABLE_FEATURE_AWK_LIBM 0
 #define IF_FEATURE_AWK_LIBM(...)
 #define IF_NOT_FEATURE_AWK_LIBM(...) __VA_ARGS__
+#undef CONFIG_FEATURE_AWK_COMPILE
+#define ENABLE_FEATURE_AWK_COMPILE 0
+#define IF_FEATURE_AWK_COMPILE(...)
+#define IF_NOT_FEATURE_AWK_COMPILE(...) __VA_ARGS__
 #define CONFIG_CMP 1
 #define ENABLE_CMP 1
 #define IF_CMP(...) __VA_ARGS__
@@ -1288,6 +1348,10 @@
 #define ENABLE_FEATURE_DIFF_DIR 1
 #define IF_FEATURE_DIFF_DIR(...) __VA_ARGS__
 #define IF_NOT_FEATURE_DIFF_DIR(...)
+#define CONFIG_FEATURE_DIFF_MYERS 1
+#define ENABLE_FEATURE_DIFF_MYERS 1
+#define IF_FEATURE_DIFF_MYERS(...) __VA_ARGS__
+#define IF_NOT_FEATURE_DIFF_MYERS(...)
 #undef CONFIG_ED
 #define ENABLE_ED 0
 #define IF_ED(...)
@@ -1348,6 +1412,10 @@
 #define ENABLE_FEATURE_FIND_EXEC 1
 #define IF_FEATURE_FIND_EXEC(...) __VA_ARGS__
 #define IF_NOT_FEATURE_FIND_EXEC(...)
+#define CONFIG_FEATURE_FIND_EXEC_PLUS 1
+#define ENABLE_FEATURE_FIND_EXEC_PLUS 1
+#define IF_FEATURE_FIND_EXEC_PLUS(...) __VA_ARGS__
+#define IF_NOT_FEATURE_FIND_EXEC_PLUS(...)
 #define CONFIG_FEATURE_FIND_USER 1
 #define ENABLE_FEATURE_FIND_USER 1
 #define IF_FEATURE_FIND_USER(...) __VA_ARGS__
@@ -1412,6 +1480,10 @@
 #define ENABLE_FEATURE_GREP_CONTEXT 1
 #define IF_FEATURE_GREP_CONTEXT(...) __VA_ARGS__
 #define IF_NOT_FEATURE_GREP_CONTEXT(...)
+#define CONFIG_FEATURE_GREP_FAST 1
+#define ENABLE_FEATURE_GREP_FAST 1
+#define IF_FEATURE_GREP_FAST(...) __VA_ARGS__
+#define IF_NOT_FEATURE_GREP_FAST(...)
 #define CONFIG_XARGS 1
 #define ENABLE_XARGS 1
 #define IF_XARGS(...) __VA_ARGS__
@@ -1432,6 +1504,10 @@
 #define ENABLE_FEATURE_XARGS_SUPPORT_ZERO_TERM 1
 #define IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(...) __VA_ARGS__
 #define IF_NOT_FEATURE_XARGS_SUPPORT_ZERO_TERM(...)
+#undef CONFIG_FEATURE_XARGS_SUPPORT_PARALLEL
+#define ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL 0
+#define IF_FEATURE_XARGS_SUPPORT_PARALLEL(...)
+#define IF_NOT_FEATURE_XARGS_SUPPORT_PARALLEL(...) __VA_ARGS__
 
 /*
  * Init Utilities
@@ -2692,6 +2768,14 @@
 #define ENABLE_FEATURE_HTTPD_GZIP 0
 #define IF_FEATURE_HTTPD_GZIP(...)
 #define IF_NOT_FEATURE_HTTPD_GZIP(...) __VA_ARGS__
+#undef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+#define ENABLE_FEATURE_HTTPD_EVENT_LOOP 0
+#define IF_FEATURE_HTTPD_EVENT_LOOP(...)
+#define IF_NOT_FEATURE_HTTPD_EVENT_LOOP(...) __VA_ARGS__
+#undef CONFIG_FEATURE_HTTPD_FILE_CACHE
+#define ENABLE_FEATURE_HTTPD_FILE_CACHE 0
+#define IF_FEATURE_HTTPD_FILE_CACHE(...)
+#define IF_NOT_FEATURE_HTTPD_FILE_CACHE(...) __VA_ARGS__
 #undef CONFIG_IFCONFIG
 #define ENABLE_IFCONFIG 0
 #define IF_IFCONFIG(...)
@@ -2788,6 +2872,18 @@
 #define ENABLE_FEATURE_INETD_RPC 0
 #define IF_FEATURE_INETD_RPC(...)
 #define IF_NOT_FEATURE_INETD_RPC(...) __VA_ARGS__
+#undef CONFIG_FEATURE_INETD_EPOLL
+#define ENABLE_FEATURE_INETD_EPOLL 0
+#define IF_FEATURE_INETD_EPOLL(...)
+#define IF_NOT_FEATURE_INETD_EPOLL(...) __VA_ARGS__
+#undef CONFIG_FEATURE_INETD_PRESPAWN
+#define ENABLE_FEATURE_INETD_PRESPAWN 0
+#define IF_FEATURE_INETD_PRESPAWN(...)
+#define IF_NOT_FEATURE_INETD_PRESPAWN(...) __VA_ARGS__
+#undef CONFIG_FEATURE_INETD_STATS
+#define ENABLE_FEATURE_INETD_STATS 0
+#define IF_FEATURE_INETD_STATS(...)
+#define IF_NOT_FEATURE_INETD_STATS(...) __VA_ARGS__
 #undef CONFIG_IP
 #define ENABLE_IP 0
 #define IF_IP(...)
@@ -3428,6 +3524,14 @@
 #define ENABLE_ASH_EXPAND_PRMT 1
 #define IF_ASH_EXPAND_PRMT(...) __VA_ARGS__
 #define IF_NOT_ASH_EXPAND_PRMT(...)
+#undef CONFIG_ASH_CMDCACHE
+#define ENABLE_ASH_CMDCACHE 0
+#define IF_ASH_CMDCACHE(...)
+#define IF_NOT_ASH_CMDCACHE(...) __VA_ARGS__
+#define CONFIG_ASH_CMDCACHE_DIR ""
+#define ENABLE_ASH_CMDCACHE_DIR 1
+#define IF_ASH_CMDCACHE_DIR(...) __VA_ARGS__
+#define IF_NOT_ASH_CMDCACHE_DIR(...)
 #undef CONFIG_CTTYHACK
 #define ENABLE_CTTYHACK 0
 #define IF_CTTYHACK(...)
@@ -3496,6 +3600,10 @@
 #define ENABLE_HUSH_MODE_X 0
 #define IF_HUSH_MODE_X(...)
 #define IF_NOT_HUSH_MODE_X(...) __VA_ARGS__
+#undef CONFIG_HUSH_MEMSTAT
+#define ENABLE_HUSH_MEMSTAT 0
+#define IF_HUSH_MEMSTAT(...)
+#define IF_NOT_HUSH_MEMSTAT(...) __VA_ARGS__
 #undef CONFIG_MSH
 #define ENABLE_MSH 0
 #define IF_MSH(...)
@@ -3572,6 +3680,10 @@
 #define ENABLE_FEATURE_SYSLOGD_CFG 0
 #define IF_FEATURE_SYSLOGD_CFG(...)
 #define IF_NOT_FEATURE_SYSLOGD_CFG(...) __VA_ARGS__
+#undef CONFIG_FEATURE_SYSLOGD_BATCH
+#define ENABLE_FEATURE_SYSLOGD_BATCH 0
+#define IF_FEATURE_SYSLOGD_BATCH(...)
+#define IF_NOT_FEATURE_SYSLOGD_BATCH(...) __VA_ARGS__
 #define CONFIG_FEATURE_SYSLOGD_READ_BUFFER_SIZE 0
 #define ENABLE_FEATURE_SYSLOGD_READ_BUFFER_SIZE 1
 #define IF_FEATURE_SYSLOGD_READ_BUFFER_SIZE(...) __VA_ARGS__
@@ -3588,10 +3700,6 @@
 #define ENABLE_LOGREAD 0
 #define IF_LOGREAD(...)
 #define IF_NOT_LOGREAD(...) __VA_ARGS__
-#undef CONFIG_FEATURE_LOGREAD_REDUCED_LOCKING
-#define ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING 0
-#define IF_FEATURE_LOGREAD_REDUCED_LOCKING(...)
-#define IF_NOT_FEATURE_LOGREAD_REDUCED_LOCKING(...) __VA_ARGS__
 #undef CONFIG_KLOGD
 #define ENABLE_KLOGD 0
 #define IF_KLOGD(...)
@@ -82,6 +82,10 @@ typedef struct archive_handle_t {
 	char* tar__longname;
 	char* tar__linkname;
 # endif
+# if ENABLE_FEATURE_TAR_INDEX
+	/* Where the current member (incl. its longname etc headers) starts */
+	off_t tar__member_start;
+# endif
 #if ENABLE_FEATURE_TAR_TO_COMMAND
 	char* tar__to_command;
 	const char* tar__to_command_shell;
@@ -210,6 +214,10 @@ typedef struct inflate_unzip_result {
 IF_DESKTOP(long long) int inflate_unzip(inflate_unzip_result *res, off_t compr_size, int src_fd, int dst_fd) FAST_FUNC;
 /* xz unpacker takes .xz stream from offset 6 */
 IF_DESKTOP(long long) int unpack_xz_stream(int src_fd, int dst_fd) FAST_FUNC;
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* decodes Blocks of a seekable multi-Block file in parallel, 0 jobs: auto */
+IF_DESKTOP(long long) int unpack_xz_stream_jobs(int src_fd, int dst_fd, unsigned jobs) FAST_FUNC;
+#endif
 /* lzma unpacker takes .lzma stream from offset 0 */
 IF_DESKTOP(long long) int unpack_lzma_stream(int src_fd, int dst_fd) FAST_FUNC;
 /* the rest wants 2 first bytes already skipped by the caller */
@@ -220,6 +228,55 @@ IF_DESKTOP(long long) int unpack_Z_stream(int src_fd, int dst_fd) FAST_FUNC;
 /* wrapper which checks first two bytes to be "BZ" */
 IF_DESKTOP(long long) int unpack_bz2_stream_prime(int src_fd, int dst_fd) FAST_FUNC;
 
+#if ENABLE_FEATURE_SEEK_INDEX
+/* Random access index for .gz/.xz, see seek_index.c */
+enum {
+	SEEK_INDEX_GZ = 1,
+	SEEK_INDEX_XZ = 2,
+	SEEK_INDEX_SPAN = 4 * 1024 * 1024, /* output bytes between checkpoints */
+	SEEK_INDEX_WINDOW = 32 * 1024,
+};
+typedef struct seek_point_t {
+	uint64_t out;      /* uncompressed offset */
+	uint64_t in;       /* compressed offset (from the start of the file) */
+	unsigned aux;      /* gz: bits of byte 'in' already used; xz: check type */
+	off_t window_pos;  /* gz: where the window is in the index file */
+} seek_point_t;
+typedef struct seek_member_t {
+	uint64_t offset;   /* uncompressed offset of member's first header */
+	char *name;
+} seek_member_t;
+typedef struct seek_index_t {
+	const char *filename;
+	int fd;
+	smallint type;
+	smallint creating;
+	unsigned point_cnt;
+	seek_point_t *points;
+	unsigned member_cnt;
+	seek_member_t *members;
+	uint64_t in_end, out_end; /* 0 if not known */
+	uint64_t src_size;        /* of the compressed file, 0 if not known */
+	uint64_t src_mtime;
+	uint64_t next_point;      /* creating: take next checkpoint here */
+} seek_index_t;
+seek_index_t *seek_index_open(const char *filename, int type) FAST_FUNC;
+void seek_index_add_point(seek_index_t *idx, const seek_point_t *pt, const void *window) FAST_FUNC;
+void seek_index_add_member(seek_index_t *idx, uint64_t offset, const char *name) FAST_FUNC;
+void seek_index_finish(seek_index_t *idx, int src_fd, uint64_t in, uint64_t out) FAST_FUNC;
+const seek_point_t *seek_index_find(const seek_index_t *idx, uint64_t out) FAST_FUNC;
+void seek_index_read_window(const seek_index_t *idx, const seek_point_t *pt, void *window) FAST_FUNC;
+int seek_index_usable(const seek_index_t *idx, int fd) FAST_FUNC;
+void seek_index_close(seek_index_t *idx) FAST_FUNC;
+/* Decompress LEN ((uint64_t)-1: all) bytes starting at uncompressed
+ * OFFSET. IDX may be NULL. If IDX is being created, the whole stream
+ * is decoded and checkpoints are added to it. Otherwise decoding
+ * starts at the nearest checkpoint, SRC_FD must be seekable then.
+ * Like unpack_{gz,xz}_stream, expects the magic to be already read */
+IF_DESKTOP(long long) int unpack_gz_stream_seek(int src_fd, int dst_fd, seek_index_t *idx, uint64_t offset, uint64_t len) FAST_FUNC;
+IF_DESKTOP(long long) int unpack_xz_stream_seek(int src_fd, int dst_fd, seek_index_t *idx, uint64_t offset, uint64_t len) FAST_FUNC;
+#endif
+
 char* append_ext(char *filename, const char *expected_ext) FAST_FUNC;
 int bbunpack(char **argv,
 	    IF_DESKTOP(long long) int FAST_FUNC (*unpacker)(unpack_info_t *info),
@@ -18,13 +18,13 @@ extern int (*const applet_main[])(int argc, char **argv);
 extern const uint16_t applet_nameofs[];
 extern const uint8_t applet_install_loc[];
 
-#if ENABLE_FEATURE_SUID || ENABLE_FEATURE_PREFER_APPLETS
+#if ENABLE_FEATURE_SUID || ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK
 # define APPLET_NAME(i) (applet_names + (applet_nameofs[i] & 0x0fff))
 #else
 # define APPLET_NAME(i) (applet_names + applet_nameofs[i])
 #endif
 
-#if ENABLE_FEATURE_PREFER_APPLETS
+#if ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK
 # define APPLET_IS_NOFORK(i) (applet_nameofs[i] & (1 << 12))
 # define APPLET_IS_NOEXEC(i) (applet_nameofs[i] & (1 << 13))
 #else
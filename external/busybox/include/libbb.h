@@ -370,6 +370,8 @@ enum {
 	/*ACTION_REVERSE      = (1 << 4), - unused */
 	ACTION_QUIET          = (1 << 5),
 	ACTION_DANGLING_OK    = (1 << 6),
+	/* Stat directory entries in parallel (callbacks are still serial) */
+	ACTION_PARALLEL       = (1 << 7),
 };
 typedef uint8_t recurse_flags_t;
 extern int recursive_action(const char *fileName, unsigned flags,
@@ -415,6 +417,16 @@ void xmove_fd(int, int) FAST_FUNC;
 
 DIR *xopendir(const char *path) FAST_FUNC;
 DIR *warn_opendir(const char *path) FAST_FUNC;
+/* Directory entry as getdents64 returns it */
+struct bb_dirent {
+	uint64_t d_ino;
+	int64_t  d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;  /* DT_xxx, DT_UNKNOWN if fs does not tell */
+	char     d_name[1];
+};
+#define bb_next_dirent(d) ((struct bb_dirent *)((char*)(d) + (d)->d_reclen))
+struct bb_dirent *xmalloc_read_dirents(int fd, size_t *size_p) FAST_FUNC RETURNS_MALLOC;
 
 char *xmalloc_realpath(const char *path) FAST_FUNC RETURNS_MALLOC;
 char *xmalloc_readlink(const char *path) FAST_FUNC RETURNS_MALLOC;
@@ -961,6 +973,10 @@ pid_t wait_any_nohang(int *wstat) FAST_FUNC;
 int wait4pid(pid_t pid) FAST_FUNC;
 /* Same as wait4pid(spawn(argv)), but with NOFORK/NOEXEC if configured: */
 int spawn_and_wait(char **argv) FAST_FUNC;
+/* Room for exec's argv and envp, ARG_MAX less POSIX's 2k reserve */
+unsigned bb_arg_max(void) FAST_FUNC;
+/* Online CPUs, clamped to 1..MAX */
+unsigned bb_online_cpus(unsigned max) FAST_FUNC;
 /* Does NOT check that applet is NOFORK, just blindly runs it */
 int run_nofork_applet(int applet_no, char **argv) FAST_FUNC;
 
@@ -1632,6 +1648,7 @@ extern uint32_t *global_crc32_table;
 uint32_t *crc32_filltable(uint32_t *tbl256, int endian) FAST_FUNC;
 uint32_t crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table) FAST_FUNC;
 uint32_t crc32_block_endian0(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table) FAST_FUNC;
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) FAST_FUNC;
 
 typedef struct masks_labels_t {
 	const char *labels;
@@ -8,6 +8,117 @@
  */
 
 #include "libbb.h"
+#if ENABLE_FEATURE_COPYFD_ZEROCOPY
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+/* splice() needs _GNU_SOURCE, and bionic does not have it */
+# if defined(SPLICE_F_MOVE) && !defined(__BIONIC__)
+#  define ZC_HAVE_SPLICE 1
+# else
+#  define ZC_HAVE_SPLICE 0
+# endif
+
+/* Ways to move data from src_fd to dst_fd inside the kernel,
+ * in order of preference */
+enum {
+	ZC_NONE,
+	ZC_COPY_FILE_RANGE, /* file to file on the same fs */
+	ZC_SENDFILE,        /* file to anything */
+	ZC_SPLICE,          /* to or from a pipe */
+	ZC_SPLICE_PIPE,     /* to a file, through a pipe of our own */
+};
+enum { ZC_CHUNK = 4 * 1024 * 1024 };
+
+static smallint zerocopy_method(int src_fd, int dst_fd)
+{
+	struct stat src, dst;
+
+	if (fstat(src_fd, &src) != 0 || fstat(dst_fd, &dst) != 0)
+		return ZC_NONE;
+	if (S_ISFIFO(src.st_mode) || S_ISFIFO(dst.st_mode))
+		return ZC_HAVE_SPLICE ? ZC_SPLICE : ZC_NONE;
+	if (S_ISREG(src.st_mode)) {
+		/* /proc files have st_size 0 and are generated on read */
+		if (src.st_size == 0)
+			return ZC_NONE;
+# ifdef __NR_copy_file_range
+		if (S_ISREG(dst.st_mode) && src.st_dev == dst.st_dev)
+			return ZC_COPY_FILE_RANGE;
+# endif
+		return ZC_SENDFILE;
+	}
+	if (ZC_HAVE_SPLICE && S_ISREG(dst.st_mode) && S_ISSOCK(src.st_mode))
+		return ZC_SPLICE_PIPE;
+	return ZC_NONE;
+}
+
+/* Move up to len bytes with *method. Returns their count, 0 on EOF,
+ * -1 if *method did not work (then it is downgraded, nothing was moved)
+ * or -2 on write error. The last one is possible only with ZC_SPLICE_PIPE,
+ * where data can be stuck in our pipe */
+static ssize_t zerocopy(int src_fd, int dst_fd, size_t len,
+		smallint *method, int *pipefd)
+{
+	ssize_t n;
+# if ZC_HAVE_SPLICE
+	ssize_t w;
+# endif
+
+ again:
+	switch (*method) {
+# ifdef __NR_copy_file_range
+	case ZC_COPY_FILE_RANGE:
+		n = syscall(__NR_copy_file_range, src_fd, NULL, dst_fd, NULL, len, 0);
+		if (n < 0 && errno != EINTR) {
+			/* Old kernel, or the fs can't do it */
+			*method = ZC_SENDFILE;
+			return -1;
+		}
+		break;
+# endif
+	default: /* ZC_SENDFILE */
+		n = sendfile(dst_fd, src_fd, NULL, len);
+		break;
+# if ZC_HAVE_SPLICE
+	case ZC_SPLICE:
+		n = splice(src_fd, NULL, dst_fd, NULL, len, SPLICE_F_MOVE);
+		break;
+	case ZC_SPLICE_PIPE:
+		if (pipefd[0] < 0 && pipe(pipefd) != 0) {
+			pipefd[0] = -1;
+			*method = ZC_NONE;
+			return -1;
+		}
+		n = splice(src_fd, NULL, pipefd[1], NULL, len, SPLICE_F_MOVE);
+		if (n <= 0)
+			break;
+		for (len = n; len != 0; len -= w) {
+			w = splice(pipefd[0], NULL, dst_fd, NULL, len, SPLICE_F_MOVE);
+			if (w < 0 && errno == EINTR) {
+				w = 0;
+				continue;
+			}
+			if (w <= 0) {
+				/* Write out what is in the pipe the usual way */
+				char buf[1024];
+
+				*method = ZC_NONE;
+				w = safe_read(pipefd[0], buf, MIN(len, sizeof(buf)));
+				if (w <= 0 || full_write(dst_fd, buf, w) != w)
+					return -2;
+			}
+		}
+		return n;
+# endif
+	}
+	if (n < 0) {
+		if (errno == EINTR)
+			goto again;
+		*method = ZC_NONE;
+	}
+	return n;
+}
+#endif
 
 /* Used by NOFORK applets (e.g. cat) - must not use xmalloc.
  * size < 0 means "ignore write errors", used by tar --to-command
@@ -18,6 +129,10 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	int status = -1;
 	off_t total = 0;
 	bool continue_on_write_error = 0;
+#if ENABLE_FEATURE_COPYFD_ZEROCOPY
+	smallint zc = ZC_NONE;
+	int pipefd[2] = { -1, -1 };
+#endif
 #if CONFIG_FEATURE_COPYBUF_KB <= 4
 	char buffer[CONFIG_FEATURE_COPYBUF_KB * 1024];
 	enum { buffer_size = sizeof(buffer) };
@@ -51,6 +166,15 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	if (src_fd < 0)
 		goto out;
 
+#if ENABLE_FEATURE_COPYFD_ZEROCOPY
+	/* Small copies are done faster by one read and one write */
+	if (dst_fd >= 0 && !continue_on_write_error
+	 && (size == 0 || size > buffer_size)
+	) {
+		zc = zerocopy_method(src_fd, dst_fd);
+	}
+#endif
+
 	if (!size) {
 		size = buffer_size;
 		status = 1; /* copy until eof */
@@ -59,6 +183,25 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	while (1) {
 		ssize_t rd;
 
+#if ENABLE_FEATURE_COPYFD_ZEROCOPY
+		if (zc != ZC_NONE) {
+			rd = zerocopy(src_fd, dst_fd,
+				(status > 0 || size > ZC_CHUNK) ? ZC_CHUNK : size,
+				&zc, pipefd);
+			if (rd == 0) {
+				status = 0;
+				break;
+			}
+			if (rd > 0)
+				goto copied;
+			if (rd < -1) {
+				bb_perror_msg(bb_msg_write_error);
+				break;
+			}
+			/* zc was downgraded, retry */
+			continue;
+		}
+#endif
 		rd = safe_read(src_fd, buffer, size > buffer_size ? buffer_size : size);
 
 		if (!rd) { /* eof - all done */
@@ -80,6 +223,7 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 				dst_fd = -1;
 			}
 		}
+ IF_FEATURE_COPYFD_ZEROCOPY(copied:)
 		total += rd;
 		if (status < 0) { /* if we aren't copying till EOF... */
 			size -= rd;
@@ -92,6 +236,12 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	}
  out:
 
+#if ENABLE_FEATURE_COPYFD_ZEROCOPY
+	if (pipefd[0] >= 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+	}
+#endif
 #if CONFIG_FEATURE_COPYBUF_KB > 4
 	if (buffer_size != 4 * 1024)
 		munmap(buffer, buffer_size);
@@ -13,6 +13,9 @@
  * endian = 1: big-endian
  * endian = 0: little-endian
  *
+ * crc32_block_endian0/1 run a buffer through such a table, and
+ * crc32_combine() merges CRCs of adjacent blocks.
+ *
  * Licensed under GPLv2, see file LICENSE in this source tree.
  */
 
@@ -43,10 +46,176 @@ uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
 	return crc_table - 256;
 }
 
+#if ENABLE_FEATURE_FAST_CRC32
+/* Slicing-by-8: process 8 bytes per step using 8 tables, where
+ * tbl[k][i] is the CRC of byte i followed by k zero bytes.
+ * The extra 7 tables are derived from whatever 256-entry table
+ * the caller gives us, and cached (one cache per bit order).
+ */
+struct crc32_slices {
+	const uint32_t *src;
+	uint32_t tbl[8][256];
+};
+
+static struct crc32_slices *crc32_slices_le;
+static struct crc32_slices *crc32_slices_be;
+
+static struct crc32_slices *get_slices(struct crc32_slices **cache,
+		const uint32_t *crc_table, int endian)
+{
+	struct crc32_slices *sl = *cache;
+	unsigned i, k;
+
+	if (sl && sl->src == crc_table)
+		return sl;
+	if (!sl)
+		*cache = sl = xmalloc(sizeof(*sl));
+	sl->src = crc_table;
+	memcpy(sl->tbl[0], crc_table, sizeof(sl->tbl[0]));
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = sl->tbl[k - 1][i];
+			if (endian)
+				c = (c << 8) ^ crc_table[c >> 24];
+			else
+				c = (c >> 8) ^ crc_table[(uint8_t)c];
+			sl->tbl[k][i] = c;
+		}
+	}
+	return sl;
+}
+
+# if (defined(__x86_64__) || defined(__i386__)) \
+  && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+/* Carry-less multiplication folding, see Intel's "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction".
+ * Constants are for the bit-reflected 0xedb88320 polynomial.
+ * len must be >= 64 and a multiple of 16.
+ */
+#  define HAVE_CRC32_PCLMUL 1
+#  include <cpuid.h>
+#  include <smmintrin.h>
+#  include <wmmintrin.h>
+
+static smallint crc32_pclmul_ok = -1;
+
+static int have_pclmul(void)
+{
+	if (crc32_pclmul_ok < 0) {
+		unsigned eax, ebx, ecx, edx;
+
+		crc32_pclmul_ok = 0;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			crc32_pclmul_ok = ((ecx & bit_PCLMUL) && (ecx & bit_SSE4_1));
+	}
+	return crc32_pclmul_ok;
+}
+
+static uint32_t __attribute__((target("pclmul,sse4.1")))
+crc32_pclmul_le(uint32_t val, const uint8_t *buf, unsigned len)
+{
+	static const uint64_t k1k2[2] ALIGNED(16) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t k3k4[2] ALIGNED(16) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t k5k0[2] ALIGNED(16) = { 0x0163cd6124ULL, 0 };
+	static const uint64_t poly[2] ALIGNED(16) = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(val));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* Fold 4 x 128 bits in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+# endif
+#endif /* FEATURE_FAST_CRC32 */
+
 uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if ENABLE_FEATURE_FAST_CRC32
+	if (len >= 64) {
+		const uint8_t *p = buf;
+		struct crc32_slices *sl = get_slices(&crc32_slices_be, crc_table, 1);
+
+		while (len >= 8) {
+			uint32_t w;
+
+			move_from_unaligned32(w, p);
+			val ^= SWAP_BE32(w);
+			val = sl->tbl[7][val >> 24] ^ sl->tbl[6][(uint8_t)(val >> 16)]
+			    ^ sl->tbl[5][(uint8_t)(val >> 8)] ^ sl->tbl[4][(uint8_t)val]
+			    ^ sl->tbl[3][p[4]] ^ sl->tbl[2][p[5]]
+			    ^ sl->tbl[1][p[6]] ^ sl->tbl[0][p[7]];
+			p += 8;
+			len -= 8;
+		}
+		buf = p;
+	}
+#endif
 	while (buf != end) {
 		val = (val << 8) ^ crc_table[(val >> 24) ^ *(uint8_t*)buf];
 		buf = (uint8_t*)buf + 1;
@@ -58,9 +227,82 @@ uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned l
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if ENABLE_FEATURE_FAST_CRC32
+	if (len >= 64) {
+		const uint8_t *p = buf;
+		struct crc32_slices *sl;
+
+# ifdef HAVE_CRC32_PCLMUL
+		/* Only valid for our one little-endian polynomial,
+		 * which is what every endian0 table is built from */
+		if (have_pclmul()) {
+			unsigned n = len & ~15;
+			val = crc32_pclmul_le(val, p, n);
+			p += n;
+			len -= n;
+		}
+# endif
+		sl = get_slices(&crc32_slices_le, crc_table, 0);
+		while (len >= 8) {
+			uint32_t w;
+
+			move_from_unaligned32(w, p);
+			val ^= SWAP_LE32(w);
+			val = sl->tbl[7][(uint8_t)val] ^ sl->tbl[6][(uint8_t)(val >> 8)]
+			    ^ sl->tbl[5][(uint8_t)(val >> 16)] ^ sl->tbl[4][val >> 24]
+			    ^ sl->tbl[3][p[4]] ^ sl->tbl[2][p[5]]
+			    ^ sl->tbl[1][p[6]] ^ sl->tbl[0][p[7]];
+			p += 8;
+			len -= 8;
+		}
+		buf = p;
+	}
+#endif
 	while (buf != end) {
 		val = crc_table[(uint8_t)val ^ *(uint8_t*)buf] ^ (val >> 8);
 		buf = (uint8_t*)buf + 1;
 	}
 	return val;
 }
+
+/* Multiply a and b modulo the little-endian (bit-reflected) polynomial.
+ * In this representation, 0x80000000 is x^0.
+ */
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : (b >> 1);
+	}
+	return p;
+}
+
+/* Given crc1 of data block A and crc2 of block B (len2 bytes long),
+ * return crc of A followed by B. Works on finished gzip-style CRCs,
+ * i.e. ~crc32_block_endian0(~0, ...) values, same as zlib's
+ * crc32_combine(). Lets parallel compressors checksum their blocks
+ * independently.
+ */
+uint32_t FAST_FUNC crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	uint32_t xn = (uint32_t)1 << 23; /* x^8: shifting by one byte */
+	uint32_t p = (uint32_t)1 << 31;  /* x^0 */
+
+	/* p = x^(8*len2) mod P, by square-and-multiply */
+	while (len2) {
+		if (len2 & 1)
+			p = crc32_multmodp(xn, p);
+		len2 >>= 1;
+		if (len2)
+			xn = crc32_multmodp(xn, xn);
+	}
+	return crc32_multmodp(p, crc1) ^ crc2;
+}
@@ -18,7 +18,9 @@ void FAST_FUNC fflush_stdout_and_exit(int retval)
 	if (fflush(stdout))
 		bb_perror_msg_and_die("%s", bb_msg_standard_output);
 
-	if (ENABLE_FEATURE_PREFER_APPLETS && die_sleep < 0) {
+	if ((ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK)
+	 && die_sleep < 0
+	) {
 		/* We are in NOFORK applet. Do not exit() directly,
 		 * but use xfunc_die() */
 		xfunc_error_retval = retval;
@@ -558,6 +558,111 @@ static void FAST_FUNC sha1_process_block64(sha1_ctx_t *ctx)
 	ctx->hash[4] += e;
 }
 
+#if ENABLE_FEATURE_SHA_HW \
+ && (defined(__x86_64__) || defined(__i386__)) \
+ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+/* x86 SHA extensions (SHA-NI). Checked for at runtime, since the same
+ * binary runs on CPUs with and without them. The round structure
+ * follows Intel's reference code: sha1rnds4/sha256rnds2 do 4/2 rounds,
+ * sha*msg1/sha*msg2 compute the message schedule 4 words at a time.
+ */
+# define HAVE_SHA_NI 1
+# include <cpuid.h>
+# include <immintrin.h>
+
+static smallint sha_ni_ok = -1;
+
+static int have_sha_ni(void)
+{
+	if (sha_ni_ok < 0) {
+		unsigned eax, ebx, ecx, edx;
+
+		sha_ni_ok = 0;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		 && (ecx & bit_SSE4_1) && (ecx & bit_SSSE3)
+		 && __get_cpuid_max(0, NULL) >= 7
+		) {
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			sha_ni_ok = (ebx >> 29) & 1; /* SHA */
+		}
+	}
+	return sha_ni_ok;
+}
+
+# define SHA_NI_FUNC __attribute__((target("sha,ssse3,sse4.1")))
+
+static void FAST_FUNC SHA_NI_FUNC sha1_process_block64_shaNI(sha1_ctx_t *ctx)
+{
+	const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+
+	ABCD = _mm_loadu_si128((const __m128i*) ctx->hash);
+	E0 = _mm_set_epi32(ctx->hash[4], 0, 0, 0);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	ABCD_SAVE = ABCD;
+	E0_SAVE = E0;
+
+	MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 0)), MASK);
+	MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 16)), MASK);
+	MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 32)), MASK);
+	MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 48)), MASK);
+
+/* Four rounds. Ea accumulates E for this step, Eb saves ABCD for the next */
+#define ROUNDS4(Ea, Eb, M, f) \
+do { \
+	Ea = _mm_sha1nexte_epu32(Ea, M); \
+	Eb = ABCD; \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, Ea, f); \
+} while (0)
+/* Message schedule: next += f(cur, prev...) */
+#define MSG_1(Mprev, Mcur)  Mprev = _mm_sha1msg1_epu32(Mprev, Mcur)
+#define MSG_2(Mnext, Mcur)  Mnext = _mm_sha1msg2_epu32(Mnext, Mcur)
+#define MSG_X(Mprev2, Mcur) Mprev2 = _mm_xor_si128(Mprev2, Mcur)
+
+	/* Rounds 0-3 */
+	E0 = _mm_add_epi32(E0, MSG0);
+	E1 = ABCD;
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+	/* 4-7 */
+	ROUNDS4(E1, E0, MSG1, 0); MSG_1(MSG0, MSG1);
+	/* 8-11 */
+	ROUNDS4(E0, E1, MSG2, 0); MSG_1(MSG1, MSG2); MSG_X(MSG0, MSG2);
+	/* 12-15 */
+	ROUNDS4(E1, E0, MSG3, 0); MSG_2(MSG0, MSG3); MSG_1(MSG2, MSG3); MSG_X(MSG1, MSG3);
+	/* 16-19 */
+	ROUNDS4(E0, E1, MSG0, 0); MSG_2(MSG1, MSG0); MSG_1(MSG3, MSG0); MSG_X(MSG2, MSG0);
+	/* 20-23 */
+	ROUNDS4(E1, E0, MSG1, 1); MSG_2(MSG2, MSG1); MSG_1(MSG0, MSG1); MSG_X(MSG3, MSG1);
+	ROUNDS4(E0, E1, MSG2, 1); MSG_2(MSG3, MSG2); MSG_1(MSG1, MSG2); MSG_X(MSG0, MSG2);
+	ROUNDS4(E1, E0, MSG3, 1); MSG_2(MSG0, MSG3); MSG_1(MSG2, MSG3); MSG_X(MSG1, MSG3);
+	ROUNDS4(E0, E1, MSG0, 1); MSG_2(MSG1, MSG0); MSG_1(MSG3, MSG0); MSG_X(MSG2, MSG0);
+	ROUNDS4(E1, E0, MSG1, 1); MSG_2(MSG2, MSG1); MSG_1(MSG0, MSG1); MSG_X(MSG3, MSG1);
+	/* 40-43 */
+	ROUNDS4(E0, E1, MSG2, 2); MSG_2(MSG3, MSG2); MSG_1(MSG1, MSG2); MSG_X(MSG0, MSG2);
+	ROUNDS4(E1, E0, MSG3, 2); MSG_2(MSG0, MSG3); MSG_1(MSG2, MSG3); MSG_X(MSG1, MSG3);
+	ROUNDS4(E0, E1, MSG0, 2); MSG_2(MSG1, MSG0); MSG_1(MSG3, MSG0); MSG_X(MSG2, MSG0);
+	ROUNDS4(E1, E0, MSG1, 2); MSG_2(MSG2, MSG1); MSG_1(MSG0, MSG1); MSG_X(MSG3, MSG1);
+	ROUNDS4(E0, E1, MSG2, 2); MSG_2(MSG3, MSG2); MSG_1(MSG1, MSG2); MSG_X(MSG0, MSG2);
+	/* 60-63 */
+	ROUNDS4(E1, E0, MSG3, 3); MSG_2(MSG0, MSG3); MSG_1(MSG2, MSG3); MSG_X(MSG1, MSG3);
+	ROUNDS4(E0, E1, MSG0, 3); MSG_2(MSG1, MSG0); MSG_1(MSG3, MSG0); MSG_X(MSG2, MSG0);
+	ROUNDS4(E1, E0, MSG1, 3); MSG_2(MSG2, MSG1); MSG_X(MSG3, MSG1);
+	ROUNDS4(E0, E1, MSG2, 3); MSG_2(MSG3, MSG2);
+	ROUNDS4(E1, E0, MSG3, 3);
+#undef ROUNDS4
+#undef MSG_1
+#undef MSG_2
+#undef MSG_X
+
+	E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+	ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	_mm_storeu_si128((__m128i*) ctx->hash, ABCD);
+	ctx->hash[4] = _mm_extract_epi32(E0, 3);
+}
+#endif
+
 /* Constants for SHA512 from FIPS 180-2:4.2.3.
  * SHA256 constants from FIPS 180-2:4.2.2
  * are the most significant half of first 64 elements
@@ -678,6 +783,78 @@ static void FAST_FUNC sha256_process_block64(sha256_ctx_t *ctx)
 	ctx->hash[7] += h;
 }
 
+#ifdef HAVE_SHA_NI
+static void FAST_FUNC SHA_NI_FUNC sha256_process_block64_shaNI(sha256_ctx_t *ctx)
+{
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i STATE0, STATE1, MSG, TMP, ABEF_SAVE, CDGH_SAVE;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+
+	/* hash[] is ABCDEFGH, instructions want ABEF and CDGH */
+	TMP = _mm_loadu_si128((const __m128i*) &ctx->hash[0]);
+	STATE1 = _mm_loadu_si128((const __m128i*) &ctx->hash[4]);
+	TMP = _mm_shuffle_epi32(TMP, 0xB1);          /* CDAB */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);    /* EFGH */
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);    /* ABEF */
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0); /* CDGH */
+	ABEF_SAVE = STATE0;
+	CDGH_SAVE = STATE1;
+
+	MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 0)), MASK);
+	MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 16)), MASK);
+	MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 32)), MASK);
+	MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ctx->wbuffer + 48)), MASK);
+
+/* Four rounds t..t+3 with message words M */
+#define K4(t) _mm_set_epi32(sha_K[t+3] >> 32, sha_K[t+2] >> 32, sha_K[t+1] >> 32, sha_K[t] >> 32)
+#define ROUNDS4(M, t) \
+do { \
+	MSG = _mm_add_epi32(M, K4(t)); \
+	STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG); \
+	MSG = _mm_shuffle_epi32(MSG, 0x0E); \
+	STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG); \
+} while (0)
+/* Message schedule */
+#define MSG_1(Mprev, Mcur) Mprev = _mm_sha256msg1_epu32(Mprev, Mcur)
+#define MSG_2(Mnext, Mcur, Mprev) \
+do { \
+	TMP = _mm_alignr_epi8(Mcur, Mprev, 4); \
+	Mnext = _mm_add_epi32(Mnext, TMP); \
+	Mnext = _mm_sha256msg2_epu32(Mnext, Mcur); \
+} while (0)
+
+	ROUNDS4(MSG0,  0);
+	ROUNDS4(MSG1,  4); MSG_1(MSG0, MSG1);
+	ROUNDS4(MSG2,  8); MSG_1(MSG1, MSG2);
+	ROUNDS4(MSG3, 12); MSG_2(MSG0, MSG3, MSG2); MSG_1(MSG2, MSG3);
+	ROUNDS4(MSG0, 16); MSG_2(MSG1, MSG0, MSG3); MSG_1(MSG3, MSG0);
+	ROUNDS4(MSG1, 20); MSG_2(MSG2, MSG1, MSG0); MSG_1(MSG0, MSG1);
+	ROUNDS4(MSG2, 24); MSG_2(MSG3, MSG2, MSG1); MSG_1(MSG1, MSG2);
+	ROUNDS4(MSG3, 28); MSG_2(MSG0, MSG3, MSG2); MSG_1(MSG2, MSG3);
+	ROUNDS4(MSG0, 32); MSG_2(MSG1, MSG0, MSG3); MSG_1(MSG3, MSG0);
+	ROUNDS4(MSG1, 36); MSG_2(MSG2, MSG1, MSG0); MSG_1(MSG0, MSG1);
+	ROUNDS4(MSG2, 40); MSG_2(MSG3, MSG2, MSG1); MSG_1(MSG1, MSG2);
+	ROUNDS4(MSG3, 44); MSG_2(MSG0, MSG3, MSG2); MSG_1(MSG2, MSG3);
+	ROUNDS4(MSG0, 48); MSG_2(MSG1, MSG0, MSG3); MSG_1(MSG3, MSG0);
+	ROUNDS4(MSG1, 52); MSG_2(MSG2, MSG1, MSG0);
+	ROUNDS4(MSG2, 56); MSG_2(MSG3, MSG2, MSG1);
+	ROUNDS4(MSG3, 60);
+#undef K4
+#undef ROUNDS4
+#undef MSG_1
+#undef MSG_2
+
+	STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+	STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);       /* FEBA */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);    /* DCHG */
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0); /* DCBA */
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);    /* ABEF */
+	_mm_storeu_si128((__m128i*) &ctx->hash[0], STATE0);
+	_mm_storeu_si128((__m128i*) &ctx->hash[4], STATE1);
+}
+#endif
+
 static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 {
 	unsigned t;
@@ -750,6 +927,10 @@ void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 	ctx->hash[4] = 0xc3d2e1f0;
 	ctx->total64 = 0;
 	ctx->process_block = sha1_process_block64;
+#ifdef HAVE_SHA_NI
+	if (have_sha_ni())
+		ctx->process_block = sha1_process_block64_shaNI;
+#endif
 }
 
 static const uint32_t init256[] = {
@@ -784,6 +965,10 @@ void FAST_FUNC sha256_begin(sha256_ctx_t *ctx)
 	memcpy(&ctx->total64, init256, sizeof(init256));
 	/*ctx->total64 = 0; - done by prepending two 32-bit zeros to init256 */
 	ctx->process_block = sha256_process_block64;
+#ifdef HAVE_SHA_NI
+	if (have_sha_ni())
+		ctx->process_block = sha256_process_block64_shaNI;
+#endif
 }
 
 /* Initialize structure containing state of computation.
@@ -853,7 +1038,14 @@ void FAST_FUNC sha1_end(sha1_ctx_t *ctx, void *resbuf)
 	/* SHA stores total in BE, need to swap on LE arches: */
 	common64_end(ctx, /*swap_needed:*/ BB_LITTLE_ENDIAN);
 
-	hash_size = (ctx->process_block == sha1_process_block64) ? 5 : 8;
+	hash_size = 8;
+	if (ctx->process_block == sha1_process_block64
+#ifdef HAVE_SHA_NI
+	 || ctx->process_block == sha1_process_block64_shaNI
+#endif
+	) {
+		hash_size = 5;
+	}
 	/* This way we do not impose alignment constraints on resbuf: */
 	if (BB_LITTLE_ENDIAN) {
 		unsigned i;
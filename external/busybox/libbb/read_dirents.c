@@ -0,0 +1,84 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+
+#include "libbb.h"
+#include <sys/syscall.h>
+
+/* Reads all entries of directory FD in one go. readdir() returns them
+ * one by one from a small buffer; reading straight into a big one
+ * takes a few getdents64 calls even for huge directories, and lets
+ * the caller size its arrays before it looks at any entry.
+ *
+ * Returns malloced buffer of struct bb_dirent records, *size_p is
+ * the number of bytes used. Walk them with bb_next_dirent().
+ * "." and ".." are not filtered out.
+ * Returns NULL (errno is set) if FD can't be read as a directory.
+ */
+struct bb_dirent* FAST_FUNC xmalloc_read_dirents(int fd, size_t *size_p)
+{
+	/* One record is at most ~280 bytes, keep at least this much free */
+	enum { CHUNK = 32 * 1024, MIN_FREE = 4 * 1024 };
+	size_t size = CHUNK, used = 0;
+	char *buf = xmalloc(size);
+#ifdef __NR_getdents64
+	ssize_t n;
+
+	for (;;) {
+		if (size - used < MIN_FREE) {
+			size *= 2;
+			buf = xrealloc(buf, size);
+		}
+		n = syscall(__NR_getdents64, fd, buf + used, size - used);
+		if (n <= 0) {
+			if (n == 0)
+				break;
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return NULL;
+		}
+		used += n;
+	}
+#else
+	DIR *dir;
+	struct dirent *de;
+
+	fd = dup(fd);
+	dir = fd >= 0 ? fdopendir(fd) : NULL;
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		free(buf);
+		return NULL;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		struct bb_dirent *d;
+		unsigned len = strlen(de->d_name);
+		/* records are 8-byte aligned, as getdents64 makes them */
+		unsigned reclen = (offsetof(struct bb_dirent, d_name) + len + 1 + 7) & ~7;
+
+		if (size - used < reclen) {
+			size *= 2;
+			buf = xrealloc(buf, size);
+		}
+		d = (struct bb_dirent *)(buf + used);
+		d->d_ino = de->d_ino;
+		d->d_off = 0;
+		d->d_reclen = reclen;
+# ifdef DT_UNKNOWN
+		d->d_type = de->d_type;
+# else
+		d->d_type = 0;
+# endif
+		memcpy(d->d_name, de->d_name, len + 1);
+		used += reclen;
+	}
+	closedir(dir);
+#endif
+	*size_p = used;
+	return (struct bb_dirent *)buf;
+}
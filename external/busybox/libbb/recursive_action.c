@@ -8,6 +8,9 @@
  */
 
 #include "libbb.h"
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+# include <pthread.h>
+#endif
 
 #undef DEBUG_RECURS_ACTION
 
@@ -30,6 +33,234 @@ static int FAST_FUNC true_action(const char *fileName UNUSED_PARAM,
 	return TRUE;
 }
 
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+/* With ACTION_PARALLEL, entries of each directory are stat'ed by
+ * a few threads while the calling thread walks the tree. The callbacks
+ * are still called by the calling thread only and in the same order
+ * as without threads: applets' callbacks use globals freely and
+ * find/tar output order must not change. What we gain is that stat()
+ * latency (NFS round trips, flash reads) of many entries overlaps.
+ *
+ * Every directory being walked has a batch of entries on a stack.
+ * Idle threads take the next entry from the deepest batch which has
+ * any left: that is the one the walker will need first. The walker
+ * does not wait for an entry nobody took yet, it stats it itself.
+ */
+enum {
+	/* It's latency we parallelize, not CPU: don't scale with CPUs */
+	RA_THREADS = 8,
+	/* Smaller directories are not worth the locking */
+	RA_MIN_BATCH = 4,
+};
+
+struct ra_entry {
+	char *name;
+	struct stat st;
+	int err;           /* errno of failed stat, or 0 */
+	smallint dangling; /* stat failed, st is from lstat */
+	smallint done;
+};
+
+struct ra_batch {
+	struct ra_batch *prev;
+	struct ra_entry *ent;
+	unsigned cnt;
+	unsigned next;     /* first entry not taken by anyone yet */
+	int dirfd;
+	int at_flags;
+	smallint dangling_ok;
+};
+
+struct ra_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct ra_batch *top;
+	pid_t pid;         /* threads exist in this process only */
+	unsigned nthreads;
+	smallint waiting;
+	smallint quit;
+	pthread_t tid[RA_THREADS];
+};
+static struct ra_pool *ra_pool;
+
+/* Same stat/lstat as recursive_action() does, but relative to dirfd */
+static void ra_stat(const struct ra_batch *b, struct ra_entry *e)
+{
+	const char *name = bb_basename(e->name);
+
+	if (fstatat(b->dirfd, name, &e->st, b->at_flags) != 0) {
+		e->err = errno;
+		if (b->dangling_ok
+		 && e->err == ENOENT
+		 && fstatat(b->dirfd, name, &e->st, AT_SYMLINK_NOFOLLOW) == 0
+		) {
+			e->dangling = 1;
+		}
+	}
+}
+
+static void *ra_worker(void *arg UNUSED_PARAM)
+{
+	struct ra_pool *p = ra_pool;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		struct ra_batch *b;
+		struct ra_entry *e;
+
+		for (b = p->top; b; b = b->prev)
+			if (b->next < b->cnt)
+				break;
+		if (!b) {
+			if (p->quit)
+				break;
+			pthread_cond_wait(&p->work_cond, &p->lock);
+			continue;
+		}
+		/* The batch stays alive until all its entries are done */
+		e = &b->ent[b->next++];
+		pthread_mutex_unlock(&p->lock);
+		ra_stat(b, e);
+		pthread_mutex_lock(&p->lock);
+		e->done = 1;
+		if (p->waiting)
+			pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static void ra_pool_start(void)
+{
+	struct ra_pool *p;
+	sigset_t set, oldset;
+
+	p = ra_pool = xzalloc(sizeof(*p));
+	p->pid = getpid();
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	/* Signals are for the applet's thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	while (p->nthreads < RA_THREADS) {
+		/* If none can be created, walker stats everything itself */
+		if (pthread_create(&p->tid[p->nthreads], NULL, ra_worker, NULL) != 0)
+			break;
+		p->nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+
+static void ra_pool_stop(void)
+{
+	struct ra_pool *p = ra_pool;
+	unsigned i;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->tid[i], NULL);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	ra_pool = NULL;
+}
+
+/* Returns with entry I of B stat'ed */
+static void ra_wait_entry(struct ra_batch *b, unsigned i)
+{
+	struct ra_pool *p = ra_pool;
+	struct ra_entry *e = &b->ent[i];
+
+	pthread_mutex_lock(&p->lock);
+	if (b->next <= i) {
+		/* Nobody took it yet (b->next == i here) */
+		b->next = i + 1;
+		pthread_mutex_unlock(&p->lock);
+		ra_stat(b, e);
+		return;
+	}
+	while (!e->done) {
+		p->waiting = 1;
+		pthread_cond_wait(&p->done_cond, &p->lock);
+	}
+	p->waiting = 0;
+	pthread_mutex_unlock(&p->lock);
+}
+
+static int recursive_action1(const char *fileName,
+		unsigned flags,
+		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		void* userData,
+		unsigned depth,
+		struct ra_entry *pre);
+
+/* Walks directory DIR, entries are stat'ed in parallel */
+static int recurse_dir_parallel(DIR *dir, const char *fileName,
+		unsigned flags,
+		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		void* userData,
+		unsigned depth)
+{
+	struct ra_batch b;
+	struct dirent *next;
+	unsigned i;
+	int status;
+
+	memset(&b, 0, sizeof(b));
+	while ((next = readdir(dir)) != NULL) {
+		char *nextFile;
+
+		nextFile = concat_subpath_file(fileName, next->d_name);
+		if (nextFile == NULL)
+			continue;
+		b.ent = xrealloc_vector(b.ent, 6, b.cnt);
+		b.ent[b.cnt++].name = nextFile;
+	}
+	b.dirfd = dirfd(dir);
+	b.at_flags = (flags & ACTION_FOLLOWLINKS) ? 0 : AT_SYMLINK_NOFOLLOW;
+	b.dangling_ok = (flags & ACTION_DANGLING_OK) != 0;
+
+	if (b.cnt >= RA_MIN_BATCH) {
+		if (!ra_pool)
+			ra_pool_start();
+		pthread_mutex_lock(&ra_pool->lock);
+		b.prev = ra_pool->top;
+		ra_pool->top = &b;
+		pthread_cond_broadcast(&ra_pool->work_cond);
+		pthread_mutex_unlock(&ra_pool->lock);
+	}
+
+	status = TRUE;
+	for (i = 0; i < b.cnt; i++) {
+		if (b.cnt >= RA_MIN_BATCH)
+			ra_wait_entry(&b, i);
+		else
+			ra_stat(&b, &b.ent[i]);
+		if (!recursive_action1(b.ent[i].name, flags, fileAction, dirAction,
+						userData, depth + 1, &b.ent[i]))
+			status = FALSE;
+		free(b.ent[i].name);
+	}
+
+	if (b.cnt >= RA_MIN_BATCH) {
+		/* All entries are done, no thread refers to b */
+		pthread_mutex_lock(&ra_pool->lock);
+		ra_pool->top = b.prev;
+		pthread_mutex_unlock(&ra_pool->lock);
+	}
+	free(b.ent);
+	return status;
+}
+#endif
+
 /* fileAction return value of 0 on any file in directory will make
  * recursive_action() return 0, but it doesn't stop directory traversal
  * (fileAction/dirAction will be called on each file).
@@ -53,12 +284,52 @@ static int FAST_FUNC true_action(const char *fileName UNUSED_PARAM,
  * 1: stat(statbuf). Calls dirAction and optionally recurse on link to dir.
  */
 
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+int FAST_FUNC recursive_action(const char *fileName,
+		unsigned flags,
+		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		void* userData,
+		unsigned depth)
+{
+	int own;
+	int status;
+
+	/* A child forked by a callback (find -exec of a NOEXEC applet)
+	 * has the pointer but not the threads, and the lock may have been
+	 * held by one of them at fork time. Leave it alone, make new ones */
+	if (ra_pool && ra_pool->pid != getpid())
+		ra_pool = NULL;
+	/* A callback may walk a tree too: the outermost walk owns the threads */
+	own = !ra_pool;
+	/* On one CPU, handing entries to threads costs more than it saves
+	 * when they are in the cache (~25% slower), walk the plain way */
+	if (own && (flags & ACTION_PARALLEL) && bb_online_cpus(2) < 2)
+		flags &= ~ACTION_PARALLEL;
+
+	status = recursive_action1(fileName, flags, fileAction, dirAction,
+			userData, depth, NULL);
+	if (own && ra_pool)
+		ra_pool_stop();
+	return status;
+}
+
+/* PRE: if not NULL, fileName was already stat'ed */
+static int recursive_action1(const char *fileName,
+		unsigned flags,
+		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		void* userData,
+		unsigned depth,
+		struct ra_entry *pre)
+#else
 int FAST_FUNC recursive_action(const char *fileName,
 		unsigned flags,
 		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
 		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
 		void* userData,
 		unsigned depth)
+#endif
 {
 	struct stat statbuf;
 	unsigned follow;
@@ -69,6 +340,18 @@ int FAST_FUNC recursive_action(const char *fileName,
 	if (!fileAction) fileAction = true_action;
 	if (!dirAction) dirAction = true_action;
 
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+	if (pre) {
+		if (pre->err) {
+			errno = pre->err;
+			if (pre->dangling)
+				return fileAction(fileName, &pre->st, userData, depth);
+			goto done_nak_warn;
+		}
+		statbuf = pre->st;
+		goto got_stat;
+	}
+#endif
 	follow = ACTION_FOLLOWLINKS;
 	if (depth == 0)
 		follow = ACTION_FOLLOWLINKS | ACTION_FOLLOWLINKS_L0;
@@ -87,6 +370,9 @@ int FAST_FUNC recursive_action(const char *fileName,
 		}
 		goto done_nak_warn;
 	}
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+ got_stat:
+#endif
 
 	/* If S_ISLNK(m), then we know that !S_ISDIR(m).
 	 * Then we can skip checking first part: if it is true, then
@@ -118,6 +404,13 @@ int FAST_FUNC recursive_action(const char *fileName,
 		/* To trigger: "find -exec rm -rf {} \;" */
 		goto done_nak_warn;
 	}
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+	if (flags & ACTION_PARALLEL) {
+		status = recurse_dir_parallel(dir, fileName, flags,
+				fileAction, dirAction, userData, depth);
+		goto dir_done;
+	}
+#endif
 	status = TRUE;
 	while ((next = readdir(dir)) != NULL) {
 		char *nextFile;
@@ -140,6 +433,9 @@ int FAST_FUNC recursive_action(const char *fileName,
 //		if (s == FALSE)
 //			status = FALSE;
 	}
+#if ENABLE_FEATURE_RECURSIVE_ACTION_THREADS
+ dir_done:
+#endif
 	closedir(dir);
 
 	if (flags & ACTION_DEPTHFIRST) {
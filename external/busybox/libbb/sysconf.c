@@ -0,0 +1,44 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Various system configuration helpers.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+#include "libbb.h"
+
+/* How many bytes of arguments (and environment) we may pass to exec.
+ * The Open Group Base Specifications Issue 6:
+ * "The xargs utility shall limit the command line length such that
+ * when the command line is invoked, the combined argument
+ * and environment lists (see the exec family of functions
+ * in the System Interfaces volume of IEEE Std 1003.1-2001)
+ * shall not exceed {ARG_MAX}-2048 bytes".
+ */
+unsigned FAST_FUNC bb_arg_max(void)
+{
+	long r = 0;
+#if defined _SC_ARG_MAX
+	r = sysconf(_SC_ARG_MAX);
+#elif defined ARG_MAX
+	r = ARG_MAX;
+#endif
+	/* Guard against -1 and other crazy values */
+	if (r < 4096 + 2048)
+		r = 4096 + 2048;
+	if (r > INT_MAX)
+		r = INT_MAX;
+	return r - 2048;
+}
+
+/* How many threads/processes to split work between: the number
+ * of online CPUs, at least 1, at most MAX */
+unsigned FAST_FUNC bb_online_cpus(unsigned max)
+{
+	long r = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (r < 1)
+		r = 1;
+	if (r > max)
+		r = max;
+	return r;
+}
@@ -13,14 +13,14 @@
 #include "libbb.h"
 
 int die_sleep;
-#if ENABLE_FEATURE_PREFER_APPLETS || ENABLE_HUSH
+#if ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK || ENABLE_HUSH
 jmp_buf die_jmp;
 #endif
 
 void FAST_FUNC xfunc_die(void)
 {
 	if (die_sleep) {
-		if ((ENABLE_FEATURE_PREFER_APPLETS || ENABLE_HUSH)
+		if ((ENABLE_FEATURE_PREFER_APPLETS || ENABLE_FEATURE_SH_NOFORK || ENABLE_HUSH)
 		 && die_sleep < 0
 		) {
 			/* Special case. We arrive here if NOFORK applet
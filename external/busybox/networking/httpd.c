@@ -98,7 +98,7 @@
  /* TODO: use TCP_CORK, parse_config() */
 
 //usage:#define httpd_trivial_usage
-//usage:       "[-ifv[v]]"
+//usage:       "[-if" IF_FEATURE_HTTPD_EVENT_LOOP("k") "v[v]]"
 //usage:       " [-c CONFFILE]"
 //usage:       " [-p [IP:]PORT]"
 //usage:	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]")
@@ -109,6 +109,8 @@
 //usage:       "Listen for incoming HTTP requests\n"
 //usage:     "\n	-i		Inetd mode"
 //usage:     "\n	-f		Don't daemonize"
+//usage:	IF_FEATURE_HTTPD_EVENT_LOOP(
+//usage:     "\n	-k		Serve static files from one process, with keep-alive")
 //usage:     "\n	-v[v]		Verbose"
 //usage:     "\n	-p [IP:]PORT	Bind to IP:PORT (default *:80)"
 //usage:	IF_FEATURE_HTTPD_SETUID(
@@ -126,6 +128,14 @@
 #if ENABLE_FEATURE_HTTPD_USE_SENDFILE
 # include <sys/sendfile.h>
 #endif
+#if ENABLE_FEATURE_HTTPD_EVENT_LOOP
+# include <sys/epoll.h>
+# include <netinet/tcp.h>
+#endif
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+# include <sys/inotify.h>
+# include <sys/resource.h>
+#endif
 /* amount of buffering in a pipe */
 #ifndef PIPE_BUF
 # define PIPE_BUF 4096
@@ -139,11 +149,16 @@
 #endif
 
 #define HEADER_READ_TIMEOUT 60
+/* -k: how long an idle kept-alive connection may wait for next request */
+#define KEEPALIVE_TIMEOUT 15
+/* -k: buckets of open file cache */
+#define FILE_CACHE_HASH 256
 
 static const char DEFAULT_PATH_HTTPD_CONF[] ALIGN1 = "/etc";
 static const char HTTPD_CONF[] ALIGN1 = "httpd.conf";
 static const char HTTP_200[] ALIGN1 = "HTTP/1.0 200 OK\r\n";
 static const char index_html[] ALIGN1 = "index.html";
+static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
 
 typedef struct has_next_ptr {
 	struct has_next_ptr *next;
@@ -310,6 +325,27 @@ struct globals {
 	/* client can handle gzip / we are going to send gzip */
 	smallint content_gzip;
 #endif
+#if ENABLE_FEATURE_HTTPD_EVENT_LOOP
+	/* reply leaves the connection open / is HTTP/1.1 */
+	smallint keep_alive;
+	smallint http11;
+	smallint accept_paused;
+	int server_socket;
+	int epoll_fd;
+	unsigned now;           /* monotonic_sec() of this loop iteration */
+	struct conn *conn_list;
+#endif
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	int inotify_fd;
+	unsigned cache_cnt;
+	unsigned cache_max;
+	struct cached_file *lru_head; /* most recently used */
+	struct cached_file *lru_tail;
+	struct cached_file *file_cache[FILE_CACHE_HASH];
+	/* Date: header of replies from cache, redone once a second */
+	time_t date_time;
+	char date[40];
+#endif
 };
 #define G (*ptr_to_globals)
 #define verbose           (G.verbose          )
@@ -357,6 +393,13 @@ enum {
 #else
 # define content_gzip     0
 #endif
+#if ENABLE_FEATURE_HTTPD_EVENT_LOOP
+# define keep_alive       (G.keep_alive       )
+# define http11           (G.http11           )
+#else
+# define keep_alive       0
+# define http11           0
+#endif
 #define INIT_G() do { \
 	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
 	IF_FEATURE_HTTPD_BASIC_AUTH(g_realm = "Web Server Authentication";) \
@@ -975,16 +1018,15 @@ static void log_and_exit(void)
 }
 
 /*
- * Create and send HTTP response headers.
- * The arguments are combined and sent as one write operation.  Note that
- * IE will puke big-time if the headers are not sent in one packet and the
- * second packet is delayed for any reason.
+ * Format HTTP response headers (and the built-in HTML body of
+ * an error reply, if any) into iobuf. Returns their length.
+ * If a custom error page is to be sent instead of the built-in
+ * body, *error_page_p is set to it and the headers are
+ * terminated right after the Location: line.
  * responseNum - the result code to send.
  */
-static void send_headers(int responseNum)
+static int format_headers(int responseNum, const char **error_page_p)
 {
-	static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
-
 	const char *responseString = "";
 	const char *infoString = NULL;
 	const char *mime_type;
@@ -994,8 +1036,11 @@ static void send_headers(int responseNum)
 	unsigned i;
 	time_t timer = time(NULL);
 	char tmp_str[80];
-	int len;
+	/* longest built-in body is under 200 chars */
+	char html[256];
+	int len, html_len;
 
+	*error_page_p = NULL;
 	for (i = 0; i < ARRAY_SIZE(http_response_type); i++) {
 		if (http_response_type[i] == responseNum) {
 			responseString = http_response[i].name;
@@ -1016,9 +1061,10 @@ static void send_headers(int responseNum)
 	/* emit the current date */
 	strftime(tmp_str, sizeof(tmp_str), RFC1123FMT, gmtime(&timer));
 	len = sprintf(iobuf,
-			"HTTP/1.0 %d %s\r\nContent-type: %s\r\n"
-			"Date: %s\r\nConnection: close\r\n",
-			responseNum, responseString, mime_type, tmp_str);
+			"HTTP/1.%c %d %s\r\nContent-type: %s\r\n"
+			"Date: %s\r\nConnection: %s\r\n",
+			'0' + http11, responseNum, responseString, mime_type, tmp_str,
+			keep_alive ? "keep-alive" : "close");
 
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
 	if (responseNum == HTTP_UNAUTHORIZED) {
@@ -1038,13 +1084,8 @@ static void send_headers(int responseNum)
 	if (error_page && access(error_page, R_OK) == 0) {
 		strcat(iobuf, "\r\n");
 		len += 2;
-
-		if (DEBUG)
-			fprintf(stderr, "headers: '%s'\n", iobuf);
-		full_write(STDOUT_FILENO, iobuf, len);
-		if (DEBUG)
-			fprintf(stderr, "writing error page: '%s'\n", error_page);
-		return send_file_and_exit(error_page, SEND_BODY);
+		*error_page_p = error_page;
+		return len;
 	}
 #endif
 
@@ -1065,7 +1106,8 @@ static void send_headers(int responseNum)
 #endif
 			"Last-Modified: %s\r\n%s %"OFF_FMT"u\r\n",
 				tmp_str,
-				content_gzip ? "Transfer-length:" : "Content-length:",
+				/* a kept-alive peer must know where the body ends */
+				content_gzip && !keep_alive ? "Transfer-length:" : "Content-length:",
 				file_size
 		);
 	}
@@ -1073,15 +1115,46 @@ static void send_headers(int responseNum)
 	if (content_gzip)
 		len += sprintf(iobuf + len, "Content-Encoding: gzip\r\n");
 
-	iobuf[len++] = '\r';
-	iobuf[len++] = '\n';
+	html_len = 0;
 	if (infoString) {
-		len += sprintf(iobuf + len,
+		html_len = sprintf(html,
 				"<HTML><HEAD><TITLE>%d %s</TITLE></HEAD>\n"
 				"<BODY><H1>%d %s</H1>\n%s\n</BODY></HTML>\n",
 				responseNum, responseString,
 				responseNum, responseString, infoString);
 	}
+	if (keep_alive && file_size == -1)
+		len += sprintf(iobuf + len, "Content-length: %u\r\n", html_len);
+
+	iobuf[len++] = '\r';
+	iobuf[len++] = '\n';
+	memcpy(iobuf + len, html, html_len);
+	return len + html_len;
+}
+
+/*
+ * Create and send HTTP response headers.
+ * The arguments are combined and sent as one write operation.  Note that
+ * IE will puke big-time if the headers are not sent in one packet and the
+ * second packet is delayed for any reason.
+ * responseNum - the result code to send.
+ */
+static void send_headers(int responseNum)
+{
+	const char *error_page;
+	int len;
+
+	len = format_headers(responseNum, &error_page);
+#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
+	if (error_page) {
+		if (DEBUG)
+			fprintf(stderr, "headers: '%s'\n", iobuf);
+		full_write(STDOUT_FILENO, iobuf, len);
+		if (DEBUG)
+			fprintf(stderr, "writing error page: '%s'\n", error_page);
+		return send_file_and_exit(error_page, SEND_BODY);
+	}
+#endif
 	if (DEBUG)
 		fprintf(stderr, "headers: '%s'\n", iobuf);
 	if (full_write(STDOUT_FILENO, iobuf, len) != len) {
@@ -1531,52 +1604,15 @@ static void send_cgi_and_exit(
 #endif          /* FEATURE_HTTPD_CGI */
 
 /*
- * Send a file response to a HTTP request, and exit
- *
- * Parameters:
- * const char *url  The requested URL (with leading /).
- * what             What to send (headers/body/both).
+ * Look up MIME type of URL by its suffix:
+ * built-in table first, then the ".ext:mime/type" config lines.
  */
-static NOINLINE void send_file_and_exit(const char *url, int what)
+static const char *find_mime_type(const char *url)
 {
-	char *suffix;
-	int fd;
-	ssize_t count;
-
-	if (content_gzip) {
-		/* does <url>.gz exist? Then use it instead */
-		char *gzurl = xasprintf("%s.gz", url);
-		fd = open(gzurl, O_RDONLY);
-		free(gzurl);
-		if (fd != -1) {
-			struct stat sb;
-			fstat(fd, &sb);
-			file_size = sb.st_size;
-			last_mod = sb.st_mtime;
-		} else {
-			IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
-			fd = open(url, O_RDONLY);
-		}
-	} else {
-		fd = open(url, O_RDONLY);
-	}
-	if (fd < 0) {
-		if (DEBUG)
-			bb_perror_msg("can't open '%s'", url);
-		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
-		 * IOW: it is unsafe to call send_headers_and_exit
-		 * if what is SEND_BODY! Can recurse! */
-		if (what != SEND_BODY)
-			send_headers_and_exit(HTTP_NOT_FOUND);
-		log_and_exit();
-	}
-	/* If you want to know about EPIPE below
-	 * (happens if you abort downloads from local httpd): */
-	signal(SIGPIPE, SIG_IGN);
-
 	/* If not found, default is "application/octet-stream" */
-	found_mime_type = "application/octet-stream";
-	suffix = strrchr(url, '.');
+	const char *found = "application/octet-stream";
+	const char *suffix = strrchr(url, '.');
+
 	if (suffix) {
 		static const char suffixTable[] ALIGN1 =
 			/* Shorter suffix must be first:
@@ -1618,7 +1654,7 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 				continue;
 			try_suffix += strlen(suffix);
 			if (*try_suffix == '\0' || *try_suffix == '.') {
-				found_mime_type = mime_type;
+				found = mime_type;
 				break;
 			}
 			/* Example: strstr(table, ".av") != NULL, but it
@@ -1631,11 +1667,58 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		/* ...then user's table */
 		for (cur = mime_a; cur; cur = cur->next) {
 			if (strcmp(cur->before_colon, suffix) == 0) {
-				found_mime_type = cur->after_colon;
+				found = cur->after_colon;
 				break;
 			}
 		}
 	}
+	return found;
+}
+
+/*
+ * Send a file response to a HTTP request, and exit
+ *
+ * Parameters:
+ * const char *url  The requested URL (with leading /).
+ * what             What to send (headers/body/both).
+ */
+static NOINLINE void send_file_and_exit(const char *url, int what)
+{
+	int fd;
+	ssize_t count;
+
+	if (content_gzip) {
+		/* does <url>.gz exist? Then use it instead */
+		char *gzurl = xasprintf("%s.gz", url);
+		fd = open(gzurl, O_RDONLY);
+		free(gzurl);
+		if (fd != -1) {
+			struct stat sb;
+			fstat(fd, &sb);
+			file_size = sb.st_size;
+			last_mod = sb.st_mtime;
+		} else {
+			IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
+			fd = open(url, O_RDONLY);
+		}
+	} else {
+		fd = open(url, O_RDONLY);
+	}
+	if (fd < 0) {
+		if (DEBUG)
+			bb_perror_msg("can't open '%s'", url);
+		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
+		 * IOW: it is unsafe to call send_headers_and_exit
+		 * if what is SEND_BODY! Can recurse! */
+		if (what != SEND_BODY)
+			send_headers_and_exit(HTTP_NOT_FOUND);
+		log_and_exit();
+	}
+	/* If you want to know about EPIPE below
+	 * (happens if you abort downloads from local httpd): */
+	signal(SIGPIPE, SIG_IGN);
+
+	found_mime_type = find_mime_type(url);
 
 	if (DEBUG)
 		bb_error_msg("sending file '%s' content-type: %s",
@@ -1824,6 +1907,101 @@ static Htaccess_Proxy *find_proxy_entry(const char *url)
 }
 #endif
 
+static unsigned sockaddr2ip(const len_and_sockaddr *fromAddr)
+{
+	if (fromAddr->u.sa.sa_family == AF_INET) {
+		return ntohl(fromAddr->u.sin.sin_addr.s_addr);
+	}
+#if ENABLE_FEATURE_IPV6
+	if (fromAddr->u.sa.sa_family == AF_INET6
+	 && fromAddr->u.sin6.sin6_addr.s6_addr32[0] == 0
+	 && fromAddr->u.sin6.sin6_addr.s6_addr32[1] == 0
+	 && ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[2]) == 0xffff)
+		return ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[3]);
+#endif
+	return 0;
+}
+
+/*
+ * Canonicalize decoded URL in place.
+ * Algorithm stolen from libbb bb_simplify_path(),
+ * but don't strdup, retain trailing slash, protect root.
+ * Returns pointer to the terminating NUL, or NULL if ".." tries
+ * to go above root.
+ */
+static char *canonicalize_url(char *urlcopy)
+{
+	char *urlp, *tptr;
+
+	urlp = tptr = urlcopy;
+	do {
+		if (*urlp == '/') {
+			/* skip duplicate (or initial) slash */
+			if (*tptr == '/') {
+				continue;
+			}
+			if (*tptr == '.') {
+				/* skip extra "/./" */
+				if (tptr[1] == '/' || !tptr[1]) {
+					continue;
+				}
+				/* "..": be careful */
+				if (tptr[1] == '.' && (tptr[2] == '/' || !tptr[2])) {
+					++tptr;
+					if (urlp == urlcopy) /* protect root */
+						return NULL;
+					while (*--urlp != '/') /* omit previous dir */;
+						continue;
+				}
+			}
+		}
+		*++urlp = *tptr;
+	} while (*++tptr);
+	*++urlp = '\0';       /* terminate after last character */
+	return urlp;
+}
+
+/*
+ * Request headers which affect how a static file is sent.
+ */
+static void parse_file_header(const char *line)
+{
+#if ENABLE_FEATURE_HTTPD_RANGES
+	if (STRNCASECMP(line, "Range:") == 0) {
+		/* We know only bytes=NNN-[MMM] */
+		char *s = skip_whitespace(line + sizeof("Range:")-1);
+		if (strncmp(s, "bytes=", 6) == 0) {
+			s += sizeof("bytes=")-1;
+			range_start = BB_STRTOOFF(s, &s, 10);
+			if (s[0] != '-' || range_start < 0) {
+				range_start = 0;
+			} else if (s[1]) {
+				range_end = BB_STRTOOFF(s+1, NULL, 10);
+				if (errno || range_end < range_start)
+					range_start = 0;
+			}
+		}
+	}
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP
+	if (STRNCASECMP(line, "Accept-Encoding:") == 0) {
+		/* Note: we do not support "gzip;q=0"
+		 * method of _disabling_ gzip
+		 * delivery. No one uses that, though */
+		const char *s = strstr(line, "gzip");
+		if (s) {
+			// want more thorough checks?
+			//if (s[-1] == ' '
+			// || s[-1] == ','
+			// || s[-1] == ':'
+			//) {
+				content_gzip = 1;
+			//}
+		}
+	}
+#endif
+}
+
 /*
  * Handle timeouts
  */
@@ -1870,17 +2048,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	 * (IOW, server process doesn't need to waste 8k) */
 	iobuf = xmalloc(IOBUF_SIZE);
 
-	rmt_ip = 0;
-	if (fromAddr->u.sa.sa_family == AF_INET) {
-		rmt_ip = ntohl(fromAddr->u.sin.sin_addr.s_addr);
-	}
-#if ENABLE_FEATURE_IPV6
-	if (fromAddr->u.sa.sa_family == AF_INET6
-	 && fromAddr->u.sin6.sin6_addr.s6_addr32[0] == 0
-	 && fromAddr->u.sin6.sin6_addr.s6_addr32[1] == 0
-	 && ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[2]) == 0xffff)
-		rmt_ip = ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[3]);
-#endif
+	rmt_ip = sockaddr2ip(fromAddr);
 	if (ENABLE_FEATURE_HTTPD_CGI || DEBUG || verbose) {
 		/* NB: can be NULL (user runs httpd -i by hand?) */
 		rmt_ip_str = xmalloc_sockaddr2dotted(&fromAddr->u.sa);
@@ -1958,33 +2126,9 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	}
 
 	/* Canonicalize path */
-	/* Algorithm stolen from libbb bb_simplify_path(),
-	 * but don't strdup, retain trailing slash, protect root */
-	urlp = tptr = urlcopy;
-	do {
-		if (*urlp == '/') {
-			/* skip duplicate (or initial) slash */
-			if (*tptr == '/') {
-				continue;
-			}
-			if (*tptr == '.') {
-				/* skip extra "/./" */
-				if (tptr[1] == '/' || !tptr[1]) {
-					continue;
-				}
-				/* "..": be careful */
-				if (tptr[1] == '.' && (tptr[2] == '/' || !tptr[2])) {
-					++tptr;
-					if (urlp == urlcopy) /* protect root */
-						send_headers_and_exit(HTTP_BAD_REQUEST);
-					while (*--urlp != '/') /* omit previous dir */;
-						continue;
-				}
-			}
-		}
-		*++urlp = *tptr;
-	} while (*++tptr);
-	*++urlp = '\0';       /* terminate after last character */
+	urlp = canonicalize_url(urlcopy);
+	if (urlp == NULL)
+		send_headers_and_exit(HTTP_BAD_REQUEST);
 
 	/* If URL is a directory, add '/' */
 	if (urlp[-1] != '/') {
@@ -2093,40 +2237,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 				authorized = check_user_passwd(urlcopy, tptr);
 			}
 #endif
-#if ENABLE_FEATURE_HTTPD_RANGES
-			if (STRNCASECMP(iobuf, "Range:") == 0) {
-				/* We know only bytes=NNN-[MMM] */
-				char *s = skip_whitespace(iobuf + sizeof("Range:")-1);
-				if (strncmp(s, "bytes=", 6) == 0) {
-					s += sizeof("bytes=")-1;
-					range_start = BB_STRTOOFF(s, &s, 10);
-					if (s[0] != '-' || range_start < 0) {
-						range_start = 0;
-					} else if (s[1]) {
-						range_end = BB_STRTOOFF(s+1, NULL, 10);
-						if (errno || range_end < range_start)
-							range_start = 0;
-					}
-				}
-			}
-#endif
-#if ENABLE_FEATURE_HTTPD_GZIP
-			if (STRNCASECMP(iobuf, "Accept-Encoding:") == 0) {
-				/* Note: we do not support "gzip;q=0"
-				 * method of _disabling_ gzip
-				 * delivery. No one uses that, though */
-				const char *s = strstr(iobuf, "gzip");
-				if (s) {
-					// want more thorough checks?
-					//if (s[-1] == ' '
-					// || s[-1] == ','
-					// || s[-1] == ':'
-					//) {
-						content_gzip = 1;
-					//}
-				}
-			}
-#endif
+			parse_file_header(iobuf);
 		} /* while extra header reading */
 	}
 
@@ -2233,30 +2344,1160 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 }
 
+#if ENABLE_FEATURE_HTTPD_EVENT_LOOP
 /*
- * The main http server function.
- * Given a socket, listen for new connections and farm out
- * the processing as a [v]forked process.
- * Never returns.
+ * Single-process server (-k).
+ *
+ * Every connection is a small state machine driven by epoll.
+ * In CONN_READ it collects a request head in rbuf. A complete head
+ * is parsed, the reply is set up and the connection goes to
+ * CONN_SEND, which pushes out the headers and then the file with
+ * sendfile() as fast as the peer takes them. Then a kept-alive
+ * connection returns to CONN_READ and serves the next request,
+ * which may be already sitting in rbuf (pipelining).
+ *
+ * Only GET and HEAD of plain files, and the redirects and errors
+ * they can produce, are served here. Everything else (CGI, proxy,
+ * POST, password protected paths, dirs with their own httpd.conf,
+ * custom error pages, HTTP/0.9) is handed off to a forked child,
+ * which replays the buffered request through
+ * handle_incoming_and_exit() and closes the connection after
+ * the reply - exactly what happens without -k.
  */
-#if BB_MMU
-static void mini_httpd(int server_socket) NORETURN;
-static void mini_httpd(int server_socket)
-{
-	/* NB: it's best to not use xfuncs in this loop before fork().
-	 * Otherwise server may die on transient errors (temporary
-	 * out-of-memory condition, etc), which is Bad(tm).
-	 * Try to do any dangerous calls after fork.
-	 */
-	while (1) {
-		int n;
-		len_and_sockaddr fromAddr;
 
-		/* Wait for connections... */
-		fromAddr.len = LSA_SIZEOF_SA;
-		n = accept(server_socket, &fromAddr.u.sa, &fromAddr.len);
-		if (n < 0)
-			continue;
+/* Request head must fit into both iobuf and hdr_buf (for replay) */
+#define CONN_BUFSIZE (COMMON_BUFSIZE < IOBUF_SIZE ? COMMON_BUFSIZE : IOBUF_SIZE)
+
+enum {
+	CONN_READ,
+	CONN_SEND,
+};
+
+struct conn {
+	struct conn *next;
+	struct conn *prev;
+	int fd;
+	unsigned events;        /* what epoll watches for */
+	unsigned deadline;      /* monotonic_sec() */
+	smallint state;
+	smallint close_after;   /* reply said "Connection: close" */
+	smallint no_sendfile;
+	unsigned ip;            /* for IP-based allow/deny rules */
+	char *ip_str;           /* only with -v */
+	/* reply */
+	char *out;              /* headers which did not fit into socket */
+	unsigned out_pos;
+	unsigned out_len;
+	int file_fd;            /* -1: no body besides what is in headers */
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	struct cached_file *cached; /* file_fd belongs to it */
+#endif
+	off_t file_pos;
+	off_t file_end;
+	/* request */
+	unsigned rpos;          /* rbuf[rpos..rlen) is not processed yet */
+	unsigned rlen;
+	unsigned head_len;      /* length of request head at rpos */
+	len_and_sockaddr from;
+	char rbuf[CONN_BUFSIZE];
+};
+
+static void reset_request(void)
+{
+	g_query = NULL;
+	found_moved_temporarily = NULL;
+	file_size = -1;
+	last_mod = 0;
+#if ENABLE_FEATURE_HTTPD_RANGES
+	range_start = 0;
+	range_end = 0;
+#endif
+	IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
+	keep_alive = 0;
+	http11 = 0;
+}
+
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+/*
+ * Open file cache.
+ *
+ * A plain file served by the loop stays open in a cache entry
+ * keyed by its canonical URL, together with its .gz variant, their
+ * sizes, mtimes and a pre-rendered block of per-file headers.
+ * A hit needs no open(), stat() or access() at all. Instead,
+ * every directory on the way to the file is watched with inotify:
+ * a change of the file or of its .gz drops the entry, anything
+ * which may change how the URL maps to files (a subdir renamed,
+ * an httpd.conf appearing...) drops them all. Without inotify,
+ * and for symlinks, whose target may live anywhere, an entry is
+ * trusted for a second only, and its files are fstat'ed on every
+ * hit: one rewritten in place must not go out with its old length.
+ *
+ * Connections sending a file share the entry's fd: sendfile()
+ * and pread() do not move the file position. An entry dropped
+ * while in use is freed when the last of them is done.
+ */
+struct file_variant {
+	int fd;                 /* -1: does not exist */
+	unsigned hdr_len;
+	char *hdr;              /* Accept-Ranges: ... up to empty line */
+	off_t size;
+	time_t mtime;
+};
+
+struct cached_file {
+	struct cached_file *hash_next;
+	struct cached_file *lru_prev;
+	struct cached_file *lru_next;
+	unsigned refs;          /* +1 while in the cache */
+	unsigned expires;       /* 0: watched by inotify */
+	const char *mime;
+	char *ctype;            /* "Content-type: MIME\r\nDate: " */
+	char *file;             /* relative to home dir */
+	struct file_variant v[1 + ENABLE_FEATURE_HTTPD_GZIP]; /* plain, .gz */
+	char url[1];
+};
+
+enum {
+	WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF,
+};
+
+static unsigned url_hash(const char *url, unsigned len)
+{
+	unsigned h = 0;
+	while (len--)
+		h = h * 31 + (unsigned char)*url++;
+	return h % FILE_CACHE_HASH;
+}
+
+static void file_cache_unref(struct cached_file *fc)
+{
+	unsigned i;
+
+	if (--fc->refs)
+		return;
+	for (i = 0; i < ARRAY_SIZE(fc->v); i++) {
+		if (fc->v[i].fd >= 0)
+			close(fc->v[i].fd);
+		free(fc->v[i].hdr);
+	}
+	free(fc->ctype);
+	free(fc->file);
+	free(fc);
+}
+
+static void file_cache_drop(struct cached_file *fc)
+{
+	struct cached_file **pp;
+
+	pp = &G.file_cache[url_hash(fc->url, strlen(fc->url))];
+	while (*pp != fc)
+		pp = &(*pp)->hash_next;
+	*pp = fc->hash_next;
+
+	if (fc->lru_prev)
+		fc->lru_prev->lru_next = fc->lru_next;
+	else
+		G.lru_head = fc->lru_next;
+	if (fc->lru_next)
+		fc->lru_next->lru_prev = fc->lru_prev;
+	else
+		G.lru_tail = fc->lru_prev;
+	G.cache_cnt--;
+	file_cache_unref(fc);
+}
+
+static void file_cache_flush(void)
+{
+	while (G.lru_head)
+		file_cache_drop(G.lru_head);
+}
+
+/* Do the open files still have the size and mtime we cached? */
+static int file_cache_unchanged(struct cached_file *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(fc->v); i++) {
+		struct stat sb;
+
+		if (fc->v[i].fd < 0)
+			continue;
+		if (fstat(fc->v[i].fd, &sb) != 0
+		 || sb.st_size != fc->v[i].size
+		 || sb.st_mtime != fc->v[i].mtime
+		) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static struct cached_file *file_cache_find(const char *url, unsigned len)
+{
+	struct cached_file *fc;
+
+	for (fc = G.file_cache[url_hash(url, len)]; fc; fc = fc->hash_next) {
+		if (strncmp(fc->url, url, len) != 0 || fc->url[len])
+			continue;
+		if (fc->expires
+		 && ((int)(G.now - fc->expires) >= 0 || !file_cache_unchanged(fc))
+		) {
+			file_cache_drop(fc);
+			return NULL;
+		}
+		/* Move to the head of LRU list */
+		if (fc->lru_prev) {
+			fc->lru_prev->lru_next = fc->lru_next;
+			if (fc->lru_next)
+				fc->lru_next->lru_prev = fc->lru_prev;
+			else
+				G.lru_tail = fc->lru_prev;
+			fc->lru_prev = NULL;
+			fc->lru_next = G.lru_head;
+			G.lru_head->lru_prev = fc;
+			G.lru_head = fc;
+		}
+		return fc;
+	}
+	return NULL;
+}
+
+/*
+ * Open FILE for variant V.
+ * Returns 0, 1 if it does not exist, -1 if it's not a regular file.
+ */
+static int open_variant(struct file_variant *v, const char *file,
+		int gz, smallint *symlink)
+{
+	struct stat sb;
+	char date[40];
+	int fd;
+
+	v->fd = -1;
+	fd = open(file, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+	if (fd < 0 && errno == ELOOP) {
+		*symlink = 1;
+		fd = open(file, O_RDONLY | O_NONBLOCK);
+	}
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	/* CGIs exec'ed by our children must not inherit it */
+	close_on_exec_on(fd);
+	v->fd = fd;
+	v->size = sb.st_size;
+	v->mtime = sb.st_mtime;
+	strftime(date, sizeof(date), RFC1123FMT, gmtime(&v->mtime));
+	v->hdr = xasprintf(
+#if ENABLE_FEATURE_HTTPD_RANGES
+			"Accept-Ranges: bytes\r\n"
+#endif
+			"Last-Modified: %s\r\nContent-length: %"OFF_FMT"u\r\n%s\r\n",
+			date, v->size,
+			gz ? "Content-Encoding: gzip\r\n" : "");
+	v->hdr_len = strlen(v->hdr);
+	return 0;
+}
+
+/*
+ * Watch all dirs from home down to the file's one.
+ * Returns 0 if something could not be watched.
+ */
+static int watch_dirs(char *file)
+{
+	char *p = file;
+
+	if (inotify_add_watch(G.inotify_fd, ".", WATCH_MASK) < 0)
+		return 0;
+	while ((p = strchr(p, '/')) != NULL) {
+		int wd;
+		*p = '\0';
+		wd = inotify_add_watch(G.inotify_fd, file, WATCH_MASK);
+		*p++ = '/';
+		if (wd < 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Open FILE (and FILE.gz) for URL[0..LEN) and put them into cache.
+ * Returns 0 and sets *fcp, HTTP_NOT_FOUND if neither exists,
+ * -1 if FILE is not a regular file.
+ */
+static int file_cache_add(const char *url, unsigned len, const char *file,
+		struct cached_file **fcp)
+{
+	struct cached_file *fc;
+	smallint symlink = 0;
+	int r;
+
+	fc = xzalloc(sizeof(*fc) + len);
+	memcpy(fc->url, url, len);
+	fc->mime = find_mime_type(file);
+	r = open_variant(&fc->v[0], file, 0, &symlink);
+#if ENABLE_FEATURE_HTTPD_GZIP
+	if (r >= 0) {
+		char *gzfile = xasprintf("%s.gz", file);
+		if (open_variant(&fc->v[1], gzfile, 1, &symlink) == 0)
+			r = 0;
+		free(gzfile);
+	}
+#endif
+	if (r) {
+		fc->refs = 1;
+		file_cache_unref(fc);
+		return r > 0 ? HTTP_NOT_FOUND : -1;
+	}
+	fc->file = xstrdup(file);
+	fc->ctype = xasprintf("Content-type: %s\r\nDate: ", fc->mime);
+	if (symlink || G.inotify_fd < 0 || !watch_dirs(fc->file))
+		fc->expires = G.now + 1;
+
+	if (G.cache_cnt >= G.cache_max)
+		file_cache_drop(G.lru_tail);
+	r = url_hash(url, len);
+	fc->hash_next = G.file_cache[r];
+	G.file_cache[r] = fc;
+	fc->lru_next = G.lru_head;
+	if (G.lru_head)
+		G.lru_head->lru_prev = fc;
+	else
+		G.lru_tail = fc;
+	G.lru_head = fc;
+	G.cache_cnt++;
+	fc->refs = 1;
+	*fcp = fc;
+	return 0;
+}
+
+/*
+ * Drop what inotify says may be stale.
+ */
+static void file_cache_inotify(void)
+{
+	while (1) {
+		char *p, *end;
+		int n = safe_read(G.inotify_fd, iobuf, IOBUF_SIZE);
+
+		if (n <= 0)
+			return;
+		for (p = iobuf, end = iobuf + n; p < end; ) {
+			struct inotify_event *ie = (void *)p;
+			struct cached_file *fc, *next;
+			unsigned len;
+
+			p += sizeof(*ie) + ie->len;
+			if (ie->mask & IN_IGNORED)
+				continue;
+			if (!ie->len /* event on a dir itself, or overflow */
+			 || (ie->mask & IN_ISDIR)
+			 || strcmp(ie->name, HTTPD_CONF) == 0
+			) {
+				file_cache_flush();
+				continue;
+			}
+			/* Don't bother finding out which dir it was:
+			 * drop every file with this name or its .gz */
+			len = strlen(ie->name);
+			if (ENABLE_FEATURE_HTTPD_GZIP
+			 && len > 3 && strcmp(ie->name + len - 3, ".gz") == 0
+			) {
+				len -= 3;
+			}
+			for (fc = G.lru_head; fc; fc = next) {
+				const char *base = bb_basename(fc->file);
+				next = fc->lru_next;
+				if (strncmp(base, ie->name, len) == 0
+				 && (!base[len] || strcmp(base + len, ".gz") == 0)
+				) {
+					file_cache_drop(fc);
+				}
+			}
+		}
+	}
+}
+
+/* Date: for replies from cache */
+static const char *cached_date(void)
+{
+	time_t t = time(NULL);
+
+	if (t != G.date_time) {
+		G.date_time = t;
+		strftime(G.date, sizeof(G.date), RFC1123FMT, gmtime(&t));
+	}
+	return G.date;
+}
+#endif
+
+static void listen_on(int on)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	/* ev.data.ptr = NULL: it's the server socket */
+	epoll_ctl(G.epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, G.server_socket, &ev);
+	G.accept_paused = !on;
+}
+
+static void conn_want(struct conn *c, unsigned events)
+{
+	if (c->events != events) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = c;
+		epoll_ctl(G.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = events;
+	}
+}
+
+/* Done with the file of the reply */
+static void conn_file_done(struct conn *c)
+{
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	if (c->cached) {
+		file_cache_unref(c->cached);
+		c->cached = NULL;
+		c->file_fd = -1;
+	}
+#endif
+	if (c->file_fd >= 0) {
+		close(c->file_fd);
+		c->file_fd = -1;
+	}
+}
+
+static void conn_close(struct conn *c)
+{
+	/* A handed off child still has the socket open,
+	 * epoll would keep reporting it: remove it explicitly */
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	conn_file_done(c);
+	free(c->out);
+	if (verbose > 2)
+		bb_error_msg("closed");
+	free(c->ip_str);
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		G.conn_list = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	free(c);
+
+	/* We ran out of fds before? Now we have one */
+	if (G.accept_paused)
+		listen_on(1);
+}
+
+/*
+ * Let a child deal with the request at c->rpos the old way.
+ * Returns -1: the connection is gone from our list.
+ */
+static int conn_hand_off(struct conn *c)
+{
+	if (fork() == 0) {
+		/* child */
+		struct conn *o;
+
+		/* Do not reload config on HUP */
+		signal(SIGHUP, SIG_IGN);
+		/* CGIs expect default SIGPIPE */
+		signal(SIGPIPE, SIG_DFL);
+		close(G.epoll_fd);
+		close(G.server_socket);
+		for (o = G.conn_list; o; o = o->next) {
+			if (o->file_fd >= 0)
+				close(o->file_fd);
+			if (o != c)
+				close(o->fd);
+		}
+		/* get_line() will see what we have already read */
+		hdr_cnt = c->rlen - c->rpos;
+		hdr_ptr = memcpy(hdr_buf, c->rbuf + c->rpos, hdr_cnt);
+		ndelay_off(c->fd);
+		xmove_fd(c->fd, 0);
+		xdup2(0, 1);
+		reset_request();
+		handle_incoming_and_exit(&c->from);
+	}
+	/* parent, or fork failed */
+	conn_close(c);
+	return -1;
+}
+
+/*
+ * Start sending the reply to the request at c->rpos:
+ * LEN bytes of headers in iobuf, then c->file_fd (unless it's -1)
+ * from range_start on, file_size bytes.
+ */
+static void conn_start_reply(struct conn *c, int len)
+{
+	int n;
+
+	c->rpos += c->head_len;
+	c->close_after = !keep_alive;
+	c->file_pos = range_start;
+	c->file_end = range_start + file_size;
+	c->no_sendfile = 0;
+	c->state = CONN_SEND;
+
+	/* The socket is almost always writable now, try it */
+	n = send(c->fd, iobuf, len, c->file_fd >= 0 ? MSG_MORE : 0);
+	if (n < 0)
+		n = 0; /* conn_send() will see the error, if any */
+	if (n < len) {
+		c->out_len = len - n;
+		c->out_pos = 0;
+		c->out = xmalloc(c->out_len);
+		memcpy(c->out, iobuf + n, c->out_len);
+	}
+}
+
+/*
+ * Set up reply to the request at c->rpos: headers,
+ * then FD (unless it's -1) from range_start on.
+ * Returns 1, or -1 if the request was handed off.
+ */
+static int conn_reply(struct conn *c, int responseNum, int fd)
+{
+	const char *error_page;
+	int len;
+
+	len = format_headers(responseNum, &error_page);
+	c->file_fd = fd;
+	if (error_page) {
+		/* Custom error pages are sent by the forking code */
+		return conn_hand_off(c);
+	}
+	/* format_headers() turned file_size into the range length */
+	conn_start_reply(c, len);
+	return 1;
+}
+
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+/*
+ * Set up reply with the file in FC.
+ * Returns 1, or -1 if the request was handed off.
+ */
+static int conn_reply_cached(struct conn *c, struct cached_file *fc, int head)
+{
+	struct file_variant *v = &fc->v[0];
+	char *p;
+
+#if ENABLE_FEATURE_HTTPD_GZIP
+	if (content_gzip && fc->v[1].fd >= 0)
+		v = &fc->v[1];
+	else
+		content_gzip = 0;
+#endif
+	if (v->fd < 0) /* only .gz exists, and peer can't take it */
+		return conn_reply(c, HTTP_NOT_FOUND, -1);
+	file_size = v->size;
+	if (!head) {
+		c->cached = fc;
+		fc->refs++;
+	}
+#if ENABLE_FEATURE_HTTPD_RANGES
+	/* we are sending compressed page: can't do ranges */
+	if (content_gzip)
+		range_start = 0;
+	if (range_start) {
+		if (!range_end || range_end >= file_size)
+			range_end = file_size - 1;
+		if (range_end >= range_start) {
+			last_mod = v->mtime;
+			found_mime_type = fc->mime;
+			return conn_reply(c, HTTP_PARTIAL_CONTENT, head ? -1 : v->fd);
+		}
+		range_start = 0;
+	}
+#endif
+	/* Same headers as format_headers() makes, from pre-rendered parts */
+	if (verbose)
+		bb_error_msg("response:%u", HTTP_OK);
+	p = stpcpy(iobuf, http11 ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.0 200 OK\r\n");
+	p = stpcpy(p, fc->ctype);
+	p = stpcpy(p, cached_date());
+	p = stpcpy(p, keep_alive ? "\r\nConnection: keep-alive\r\n" : "\r\nConnection: close\r\n");
+	memcpy(p, v->hdr, v->hdr_len);
+	c->file_fd = head ? -1 : v->fd;
+	conn_start_reply(c, p - iobuf + v->hdr_len);
+	return 1;
+}
+#endif
+
+/*
+ * Parse request head at c->rpos and set up the reply.
+ * Returns 0 if the head is not complete yet, 1 if the reply
+ * is set up, -1 if the request was handed off.
+ */
+static int conn_request(struct conn *c)
+{
+	char *buf = c->rbuf + c->rpos;
+	char *end = c->rbuf + c->rlen;
+	char *p, *line, *next, *urlp, *tptr, *urlcopy;
+	smallint head, ip_allowed;
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	struct cached_file *fc;
+	unsigned url_len;
+#else
+	struct stat sb;
+	int fd;
+#endif
+
+	/* Tolerate empty lines between pipelined requests */
+	while (buf < end && (*buf == '\r' || *buf == '\n'))
+		buf++;
+	c->rpos = buf - c->rbuf;
+
+	p = memchr(buf, '\n', end - buf);
+	if (!p)
+		return 0;
+	/* "GET /url" without "HTTP/x.y" (HTTP/0.9) has no headers */
+	if (!memmem(buf, p - buf, " HTTP/", 6))
+		return conn_hand_off(c);
+	/* Find the empty line which ends the head */
+	while (1) {
+		char *q = p + 1;
+		if (q < end && *q == '\r')
+			q++;
+		if (q < end && *q == '\n') {
+			p = q;
+			break;
+		}
+		p = memchr(p + 1, '\n', end - (p + 1));
+		if (!p)
+			return 0;
+	}
+	c->head_len = p + 1 - buf;
+	memcpy(iobuf, buf, c->head_len);
+	iobuf[c->head_len - 1] = '\0';
+
+	reset_request();
+	rmt_ip = c->ip;
+
+	/* Request line: cut it at '\n', drop '\r' */
+	next = strchr(iobuf, '\n');
+	*next++ = '\0';
+	if (next[-2] == '\r')
+		next[-2] = '\0';
+	urlp = strpbrk(iobuf, " \t");
+	if (urlp == NULL)
+		goto bad_request;
+	*urlp++ = '\0';
+	head = 0;
+	if (strcasecmp(iobuf, "GET") != 0) {
+		/* POST goes to CGI, unknown methods get 501 from the child */
+		if (!ENABLE_FEATURE_HTTPD_CGI || strcasecmp(iobuf, "HEAD") != 0)
+			return conn_hand_off(c);
+		head = 1;
+	}
+	urlp = skip_whitespace(urlp);
+	if (urlp[0] != '/')
+		goto bad_request;
+	tptr = strchrnul(urlp, ' ');
+	if (!tptr[0] || strncmp(tptr + 1, "HTTP/1.", 7) != 0)
+		return conn_hand_off(c);
+	/* HTTP/1.1 keeps connections open unless told otherwise */
+	http11 = keep_alive = (tptr[8] != '0');
+	*tptr = '\0';
+	urlcopy = alloca((tptr - urlp) + 2 + strlen(index_page));
+	strcpy(urlcopy, urlp);
+
+	/* Headers */
+	while (*next) {
+		line = next;
+		next = strchrnul(line, '\n');
+		tptr = next;
+		if (*next)
+			next++;
+		if (tptr > line && tptr[-1] == '\r')
+			tptr--;
+		*tptr = '\0';
+
+		if (STRNCASECMP(line, "Connection:") == 0) {
+			tptr = skip_whitespace(line + sizeof("Connection:")-1);
+			if (STRNCASECMP(tptr, "close") == 0)
+				keep_alive = 0;
+			if (STRNCASECMP(tptr, "keep-alive") == 0)
+				keep_alive = 1;
+		} else if (STRNCASECMP(line, "Transfer-Encoding:") == 0
+		 || (STRNCASECMP(line, "Content-length:") == 0
+		    && strcmp(skip_whitespace(line + sizeof("Content-length:")-1), "0") != 0)
+		) {
+			/* Request has a body, we don't want to parse it
+			 * as the next request */
+			return conn_hand_off(c);
+		}
+		parse_file_header(line);
+	}
+
+	/* Extract url args if present */
+	tptr = strchr(urlcopy, '?');
+	if (tptr) {
+		*tptr++ = '\0';
+		g_query = tptr;
+	}
+	tptr = decodeString(urlcopy, 0);
+	if (tptr == NULL)
+		goto bad_request;
+	if (tptr == urlcopy + 1) {
+		/* '/' or NUL is encoded */
+		return conn_reply(c, HTTP_NOT_FOUND, -1);
+	}
+	urlp = canonicalize_url(urlcopy);
+	if (urlp == NULL)
+		goto bad_request;
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	/* A hit is a plain file, and was not under a dir
+	 * with httpd.conf: skip the checks below which stat() */
+	url_len = urlp - urlcopy;
+	fc = file_cache_find(urlcopy, url_len);
+#else
+# define fc 0
+#endif
+	if (!fc && urlp[-1] != '/' && is_directory(urlcopy + 1, 1, NULL))
+		found_moved_temporarily = urlcopy;
+	if (verbose > 1)
+		bb_error_msg("url:%s", urlcopy);
+
+	ip_allowed = checkPermIP();
+	if (ip_allowed && !fc) {
+		/* A dir with its own httpd.conf may change the rules,
+		 * only for this request: let a child merge it */
+		char *conf = alloca(strlen(urlcopy) + sizeof(HTTPD_CONF) + 1);
+		tptr = urlcopy;
+		while ((tptr = strchr(tptr + 1, '/')) != NULL) {
+			*tptr = '\0';
+			sprintf(conf, "%s/%s", urlcopy + 1, HTTPD_CONF);
+			*tptr = '/';
+			if (access(conf, F_OK) == 0)
+				return conn_hand_off(c);
+		}
+	}
+	if (strcmp(bb_basename(urlcopy), HTTPD_CONF) == 0 || !ip_allowed) {
+		/* protect listing [/path]/httpd.conf or IP deny */
+		return conn_reply(c, HTTP_FORBIDDEN, -1);
+	}
+#if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+	/* Password protected: "Authorization:" is checked by the child */
+	if (!check_user_passwd(urlcopy, ":"))
+		return conn_hand_off(c);
+	free(remoteuser);
+	remoteuser = NULL;
+#endif
+	if (found_moved_temporarily)
+		return conn_reply(c, HTTP_MOVED_TEMPORARILY, -1);
+#if ENABLE_FEATURE_HTTPD_PROXY
+	if (find_proxy_entry(urlcopy))
+		return conn_hand_off(c);
+#endif
+
+	tptr = urlcopy + 1;      /* skip first '/' */
+#if ENABLE_FEATURE_HTTPD_CGI
+	if (strncmp(tptr, "cgi-bin/", 8) == 0)
+		return conn_hand_off(c);
+#endif
+	if (urlp[-1] == '/')
+		strcpy(urlp, index_page);
+#if ENABLE_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR
+	p = strrchr(tptr, '.');
+	if (p) {
+		Htaccess *cur;
+		for (cur = script_i; cur; cur = cur->next) {
+			if (strcmp(cur->before_colon + 1, p) == 0)
+				return conn_hand_off(c);
+		}
+	}
+#endif
+
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	if (!fc) {
+		int r = file_cache_add(urlcopy, url_len, tptr, &fc);
+		if (r < 0) {
+			/* Reading a fifo or a device can block us all */
+			return conn_hand_off(c);
+		}
+		if (r) {
+# if ENABLE_FEATURE_HTTPD_CGI
+			/* Dir URL without index.html: maybe cgi-bin/index.cgi */
+			if (urlp[-1] == '/')
+				return conn_hand_off(c);
+# endif
+			return conn_reply(c, HTTP_NOT_FOUND, -1);
+		}
+	}
+	return conn_reply_cached(c, fc, head);
+#else
+# undef fc
+	fd = -1;
+# if ENABLE_FEATURE_HTTPD_GZIP
+	if (content_gzip) {
+		/* does <url>.gz exist? Then use it instead */
+		char *gzurl = alloca(strlen(tptr) + sizeof(".gz"));
+		sprintf(gzurl, "%s.gz", tptr);
+		fd = open(gzurl, O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			content_gzip = 0;
+	}
+# endif
+	if (fd < 0)
+		fd = open(tptr, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+# if ENABLE_FEATURE_HTTPD_CGI
+		/* Dir URL without index.html: maybe cgi-bin/index.cgi */
+		if (urlp[-1] == '/')
+			return conn_hand_off(c);
+# endif
+		return conn_reply(c, HTTP_NOT_FOUND, -1);
+	}
+	if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+		/* Reading a fifo or a device can block us all */
+		close(fd);
+		return conn_hand_off(c);
+	}
+	file_size = sb.st_size;
+	last_mod = sb.st_mtime;
+	found_mime_type = find_mime_type(tptr);
+	if (head) {
+		close(fd);
+		fd = -1;
+	}
+# if ENABLE_FEATURE_HTTPD_RANGES
+	/* we are sending compressed page: can't do ranges */
+	if (content_gzip)
+		range_start = 0;
+	if (range_start) {
+		if (!range_end || range_end >= file_size)
+			range_end = file_size - 1;
+		if (range_end >= range_start)
+			return conn_reply(c, HTTP_PARTIAL_CONTENT, fd);
+		range_start = 0;
+	}
+# endif
+	return conn_reply(c, HTTP_OK, fd);
+#endif
+
+ bad_request:
+	keep_alive = 0;
+	return conn_reply(c, HTTP_BAD_REQUEST, -1);
+}
+
+/*
+ * Push out as much of the reply as the socket takes.
+ * Returns 1 if the reply is sent, 0 if the socket is full,
+ * -1 on error.
+ */
+static int conn_send(struct conn *c)
+{
+	/* Don't let one fast peer starve the others */
+	int budget = 16;
+	ssize_t n;
+
+	if (c->out) {
+		n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+				c->file_fd >= 0 ? MSG_MORE : 0);
+		if (n < 0)
+			return errno == EAGAIN ? 0 : -1;
+		c->out_pos += n;
+		if (c->out_pos < c->out_len)
+			return 0;
+		free(c->out);
+		c->out = NULL;
+	}
+	while (c->file_fd >= 0 && c->file_pos < c->file_end) {
+		off_t left = c->file_end - c->file_pos;
+
+		if (--budget < 0)
+			return 0;
+#if ENABLE_FEATURE_HTTPD_USE_SENDFILE
+		if (!c->no_sendfile) {
+			n = sendfile(c->fd, c->file_fd, &c->file_pos,
+					left < 1024*1024 ? left : 1024*1024);
+			if (n > 0)
+				continue;
+			if (n == 0) /* file was truncated under us */
+				return -1;
+			if (errno == EAGAIN)
+				return 0;
+			if (errno != EINVAL && errno != ENOSYS)
+				return -1;
+			/* fall back to read/write */
+			c->no_sendfile = 1;
+		}
+#endif
+		n = pread(c->file_fd, iobuf, left < IOBUF_SIZE ? left : IOBUF_SIZE, c->file_pos);
+		if (n <= 0)
+			return -1;
+		n = send(c->fd, iobuf, n, 0);
+		if (n < 0)
+			return errno == EAGAIN ? 0 : -1;
+		c->file_pos += n;
+	}
+	return 1;
+}
+
+/*
+ * Move the connection forward until it would block.
+ */
+static void conn_run(struct conn *c)
+{
+	int r;
+
+	while (1) {
+		if (c->state == CONN_SEND) {
+			r = conn_send(c);
+			if (r == 0) {
+				c->deadline = G.now + HEADER_READ_TIMEOUT;
+				conn_want(c, EPOLLOUT);
+				return;
+			}
+			if (r < 0) {
+				if (verbose > 1)
+					bb_perror_msg("error");
+				break;
+			}
+			if (c->close_after)
+				break;
+			conn_file_done(c);
+			c->state = CONN_READ;
+		}
+
+		r = conn_request(c);
+		if (r < 0) /* handed off */
+			return;
+		if (r > 0) /* reply is set up */
+			continue;
+
+		/* Need more of the request */
+		if (c->rpos) {
+			c->rlen -= c->rpos;
+			memmove(c->rbuf, c->rbuf + c->rpos, c->rlen);
+			c->rpos = 0;
+		}
+		if (c->rlen == CONN_BUFSIZE) {
+			/* Huge head. get_line() in the child
+			 * truncates overlong lines, let it deal */
+			conn_hand_off(c);
+			return;
+		}
+		r = safe_read(c->fd, c->rbuf + c->rlen, CONN_BUFSIZE - c->rlen);
+		if (r < 0 && errno == EAGAIN) {
+			c->deadline = G.now + (c->rlen ? HEADER_READ_TIMEOUT : KEEPALIVE_TIMEOUT);
+			conn_want(c, EPOLLIN);
+			return;
+		}
+		if (r <= 0) /* EOF or error */
+			break;
+		c->rlen += r;
+	}
+	conn_close(c);
+}
+
+static void conn_accept(void)
+{
+	/* NB: it's best to not use xfuncs here: a transient
+	 * out-of-memory condition must not kill the server. */
+	while (1) {
+		struct conn *c;
+		struct epoll_event ev;
+		len_and_sockaddr fromAddr;
+		int n;
+
+		fromAddr.len = LSA_SIZEOF_SA;
+		n = accept(G.server_socket, &fromAddr.u.sa, &fromAddr.len);
+		if (n < 0) {
+			/* Out of fds: stop accepting until a conn closes */
+			if (errno == EMFILE || errno == ENFILE)
+				listen_on(0);
+			return;
+		}
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			close(n);
+			continue;
+		}
+		/* set the KEEPALIVE option to cull dead connections */
+		setsockopt(n, SOL_SOCKET, SO_KEEPALIVE, &const_int_1, sizeof(const_int_1));
+		/* We coalesce with MSG_MORE ourself. Without this, the tail
+		 * of a reply on a kept-alive connection waits for an ACK */
+		setsockopt(n, IPPROTO_TCP, TCP_NODELAY, &const_int_1, sizeof(const_int_1));
+		ndelay_on(n);
+		c->fd = n;
+		c->file_fd = -1;
+		c->from = fromAddr;
+		c->ip = sockaddr2ip(&fromAddr);
+		c->deadline = G.now + HEADER_READ_TIMEOUT;
+		c->events = EPOLLIN;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, n, &ev) != 0) {
+			close(n);
+			free(c);
+			continue;
+		}
+		c->next = G.conn_list;
+		if (c->next)
+			c->next->prev = c;
+		G.conn_list = c;
+
+		if (verbose) {
+			c->ip_str = xmalloc_sockaddr2dotted(&fromAddr.u.sa);
+			if (verbose > 2 && c->ip_str) {
+				const char *name = applet_name;
+				applet_name = c->ip_str;
+				bb_error_msg("connected");
+				applet_name = name;
+			}
+		}
+	}
+}
+
+/*
+ * The main http server function for -k.
+ * Never returns.
+ */
+static void mini_httpd_event_loop(int server_socket) NORETURN;
+static void mini_httpd_event_loop(int server_socket)
+{
+	const char *name = applet_name;
+	unsigned last_sweep = 0;
+
+	iobuf = xmalloc(IOBUF_SIZE);
+	/* If you want to know about EPIPE
+	 * (happens if you abort downloads from local httpd): */
+	signal(SIGPIPE, SIG_IGN);
+	/* Reload config between requests, not in the middle of one */
+	signal(SIGHUP, record_signo);
+
+	G.server_socket = server_socket;
+	ndelay_on(server_socket);
+	G.epoll_fd = epoll_create(64);
+	if (G.epoll_fd < 0)
+		bb_perror_msg_and_die("epoll_create");
+	listen_on(1);
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+	{
+		struct rlimit rl;
+		struct epoll_event ev;
+
+		/* Entry has up to two fds, leave most of them to conns */
+		getrlimit(RLIMIT_NOFILE, &rl);
+		G.cache_max = rl.rlim_cur / 8 > 4096 ? 4096 : rl.rlim_cur / 8;
+		if (G.cache_max < 8)
+			G.cache_max = 8;
+		G.inotify_fd = inotify_init();
+		if (G.inotify_fd >= 0) {
+			ndelay_on(G.inotify_fd);
+			close_on_exec_on(G.inotify_fd);
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = &G.inotify_fd;
+			epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, G.inotify_fd, &ev);
+		}
+	}
+#endif
+
+	while (1) {
+		struct epoll_event ev[64];
+		int i, n;
+
+		n = epoll_wait(G.epoll_fd, ev, ARRAY_SIZE(ev), 1000);
+		G.now = monotonic_sec();
+		if (bb_got_signal) {
+			bb_got_signal = 0;
+			parse_conf(DEFAULT_PATH_HTTPD_CONF, SIGNALED_PARSE);
+			/* mime types and rules may be different now */
+			IF_FEATURE_HTTPD_FILE_CACHE(file_cache_flush();)
+		}
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+		/* Before any request of this batch: a file changed
+		 * before the request was sent must not be served stale */
+		for (i = 0; i < n; i++)
+			if (ev[i].data.ptr == &G.inotify_fd)
+				file_cache_inotify();
+#endif
+		for (i = 0; i < n; i++) {
+			struct conn *c = ev[i].data.ptr;
+
+			if (!c) {
+				conn_accept();
+				continue;
+			}
+#if ENABLE_FEATURE_HTTPD_FILE_CACHE
+			if (ev[i].data.ptr == &G.inotify_fd)
+				continue;
+#endif
+			/* this trick makes -v logging much simpler */
+			if (c->ip_str)
+				applet_name = c->ip_str;
+			conn_run(c);
+			applet_name = name;
+		}
+
+		if (G.now != last_sweep) {
+			struct conn *c, *next;
+
+			last_sweep = G.now;
+			for (c = G.conn_list; c; c = next) {
+				next = c->next;
+				if ((int)(G.now - c->deadline) < 0)
+					continue;
+				if (c->ip_str)
+					applet_name = c->ip_str;
+				if (c->state == CONN_READ && c->rlen != c->rpos) {
+					/* Request started, but did not complete in time */
+					const char *error_page;
+					reset_request();
+					n = format_headers(HTTP_REQUEST_TIMEOUT, &error_page);
+					send(c->fd, iobuf, n, MSG_DONTWAIT);
+				}
+				conn_close(c);
+				applet_name = name;
+			}
+		}
+	}
+	/* never reached */
+}
+#endif
+
+/*
+ * The main http server function.
+ * Given a socket, listen for new connections and farm out
+ * the processing as a [v]forked process.
+ * Never returns.
+ */
+#if BB_MMU
+static void mini_httpd(int server_socket) NORETURN;
+static void mini_httpd(int server_socket)
+{
+	/* NB: it's best to not use xfuncs in this loop before fork().
+	 * Otherwise server may die on transient errors (temporary
+	 * out-of-memory condition, etc), which is Bad(tm).
+	 * Try to do any dangerous calls after fork.
+	 */
+	while (1) {
+		int n;
+		len_and_sockaddr fromAddr;
+
+		/* Wait for connections... */
+		fromAddr.len = LSA_SIZEOF_SA;
+		n = accept(server_socket, &fromAddr.u.sa, &fromAddr.len);
+		if (n < 0)
+			continue;
 
 		/* set the KEEPALIVE option to cull dead connections */
 		setsockopt(n, SOL_SOCKET, SO_KEEPALIVE, &const_int_1, sizeof(const_int_1));
@@ -2355,6 +3596,7 @@ enum {
 	p_opt_inetd     ,
 	p_opt_foreground,
 	p_opt_verbose   ,
+	IF_FEATURE_HTTPD_EVENT_LOOP(k_opt_event_loop,)
 	OPT_CONFIG_FILE = 1 << c_opt_config_file,
 	OPT_DECODE_URL  = 1 << d_opt_decode_url,
 	OPT_HOME_HTTPD  = 1 << h_opt_home_httpd,
@@ -2366,6 +3608,7 @@ enum {
 	OPT_INETD       = 1 << p_opt_inetd,
 	OPT_FOREGROUND  = 1 << p_opt_foreground,
 	OPT_VERBOSE     = 1 << p_opt_verbose,
+	OPT_EVENT_LOOP  = IF_FEATURE_HTTPD_EVENT_LOOP((1 << k_opt_event_loop)) + 0,
 };
 
 
@@ -2398,7 +3641,8 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH("r:")
 			IF_FEATURE_HTTPD_AUTH_MD5("m:")
 			IF_FEATURE_HTTPD_SETUID("u:")
-			"p:ifv",
+			"p:ifv"
+			IF_FEATURE_HTTPD_EVENT_LOOP("k"),
 			&opt_c_configFile, &url_for_decode, &home_httpd
 			IF_FEATURE_HTTPD_ENCODE_URL_STR(, &url_for_encode)
 			IF_FEATURE_HTTPD_BASIC_AUTH(, &g_realm)
@@ -2485,6 +3729,10 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 #if BB_MMU
 	if (!(opt & OPT_FOREGROUND))
 		bb_daemonize(0); /* don't change current directory */
+#if ENABLE_FEATURE_HTTPD_EVENT_LOOP
+	if (opt & OPT_EVENT_LOOP)
+		mini_httpd_event_loop(server_socket); /* never returns */
+#endif
 	mini_httpd(server_socket); /* never returns */
 #else
 	mini_httpd_nommu(server_socket, argc, argv); /* never returns */
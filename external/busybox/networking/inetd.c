@@ -61,7 +61,8 @@
  *      socket_type                     stream/dgram/raw/rdm/seqpacket
  *      protocol                        must be in /etc/protocols
  *                                      (usually "tcp" or "udp")
- *      wait/nowait[.max]               single-threaded/multi-threaded, max #
+ *      wait/nowait[.max][+N]           single-threaded/multi-threaded, max #,
+ *                                      N servers waiting in accept
  *      user[.group] or user[:group]    user/group to run daemon as
  *      server_program                  full path name
  *      server_program_arguments        maximum of MAXARGS (20)
@@ -132,6 +133,13 @@
  * connection requests until a timeout.
  */
 
+/* "nowait+N" stream services are prespawned: inetd keeps N children
+ * which accept() on the service socket themselves and vfork+exec
+ * a server for every connection. They reap their servers and report
+ * starts and exits to inetd through a pipe (for .max and statistics).
+ * inetd itself does not watch such sockets.
+ */
+
 /* Despite of above doc saying that dgram services must use "wait",
  * "udp nowait" servers are implemented in busyboxed inetd.
  * IPv6 addresses are also implemented. However, they may look ugly -
@@ -155,7 +163,7 @@
  */
 
 //usage:#define inetd_trivial_usage
-//usage:       "[-fe] [-q N] [-R N] [CONFFILE]"
+//usage:       "[-fe] [-q N] [-R N]" IF_FEATURE_INETD_STATS(" [-S ADDR]") " [CONFFILE]"
 //usage:#define inetd_full_usage "\n\n"
 //usage:       "Listen for network connections and launch programs\n"
 //usage:     "\n	-f	Run in foreground"
@@ -163,11 +171,19 @@
 //usage:     "\n	-q N	Socket listen queue (default: 128)"
 //usage:     "\n	-R N	Pause services after N connects/min"
 //usage:     "\n		(default: 0 - disabled)"
+//usage:	IF_FEATURE_INETD_STATS(
+//usage:     "\n	-S ADDR	Show statistics to clients of ADDR (/PATH or IP:PORT)")
 
 #include <syslog.h>
 #include <sys/un.h>
 
 #include "libbb.h"
+#if ENABLE_FEATURE_INETD_EPOLL
+# include <sys/epoll.h>
+#endif
+#if ENABLE_FEATURE_INETD_PRESPAWN
+# include <sys/prctl.h>
+#endif
 
 #if ENABLE_FEATURE_INETD_RPC
 # if defined(__UCLIBC__) && ! defined(__UCLIBC_HAS_RPC__)
@@ -210,6 +226,8 @@
 # define INETD_BUILTINS_ENABLED
 #endif
 
+#define INETD_TRACK_CHILDREN (ENABLE_FEATURE_INETD_PRESPAWN || ENABLE_FEATURE_INETD_STATS)
+
 typedef struct servtab_t {
 	/* The most frequently referenced one: */
 	int se_fd;                            /* open descriptor */
@@ -237,6 +255,25 @@ typedef struct servtab_t {
 	unsigned se_max;                      /* allowed instances per minute */
 	unsigned se_count;                    /* number started since se_time */
 	unsigned se_time;                     /* when we started counting */
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	unsigned se_prespawn;                 /* keep this many children accepting */
+	unsigned se_accepting;                /* how many are there now */
+#define is_prespawned(sep)        ((sep)->se_prespawn != 0)
+#else
+#define is_prespawned(sep)        0
+#endif
+#if ENABLE_FEATURE_INETD_STATS
+	unsigned se_rate_time;                /* when se_rate_cur started */
+	unsigned se_rate_cur;                 /* connects since se_rate_time */
+	unsigned se_rate_prev;                /* in CNT_INTERVAL before that */
+	unsigned se_busy;                     /* servers running now */
+	unsigned se_max_ms;                   /* longest server run */
+	unsigned long long se_conns;          /* connects (or datagrams) so far */
+	unsigned long long se_spawned;        /* servers started... */
+	unsigned long long se_spawn_us;       /* ...and time it took in total */
+	unsigned long long se_done;           /* servers exited... */
+	unsigned long long se_run_ms;         /* ...and time they ran in total */
+#endif
 	char *se_user;                        /* user name to run as */
 	char *se_group;                       /* group name to run as, can be NULL */
 #ifdef INETD_BUILTINS_ENABLED
@@ -303,17 +340,63 @@ static const struct builtin builtins[] = {
 };
 #endif /* INETD_BUILTINS_ENABLED */
 
+#if INETD_TRACK_CHILDREN
+/* Running servers (except non-forking builtins)
+ * and prespawned children, hashed by pid */
+struct child {
+	struct child *next;
+	servtab_t *sep;         /* NULL if service is gone or we killed it */
+	pid_t pid;
+	unsigned started;       /* monotonic_ms() when it got a connection */
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	pid_t acceptor;         /* prespawned child which started it, or 0 */
+	smallint prespawned;    /* this is a prespawned child */
+#endif
+};
+enum { CHILD_HASH = 256 };
+#endif
+
+#if ENABLE_FEATURE_INETD_PRESPAWN
+/* What prespawned children write to spawn_pipe */
+struct spawn_msg {
+	pid_t pid;              /* server which was started, or exited */
+	pid_t acceptor;         /* prespawned child which started it */
+	unsigned ms;            /* monotonic_ms() then */
+	int spawn_us;           /* from accept to exec, -1: server exited */
+};
+#endif
+
 struct globals {
 	rlim_t rlim_ofile_cur;
 	struct rlimit rlim_ofile;
 	servtab_t *serv_list;
 	int global_queuelen;
+#if ENABLE_FEATURE_INETD_EPOLL
+	int epoll_fd;
+	int signal_pipe[2];
+	smallint signal_ready;
+#else
 	int maxsock;         /* max fd# in allsock, -1: unknown */
 	/* whenever maxsock grows, prev_maxsock is set to new maxsock,
 	 * but if maxsock is set to -1, prev_maxsock is not changed */
 	int prev_maxsock;
+#endif
 	unsigned max_concurrency;
 	smallint alarm_armed;
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	smallint spawn_needed; /* some services may be short of children */
+	/* in prespawned child: */
+	smallint got_conn;     /* server for it is not started yet */
+	smallint got_term;     /* SIGTERM came meanwhile */
+	int spawn_pipe[2];
+#endif
+#if ENABLE_FEATURE_INETD_STATS
+	int stats_fd;
+	const char *stats_addr;
+#endif
+#if INETD_TRACK_CHILDREN
+	struct child **children;
+#endif
 	uid_t real_uid; /* user ID who ran us */
 	const char *config_filename;
 	parser_t *parser;
@@ -323,7 +406,14 @@ struct globals {
 	char *ring_pos;
 	char ring[128];
 #endif
+	struct sigaction saved_pipe_handler;
+#if ENABLE_FEATURE_INETD_EPOLL
+	/* Main loop keeps CHLD/HUP/ALRM blocked except in epoll_wait,
+	 * their handlers just write them to signal_pipe */
+	sigset_t orig_mask;
+#else
 	fd_set allsock;
+#endif
 	/* Used in next_line(), and as scratch read buffer */
 	char line[256];          /* _at least_ 256, see LINE_SIZE */
 } FIX_ALIASING;
@@ -350,6 +440,7 @@ struct BUG_G_too_big {
 #define ring_pos        (G.ring_pos       )
 #define ring            (G.ring           )
 #define allsock         (G.allsock        )
+#define saved_pipe_handler (G.saved_pipe_handler)
 #define line            (G.line           )
 #define INIT_G() do { \
 	rlim_ofile_cur = OPEN_MAX; \
@@ -404,6 +495,13 @@ static void restore_sigmask(sigset_t *m)
 	sigprocmask(SIG_SETMASK, m, NULL);
 }
 
+/* Mask for a child to run with, M is what block_CHLD_HUP_ALRM() saved */
+#if ENABLE_FEATURE_INETD_EPOLL
+# define child_sigmask(m) (&G.orig_mask)
+#else
+# define child_sigmask(m) (m)
+#endif
+
 #if ENABLE_FEATURE_INETD_RPC
 static void register_rpc(servtab_t *sep)
 {
@@ -437,6 +535,33 @@ static void unregister_rpc(servtab_t *sep)
 }
 #endif /* FEATURE_INETD_RPC */
 
+#if ENABLE_FEATURE_INETD_EPOLL
+static void watch_fd(int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = ptr;
+	/* EEXIST if it is watched already, that's ok */
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* NB: epoll watches the socket, not the fd number. Remove it
+ * before the fd is closed or reused (children may keep it open) */
+static void remove_fd_from_set(servtab_t *sep)
+{
+	if (sep->se_fd >= 0)
+		epoll_ctl(G.epoll_fd, EPOLL_CTL_DEL, sep->se_fd, NULL);
+}
+
+static void add_fd_to_set(servtab_t *sep)
+{
+	/* prespawned children accept on it, not us */
+	if (sep->se_fd >= 0 && !is_prespawned(sep))
+		watch_fd(sep->se_fd, sep);
+}
+#else
 static void bump_nofile(void)
 {
 	enum { FD_CHUNK = 32 };
@@ -460,16 +585,20 @@ static void bump_nofile(void)
 	rlim_ofile_cur = rl.rlim_cur;
 }
 
-static void remove_fd_from_set(int fd)
+static void remove_fd_from_set(servtab_t *sep)
 {
+	int fd = sep->se_fd;
+
 	if (fd >= 0) {
 		FD_CLR(fd, &allsock);
 		maxsock = -1;
 	}
 }
 
-static void add_fd_to_set(int fd)
+static void add_fd_to_set(servtab_t *sep)
 {
+	int fd = sep->se_fd;
+
 	if (fd >= 0) {
 		FD_SET(fd, &allsock);
 		if (maxsock >= 0 && fd > maxsock) {
@@ -496,6 +625,416 @@ static void recalculate_maxsock(void)
 	if ((rlim_t)maxsock > rlim_ofile_cur - FD_MARGIN)
 		bump_nofile();
 }
+#endif /* !FEATURE_INETD_EPOLL */
+
+static int too_many_connections(servtab_t *sep)
+{
+	if (sep->se_max != 0) {
+		if (++sep->se_count == 1)
+			sep->se_time = monotonic_sec();
+		else if (sep->se_count >= sep->se_max) {
+			unsigned now = monotonic_sec();
+			/* did we accumulate se_max connects too quickly? */
+			if (now - sep->se_time <= CNT_INTERVAL) {
+				bb_error_msg("%s/%s: too many connections, pausing",
+						sep->se_service, sep->se_proto);
+				return 1;
+			}
+			sep->se_count = 0;
+		}
+	}
+	return 0;
+}
+
+#if INETD_TRACK_CHILDREN
+static void kill_prespawned(servtab_t *sep, int forget_busy);
+#endif
+#if ENABLE_FEATURE_INETD_PRESPAWN
+static void read_spawn_pipe(void);
+#endif
+
+static void pause_service(servtab_t *sep)
+{
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	kill_prespawned(sep, 0);
+#endif
+	remove_fd_from_set(sep);
+	close(sep->se_fd);
+	sep->se_fd = -1;
+	sep->se_count = 0;
+	rearm_alarm(); /* will revive it in RETRYTIME sec */
+}
+
+/* Runs in the child, after fork */
+static int set_server_identity(servtab_t *sep)
+{
+	struct passwd *pwd;
+	struct group *grp = grp; /* for compiler */
+
+	pwd = getpwnam(sep->se_user);
+	if (pwd == NULL) {
+		bb_error_msg("%s: no such %s", sep->se_user, "user");
+		return -1;
+	}
+	if (sep->se_group && (grp = getgrnam(sep->se_group)) == NULL) {
+		bb_error_msg("%s: no such %s", sep->se_group, "group");
+		return -1;
+	}
+	if (real_uid != 0 && real_uid != pwd->pw_uid) {
+		/* a user running private inetd */
+		bb_error_msg("non-root must run services as himself");
+		return -1;
+	}
+	if (pwd->pw_uid) {
+		if (sep->se_group)
+			pwd->pw_gid = grp->gr_gid;
+		/* initgroups, setgid, setuid: */
+		change_identity(pwd);
+	} else if (sep->se_group) {
+		xsetgid(grp->gr_gid);
+		setgroups(1, &grp->gr_gid);
+	}
+	if (rlim_ofile.rlim_cur != rlim_ofile_cur)
+		if (setrlimit(RLIMIT_NOFILE, &rlim_ofile) < 0)
+			bb_perror_msg("setrlimit");
+	return 0;
+}
+
+#if ENABLE_FEATURE_INETD_STATS
+/* Count connects in this and previous CNT_INTERVAL */
+static void count_conns(servtab_t *sep, unsigned n)
+{
+	unsigned now = monotonic_sec();
+	unsigned elapsed = now - sep->se_rate_time;
+
+	if (elapsed >= CNT_INTERVAL) {
+		sep->se_rate_prev = elapsed < 2 * CNT_INTERVAL ? sep->se_rate_cur : 0;
+		sep->se_rate_cur = 0;
+		sep->se_rate_time = now - elapsed % CNT_INTERVAL;
+	}
+	sep->se_rate_cur += n;
+	sep->se_conns += n;
+}
+
+static void send_stats(void)
+{
+	servtab_t *sep;
+	int fd;
+
+	fd = accept(G.stats_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	/* a client which doesn't read gets less, but doesn't block us */
+	ndelay_on(fd);
+	fdprintf(fd, "#service proto conns conns/min busy accepting"
+			" spawn_us run_ms max_ms\n");
+	for (sep = serv_list; sep; sep = sep->se_next) {
+		unsigned per_min;
+
+		count_conns(sep, 0);
+		/* approximate connects during the last CNT_INTERVAL */
+		per_min = sep->se_rate_cur + (unsigned long long)sep->se_rate_prev
+			* (CNT_INTERVAL - (monotonic_sec() - sep->se_rate_time))
+			/ CNT_INTERVAL;
+		fdprintf(fd, "%s:%s %s %llu %u %u %u %llu %llu %u\n",
+			sep->se_local_hostname, sep->se_service, sep->se_proto,
+			sep->se_conns, per_min, sep->se_busy,
+			IF_FEATURE_INETD_PRESPAWN(sep->se_accepting) IF_NOT_FEATURE_INETD_PRESPAWN(0),
+			sep->se_spawned ? sep->se_spawn_us / sep->se_spawned : 0,
+			sep->se_done ? sep->se_run_ms / sep->se_done : 0,
+			sep->se_max_ms
+		);
+	}
+	close(fd);
+}
+#endif
+
+#if INETD_TRACK_CHILDREN
+static struct child **find_child(pid_t pid)
+{
+	struct child **cp = &G.children[(unsigned)pid % CHILD_HASH];
+
+	while (*cp && (*cp)->pid != pid)
+		cp = &(*cp)->next;
+	return cp;
+}
+
+static struct child *add_child(pid_t pid, servtab_t *sep)
+{
+	struct child **cp = &G.children[(unsigned)pid % CHILD_HASH];
+	struct child *c = xzalloc(sizeof(*c));
+
+	c->pid = pid;
+	c->sep = sep;
+	c->started = monotonic_ms();
+	c->next = *cp;
+	*cp = c;
+	return c;
+}
+
+/* Kill prespawned children of SEP. If SEP is going away,
+ * FORGET_BUSY makes us forget its running servers too */
+static void kill_prespawned(servtab_t *sep, int forget_busy)
+{
+	struct child *c;
+	unsigned i;
+
+	for (i = 0; i < CHILD_HASH; i++) {
+		for (c = G.children[i]; c; c = c->next) {
+			if (c->sep != sep)
+				continue;
+#if ENABLE_FEATURE_INETD_PRESPAWN
+			if (c->prespawned) {
+				kill(c->pid, SIGTERM);
+				sep->se_accepting--;
+				c->sep = NULL;
+				continue;
+			}
+#endif
+			if (forget_busy)
+				c->sep = NULL;
+		}
+	}
+}
+
+/* Server *CP exited at MS */
+static void server_done(struct child **cp, unsigned ms)
+{
+	struct child *c = *cp;
+#if ENABLE_FEATURE_INETD_STATS
+	servtab_t *sep = c->sep;
+
+	if (sep) {
+		ms -= c->started;
+		sep->se_busy--;
+		sep->se_done++;
+		sep->se_run_ms += ms;
+		if (sep->se_max_ms < ms)
+			sep->se_max_ms = ms;
+	}
+#endif
+	*cp = c->next;
+	free(c);
+}
+
+#if ENABLE_FEATURE_INETD_PRESPAWN
+static void read_spawn_pipe(void)
+{
+	struct spawn_msg msg;
+
+	while (safe_read(G.spawn_pipe[0], &msg, sizeof(msg)) == sizeof(msg)) {
+		struct child *c;
+		servtab_t *sep;
+
+		if (msg.spawn_us < 0) {
+			struct child **cp = find_child(msg.pid);
+			if (*cp)
+				server_done(cp, msg.ms);
+			continue;
+		}
+		c = *find_child(msg.acceptor);
+		sep = c ? c->sep : NULL;
+		if (!sep)
+			continue;
+#if ENABLE_FEATURE_INETD_STATS
+		c = add_child(msg.pid, sep);
+		c->started = msg.ms;
+		c->acceptor = msg.acceptor;
+		count_conns(sep, 1);
+		sep->se_busy++;
+		sep->se_spawned++;
+		sep->se_spawn_us += msg.spawn_us;
+#endif
+		if (too_many_connections(sep))
+			pause_service(sep);
+	}
+}
+
+/* Its servers are not our children, they won't be reported anymore */
+static void forget_servers(pid_t acceptor)
+{
+	unsigned i;
+
+	for (i = 0; i < CHILD_HASH; i++) {
+		struct child **cp = &G.children[i];
+		while (*cp) {
+			if ((*cp)->acceptor != acceptor) {
+				cp = &(*cp)->next;
+				continue;
+			}
+#if ENABLE_FEATURE_INETD_STATS
+			if ((*cp)->sep)
+				(*cp)->sep->se_busy--;
+#endif
+			{
+				struct child *c = *cp;
+				*cp = c->next;
+				free(c);
+			}
+		}
+	}
+}
+#endif
+
+static void child_exited(pid_t pid, int status)
+{
+	struct child **cp = find_child(pid);
+	struct child *c = *cp;
+
+	if (!c)
+		return;
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	if (c->prespawned) {
+		servtab_t *sep = c->sep;
+
+		/* (don't let pause_service() kill its pid, it's reaped) */
+		c->prespawned = 0;
+		read_spawn_pipe();
+		forget_servers(pid);
+		cp = find_child(pid);
+		*cp = c->next;
+		free(c);
+		if (sep) {
+			sep->se_accepting--;
+			G.spawn_needed = 1;
+			/* exit (not a signal): bad user, can't accept...
+			 * don't respawn it in a loop */
+			if (WIFEXITED(status)) {
+				bb_error_msg("%s/%s: prespawned server exited, pausing",
+						sep->se_service, sep->se_proto);
+				pause_service(sep);
+			}
+		}
+		return;
+	}
+#endif
+	server_done(cp, monotonic_ms());
+}
+#endif /* INETD_TRACK_CHILDREN */
+
+#if ENABLE_FEATURE_INETD_PRESPAWN
+static void prespawned_term(int sig UNUSED_PARAM)
+{
+	/* Don't drop a connection we already accepted */
+	if (!G.got_conn)
+		_exit(EXIT_SUCCESS);
+	G.got_term = 1;
+}
+
+static void prespawned_reap(int sig UNUSED_PARAM)
+{
+	struct spawn_msg msg;
+	int save_errno = errno;
+
+	msg.acceptor = getpid();
+	msg.spawn_us = -1;
+	while ((msg.pid = wait_any_nohang(NULL)) > 0) {
+		msg.ms = monotonic_ms();
+		/* atomic: less than PIPE_BUF */
+		write(G.spawn_pipe[1], &msg, sizeof(msg));
+	}
+	errno = save_errno;
+}
+
+static int prespawn_child(servtab_t *sep)
+{
+	struct spawn_msg msg;
+	servtab_t *sep2;
+	sigset_t chld;
+	unsigned long long accepted_us;
+	pid_t pid, inetd_pid;
+	int fd;
+
+	inetd_pid = getpid();
+	pid = fork();
+	if (pid < 0) {
+		bb_perror_msg("fork");
+		return -1;
+	}
+	if (pid > 0) {
+		add_child(pid, sep)->prespawned = 1;
+		sep->se_accepting++;
+		return 0;
+	}
+
+	/* child: accept connections, start a server for each */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (getppid() != inetd_pid) /* too late */
+		_exit(EXIT_SUCCESS);
+	bb_signals(0
+		+ (1 << SIGHUP)
+		+ (1 << SIGALRM)
+		+ (1 << SIGINT)
+		, SIG_DFL);
+	signal(SIGTERM, prespawned_term);
+	signal(SIGCHLD, prespawned_reap);
+	setsid();
+	for (sep2 = serv_list; sep2; sep2 = sep2->se_next)
+		if (sep2 != sep)
+			maybe_close(sep2->se_fd);
+	if (set_server_identity(sep))
+		_exit(EXIT_FAILURE);
+	msg.acceptor = getpid();
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	restore_sigmask(&G.orig_mask);
+
+	for (;;) {
+		fd = accept(sep->se_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			bb_perror_msg("accept (for %s)", sep->se_service);
+			_exit(EXIT_FAILURE);
+		}
+		G.got_conn = 1;
+		accepted_us = monotonic_us();
+		/* don't reap (and report) it before we report it started */
+		sigprocmask(SIG_BLOCK, &chld, NULL);
+		pid = vfork();
+		if (pid == 0) {
+			xmove_fd(fd, STDIN_FILENO);
+			xdup2(STDIN_FILENO, STDOUT_FILENO);
+			xdup2(STDIN_FILENO, STDERR_FILENO);
+			close(sep->se_fd);
+			sigaction_set(SIGPIPE, &saved_pipe_handler);
+			restore_sigmask(&G.orig_mask);
+			BB_EXECVP(sep->se_program, sep->se_argv);
+			bb_perror_msg("can't execute '%s'", sep->se_program);
+			_exit(EXIT_FAILURE);
+		}
+		close(fd);
+		if (pid > 0) {
+			msg.pid = pid;
+			msg.ms = accepted_us / 1000;
+			/* with vfork, it has exec'ed by now */
+			msg.spawn_us = monotonic_us() - accepted_us;
+			write(G.spawn_pipe[1], &msg, sizeof(msg));
+		} else {
+			bb_perror_msg("vfork");
+		}
+		sigprocmask(SIG_UNBLOCK, &chld, NULL);
+		G.got_conn = 0;
+		if (G.got_term)
+			_exit(EXIT_SUCCESS);
+	}
+}
+
+static void prespawn_children(void)
+{
+	servtab_t *sep;
+
+	G.spawn_needed = 0;
+	for (sep = serv_list; sep; sep = sep->se_next) {
+		while (sep->se_fd >= 0 && sep->se_accepting < sep->se_prespawn) {
+			if (prespawn_child(sep) < 0) {
+				rearm_alarm(); /* try again later */
+				return;
+			}
+		}
+	}
+}
+#endif /* FEATURE_INETD_PRESPAWN */
 
 static void prepare_socket_fd(servtab_t *sep)
 {
@@ -552,8 +1091,8 @@ static void prepare_socket_fd(servtab_t *sep)
 	if (sep->se_socktype == SOCK_STREAM)
 		listen(fd, global_queuelen);
 
-	add_fd_to_set(fd);
 	sep->se_fd = fd;
+	add_fd_to_set(sep);
 }
 
 static int reopen_config_file(void)
@@ -741,9 +1280,18 @@ static servtab_t *parse_one_line(void)
 			goto parse_err;
 	}
 
-	/* [no]wait[.max] user[:group] prog [args] */
+	/* [no]wait[.max][+N] user[:group] prog [args] */
 	arg = token[3];
 	sep->se_max = max_concurrency;
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	p = strchr(arg, '+');
+	if (p) {
+		*p++ = '\0';
+		sep->se_prespawn = bb_strtou(p, NULL, 10);
+		if (errno || sep->se_prespawn == 0)
+			goto parse_err;
+	}
+#endif
 	p = strchr(arg, '.');
 	if (p) {
 		*p++ = '\0';
@@ -786,8 +1334,16 @@ static servtab_t *parse_one_line(void)
 		/* stream builtins must be "nowait", dgram must be "wait" */
 		if (sep->se_wait != (sep->se_socktype == SOCK_DGRAM))
 			goto parse_err;
+		if (is_prespawned(sep))
+			goto parse_err;
 	}
 #endif
+	/* only "stream nowait" servers can accept by themselves */
+	if (is_prespawned(sep)
+	 && (sep->se_wait || sep->se_socktype != SOCK_STREAM)
+	) {
+		goto parse_err;
+	}
 	argc = 0;
 	while ((arg = token[6+argc]) != NULL && argc < MAXARGV)
 		sep->se_argv[argc++] = xstrdup(arg);
@@ -899,6 +1455,14 @@ static void reread_config_file(int sig UNUSED_PARAM)
 				unregister_rpc(sep);
 			sep->se_rpcver_lo = cp->se_rpcver_lo;
 			sep->se_rpcver_hi = cp->se_rpcver_hi;
+#endif
+#if ENABLE_FEATURE_INETD_PRESPAWN
+			/* Children waiting in accept run with old
+			 * user and program: replace them */
+			kill_prespawned(sep, 0);
+			sep->se_prespawn = cp->se_prespawn;
+			if (is_prespawned(sep))
+				remove_fd_from_set(sep);
 #endif
 			if (cp->se_wait == 0) {
 				/* New config says "nowait". If old one
@@ -906,7 +1470,7 @@ static void reread_config_file(int sig UNUSED_PARAM)
 				 * for a child (and not accepting connects).
 				 * Stop waiting, start listening again.
 				 * (if it's not true, this op is harmless) */
-				add_fd_to_set(sep->se_fd);
+				add_fd_to_set(sep);
 			}
 			sep->se_wait = cp->se_wait;
 			sep->se_max = cp->se_max;
@@ -991,7 +1555,7 @@ static void reread_config_file(int sig UNUSED_PARAM)
 		 || lsa->len != sep->se_lsa->len
 		 || memcmp(&lsa->u.sa, &sep->se_lsa->u.sa, lsa->len) != 0
 		) {
-			remove_fd_from_set(sep->se_fd);
+			remove_fd_from_set(sep);
 			maybe_close(sep->se_fd);
 			free(sep->se_lsa);
 			sep->se_lsa = lsa;
@@ -1018,7 +1582,10 @@ static void reread_config_file(int sig UNUSED_PARAM)
 			continue;
 		}
 		*sepp = sep->se_next;
-		remove_fd_from_set(sep->se_fd);
+#if INETD_TRACK_CHILDREN
+		kill_prespawned(sep, 1);
+#endif
+		remove_fd_from_set(sep);
 		maybe_close(sep->se_fd);
 #if ENABLE_FEATURE_INETD_RPC
 		if (is_rpc_service(sep))
@@ -1030,6 +1597,9 @@ static void reread_config_file(int sig UNUSED_PARAM)
 		free(sep);
 	}
 	restore_sigmask(&omask);
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	G.spawn_needed = 1;
+#endif
  ret:
 	errno = save_errno;
 }
@@ -1045,6 +1615,9 @@ static void reap_child(int sig UNUSED_PARAM)
 		pid = wait_any_nohang(&status);
 		if (pid <= 0)
 			break;
+#if INETD_TRACK_CHILDREN
+		child_exited(pid, status);
+#endif
 		for (sep = serv_list; sep; sep = sep->se_next) {
 			if (sep->se_wait != pid)
 				continue;
@@ -1056,7 +1629,7 @@ static void reap_child(int sig UNUSED_PARAM)
 				bb_error_msg("%s: exit signal %u",
 						sep->se_program, WTERMSIG(status));
 			sep->se_wait = 1;
-			add_fd_to_set(sep->se_fd);
+			add_fd_to_set(sep);
 			break;
 		}
 	}
@@ -1078,9 +1651,24 @@ static void retry_network_setup(int sig UNUSED_PARAM)
 #endif
 		}
 	}
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	G.spawn_needed = 1;
+#endif
 	errno = save_errno;
 }
 
+#if ENABLE_FEATURE_INETD_EPOLL
+static void record_signal(int sig)
+{
+	unsigned char c = sig;
+	int save_errno = errno;
+
+	/* If the pipe is full, we will be woken up anyway */
+	write(G.signal_pipe[1], &c, 1);
+	errno = save_errno;
+}
+#endif
+
 static void clean_up_and_exit(int sig UNUSED_PARAM)
 {
 	servtab_t *sep;
@@ -1089,6 +1677,9 @@ static void clean_up_and_exit(int sig UNUSED_PARAM)
 	for (sep = serv_list; sep; sep = sep->se_next) {
 		if (sep->se_fd == -1)
 			continue;
+#if ENABLE_FEATURE_INETD_PRESPAWN
+		kill_prespawned(sep, 0);
+#endif
 
 		switch (sep->se_family) {
 		case AF_UNIX:
@@ -1104,6 +1695,10 @@ static void clean_up_and_exit(int sig UNUSED_PARAM)
 		if (ENABLE_FEATURE_CLEAN_UP)
 			close(sep->se_fd);
 	}
+#if ENABLE_FEATURE_INETD_STATS
+	if (G.stats_addr && G.stats_addr[0] == '/')
+		unlink(G.stats_addr);
+#endif
 	remove_pidfile(_PATH_INETDPID);
 	exit(EXIT_SUCCESS);
 }
@@ -1111,10 +1706,8 @@ static void clean_up_and_exit(int sig UNUSED_PARAM)
 int inetd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int inetd_main(int argc UNUSED_PARAM, char **argv)
 {
-	struct sigaction sa, saved_pipe_handler;
+	struct sigaction sa;
 	servtab_t *sep, *sep2;
-	struct passwd *pwd;
-	struct group *grp = grp; /* for compiler */
 	int opt;
 	pid_t pid;
 	sigset_t omask;
@@ -1126,7 +1719,9 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 		config_filename = NULL;
 
 	opt_complementary = "R+:q+"; /* -q N, -R N */
-	opt = getopt32(argv, "R:feq:", &max_concurrency, &global_queuelen);
+	opt = getopt32(argv, "R:feq:" IF_FEATURE_INETD_STATS("S:"),
+			&max_concurrency, &global_queuelen
+			IF_FEATURE_INETD_STATS(, &G.stats_addr));
 	argv += optind;
 	//argc -= optind;
 	if (argv[0])
@@ -1160,6 +1755,60 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 	rlim_ofile_cur = rlim_ofile.rlim_cur;
 	if (rlim_ofile_cur == RLIM_INFINITY)    /* ! */
 		rlim_ofile_cur = OPEN_MAX;
+#if ENABLE_FEATURE_INETD_EPOLL
+	/* No FD_SETSIZE limit: take all fds we can (children get back
+	 * the original limit) */
+	{
+		struct rlimit rl = rlim_ofile;
+		rl.rlim_cur = rl.rlim_max;
+		if (rl.rlim_cur != RLIM_INFINITY
+		 && setrlimit(RLIMIT_NOFILE, &rl) == 0
+		) {
+			rlim_ofile_cur = rl.rlim_cur;
+		}
+	}
+	G.epoll_fd = epoll_create(64);
+	if (G.epoll_fd < 0)
+		bb_perror_msg_and_die("epoll_create");
+	close_on_exec_on(G.epoll_fd);
+	xpipe(G.signal_pipe);
+	close_on_exec_on(G.signal_pipe[0]);
+	close_on_exec_on(G.signal_pipe[1]);
+	ndelay_on(G.signal_pipe[0]);
+	ndelay_on(G.signal_pipe[1]);
+	watch_fd(G.signal_pipe[0], &G.signal_pipe);
+#endif
+#if INETD_TRACK_CHILDREN
+	G.children = xzalloc(CHILD_HASH * sizeof(G.children[0]));
+#endif
+#if ENABLE_FEATURE_INETD_PRESPAWN
+	xpipe(G.spawn_pipe);
+	close_on_exec_on(G.spawn_pipe[0]);
+	close_on_exec_on(G.spawn_pipe[1]);
+	ndelay_on(G.spawn_pipe[0]);
+	watch_fd(G.spawn_pipe[0], &G.spawn_pipe);
+#endif
+#if ENABLE_FEATURE_INETD_STATS
+	if (G.stats_addr) {
+		int fd;
+
+		if (G.stats_addr[0] == '/') {
+			len_and_sockaddr *lsa = xzalloc_lsa(AF_UNIX);
+			safe_strncpy(((struct sockaddr_un*)&lsa->u.sa)->sun_path,
+					G.stats_addr, sizeof(struct sockaddr_un) - 2);
+			unlink(G.stats_addr);
+			fd = xsocket(AF_UNIX, SOCK_STREAM, 0);
+			xbind(fd, &lsa->u.sa, lsa->len);
+			free(lsa);
+		} else {
+			fd = create_and_bind_stream_or_die(G.stats_addr, 0);
+		}
+		xlisten(fd, 8);
+		close_on_exec_on(fd);
+		G.stats_fd = fd;
+		watch_fd(fd, &G.stats_fd);
+	}
+#endif
 
 	memset(&sa, 0, sizeof(sa));
 	/*sigemptyset(&sa.sa_mask); - memset did it */
@@ -1167,6 +1816,13 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 	sigaddset(&sa.sa_mask, SIGCHLD);
 	sigaddset(&sa.sa_mask, SIGHUP);
 //FIXME: explain why no SA_RESTART
+#if ENABLE_FEATURE_INETD_EPOLL
+	/* Main loop runs the real handlers */
+	sa.sa_handler = record_signal;
+	sigaction_set(SIGALRM, &sa);
+	sigaction_set(SIGHUP, &sa);
+	sigaction_set(SIGCHLD, &sa);
+#else
 //FIXME: retry_network_setup is unsafe to run in signal handler (many reasons)!
 	sa.sa_handler = retry_network_setup;
 	sigaction_set(SIGALRM, &sa);
@@ -1176,6 +1832,7 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 //FIXME: reap_child is unsafe to run in signal handler (uses stdio)!
 	sa.sa_handler = reap_child;
 	sigaction_set(SIGCHLD, &sa);
+#endif
 //FIXME: clean_up_and_exit is unsafe to run in signal handler (uses stdio)!
 	sa.sa_handler = clean_up_and_exit;
 	sigaction_set(SIGTERM, &sa);
@@ -1186,9 +1843,73 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 
 	reread_config_file(SIGHUP); /* load config from file */
 
+#if ENABLE_FEATURE_INETD_EPOLL
+	/* Handle these signals synchronously: handlers change serv_list,
+	 * can't let them run while we look at events[] */
+	block_CHLD_HUP_ALRM(&G.orig_mask);
+#endif
 	for (;;) {
 		int ready_fd_cnt;
 		int ctrl, accepted_fd, new_udp_fd;
+#if ENABLE_FEATURE_INETD_STATS
+		unsigned spawn_t0;
+#endif
+#if ENABLE_FEATURE_INETD_EPOLL
+		struct epoll_event events[16];
+		int i;
+
+		while (G.signal_ready) {
+			unsigned char sig;
+
+			if (safe_read(G.signal_pipe[0], &sig, 1) != 1) {
+				G.signal_ready = 0;
+				break;
+			}
+			if (sig == SIGCHLD)
+				reap_child(SIGCHLD);
+			else if (sig == SIGHUP)
+				reread_config_file(SIGHUP);
+			else
+				retry_network_setup(SIGALRM);
+		}
+# if ENABLE_FEATURE_INETD_PRESPAWN
+		if (G.spawn_needed)
+			prespawn_children();
+# endif
+		/* A signal which comes before epoll_wait() sleeps
+		 * is in signal_pipe, and wakes it up */
+		restore_sigmask(&G.orig_mask);
+		ready_fd_cnt = epoll_wait(G.epoll_fd, events, ARRAY_SIZE(events), -1);
+		block_CHLD_HUP_ALRM(&G.orig_mask); /* does not touch errno */
+		if (ready_fd_cnt < 0) {
+			if (errno != EINTR) {
+				bb_perror_msg("epoll_wait");
+				sleep(1);
+			}
+			continue;
+		}
+
+		for (i = 0; i < ready_fd_cnt; i++) {
+			sep = events[i].data.ptr;
+			/* read it at the top of the loop, after we are done
+			 * with events[]: reread_config_file() frees servtabs */
+			if (sep == (void*)&G.signal_pipe) {
+				G.signal_ready = 1;
+				continue;
+			}
+# if ENABLE_FEATURE_INETD_PRESPAWN
+			if (sep == (void*)&G.spawn_pipe) {
+				read_spawn_pipe();
+				continue;
+			}
+# endif
+# if ENABLE_FEATURE_INETD_STATS
+			if (sep == (void*)&G.stats_fd) {
+				send_stats();
+				continue;
+			}
+# endif
+#else
 		fd_set readable;
 
 		if (maxsock < 0)
@@ -1212,6 +1933,10 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 				continue;
 
 			ready_fd_cnt--;
+#endif
+#if ENABLE_FEATURE_INETD_STATS
+			spawn_t0 = monotonic_us();
+#endif
 			ctrl = sep->se_fd;
 			accepted_fd = -1;
 			new_udp_fd = -1;
@@ -1253,6 +1978,9 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 					}
 				}
 			}
+#if ENABLE_FEATURE_INETD_STATS
+			count_conns(sep, 1);
+#endif
 
 			block_CHLD_HUP_ALRM(&omask);
 			pid = 0;
@@ -1263,27 +1991,12 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 			     && sep->se_builtin->bi_fork))
 #endif
 			{
-				if (sep->se_max != 0) {
-					if (++sep->se_count == 1)
-						sep->se_time = monotonic_sec();
-					else if (sep->se_count >= sep->se_max) {
-						unsigned now = monotonic_sec();
-						/* did we accumulate se_max connects too quickly? */
-						if (now - sep->se_time <= CNT_INTERVAL) {
-							bb_error_msg("%s/%s: too many connections, pausing",
-									sep->se_service, sep->se_proto);
-							remove_fd_from_set(sep->se_fd);
-							close(sep->se_fd);
-							sep->se_fd = -1;
-							sep->se_count = 0;
-							rearm_alarm(); /* will revive it in RETRYTIME sec */
-							restore_sigmask(&omask);
-							maybe_close(new_udp_fd);
-							maybe_close(accepted_fd);
-							continue; /* -> check next fd in fd set */
-						}
-						sep->se_count = 0;
-					}
+				if (too_many_connections(sep)) {
+					pause_service(sep);
+					restore_sigmask(&omask);
+					maybe_close(new_udp_fd);
+					maybe_close(accepted_fd);
+					continue; /* -> check next fd in fd set */
 				}
 				/* on NOMMU, streamed chargen
 				 * builtin wouldn't work, but it is
@@ -1309,16 +2022,25 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 			/* if pid == 0 here, we didn't fork */
 
 			if (pid > 0) { /* parent */
+#if ENABLE_FEATURE_INETD_STATS
+				add_child(pid, sep);
+				sep->se_busy++;
+				sep->se_spawned++;
+				/* with vfork, child has exec'ed by now */
+				sep->se_spawn_us += (unsigned)monotonic_us() - spawn_t0;
+#endif
 				if (sep->se_wait) {
 					/* wait: we passed socket to child,
 					 * will wait for child to terminate */
 					sep->se_wait = pid;
-					remove_fd_from_set(sep->se_fd);
+					remove_fd_from_set(sep);
 				}
 				if (new_udp_fd >= 0) {
 					/* udp nowait: child connected the socket,
 					 * we created and will use new, unconnected one */
+					remove_fd_from_set(sep);
 					xmove_fd(new_udp_fd, sep->se_fd);
+					add_fd_to_set(sep);
 				}
 				restore_sigmask(&omask);
 				maybe_close(accepted_fd);
@@ -1332,7 +2054,7 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 					close(sep->se_fd); /* listening socket */
 					logmode = LOGMODE_NONE; /* make xwrite etc silent */
 				}
-				restore_sigmask(&omask);
+				restore_sigmask(pid ? child_sigmask(&omask) : &omask);
 				if (sep->se_socktype == SOCK_STREAM)
 					sep->se_builtin->bi_stream_fn(ctrl, sep);
 				else
@@ -1364,32 +2086,8 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 				free(lsa);
 			}
 			/* prepare env and exec program */
-			pwd = getpwnam(sep->se_user);
-			if (pwd == NULL) {
-				bb_error_msg("%s: no such %s", sep->se_user, "user");
+			if (set_server_identity(sep))
 				goto do_exit1;
-			}
-			if (sep->se_group && (grp = getgrnam(sep->se_group)) == NULL) {
-				bb_error_msg("%s: no such %s", sep->se_group, "group");
-				goto do_exit1;
-			}
-			if (real_uid != 0 && real_uid != pwd->pw_uid) {
-				/* a user running private inetd */
-				bb_error_msg("non-root must run services as himself");
-				goto do_exit1;
-			}
-			if (pwd->pw_uid) {
-				if (sep->se_group)
-					pwd->pw_gid = grp->gr_gid;
-				/* initgroups, setgid, setuid: */
-				change_identity(pwd);
-			} else if (sep->se_group) {
-				xsetgid(grp->gr_gid);
-				setgroups(1, &grp->gr_gid);
-			}
-			if (rlim_ofile.rlim_cur != rlim_ofile_cur)
-				if (setrlimit(RLIMIT_NOFILE, &rlim_ofile) < 0)
-					bb_perror_msg("setrlimit");
 
 			/* closelog(); - WRONG. we are after vfork,
 			 * this may confuse syslog() internal state.
@@ -1408,7 +2106,7 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 				if (sep2->se_fd != ctrl)
 					maybe_close(sep2->se_fd);
 			sigaction_set(SIGPIPE, &saved_pipe_handler);
-			restore_sigmask(&omask);
+			restore_sigmask(child_sigmask(&omask));
 			BB_EXECVP(sep->se_program, sep->se_argv);
 			bb_perror_msg("can't execute '%s'", sep->se_program);
  do_exit1:
@@ -184,6 +184,27 @@
 //config:	  This option recreates the prompt string from the environment
 //config:	  variable each time it is displayed.
 //config:
+//config:config ASH_CMDCACHE
+//config:	bool "Share command lookups between shell instances"
+//config:	default y
+//config:	depends on ASH && PLATFORM_LINUX
+//config:	help
+//config:	  Remember where commands were found in $PATH in a small table
+//config:	  in a file shared by all ash instances of the same user,
+//config:	  so that short-lived "sh -c CMD" shells do not have to stat()
+//config:	  their way through $PATH again. Entries are tied to $PATH and
+//config:	  to the mtimes of its directories; the directories are
+//config:	  rechecked at most once a second.
+//config:
+//config:config ASH_CMDCACHE_DIR
+//config:	string "Directory for the command lookup cache"
+//config:	default "/dev/shm"
+//config:	depends on ASH_CMDCACHE
+//config:	help
+//config:	  The cache is kept in DIR/ash_cmdcache.1.<uid>. DIR should be
+//config:	  writable by every user running ash, preferably on tmpfs.
+//config:	  If it does not exist, the cache is silently not used.
+//config:
 
 //applet:IF_ASH(APPLET(ash, BB_DIR_BIN, BB_SUID_DROP))
 //applet:IF_FEATURE_SH_IS_ASH(APPLET_ODDNAME(sh, ash, BB_DIR_BIN, BB_SUID_DROP, sh))
@@ -7345,7 +7366,9 @@ struct cmdentry {
 		/* index >= 0 for commands without path (slashes) */
 		/* (TODO: what exactly does the value mean? PATH position?) */
 		/* index == -1 for commands with slashes */
-		/* index == (-2 - applet_no) for NOFORK applets */
+		/* index == (-2 - applet_no) for NOFORK applets
+		 * (and, with DO_APPLET, for NOFORK/NOEXEC applets
+		 * found in PATH as links to our own binary) */
 		const struct builtincmd *cmd;
 		struct funcnode *func;
 	} u;
@@ -7361,6 +7384,7 @@ struct cmdentry {
 #define DO_ABS          0x02    /* checks absolute paths */
 #define DO_NOFUNC       0x04    /* don't return shell functions, for command */
 #define DO_ALTPATH      0x08    /* using alternate path */
+#define DO_APPLET       0x10    /* return applets which need no exec as such */
 #define DO_ALTBLTIN     0x20    /* %builtin in alt. path */
 
 static void find_command(char *, struct cmdentry *, int, const char *);
@@ -7382,6 +7406,9 @@ struct tblentry {
 	union param param;      /* definition of builtin function */
 	smallint cmdtype;       /* CMDxxx */
 	char rehash;            /* if set, cd done since entry created */
+#if ENABLE_FEATURE_SH_NOFORK
+	int16_t applet_no;      /* CMDNORMAL: >= 0 if it is us, see path_applet */
+#endif
 	char cmdname[1];        /* name of command */
 };
 
@@ -7393,12 +7420,302 @@ static struct tblentry **cmdtable;
 static int builtinloc = -1;     /* index in path of %builtin, or -1 */
 
 
+#if ENABLE_FEATURE_SH_NOFORK
+static dev_t self_dev;
+static ino_t self_ino;
+# if ENABLE_ASH_CMDCACHE
+static off_t self_size;
+static time_t self_mtime;
+# endif
+
+static void
+check_self(void)
+{
+	static smallint self_checked;
+	struct stat st;
+
+	if (self_checked)
+		return;
+	self_checked = 1;
+	if (stat(bb_busybox_exec_path, &st) == 0) {
+		self_dev = st.st_dev;
+		self_ino = st.st_ino;
+# if ENABLE_ASH_CMDCACHE
+		self_size = st.st_size;
+		self_mtime = st.st_mtime;
+# endif
+	}
+}
+
+/* If NAME is an applet which can run without exec, return its number */
+static int
+self_applet(const char *name)
+{
+	int applet_no = find_applet_by_name(name);
+
+	if (applet_no >= 0
+	 && (APPLET_IS_NOFORK(applet_no) || APPLET_IS_NOEXEC(applet_no))
+	) {
+		return applet_no;
+	}
+	return -1;
+}
+
+/*
+ * PATH search found an executable.  If it is our own binary and NAME
+ * is an applet which can run without exec, return the applet's number,
+ * else -1.
+ */
+static int
+path_applet(const char *name, const struct stat *st)
+{
+	check_self();
+	/* exec of a suid/sgid binary may change our credentials */
+	if (st->st_mode & (S_ISUID | S_ISGID))
+		return -1;
+	if (st->st_ino != self_ino || st->st_dev != self_dev)
+		return -1;
+	return self_applet(name);
+}
+#endif
+
+
+#if ENABLE_ASH_CMDCACHE
+/* ============ Command lookup cache shared between shells */
+
+/*
+ * Boot scripts start lots of short-lived "sh -c CMD" shells, and each
+ * of them stat()s its way through $PATH for every command it runs.
+ * Successful lookups are therefore also recorded in a table in a file
+ * which every ash of the same user maps.  Entries are keyed on a hash
+ * of $PATH and of dev/ino/mtime of each $PATH directory, so creating,
+ * removing or renaming anything in them invalidates the entries.
+ * Rechecking the directories costs about as much as the search itself,
+ * so a check made by any shell is trusted for CMDCACHE_TTL_MS.
+ *
+ * There is no locking: every record carries a checksum, and a record
+ * torn by a concurrent writer is just a miss.
+ */
+#define CMDCACHE_FILE   CONFIG_ASH_CMDCACHE_DIR"/ash_cmdcache.1." /* + euid */
+#define CMDCACHE_TTL_MS 1000
+#define CMDCACHE_PATHS  16
+#define CMDCACHE_SLOTS  1024    /* power of 2 */
+#define CMDCACHE_PROBE  4
+
+struct cmdcache_path {
+	uint32_t path_hash;     /* of $PATH */
+	uint32_t key;           /* path_hash + stat() of $PATH dirs */
+	uint32_t stamp;         /* monotonic_ms() when dirs were checked */
+	uint32_t check;
+};
+
+struct cmdcache_ent {
+	uint32_t key;
+	int16_t idx;            /* index in $PATH */
+	int16_t self;           /* path_applet found it is us */
+	char name[24];
+	uint32_t check;
+};
+
+struct cmdcache {
+	struct cmdcache_path path[CMDCACHE_PATHS];
+	struct cmdcache_ent ent[CMDCACHE_SLOTS];
+};
+
+static struct cmdcache *cmdcache; /* MAP_FAILED if we can't have it */
+static uint32_t cmdcache_key;     /* for current $PATH, 0: recheck */
+static uint32_t cmdcache_stamp;
+
+static uint32_t
+cmdcache_hash(uint32_t h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+
+	while (n--)
+		h = (h ^ *s++) * 16777619;
+	return h;
+}
+/* Checksum covers everything before the trailing "check" member */
+#define CMDCACHE_CHECK(r) cmdcache_hash(2166136261u, (r), sizeof(*(r)) - sizeof((r)->check))
+
+static struct cmdcache *
+cmdcache_open(void)
+{
+	char fname[sizeof(CMDCACHE_FILE) + sizeof(int)*3];
+	struct stat st;
+	void *p;
+	int fd;
+
+	p = MAP_FAILED;
+	sprintf(fname, CMDCACHE_FILE"%u", (unsigned)geteuid());
+	fd = open(fname, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		return p;
+	/* Do not let anybody else feed us wrong answers */
+	if (fstat(fd, &st) == 0
+	 && S_ISREG(st.st_mode)
+	 && st.st_uid == geteuid()
+	 && !(st.st_mode & (S_IRWXG | S_IRWXO))
+	 && (st.st_size == sizeof(struct cmdcache)
+	    || (st.st_size == 0 && ftruncate(fd, sizeof(struct cmdcache)) == 0))
+	) {
+		p = mmap(NULL, sizeof(struct cmdcache), PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	return p;
+}
+
+/*
+ * Return the key for the current $PATH, or 0 if lookups in it
+ * can't be shared: relative directories depend on cwd,
+ * %builtin and %func on more than stat() can tell.
+ */
+static uint32_t
+cmdcache_getkey(void)
+{
+	struct cmdcache_path rec, *slot;
+	const char *path, *p;
+	uint32_t now, h;
+
+	now = monotonic_ms();
+	if (cmdcache_key && now - cmdcache_stamp < CMDCACHE_TTL_MS)
+		return cmdcache_key;
+	cmdcache_key = 0;
+
+	path = pathval();
+	if (strchr(path, '%'))
+		return 0;
+	p = path;
+	do {
+		if (*p != '/')
+			return 0;
+		p = strchrnul(p, ':');
+	} while (*p++);
+
+	if (!cmdcache)
+		cmdcache = cmdcache_open();
+	if (cmdcache == MAP_FAILED)
+		return 0;
+
+	h = cmdcache_hash(2166136261u, path, p - path);
+#if ENABLE_FEATURE_SH_NOFORK
+	/* Entries tell which commands are us: not usable by other binaries,
+	 * nor after our binary was replaced in place */
+	check_self();
+	h = cmdcache_hash(h, &self_dev, sizeof(self_dev));
+	h = cmdcache_hash(h, &self_ino, sizeof(self_ino));
+	h = cmdcache_hash(h, &self_size, sizeof(self_size));
+	h = cmdcache_hash(h, &self_mtime, sizeof(self_mtime));
+#endif
+	slot = &cmdcache->path[h % CMDCACHE_PATHS];
+	rec = *slot;
+	if (rec.path_hash != h
+	 || now - rec.stamp >= CMDCACHE_TTL_MS
+	 || rec.check != CMDCACHE_CHECK(&rec)
+	) {
+		char *dir;
+		struct stat st;
+		time_t t = time(NULL);
+		time_t mtime;
+
+		rec.path_hash = h;
+		rec.stamp = now;
+		p = path;
+		while ((dir = path_advance(&p, "")) != NULL) {
+			stunalloc(dir);
+			if (stat(dir, &st) != 0) {
+				h = cmdcache_hash(h, &errno, sizeof(errno));
+				continue;
+			}
+			/* Only whole seconds are portable (not in bionic's stat).
+			 * A change later in the same second as the one we see
+			 * would not change the key: don't cache until it's over */
+			mtime = st.st_mtime;
+			if (mtime >= t)
+				return 0;
+			h = cmdcache_hash(h, &st.st_dev, sizeof(st.st_dev));
+			h = cmdcache_hash(h, &st.st_ino, sizeof(st.st_ino));
+			h = cmdcache_hash(h, &mtime, sizeof(mtime));
+		}
+		rec.key = h | 1;
+		rec.check = CMDCACHE_CHECK(&rec);
+		*slot = rec;
+	}
+	cmdcache_stamp = rec.stamp;
+	cmdcache_key = rec.key;
+	return cmdcache_key;
+}
+
+static unsigned
+cmdcache_slot(const char *name, uint32_t key)
+{
+	return cmdcache_hash(key, name, strlen(name));
+}
+
+/* Returns 1 and fills *idx, *self if NAME was found in $PATH before */
+static int
+cmdcache_lookup(const char *name, int *idx, int *self)
+{
+	struct cmdcache_ent rec;
+	uint32_t key;
+	unsigned n, i;
+
+	key = cmdcache_getkey();
+	if (!key || strlen(name) >= sizeof(rec.name))
+		return 0;
+	n = cmdcache_slot(name, key);
+	for (i = 0; i < CMDCACHE_PROBE; i++) {
+		rec = cmdcache->ent[(n + i) & (CMDCACHE_SLOTS - 1)];
+		if (rec.key == key
+		 && strncmp(rec.name, name, sizeof(rec.name)) == 0
+		 && rec.check == CMDCACHE_CHECK(&rec)
+		) {
+			*idx = rec.idx;
+			*self = rec.self;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+cmdcache_store(const char *name, int idx, int self)
+{
+	struct cmdcache_ent rec, *ent, *victim;
+	uint32_t key;
+	unsigned n, i;
+
+	key = cmdcache_key; /* cmdcache_lookup() just set it */
+	if (!key || strlen(name) >= sizeof(rec.name))
+		return;
+	n = cmdcache_slot(name, key);
+	victim = &cmdcache->ent[n & (CMDCACHE_SLOTS - 1)];
+	for (i = 0; i < CMDCACHE_PROBE; i++) {
+		/* Take a slot of an outdated key, else evict the first one */
+		ent = &cmdcache->ent[(n + i) & (CMDCACHE_SLOTS - 1)];
+		if (ent->key != key || ent->check != CMDCACHE_CHECK(ent)) {
+			victim = ent;
+			break;
+		}
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.key = key;
+	rec.idx = idx;
+	rec.self = self;
+	strcpy(rec.name, name);
+	rec.check = CMDCACHE_CHECK(&rec);
+	*victim = rec;
+}
+#endif
+
+
 static void
 tryexec(IF_FEATURE_SH_STANDALONE(int applet_no,) char *cmd, char **argv, char **envp)
 {
 #if ENABLE_FEATURE_SH_STANDALONE
 	if (applet_no >= 0) {
-		if (APPLET_IS_NOEXEC(applet_no)) {
+		if (APPLET_IS_NOEXEC(applet_no) || APPLET_IS_NOFORK(applet_no)) {
 			clearenv();
 			while (*envp)
 				putenv(*envp++);
@@ -7471,6 +7788,18 @@ shellexec(char **argv, const char *path, int idx)
 
 	clearredir(/*drop:*/ 1);
 	envp = listvars(VEXPORT, VUNSET, /*end:*/ NULL);
+#if ENABLE_FEATURE_SH_NOFORK
+	if (idx < -1) {
+		/* find_command(DO_APPLET) says we can run it without exec */
+		int a = -2 - idx;
+		if (APPLET_IS_NOEXEC(a) || APPLET_IS_NOFORK(a)) {
+			clearenv();
+			while (*envp)
+				putenv(*envp++);
+			run_applet_no_and_exit(a, argv);
+		}
+	}
+#endif
 	if (strchr(argv[0], '/') != NULL
 #if ENABLE_FEATURE_SH_STANDALONE
 	 || (applet_no = find_applet_by_name(argv[0])) >= 0
@@ -7592,6 +7921,7 @@ cmdlookup(const char *name, int add)
 				 * tblentry::cmdname is char[1] */);
 		/*cmdp->next = NULL; - ckzalloc did it */
 		cmdp->cmdtype = CMDUNKNOWN;
+		IF_FEATURE_SH_NOFORK(cmdp->applet_no = -1;)
 		strcpy(cmdp->cmdname, name);
 	}
 	lastcmdentry = pp;
@@ -7739,6 +8069,9 @@ changepath(const char *new)
 	if (builtinloc >= 0 && idx_bltin < 0)
 		firstchange = 0;
 	clearcmdentry(firstchange);
+#if ENABLE_ASH_CMDCACHE
+	cmdcache_key = 0;
+#endif
 	builtinloc = idx_bltin;
 }
 
@@ -9292,7 +9625,7 @@ evalcommand(union node *cmd, int flags)
 	/* Now locate the command. */
 	if (argc) {
 		const char *oldpath;
-		int cmd_flag = DO_ERR;
+		int cmd_flag = DO_ERR | DO_APPLET;
 
 		path += 5;
 		oldpath = path;
@@ -9340,17 +9673,19 @@ evalcommand(union node *cmd, int flags)
 	default: {
 
 #if ENABLE_FEATURE_SH_NOFORK
-/* (1) BUG: if variables are set, we need to fork, or save/restore them
- *     around run_nofork_applet() call.
- * (2) Should this check also be done in forkshell()?
- *     (perhaps it should, so that "VAR=VAL nofork" at least avoids exec...)
- */
 		/* find_command() encodes applet_no as (-2 - applet_no) */
 		int applet_no = (- cmdentry.u.index - 2);
-		if (applet_no >= 0 && APPLET_IS_NOFORK(applet_no)) {
-			listsetvar(varlist.list, VEXPORT|VSTACK);
+		/* "VAR=VAL nofork" must not change our own VAR: it forks,
+		 * and shellexec() runs the applet in the child without exec */
+		if (applet_no >= 0 && APPLET_IS_NOFORK(applet_no) && !varlist.list) {
+			char **sv_environ = environ;
+
+			/* The applet looks for exported variables in environ */
+			environ = listvars(VEXPORT, VUNSET, /*end:*/ NULL);
 			/* run <applet>_main() */
 			exitstatus = run_nofork_applet(applet_no, argv);
+			environ = sv_environ;
+			flush_stdout_stderr();
 			break;
 		}
 #endif
@@ -12307,6 +12642,9 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	int e;
 	int updatetbl;
 	struct builtincmd *bcmd;
+#if ENABLE_FEATURE_SH_NOFORK
+	int applet_no = -1;
+#endif
 
 	/* If name contains a slash, don't use PATH or hash table */
 	if (strchr(name, '/') != NULL) {
@@ -12394,6 +12732,16 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 		else
 			prev = cmdp->param.index;
 	}
+#if ENABLE_ASH_CMDCACHE
+	else if (updatetbl) {
+		int self;
+		if (cmdcache_lookup(name, &idx, &self)) {
+			/* Applet numbers are not stored: they differ between builds */
+			IF_FEATURE_SH_NOFORK(applet_no = self ? self_applet(name) : -1;)
+			goto found;
+		}
+	}
+#endif
 
 	e = ENOENT;
 	idx = -1;
@@ -12447,17 +12795,22 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 			goto success;
 		}
 		TRACE(("searchexec \"%s\" returns \"%s\"\n", name, fullname));
+#if ENABLE_FEATURE_SH_NOFORK
+		applet_no = path_applet(name, &statb);
+#endif
 		if (!updatetbl) {
 			entry->cmdtype = CMDNORMAL;
 			entry->u.index = idx;
+#if ENABLE_FEATURE_SH_NOFORK
+			if ((act & DO_APPLET) && applet_no >= 0)
+				entry->u.index = -2 - applet_no;
+#endif
 			return;
 		}
-		INT_OFF;
-		cmdp = cmdlookup(name, 1);
-		cmdp->cmdtype = CMDNORMAL;
-		cmdp->param.index = idx;
-		INT_ON;
-		goto success;
+#if ENABLE_ASH_CMDCACHE
+		cmdcache_store(name, idx, IF_FEATURE_SH_NOFORK(applet_no >= 0) IF_NOT_FEATURE_SH_NOFORK(0));
+#endif
+		goto found;
 	}
 
 	/* We failed.  If there was an entry for this command, delete it */
@@ -12468,6 +12821,15 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	entry->cmdtype = CMDUNKNOWN;
 	return;
 
+ found:
+	INT_OFF;
+	cmdp = cmdlookup(name, 1);
+	cmdp->cmdtype = CMDNORMAL;
+	cmdp->param.index = idx;
+	IF_FEATURE_SH_NOFORK(cmdp->applet_no = applet_no;)
+	INT_ON;
+	goto success;
+
  builtin_success:
 	if (!updatetbl) {
 		entry->cmdtype = CMDBUILTIN;
@@ -12483,6 +12845,10 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	cmdp->rehash = 0;
 	entry->cmdtype = cmdp->cmdtype;
 	entry->u = cmdp->param;
+#if ENABLE_FEATURE_SH_NOFORK
+	if ((act & DO_APPLET) && cmdp->cmdtype == CMDNORMAL && cmdp->applet_no >= 0)
+		entry->u.index = -2 - cmdp->applet_no;
+#endif
 }
 
 
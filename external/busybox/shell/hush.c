@@ -238,6 +238,16 @@ typedef void (*hush_sighandler_t)(int);
 //config:	  This instructs hush to print commands before execution.
 //config:	  Adds ~300 bytes.
 //config:
+//config:config HUSH_MEMSTAT
+//config:	bool "memstat builtin"
+//config:	default y
+//config:	depends on HUSH
+//config:	help
+//config:	  Enable memstat builtin, which shows how many heap allocations
+//config:	  hush made so far, and how many were served from its
+//config:	  per-command memory regions instead. Useful for measuring
+//config:	  allocation churn of scripts. Adds ~600 bytes.
+//config:
 //config:config MSH
 //config:	bool "msh (deprecated: aliased to hush)"
 //config:	default n
@@ -385,7 +395,6 @@ static const char hush_version_str[] ALIGN1 = "HUSH_VERSION="BB_VER;
 typedef struct nommu_save_t {
 	char **new_env;
 	struct variable *old_vars;
-	char **argv;
 	char **argv_from_re_execing;
 } nommu_save_t;
 #endif
@@ -431,6 +440,8 @@ typedef struct o_string {
 	smallint has_quoted_part;
 	smallint has_empty_slot;
 	smallint o_assignment; /* 0:maybe, 1:yes, 2:no */
+	/* data is in G.scratch region, not malloced */
+	smallint o_scratch;
 } o_string;
 enum {
 	EXP_FLAG_SINGLEWORD     = 0x80, /* must be 0x80 */
@@ -544,6 +555,8 @@ struct command {
 #endif
 #if ENABLE_HUSH_FUNCTIONS
 	struct function *child_func;
+	/* CMD_FUNCDEF: region the function body lives in */
+	struct region *func_region;
 /* This field is used to prevent a bug here:
  * while...do f1() {a;}; f1; f1() {b;}; f1; done
  * When we execute "f1() {a;}" cmd, we create new function and clear
@@ -659,12 +672,43 @@ struct function {
 	char *name;
 	struct command *parent_cmd;
 	struct pipe *body;
+	struct region *region; /* holds name and body, we have a ref on it */
 # if !BB_MMU
 	char *body_as_string;
 # endif
 };
 #endif
 
+/* Memory regions.
+ * Parse trees (pipes, commands, argv[] and redirects) are allocated
+ * from a region created for each parsed list of commands, and are freed
+ * all at once when the list has been run and nothing (a function
+ * defined in it, or a running function) references it anymore.
+ * Expansion results (argv_expanded etc) are allocated from G.scratch,
+ * which is used as a stack: run_list releases it to the mark taken
+ * before each run_pipe, so loop iterations reuse the same memory.
+ * Chunks of released and freed regions go to G.spare_chunks
+ * and are reused by all regions.
+ */
+struct region_chunk {
+	struct region_chunk *prev;
+	char *end;
+	/* data follows */
+};
+struct region {
+	struct region_chunk *chunk; /* current (newest) chunk */
+	char *next;                 /* free space in current chunk */
+	char *end;
+	char *last;                 /* last allocation, can be resized in place */
+	unsigned chunk_size;        /* size of next chunk we malloc */
+	int refcnt;
+};
+struct region_mark {
+	struct region_chunk *chunk;
+	char *next;
+	char *last;
+};
+
 
 /* set -/+o OPT support. (TODO: make it optional)
  * bash supports the following opts:
@@ -789,6 +833,20 @@ struct globals {
 #endif
 	const char *ifs;
 	const char *cwd;
+	struct region *parse_region; /* new parse tree nodes go here */
+	struct region scratch;
+	struct region_chunk *spare_chunks; /* freed chunks kept for reuse */
+#if ENABLE_HUSH_MEMSTAT
+	struct {
+		unsigned long mallocs;
+		unsigned long reallocs;
+		unsigned long frees;
+		unsigned long region_allocs;
+		unsigned long region_resizes;
+		unsigned long chunks;
+		unsigned long chunk_bytes;
+	} memstat;
+#endif
 	struct variable *top_var;
 	char **expanded_assignments;
 #if ENABLE_HUSH_FUNCTIONS
@@ -831,8 +889,9 @@ struct globals {
 /* Not #defining name to G.name - this quickly gets unwieldy
  * (too many defines). Also, I actually prefer to see when a variable
  * is global, thus "G." prefix is a useful hint */
+/* (xzalloc): bypass memstat's counting macro, G does not exist yet */
 #define INIT_G() do { \
-	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
+	SET_PTR_TO_GLOBALS((xzalloc)(sizeof(G))); \
 	/* memset(&G.sa, 0, sizeof(G.sa)); */  \
 	sigfillset(&G.sa.sa_mask); \
 	G.sa.sa_flags = SA_RESTART; \
@@ -859,6 +918,9 @@ static int builtin_local(char **argv) FAST_FUNC;
 #if HUSH_DEBUG
 static int builtin_memleak(char **argv) FAST_FUNC;
 #endif
+#if ENABLE_HUSH_MEMSTAT
+static int builtin_memstat(char **argv) FAST_FUNC;
+#endif
 #if ENABLE_PRINTF
 static int builtin_printf(char **argv) FAST_FUNC;
 #endif
@@ -930,6 +992,9 @@ static const struct built_in_command bltins1[] = {
 #endif
 #if HUSH_DEBUG
 	BLTIN("memleak"  , builtin_memleak , NULL),
+#endif
+#if ENABLE_HUSH_MEMSTAT
+	BLTIN("memstat"  , builtin_memstat , "Show memory allocation counters"),
 #endif
 	BLTIN("read"     , builtin_read    , "Input into variable"),
 #if ENABLE_HUSH_FUNCTIONS
@@ -1074,6 +1139,24 @@ static void xxfree(void *ptr)
 # define free(p)        xxfree(p)
 #endif
 
+/* Allocation counting for memstat builtin.
+ */
+#if ENABLE_HUSH_MEMSTAT && !LEAK_HUNTING
+static void hush_free(void *ptr)
+{
+	if (ptr)
+		G.memstat.frees++;
+	free(ptr);
+}
+# define xmalloc(s)      (G.memstat.mallocs++, xmalloc(s))
+# define xzalloc(s)      (G.memstat.mallocs++, xzalloc(s))
+# define xstrdup(s)      (G.memstat.mallocs++, xstrdup(s))
+# define xstrndup(s, n)  (G.memstat.mallocs++, xstrndup(s, n))
+# define xasprintf(...)  (G.memstat.mallocs++, xasprintf(__VA_ARGS__))
+# define xrealloc(p, s)  (G.memstat.reallocs++, xrealloc(p, s))
+# define free(p)         hush_free(p)
+#endif
+
 
 /* Syntax and runtime errors. They always abort scripts.
  * In interactive use they usually discard unparsed and/or unexecuted commands
@@ -1247,6 +1330,172 @@ static void free_strings(char **strings)
 }
 
 
+/* Memory regions (see comment at struct region)
+ */
+#define REGION_ALIGN(n)   (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+#define REGION_CHUNK_MIN  1024
+#define REGION_CHUNK_MAX  (32 * 1024)
+
+static void region_new_chunk(struct region *r, size_t size)
+{
+	struct region_chunk *c, **cp;
+
+	for (cp = &G.spare_chunks; (c = *cp) != NULL; cp = &c->prev) {
+		if ((size_t)(c->end - (char*)(c + 1)) >= size) {
+			*cp = c->prev;
+			goto got_it;
+		}
+	}
+	/* Each new chunk is twice as big as previous one, up to a limit */
+	r->chunk_size = r->chunk_size * 2;
+	if (r->chunk_size < REGION_CHUNK_MIN)
+		r->chunk_size = REGION_CHUNK_MIN;
+	if (r->chunk_size > REGION_CHUNK_MAX)
+		r->chunk_size = REGION_CHUNK_MAX;
+	size = REGION_ALIGN(size + sizeof(*c));
+	if (size < r->chunk_size)
+		size = r->chunk_size;
+	c = xmalloc(size);
+	c->end = (char*)c + size;
+	IF_HUSH_MEMSTAT(G.memstat.chunks++;)
+	IF_HUSH_MEMSTAT(G.memstat.chunk_bytes += size;)
+ got_it:
+	c->prev = r->chunk;
+	r->chunk = c;
+	r->next = (char*)(c + 1);
+	r->end = c->end;
+}
+
+static void *region_alloc(struct region *r, size_t size)
+{
+	char *p;
+
+	size = REGION_ALIGN(size);
+	if ((size_t)(r->end - r->next) < size)
+		region_new_chunk(r, size);
+	p = r->next;
+	r->next = p + size;
+	r->last = p;
+	IF_HUSH_MEMSTAT(G.memstat.region_allocs++;)
+	return p;
+}
+
+static void *region_zalloc(struct region *r, size_t size)
+{
+	return memset(region_alloc(r, size), 0, size);
+}
+
+static char *region_strdup(struct region *r, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	return memcpy(region_alloc(r, len), s, len);
+}
+
+/* Like realloc. If ptr is the last allocation, it is resized in place */
+static void *region_resize(struct region *r, void *ptr, size_t oldsize, size_t newsize)
+{
+	void *p;
+
+	if (ptr && ptr == r->last
+	 && (size_t)(r->end - (char*)ptr) >= REGION_ALIGN(newsize)
+	) {
+		r->next = (char*)ptr + REGION_ALIGN(newsize);
+		IF_HUSH_MEMSTAT(G.memstat.region_resizes++;)
+		return ptr;
+	}
+	p = region_alloc(r, newsize);
+	if (oldsize)
+		memcpy(p, ptr, oldsize < newsize ? oldsize : newsize);
+	return p;
+}
+
+/* Region used as a stack: release frees everything allocated after mark.
+ * Data allocated before the mark must not be resized until release. */
+static void region_put_chunk(struct region_chunk *c)
+{
+	if (c->end - (char*)c > REGION_CHUNK_MAX) {
+		IF_HUSH_MEMSTAT(G.memstat.chunk_bytes -= c->end - (char*)c;)
+		free(c);
+		return;
+	}
+	c->prev = G.spare_chunks;
+	G.spare_chunks = c;
+}
+
+static void region_get_mark(struct region *r, struct region_mark *m)
+{
+	m->chunk = r->chunk;
+	m->next = r->next;
+	m->last = r->last;
+}
+
+static void region_release(struct region *r, const struct region_mark *m)
+{
+	struct region_chunk *c;
+
+	while ((c = r->chunk) != m->chunk) {
+		r->chunk = c->prev;
+		region_put_chunk(c);
+	}
+	r->next = m->next;
+	r->end = c ? c->end : NULL;
+	r->last = m->last;
+}
+
+/* Refcounted regions, for parse trees */
+static struct region *region_new(void)
+{
+	struct region tmp, *r;
+
+	memset(&tmp, 0, sizeof(tmp));
+	r = region_alloc(&tmp, sizeof(*r));
+	*r = tmp; /* struct region lives in its own first chunk */
+	r->refcnt = 1;
+	return r;
+}
+
+static void region_ref(struct region *r)
+{
+	if (r)
+		r->refcnt++;
+}
+
+static void region_unref(struct region *r)
+{
+	struct region_chunk *c, *prev;
+
+	if (!r || --r->refcnt != 0)
+		return;
+	c = r->chunk;
+	while (c) {
+		prev = c->prev;
+		region_put_chunk(c);
+		c = prev;
+	}
+}
+
+/* Note: takes ownership of "add" ptr (it is not strdup'ed).
+ * The vector has power-of-2 capacity (min 4), so that appending
+ * words one by one does not copy it every time. */
+static char **region_add_string(struct region *r, char **strings, char *add)
+{
+	unsigned n = 0;
+
+	if (strings)
+		while (strings[n])
+			n++;
+	if (n < 3 ? !strings : !((n + 1) & n)) {
+		char **v = region_alloc(r, (n < 3 ? 4 : 2 * (n + 1)) * sizeof(v[0]));
+		if (n)
+			memcpy(v, strings, n * sizeof(v[0]));
+		strings = v;
+	}
+	strings[n] = add;
+	strings[n + 1] = NULL;
+	return strings;
+}
+
+
 /* Helpers for setting new $n and restoring them back
  */
 typedef struct save_arg_t {
@@ -2165,20 +2414,34 @@ static void o_reset_to_empty_unquoted(o_string *o)
 
 static void o_free(o_string *o)
 {
-	free(o->data);
+	if (!o->o_scratch)
+		free(o->data);
 	memset(o, 0, sizeof(*o));
 }
 
 static ALWAYS_INLINE void o_free_unsafe(o_string *o)
 {
-	free(o->data);
+	if (!o->o_scratch)
+		free(o->data);
+}
+
+/* Resize o->data to hold o->maxlen chars */
+static void o_resize(o_string *o, int oldmaxlen)
+{
+	if (!o->o_scratch) {
+		o->data = xrealloc(o->data, 1 + o->maxlen);
+		return;
+	}
+	o->data = region_resize(&G.scratch, o->data,
+			o->data ? 1 + oldmaxlen : 0, 1 + o->maxlen);
 }
 
 static void o_grow_by(o_string *o, int len)
 {
 	if (o->length + len > o->maxlen) {
+		int oldmaxlen = o->maxlen;
 		o->maxlen += (2*len > B_CHUNK ? 2*len : B_CHUNK);
-		o->data = xrealloc(o->data, 1 + o->maxlen);
+		o_resize(o, oldmaxlen);
 	}
 }
 
@@ -2369,7 +2632,7 @@ static int o_save_ptr_helper(o_string *o, int n)
 			debug_printf_list("list[%d]=%d string_start=%d (growing)\n", n, string_len, string_start);
 			/* list[n] points to string_start, make space for 16 more pointers */
 			o->maxlen += 0x10 * sizeof(list[0]);
-			o->data = xrealloc(o->data, o->maxlen + 1);
+			o_resize(o, o->maxlen - 0x10 * sizeof(list[0]));
 			list = (char**)o->data;
 			memmove(list + n + 0x10, list + n, string_len);
 			o->length += 0x10 * sizeof(list[0]);
@@ -2710,16 +2973,17 @@ static char **o_finalize_list(o_string *o, int n)
 
 static void free_pipe_list(struct pipe *pi);
 
-/* Returns pi->next - next pipe in the list */
+/* Parse tree itself is in a region, freed by region_unref().
+ * This only frees what is malloced, and unlinks functions.
+ * Returns pi->next - next pipe in the list */
 static struct pipe *free_pipe(struct pipe *pi)
 {
-	struct pipe *next;
 	int i;
 
 	debug_printf_clean("free_pipe (pid %d)\n", getpid());
 	for (i = 0; i < pi->num_cmds; i++) {
 		struct command *command;
-		struct redir_struct *r, *rnext;
+		struct redir_struct *r;
 
 		command = &pi->cmds[i];
 		debug_printf_clean("  command %d:\n", i);
@@ -2731,8 +2995,6 @@ static struct pipe *free_pipe(struct pipe *pi)
 					debug_printf_clean("   argv[%d] = %s\n", a, *p);
 				}
 			}
-			free_strings(command->argv);
-			//command->argv = NULL;
 		}
 		/* not "else if": on syntax error, we may have both! */
 		if (command->group) {
@@ -2754,31 +3016,22 @@ static struct pipe *free_pipe(struct pipe *pi)
 		free(command->group_as_string);
 		//command->group_as_string = NULL;
 #endif
-		for (r = command->redirects; r; r = rnext) {
+		for (r = command->redirects; r; r = r->next) {
 			debug_printf_clean("   redirect %d%s",
 					r->rd_fd, redir_table[r->rd_type].descrip);
 			/* guard against the case >$FOO, where foo is unset or blank */
 			if (r->rd_filename) {
 				debug_printf_clean(" fname:'%s'\n", r->rd_filename);
-				free(r->rd_filename);
-				//r->rd_filename = NULL;
 			}
 			debug_printf_clean(" rd_dup:%d\n", r->rd_dup);
-			rnext = r->next;
-			free(r);
 		}
-		//command->redirects = NULL;
 	}
-	free(pi->cmds);   /* children are an array, they get freed all at once */
-	//pi->cmds = NULL;
 #if ENABLE_HUSH_JOB
 	free(pi->cmdtext);
 	//pi->cmdtext = NULL;
 #endif
 
-	next = pi->next;
-	free(pi);
-	return next;
+	return pi->next;
 }
 
 static void free_pipe_list(struct pipe *pi)
@@ -2886,7 +3139,7 @@ static void debug_print_tree(struct pipe *pi, int lvl)
 static struct pipe *new_pipe(void)
 {
 	struct pipe *pi;
-	pi = xzalloc(sizeof(struct pipe));
+	pi = region_zalloc(G.parse_region, sizeof(struct pipe));
 	/*pi->followup = 0; - deliberately invalid value */
 	/*pi->res_word = RES_NONE; - RES_NONE is 0 anyway */
 	return pi;
@@ -2917,7 +3170,9 @@ static int done_command(struct parse_context *ctx)
 
 	/* Only real trickiness here is that the uncommitted
 	 * command structure is not counted in pi->num_cmds. */
-	pi->cmds = xrealloc(pi->cmds, sizeof(*pi->cmds) * (pi->num_cmds+1));
+	pi->cmds = region_resize(G.parse_region, pi->cmds,
+			sizeof(*pi->cmds) * pi->num_cmds,
+			sizeof(*pi->cmds) * (pi->num_cmds+1));
 	ctx->command = command = &pi->cmds[pi->num_cmds];
  clear_and_ret:
 	memset(command, 0, sizeof(*command));
@@ -3177,7 +3432,7 @@ static int done_word(o_string *word, struct parse_context *ctx)
 		 * shell may perform it, but shall do so only when
 		 * the expansion would result in one word."
 		 */
-		ctx->pending_redirect->rd_filename = xstrdup(word->data);
+		ctx->pending_redirect->rd_filename = region_strdup(G.parse_region, word->data);
 		/* Cater for >\file case:
 		 * >\a creates file a; >\\a, >"\a", >"\\a" create file \a
 		 * Same with heredocs:
@@ -3266,7 +3521,8 @@ static int done_word(o_string *word, struct parse_context *ctx)
 				p += 3;
 			}
 		}
-		command->argv = add_string_to_strings(command->argv, xstrdup(word->data));
+		command->argv = region_add_string(G.parse_region, command->argv,
+				region_strdup(G.parse_region, word->data));
 		debug_print_strings("word appended to argv", command->argv);
 	}
 
@@ -3390,7 +3646,7 @@ static int parse_redirect(struct parse_context *ctx,
 	while ((redir = *redirp) != NULL) {
 		redirp = &(redir->next);
 	}
-	*redirp = redir = xzalloc(sizeof(*redir));
+	*redirp = redir = region_zalloc(G.parse_region, sizeof(*redir));
 	/* redir->next = NULL; */
 	/* redir->rd_filename = NULL; */
 	redir->rd_type = style;
@@ -3532,8 +3788,8 @@ static int fetch_heredocs(int heredoc_cnt, struct parse_context *ctx, struct in_
 						syntax_error("unexpected EOF in here document");
 						return 1;
 					}
-					free(redir->rd_filename);
-					redir->rd_filename = p;
+					redir->rd_filename = region_strdup(G.parse_region, p);
+					free(p);
 					heredoc_cnt--;
 				}
 				redir = redir->next;
@@ -3605,6 +3861,7 @@ static int parse_group(o_string *dest, struct parse_context *ctx,
 		}
 		nommu_addchr(&ctx->as_string, ch);
 		command->cmd_type = CMD_FUNCDEF;
+		command->func_region = G.parse_region;
 		goto skip;
 	}
 #endif
@@ -4705,8 +4962,11 @@ static struct pipe *parse_stream(char **pstring,
 /* only ${var/pattern/repl} (its pattern part) needs additional mode */
 #define expand_string_to_string(str, do_unbackslash) \
 	expand_string_to_string(str)
+#define expand_string_to_scratch(str, do_unbackslash) \
+	expand_string_to_scratch(str)
 #endif
 static char *expand_string_to_string(const char *str, int do_unbackslash);
+static char *expand_string_to_scratch(const char *str, int do_unbackslash);
 #if ENABLE_HUSH_TICK
 static int process_command_subs(o_string *dest, const char *s);
 #endif
@@ -4819,7 +5079,7 @@ static int expand_on_ifs(int *ended_with_ifs, o_string *output, int n, const cha
  * they are in double quotes, with the exception that they are not :).
  * Just the rules are similar: "expand only $var and `cmd`"
  *
- * Returns malloced string.
+ * Returns string in G.scratch, caller releases it.
  * As an optimization, we return NULL if expansion is not needed.
  */
 #if !ENABLE_HUSH_BASH_COMPAT
@@ -4829,7 +5089,6 @@ static int expand_on_ifs(int *ended_with_ifs, o_string *output, int n, const cha
 #endif
 static char *encode_then_expand_string(const char *str, int process_bkslash, int do_unbackslash)
 {
-	char *exp_str;
 	struct in_str input;
 	o_string dest = NULL_O_STRING;
 
@@ -4845,14 +5104,12 @@ static char *encode_then_expand_string(const char *str, int process_bkslash, int
 	/* We need to expand. Example:
 	 * echo $(($a + `echo 1`)) $((1 + $((2)) ))
 	 */
+	dest.o_scratch = 1;
 	setup_string_in_str(&input, str);
 	encode_string(NULL, &dest, &input, EOF, process_bkslash);
 //TODO: error check (encode_string returns 0 on error)?
 	//bb_error_msg("'%s' -> '%s'", str, dest.data);
-	exp_str = expand_string_to_string(dest.data, /*unbackslash:*/ do_unbackslash);
-	//bb_error_msg("'%s' -> '%s'", dest.data, exp_str);
-	o_free_unsafe(&dest);
-	return exp_str;
+	return expand_string_to_scratch(dest.data, /*unbackslash:*/ do_unbackslash);
 }
 
 #if ENABLE_SH_MATH_SUPPORT
@@ -4861,13 +5118,15 @@ static arith_t expand_and_evaluate_arith(const char *arg, const char **errmsg_p)
 	arith_state_t math_state;
 	arith_t res;
 	char *exp_str;
+	struct region_mark mark;
 
 	math_state.lookupvar = get_local_var_value;
 	math_state.setvar = set_local_var_from_halves;
 	//math_state.endofname = endofname;
+	region_get_mark(&G.scratch, &mark);
 	exp_str = encode_then_expand_string(arg, /*process_bkslash:*/ 1, /*unbackslash:*/ 1);
 	res = arith(&math_state, exp_str ? exp_str : arg);
-	free(exp_str);
+	region_release(&G.scratch, &mark);
 	if (errmsg_p)
 		*errmsg_p = math_state.errmsg;
 	if (math_state.errmsg)
@@ -4945,6 +5204,7 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 	char *exp_saveptr; /* points to expansion operator */
 	char *exp_word = exp_word; /* for compiler */
 	char arg0;
+	struct region_mark mark;
 
 	*p = '\0'; /* replace trailing SPECIAL_VAR_SYMBOL */
 	var = arg;
@@ -5037,6 +5297,7 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 				unsigned scan_flags = pick_scan(exp_op, *exp_word);
 				if (exp_op == *exp_word)  /* ## or %% */
 					exp_word++;
+				region_get_mark(&G.scratch, &mark);
 				exp_exp_word = encode_then_expand_string(exp_word, /*process_bkslash:*/ 1, /*unbackslash:*/ 1);
 				if (exp_exp_word)
 					exp_word = exp_exp_word;
@@ -5048,7 +5309,7 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 				loc = scan_and_match(t, exp_word, scan_flags);
 				//bb_error_msg("op:%c str:'%s' pat:'%s' res:'%s'",
 				//		exp_op, t, exp_word, loc);
-				free(exp_exp_word);
+				region_release(&G.scratch, &mark);
 				if (loc) { /* match was found */
 					if (scan_flags & SCAN_MATCH_LEFT_HALF) /* #[#] */
 						val = loc; /* take right part */
@@ -5079,9 +5340,10 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 				 * (note that a*z _pattern_ is never globbed!)
 				 */
 				char *pattern, *repl, *t;
+				region_get_mark(&G.scratch, &mark);
 				pattern = encode_then_expand_string(exp_word, /*process_bkslash:*/ 0, /*unbackslash:*/ 0);
 				if (!pattern)
-					pattern = xstrdup(exp_word);
+					pattern = region_strdup(&G.scratch, exp_word);
 				debug_printf_varexp("pattern:'%s'->'%s'\n", exp_word, pattern);
 				*p++ = SPECIAL_VAR_SYMBOL;
 				exp_word = p;
@@ -5100,8 +5362,7 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 						exp_op);
 				if (to_be_freed) /* at least one replace happened */
 					val = to_be_freed;
-				free(pattern);
-				free(repl);
+				region_release(&G.scratch, &mark);
 			}
 		}
 #endif
@@ -5176,9 +5437,11 @@ static NOINLINE const char *expand_one_var(char **to_be_freed_pp, char *arg, cha
 			debug_printf_expand("expand: op:%c (null:%s) test:%i\n", exp_op,
 					(exp_save == ':') ? "true" : "false", use_word);
 			if (use_word) {
+				region_get_mark(&G.scratch, &mark);
 				to_be_freed = encode_then_expand_string(exp_word, /*process_bkslash:*/ 1, /*unbackslash:*/ 1);
 				if (to_be_freed)
-					exp_word = to_be_freed;
+					exp_word = to_be_freed = xstrdup(to_be_freed);
+				region_release(&G.scratch, &mark);
 				if (exp_op == '?') {
 					/* mimic bash message */
 					die_if_script("%s: %s",
@@ -5414,6 +5677,7 @@ static char **expand_variables(char **argv, unsigned expflags)
 	o_string output = NULL_O_STRING;
 
 	output.o_expflags = expflags;
+	output.o_scratch = 1;
 
 	n = 0;
 	while (*argv) {
@@ -5422,7 +5686,7 @@ static char **expand_variables(char **argv, unsigned expflags)
 	}
 	debug_print_list("expand_variables", &output, n);
 
-	/* output.data (malloced in one block) gets returned in "list" */
+	/* output.data (one block in G.scratch) gets returned in "list" */
 	list = o_finalize_list(&output, n);
 	debug_print_strings("expand_variables[1]", list);
 	return list;
@@ -5445,8 +5709,10 @@ static char **expand_strvec_to_strvec_singleword_noglob(char **argv)
  *
  * NB: should NOT do globbing!
  * "export v=/bin/c*; env | grep ^v=" outputs "v=/bin/c*"
+ *
+ * Result is in G.scratch.
  */
-static char *expand_string_to_string(const char *str, int do_unbackslash)
+static char *expand_string_to_scratch(const char *str, int do_unbackslash)
 {
 #if !ENABLE_HUSH_BASH_COMPAT
 	const int do_unbackslash = 1;
@@ -5461,7 +5727,7 @@ static char *expand_string_to_string(const char *str, int do_unbackslash)
 	if (!strchr(str, SPECIAL_VAR_SYMBOL) && !strchr(str, '\\')) {
 		//TODO: Can use on strings with \ too, just unbackslash() them?
 		debug_printf_expand("string_to_string(fast)=>'%s'\n", str);
-		return xstrdup(str);
+		return region_strdup(&G.scratch, str);
 	}
 
 	argv[0] = (char*)str;
@@ -5473,19 +5739,31 @@ static char *expand_string_to_string(const char *str, int do_unbackslash)
 	if (HUSH_DEBUG)
 		if (!list[0] || list[1])
 			bb_error_msg_and_die("BUG in varexp2");
-	/* actually, just move string 2*sizeof(char*) bytes back */
-	overlapping_strcpy((char*)list, list[0]);
 	if (do_unbackslash)
-		unbackslash((char*)list);
-	debug_printf_expand("string_to_string=>'%s'\n", (char*)list);
-	return (char*)list;
+		unbackslash(list[0]);
+	debug_printf_expand("string_to_string=>'%s'\n", list[0]);
+	return list[0];
+}
+
+/* Same, but returns malloced string */
+static char *expand_string_to_string(const char *str, int do_unbackslash)
+{
+	struct region_mark mark;
+
+	region_get_mark(&G.scratch, &mark);
+	str = xstrdup(expand_string_to_scratch(str, do_unbackslash));
+	region_release(&G.scratch, &mark);
+	return (char*)str;
 }
 
 /* Used for "eval" builtin */
 static char* expand_strvec_to_string(char **argv)
 {
 	char **list;
+	char *str;
+	struct region_mark mark;
 
+	region_get_mark(&G.scratch, &mark);
 	list = expand_variables(argv, EXP_FLAG_SINGLEWORD);
 	/* Convert all NULs to spaces */
 	if (list[0]) {
@@ -5499,9 +5777,10 @@ static char* expand_strvec_to_string(char **argv)
 			n++;
 		}
 	}
-	overlapping_strcpy((char*)list, list[0]);
-	debug_printf_expand("strvec_to_string='%s'\n", (char*)list);
-	return (char*)list;
+	str = xstrdup(list[0] ? list[0] : "");
+	region_release(&G.scratch, &mark);
+	debug_printf_expand("strvec_to_string='%s'\n", str);
+	return str;
 }
 
 static char **expand_assignments(char **argv, int count)
@@ -5745,13 +6024,19 @@ static void parse_and_run_stream(struct in_str *inp, int end_trigger)
 	bool empty = 1;
 	while (1) {
 		struct pipe *pipe_list;
+		struct region *region, *saved_region;
 
 #if ENABLE_HUSH_INTERACTIVE
 		if (end_trigger == ';')
 			inp->promptmode = 0; /* PS1 */
 #endif
+		/* Parse tree of this list goes into its own region */
+		saved_region = G.parse_region;
+		G.parse_region = region = region_new();
 		pipe_list = parse_stream(NULL, inp, end_trigger);
+		G.parse_region = saved_region;
 		if (!pipe_list || pipe_list == ERR_PTR) { /* EOF/error */
+			region_unref(region);
 			/* If we are in "big" script
 			 * (not in `cmd` or something similar)...
 			 */
@@ -5775,6 +6060,7 @@ static void parse_and_run_stream(struct in_str *inp, int end_trigger)
 		debug_print_tree(pipe_list, 0);
 		debug_printf_exec("parse_and_run_stream: run_and_free_list\n");
 		run_and_free_list(pipe_list);
+		region_unref(region);
 		empty = 0;
 #if ENABLE_HUSH_FUNCTIONS
 		if (G.flag_return_in_progress == 1)
@@ -5946,11 +6232,12 @@ static void setup_heredoc(struct redir_struct *redir)
 	/* the _body_ of heredoc (misleading field name) */
 	const char *heredoc = redir->rd_filename;
 	char *expanded;
+	struct region_mark mark;
 #if !BB_MMU
 	char **to_free;
 #endif
 
-	expanded = NULL;
+	region_get_mark(&G.scratch, &mark);
 	if (!(redir->rd_dup & HEREDOC_QUOTED)) {
 		expanded = encode_then_expand_string(heredoc, /*process_bkslash:*/ 1, /*unbackslash:*/ 1);
 		if (expanded)
@@ -5972,7 +6259,7 @@ static void setup_heredoc(struct redir_struct *redir)
 		len -= written;
 		if (len == 0) {
 			close(pair.wr);
-			free(expanded);
+			region_release(&G.scratch, &mark);
 			return;
 		}
 		heredoc += written;
@@ -6015,7 +6302,7 @@ static void setup_heredoc(struct redir_struct *redir)
 	free(to_free);
 #endif
 	close(pair.wr);
-	free(expanded);
+	region_release(&G.scratch, &mark);
 	wait(NULL); /* wait till child has died */
 }
 
@@ -6044,7 +6331,7 @@ static int setup_redirects(struct command *prog, int squirrel[])
 
 		if (redir->rd_dup == REDIRFD_TO_FILE) {
 			/* rd_fd<*>file case (<*> is <,>,>>,<>) */
-			char *p;
+			struct region_mark mark;
 			if (redir->rd_filename == NULL) {
 				/* Something went wrong in the parse.
 				 * Pretend it didn't happen */
@@ -6052,9 +6339,9 @@ static int setup_redirects(struct command *prog, int squirrel[])
 				continue;
 			}
 			mode = redir_table[redir->rd_type].mode;
-			p = expand_string_to_string(redir->rd_filename, /*unbackslash:*/ 1);
-			openfd = open_or_warn(p, mode);
-			free(p);
+			region_get_mark(&G.scratch, &mark);
+			openfd = open_or_warn(expand_string_to_scratch(redir->rd_filename, /*unbackslash:*/ 1), mode);
+			region_release(&G.scratch, &mark);
 			if (openfd < 0) {
 			/* this could get lost if stderr has been redirected, but
 			 * bash and ash both lose it as well (though zsh doesn't!) */
@@ -6177,7 +6464,8 @@ static const struct function *find_function(const char *name)
 	return funcp;
 }
 
-/* Note: takes ownership on name ptr */
+/* Note: name ptr must live as long as function does
+ * (caller sets ->region which holds it) */
 static struct function *new_function(char *name)
 {
 	struct function **funcpp = find_function_slot(name);
@@ -6188,7 +6476,6 @@ static struct function *new_function(char *name)
 		debug_printf_exec("func %p parent_cmd %p\n", funcp, cmd);
 		if (!cmd) {
 			debug_printf_exec("freeing & replacing function '%s'\n", funcp->name);
-			free(funcp->name);
 			/* Note: if !funcp->body, do not free body_as_string!
 			 * This is a special case of "-F name body" function:
 			 * body_as_string was not malloced! */
@@ -6206,6 +6493,10 @@ static struct function *new_function(char *name)
 			cmd->group_as_string = funcp->body_as_string;
 # endif
 		}
+		/* Name and body are in this region. If parent_cmd is alive,
+		 * whoever runs its tree holds a ref too */
+		region_unref(funcp->region);
+		funcp->region = NULL;
 	} else {
 		debug_printf_exec("remembering new function '%s'\n", name);
 		funcp = *funcpp = xzalloc(sizeof(*funcp));
@@ -6227,14 +6518,14 @@ static void unset_func(const char *name)
 		/* funcp is unlinked now, deleting it.
 		 * Note: if !funcp->body, the function was created by
 		 * "-F name body", do not free ->body_as_string
-		 * and ->name as they were not malloced. */
+		 * as it was not malloced. */
 		if (funcp->body) {
 			free_pipe_list(funcp->body);
-			free(funcp->name);
 # if !BB_MMU
 			free(funcp->body_as_string);
 # endif
 		}
+		region_unref(funcp->region);
 		free(funcp);
 	}
 }
@@ -6295,7 +6586,12 @@ static int run_function(const struct function *funcp, char **argv)
 	} else
 # endif
 	{
+		/* Keep body alive even if function is redefined
+		 * or unset while it runs */
+		struct region *region = funcp->region;
+		region_ref(region);
 		rc = run_list(funcp->body);
+		region_unref(region);
 	}
 
 # if ENABLE_HUSH_LOCAL
@@ -6453,9 +6749,6 @@ static NOINLINE void pseudo_exec_argv(nommu_save_t *nommu_save,
 		argv = argv_expanded;
 	} else {
 		argv = expand_strvec_to_strvec(argv + assignment_cnt);
-#if !BB_MMU
-		nommu_save->argv = argv;
-#endif
 	}
 	dump_cmd_in_x_mode(argv);
 
@@ -6651,7 +6944,10 @@ static void remove_bg_job(struct pipe *pi)
 static void delete_finished_bg_job(struct pipe *pi)
 {
 	remove_bg_job(pi);
-	free_pipe(pi);
+	/* Jobs are malloced copies, not in a parse tree region */
+	free(pi->cmds);
+	free(pi->cmdtext);
+	free(pi);
 }
 #endif /* JOB */
 
@@ -6948,6 +7244,8 @@ static NOINLINE int run_pipe(struct pipe *pi)
 			funcp = new_function(command->argv[0]);
 			/* funcp->name is already set to argv[0] */
 			funcp->body = command->group;
+			funcp->region = command->func_region;
+			region_ref(funcp->region);
 # if !BB_MMU
 			funcp->body_as_string = command->group_as_string;
 			command->group_as_string = NULL;
@@ -7058,7 +7356,6 @@ static NOINLINE int run_pipe(struct pipe *pi)
 
 		/* if someone gives us an empty string: `cmd with empty output` */
 		if (!argv_expanded[0]) {
-			free(argv_expanded);
 			debug_leave();
 			return G.last_exitcode;
 		}
@@ -7108,14 +7405,14 @@ static NOINLINE int run_pipe(struct pipe *pi)
 /* clean_up_and_ret0: */
 			restore_redirects(squirrel);
  clean_up_and_ret1:
-			free(argv_expanded);
 			IF_HAS_KEYWORDS(if (pi->pi_inverted) rcode = !rcode;)
 			debug_leave();
 			debug_printf_exec("run_pipe return %d\n", rcode);
 			return rcode;
 		}
 
-		if (ENABLE_FEATURE_SH_NOFORK) {
+		/* This runs applets by name, not by $PATH */
+		if (ENABLE_FEATURE_SH_NOFORK && ENABLE_FEATURE_PREFER_APPLETS) {
 			int n = find_applet_by_name(argv_expanded[0]);
 			if (n >= 0 && APPLET_IS_NOFORK(n)) {
 				rcode = redirect_and_varexp_helper(&new_env, &old_vars, command, squirrel, argv_expanded);
@@ -7146,7 +7443,6 @@ static NOINLINE int run_pipe(struct pipe *pi)
 		volatile nommu_save_t nommu_save;
 		nommu_save.new_env = NULL;
 		nommu_save.old_vars = NULL;
-		nommu_save.argv = NULL;
 		nommu_save.argv_from_re_execing = NULL;
 #endif
 		command = &pi->cmds[cmd_no];
@@ -7219,12 +7515,10 @@ static NOINLINE int run_pipe(struct pipe *pi)
 		enable_restore_tty_pgrp_on_exit();
 #if !BB_MMU
 		/* Clean up after vforked child */
-		free(nommu_save.argv);
 		free(nommu_save.argv_from_re_execing);
 		unset_vars(nommu_save.new_env);
 		add_vars(nommu_save.old_vars);
 #endif
-		free(argv_expanded);
 		argv_expanded = NULL;
 		if (command->pid < 0) { /* [v]fork failed */
 			/* Clearly indicate, was it fork or vfork */
@@ -7267,7 +7561,6 @@ static int run_list(struct pipe *pi)
 #if ENABLE_HUSH_LOOPS
 	struct pipe *loop_top = NULL;
 	char **for_lcur = NULL;
-	char **for_list = NULL;
 #endif
 	smallint last_followup;
 	smalluint rcode;
@@ -7401,14 +7694,12 @@ static int run_list(struct pipe *pi)
 				} /* else: "for var; do..." -> assume "$@" list */
 				/* create list of variable values */
 				debug_print_strings("for_list made from", vals);
-				for_list = expand_strvec_to_strvec(vals);
-				for_lcur = for_list;
-				debug_print_strings("for_list", for_list);
+				/* In G.scratch, below marks of loop body commands */
+				for_lcur = expand_strvec_to_strvec(vals);
+				debug_print_strings("for_list", for_lcur);
 			}
 			if (!*for_lcur) {
 				/* "for" loop is over, clean up */
-				free(for_list);
-				for_list = NULL;
 				for_lcur = NULL;
 				break;
 			}
@@ -7437,10 +7728,14 @@ static int run_list(struct pipe *pi)
 			/* all prev words didn't match, does this one match? */
 			argv = pi->cmds->argv;
 			while (*argv) {
-				char *pattern = expand_string_to_string(*argv, /*unbackslash:*/ 1);
+				struct region_mark mark;
+				char *pattern;
+
+				region_get_mark(&G.scratch, &mark);
+				pattern = expand_string_to_scratch(*argv, /*unbackslash:*/ 1);
 				/* TODO: which FNM_xxx flags to use? */
 				cond_code = (fnmatch(pattern, case_word, /*flags:*/ 0) != 0);
-				free(pattern);
+				region_release(&G.scratch, &mark);
 				if (cond_code == 0) { /* match! we will execute this branch */
 					free(case_word); /* make future "word)" stop */
 					case_word = NULL;
@@ -7471,10 +7766,15 @@ static int run_list(struct pipe *pi)
 		debug_printf_exec(": run_pipe with %d members\n", pi->num_cmds);
 		{
 			int r;
+			struct region_mark mark;
 #if ENABLE_HUSH_LOOPS
 			G.flag_break_continue = 0;
 #endif
+			/* Expansions done by run_pipe are not needed after it,
+			 * next command (or loop iteration) reuses the memory */
+			region_get_mark(&G.scratch, &mark);
 			rcode = r = run_pipe(pi); /* NB: rcode is a smallint */
+			region_release(&G.scratch, &mark);
 			if (r != -1) {
 				/* We ran a builtin, function, or group.
 				 * rcode is already known
@@ -7580,7 +7880,6 @@ static int run_list(struct pipe *pi)
 #if ENABLE_HUSH_LOOPS
 	if (loop_top)
 		G.depth_of_loop--;
-	free(for_list);
 #endif
 #if ENABLE_HUSH_CASE
 	free(case_word);
@@ -8681,6 +8980,40 @@ static int FAST_FUNC builtin_memleak(char **argv UNUSED_PARAM)
 }
 #endif
 
+#if ENABLE_HUSH_MEMSTAT
+/* memstat [-r]: show (and reset) allocation counters.
+ * Run it before and after a loop to see how many heap allocations
+ * one iteration costs.
+ */
+static int FAST_FUNC builtin_memstat(char **argv)
+{
+	static const char names[] ALIGN1 =
+		"malloc\0" "realloc\0" "free\0"
+		"region_alloc\0" "region_resize\0"
+		"chunk_malloc\0" "chunk_bytes\0";
+	unsigned long *cnt = &G.memstat.mallocs;
+	const char *name = names;
+
+	while (*name) {
+		printf("%-14s%lu\n", name, *cnt++);
+		name += strlen(name) + 1;
+	}
+	if (argv[1]) {
+		unsigned long bytes;
+
+		if (strcmp(argv[1], "-r") != 0) {
+			bb_error_msg("%s: invalid option '%s'", argv[0], argv[1]);
+			return EXIT_FAILURE;
+		}
+		/* chunk_bytes is not a counter, it is memory in use */
+		bytes = G.memstat.chunk_bytes;
+		memset(&G.memstat, 0, sizeof(G.memstat));
+		G.memstat.chunk_bytes = bytes;
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
 static int FAST_FUNC builtin_pwd(char **argv UNUSED_PARAM)
 {
 	puts(get_cwd(0));
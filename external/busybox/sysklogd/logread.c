@@ -10,14 +10,14 @@
  */
 
 //usage:#define logread_trivial_usage
-//usage:       "[-f]"
+//usage:       "[-f] [-c FILE]"
 //usage:#define logread_full_usage "\n\n"
 //usage:       "Show messages in syslogd's circular buffer\n"
 //usage:     "\n	-f	Output data as log grows"
+//usage:     "\n	-c FILE	Start after the position saved in FILE, save new one there"
 
 #include "libbb.h"
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
 
 #define DEBUG 0
@@ -25,45 +25,45 @@
 /* our shared key (syslogd.c and logread.c must be in sync) */
 enum { KEY_ID = 0x414e4547 }; /* "GENA" */
 
+/* See syslogd.c for the description */
 struct shbuf_ds {
-	int32_t size;           // size of data - 1
-	int32_t tail;           // end of message list
-	char data[1];           // messages
+	uint32_t magic;
+	uint32_t size;          /* of data[], power of 2 */
+	volatile uint32_t claim;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	char data[1];
 };
-
-static const struct sembuf init_sem[3] = {
-	{0, -1, IPC_NOWAIT | SEM_UNDO},
-	{1, 0}, {0, +1, SEM_UNDO}
+struct shrec {
+	uint32_t pos;           /* where this message starts */
+	uint32_t seq;           /* number of this message */
+	uint32_t len;           /* of text with NUL, or SHREC_PAD */
+};
+enum {
+	SHBUF_MAGIC = 0x52474f4c, /* "LOGR" */
+	SHREC_PAD = 0xffffffff,
 };
+#define smp_mb() __sync_synchronize()
 
 struct globals {
-	struct sembuf SMrup[1]; // {0, -1, IPC_NOWAIT | SEM_UNDO},
-	struct sembuf SMrdn[2]; // {1, 0}, {0, +1, SEM_UNDO}
 	struct shbuf_ds *shbuf;
+	const char *cursor_file;
+	uint32_t cur;           /* position of next message to show */
+	uint32_t seq;           /* its number, if have_seq */
+	smallint have_seq;
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
-#define SMrup (G.SMrup)
-#define SMrdn (G.SMrdn)
 #define shbuf (G.shbuf)
-#define INIT_G() do { \
-	memcpy(SMrup, init_sem, sizeof(init_sem)); \
-} while (0)
-
-static void error_exit(const char *str) NORETURN;
-static void error_exit(const char *str)
-{
-	//release all acquired resources
-	shmdt(shbuf);
-	bb_perror_msg_and_die(str);
-}
 
-/*
- * sem_up - up()'s a semaphore.
- */
-static void sem_up(int semid)
+static void save_cursor(void)
 {
-	if (semop(semid, SMrup, 1) == -1)
-		error_exit("semop[SMrup]");
+	if (G.cursor_file && G.have_seq) {
+		FILE *fp = fopen_for_write(G.cursor_file);
+		if (fp) {
+			fprintf(fp, "%u %u\n", (unsigned)G.cur, (unsigned)G.seq);
+			fclose(fp);
+		}
+	}
 }
 
 static void interrupted(int sig UNUSED_PARAM)
@@ -73,15 +73,59 @@ static void interrupted(int sig UNUSED_PARAM)
 	exit(EXIT_SUCCESS);
 }
 
+/*
+ * Copy message at G.cur into TEXT (size/4 bytes), advance G.cur.
+ * Returns 1 if TEXT has a message, 0 if not (skipped padding),
+ * -1 if syslogd overwrote it: G.cur is moved to the oldest message.
+ */
+static int read_msg(char *text)
+{
+	uint32_t size = shbuf->size;
+	uint32_t off = G.cur % size;
+	uint32_t room = size - off;
+	struct shrec rec;
+	bool fits;
+
+	if (room < sizeof(rec)) {
+		G.cur += room;
+		return 0;
+	}
+	memcpy(&rec, shbuf->data + off, sizeof(rec));
+	/* A torn record can claim any length: don't copy past data[] */
+	fits = (rec.len - 1 < size / 4 && rec.len <= room - sizeof(rec));
+	if (rec.len != SHREC_PAD && fits)
+		memcpy(text, shbuf->data + off + sizeof(rec), rec.len);
+	smp_mb();
+	/* Was syslogd writing over it while we were copying? */
+	if (shbuf->claim - G.cur > size || rec.pos != G.cur
+	 || (rec.len != SHREC_PAD && !fits)
+	) {
+		G.cur = shbuf->tail;
+		return -1;
+	}
+	if (rec.len == SHREC_PAD) {
+		G.cur += room;
+		return 0;
+	}
+	G.cur += (sizeof(rec) + rec.len + 3) & ~3;
+	/* (seq goes back if syslogd was restarted) */
+	if (G.have_seq && (int32_t)(rec.seq - G.seq) > 0)
+		bb_error_msg("%u messages lost", (unsigned)(rec.seq - G.seq));
+	G.seq = rec.seq + 1;
+	G.have_seq = 1;
+	text[rec.len - 1] = '\0';
+	return 1;
+}
+
 int logread_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int logread_main(int argc UNUSED_PARAM, char **argv)
 {
-	unsigned cur;
-	int log_semid; /* ipc semaphore id */
 	int log_shmid; /* ipc shared memory id */
-	smallint follow = getopt32(argv, "f");
+	uint32_t stop;
+	char *text;
+	smallint follow;
 
-	INIT_G();
+	follow = getopt32(argv, "fc:", &G.cursor_file) & 1;
 
 	log_shmid = shmget(KEY_ID, 0, 0);
 	if (log_shmid == -1)
@@ -89,101 +133,61 @@ int logread_main(int argc UNUSED_PARAM, char **argv)
 
 	/* Attach shared memory to our char* */
 	shbuf = shmat(log_shmid, NULL, SHM_RDONLY);
-	if (shbuf == NULL)
+	if (shbuf == (void*) -1L)
 		bb_perror_msg_and_die("can't access syslogd buffer");
-
-	log_semid = semget(KEY_ID, 0, 0);
-	if (log_semid == -1)
-		error_exit("can't get access to semaphores for syslogd buffer");
+	if (shbuf->magic != SHBUF_MAGIC)
+		bb_error_msg_and_die("syslogd buffer has unknown format");
+	smp_mb();
 
 	signal(SIGINT, interrupted);
 
-	/* Suppose atomic memory read */
-	/* Max possible value for tail is shbuf->size - 1 */
-	cur = shbuf->tail;
+	/* -f shows only new messages, unless told where to start */
+	G.cur = follow ? shbuf->head : shbuf->tail;
+	if (G.cursor_file) {
+		FILE *fp = fopen_for_read(G.cursor_file);
+		if (fp) {
+			unsigned pos, seq;
+			if (fscanf(fp, "%u %u", &pos, &seq) == 2) {
+				G.cur = pos;
+				G.seq = seq;
+				G.have_seq = 1;
+			}
+			fclose(fp);
+		}
+		/* Overwritten, or from another syslogd run? */
+		if (shbuf->head - G.cur > shbuf->size)
+			G.cur = shbuf->tail;
+	}
+	text = xmalloc(shbuf->size / 4);
+	/* Without -f, don't chase messages which arrive while we print */
+	stop = shbuf->head;
 
 	/* Loop for logread -f, one pass if there was no -f */
-	do {
-		unsigned shbuf_size;
-		unsigned shbuf_tail;
-		const char *shbuf_data;
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		int i;
-		int len_first_part;
-		int len_total = len_total; /* for gcc */
-		char *copy = copy; /* for gcc */
-#endif
-		if (semop(log_semid, SMrdn, 2) == -1)
-			error_exit("semop[SMrdn]");
-
-		/* Copy the info, helps gcc to realize that it doesn't change */
-		shbuf_size = shbuf->size;
-		shbuf_tail = shbuf->tail;
-		shbuf_data = shbuf->data; /* pointer! */
+	while (1) {
+		uint32_t head = shbuf->head;
 
+		smp_mb();
 		if (DEBUG)
-			printf("cur:%d tail:%i size:%i\n",
-					cur, shbuf_tail, shbuf_size);
-
-		if (!follow) {
-			/* advance to oldest complete message */
-			/* find NUL */
-			cur += strlen(shbuf_data + cur);
-			if (cur >= shbuf_size) { /* last byte in buffer? */
-				cur = strnlen(shbuf_data, shbuf_tail);
-				if (cur == shbuf_tail)
-					goto unlock; /* no complete messages */
-			}
-			/* advance to first byte of the message */
-			cur++;
-			if (cur >= shbuf_size) /* last byte in buffer? */
-				cur = 0;
-		} else { /* logread -f */
-			if (cur == shbuf_tail) {
-				sem_up(log_semid);
-				fflush_all();
-				sleep(1); /* TODO: replace me with a sleep_on */
-				continue;
-			}
-		}
-
-		/* Read from cur to tail */
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		len_first_part = len_total = shbuf_tail - cur;
-		if (len_total < 0) {
-			/* message wraps: */
-			/* [SECOND PART.........FIRST PART] */
-			/*  ^data      ^tail    ^cur      ^size */
-			len_total += shbuf_size;
-		}
-		copy = xmalloc(len_total + 1);
-		if (len_first_part < 0) {
-			/* message wraps (see above) */
-			len_first_part = shbuf_size - cur;
-			memcpy(copy + len_first_part, shbuf_data, shbuf_tail);
-		}
-		memcpy(copy, shbuf_data + cur, len_first_part);
-		copy[len_total] = '\0';
-		cur = shbuf_tail;
-#else
-		while (cur != shbuf_tail) {
-			fputs(shbuf_data + cur, stdout);
-			cur += strlen(shbuf_data + cur) + 1;
-			if (cur >= shbuf_size)
-				cur = 0;
+			printf("cur:%u head:%u tail:%u\n",
+					(unsigned)G.cur, (unsigned)head, (unsigned)shbuf->tail);
+		if (!follow && (int32_t)(G.cur - stop) >= 0)
+			head = G.cur;
+		if (G.cur == head) {
+			save_cursor();
+			if (!follow)
+				break;
+			fflush_all();
+			sleep(1); /* TODO: replace me with a sleep_on */
+			continue;
 		}
-#endif
- unlock:
-		/* release the lock on the log chain */
-		sem_up(log_semid);
-
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		for (i = 0; i < len_total; i += strlen(copy + i) + 1) {
-			fputs(copy + i, stdout);
+		if (head - G.cur > shbuf->size) {
+			/* Overrun (or bogus cursor) */
+			G.cur = shbuf->tail;
+			continue;
 		}
-		free(copy);
-#endif
-	} while (follow);
+		if (read_msg(text) > 0)
+			fputs(text, stdout);
+	}
 
 	shmdt(shbuf);
 
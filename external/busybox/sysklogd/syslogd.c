@@ -63,9 +63,18 @@
 #include <netinet/in.h>
 #endif
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+#include <sys/inotify.h>
+/* recvmmsg() needs _GNU_SOURCE, and bionic does not have it */
+# if defined(_GNU_SOURCE) && defined(MSG_WAITFORONE) && !defined(__BIONIC__)
+#  define HAVE_RECVMMSG 1
+# else
+#  define HAVE_RECVMMSG 0
+# endif
+#endif
+
 #if ENABLE_FEATURE_IPC_SYSLOG
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
 #endif
 
@@ -73,8 +82,8 @@
 #define DEBUG 0
 
 /* MARK code is not very useful, is bloat, and broken:
- * can deadlock if alarmed to make MARK while writing to IPC buffer
- * (semaphores are down but do_mark routine tries to down them again) */
+ * can corrupt IPC buffer if alarmed to make MARK while writing to it
+ * (there is only one writer, and it's not reentrant) */
 #undef SYSLOGD_MARK
 
 /* Write locking does not seem to be useful either */
@@ -83,14 +92,48 @@
 enum {
 	MAX_READ = CONFIG_FEATURE_SYSLOGD_READ_BUFFER_SIZE,
 	DNS_WAIT_SEC = 2 * 60,
+	/* messages per recv_batch() */
+	RECV_BATCH = ENABLE_FEATURE_SYSLOGD_BATCH ? 16 : 1,
+	/* size of per-file output buffer */
+	LOG_BUF_SIZE = 16 * 1024,
+	/* max time a line can wait in it */
+	LOG_FLUSH_MS = 100,
 };
 
-/* Semaphore operation structures */
+/* Shared mem ring buffer (syslogd.c and logread.c must be in sync).
+ * One writer (us), any number of readers, no locks.
+ * Positions count bytes written since start, pos % size is offset
+ * in data[]. A message is a struct shrec followed by NUL terminated
+ * text, padded to 4 bytes. It never wraps around the end of data[]:
+ * if it does not fit, the rest of data[] is skipped (and marked
+ * with a SHREC_PAD record if there is room for one).
+ * Before writing a message, writer moves tail (first intact message)
+ * past what it is going to overwrite and sets claim to the end
+ * of the new message. After, it sets head to the same value.
+ * Reader copies a message at pos < head, then checks that
+ * claim - pos <= size, i.e. it was not being overwritten
+ * meanwhile. Otherwise, it lost messages and restarts from tail.
+ */
 struct shbuf_ds {
-	int32_t size;   /* size of data - 1 */
-	int32_t tail;   /* end of message list */
-	char data[1];   /* data/messages */
+	uint32_t magic;
+	uint32_t size;          /* of data[], power of 2 */
+	volatile uint32_t claim;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	char data[1];
+};
+struct shrec {
+	uint32_t pos;           /* where this message starts */
+	uint32_t seq;           /* number of this message */
+	uint32_t len;           /* of text with NUL, or SHREC_PAD */
+};
+enum {
+	SHBUF_MAGIC = 0x52474f4c, /* "LOGR" */
+	SHREC_PAD = 0xffffffff,
 };
+/* Full memory barrier: orders stores to claim/data/head
+ * against loads of data/claim in readers on other CPUs */
+#define smp_mb() __sync_synchronize()
 
 #if ENABLE_FEATURE_REMOTE_LOG
 typedef struct {
@@ -108,6 +151,12 @@ typedef struct logFile_t {
 	unsigned size;
 	uint8_t isRegular;
 #endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	int wd;                 /* inotify watch of its dir, 0 if none */
+	unsigned buf_len;
+	unsigned buf_lines;
+	char *buf;              /* lines not written yet */
+#endif
 } logFile_t;
 
 #if ENABLE_FEATURE_SYSLOGD_CFG
@@ -133,10 +182,7 @@ IF_FEATURE_ROTATE_LOGFILE( \
 ) \
 IF_FEATURE_IPC_SYSLOG( \
 	int shmid; /* ipc shared memory id */   \
-	int s_semid; /* ipc semaphore id */     \
 	int shm_size;                           \
-	struct sembuf SMwup[1];                 \
-	struct sembuf SMwdn[3];                 \
 ) \
 IF_FEATURE_SYSLOGD_CFG( \
 	logRule_t *log_rules; \
@@ -154,13 +200,32 @@ struct globals {
 #endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	struct shbuf_ds *shbuf;
+	uint32_t shm_seq;
+#endif
+#if ENABLE_FEATURE_SYSLOGD_DUP
+	int last_sz;
+	char *last_buf;
+#endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	int inotify_fd;
+	smallint log_pending;   /* some buf_len != 0 */
+	smallint want_stats;    /* got SIGUSR1 */
+	unsigned pending_since; /* monotonic_ms() */
+	unsigned stat_received;
+	unsigned stat_written;
+	unsigned stat_dropped;
+	unsigned recv_len[RECV_BATCH];
+# if HAVE_RECVMMSG
+	struct mmsghdr mmsg[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+# endif
 #endif
 	time_t last_log_time;
 	/* localhost's name. We print only first 64 chars */
 	char *hostname;
 
-	/* We recv into recvbuf... */
-	char recvbuf[MAX_READ * (1 + ENABLE_FEATURE_SYSLOGD_DUP)];
+	/* We recv into recvbuf (for -D, last message is kept after the batch)... */
+	char recvbuf[MAX_READ * (RECV_BATCH + ENABLE_FEATURE_SYSLOGD_DUP)];
 	/* ...then copy to parsebuf, escaping control chars */
 	/* (can grow x2 max) */
 	char parsebuf[MAX_READ*2];
@@ -185,10 +250,7 @@ static const struct init_globals init_data = {
 #endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	.shmid = -1,
-	.s_semid = -1,
 	.shm_size = ((CONFIG_FEATURE_IPC_SYSLOG_BUFFER_SIZE)*1024), /* default shm size */
-	.SMwup = { {1, -1, IPC_NOWAIT} },
-	.SMwdn = { {0, 0}, {1, 0}, {1, +1} },
 #endif
 };
 
@@ -441,17 +503,27 @@ static void ipcsyslog_cleanup(void)
 	if (G.shmid != -1) {
 		shmctl(G.shmid, IPC_RMID, NULL);
 	}
-	if (G.s_semid != -1) {
-		semctl(G.s_semid, 0, IPC_RMID, 0);
-	}
 }
 
 static void ipcsyslog_init(void)
 {
+	unsigned size;
+
+	/* Positions wrap at 2^32, data size must divide it */
+	size = 4096;
+	while (size * 2 <= (unsigned)G.shm_size && size * 2 != 0)
+		size *= 2;
+	G.shm_size = offsetof(struct shbuf_ds, data) + size;
+
 	if (DEBUG)
 		printf("shmget(%x, %d,...)\n", (int)KEY_ID, G.shm_size);
 
 	G.shmid = shmget(KEY_ID, G.shm_size, IPC_CREAT | 0644);
+	if (G.shmid == -1 && errno == EINVAL) {
+		/* Left by a syslogd with smaller buffer, replace it */
+		shmctl(shmget(KEY_ID, 0, 0), IPC_RMID, NULL);
+		G.shmid = shmget(KEY_ID, G.shm_size, IPC_CREAT | 0644);
+	}
 	if (G.shmid == -1) {
 		bb_perror_msg_and_die("shmget");
 	}
@@ -462,60 +534,60 @@ static void ipcsyslog_init(void)
 	}
 
 	memset(G.shbuf, 0, G.shm_size);
-	G.shbuf->size = G.shm_size - offsetof(struct shbuf_ds, data) - 1;
-	/*G.shbuf->tail = 0;*/
-
-	/* we'll trust the OS to set initial semval to 0 (let's hope) */
-	G.s_semid = semget(KEY_ID, 2, IPC_CREAT | IPC_EXCL | 1023);
-	if (G.s_semid == -1) {
-		if (errno == EEXIST) {
-			G.s_semid = semget(KEY_ID, 2, 0);
-			if (G.s_semid != -1)
-				return;
-		}
-		bb_perror_msg_and_die("semget");
-	}
+	G.shbuf->size = size;
+	smp_mb();
+	G.shbuf->magic = SHBUF_MAGIC;
+}
+
+/* Position of the message after the one at POS */
+static uint32_t shbuf_next(uint32_t pos)
+{
+	uint32_t room = G.shbuf->size - pos % G.shbuf->size;
+	struct shrec *rec = (void *)(G.shbuf->data + pos % G.shbuf->size);
+
+	if (room < sizeof(*rec) || rec->len == SHREC_PAD)
+		return pos + room;
+	return pos + ((sizeof(*rec) + rec->len + 3) & ~3);
 }
 
 /* Write message to shared mem buffer */
 static void log_to_shmem(const char *msg)
 {
-	int old_tail, new_tail;
-	int len;
-
-	if (semop(G.s_semid, G.SMwdn, 3) == -1) {
-		bb_perror_msg_and_die("SMwdn");
-	}
+	struct shbuf_ds *sb = G.shbuf;
+	struct shrec *rec;
+	uint32_t pos, end, room, len;
 
-	/* Circular Buffer Algorithm:
-	 * --------------------------
-	 * tail == position where to store next syslog message.
-	 * tail's max value is (shbuf->size - 1)
-	 * Last byte of buffer is never used and remains NUL.
-	 */
 	len = strlen(msg) + 1; /* length with NUL included */
- again:
-	old_tail = G.shbuf->tail;
-	new_tail = old_tail + len;
-	if (new_tail < G.shbuf->size) {
-		/* store message, set new tail */
-		memcpy(G.shbuf->data + old_tail, msg, len);
-		G.shbuf->tail = new_tail;
-	} else {
-		/* k == available buffer space ahead of old tail */
-		int k = G.shbuf->size - old_tail;
-		/* copy what fits to the end of buffer, and repeat */
-		memcpy(G.shbuf->data + old_tail, msg, k);
-		msg += k;
-		len -= k;
-		G.shbuf->tail = 0;
-		goto again;
-	}
-	if (semop(G.s_semid, G.SMwup, 1) == -1) {
-		bb_perror_msg_and_die("SMwup");
+	/* Even a huge one must leave room for a few others */
+	if (len > sb->size / 4)
+		len = sb->size / 4;
+	pos = sb->head;
+	room = sb->size - pos % sb->size;
+	if (room < sizeof(*rec) + len)
+		pos += room; /* does not fit, start at data[0] */
+	end = pos + ((sizeof(*rec) + len + 3) & ~3);
+
+	while (end - sb->tail > sb->size)
+		sb->tail = shbuf_next(sb->tail);
+	sb->claim = end;
+	smp_mb();
+
+	if (pos != sb->head && room >= sizeof(*rec)) {
+		rec = (void *)(sb->data + sb->head % sb->size);
+		rec->pos = sb->head;
+		rec->len = SHREC_PAD;
 	}
+	rec = (void *)(sb->data + pos % sb->size);
+	rec->pos = pos;
+	rec->seq = G.shm_seq++;
+	rec->len = len;
+	memcpy(rec + 1, msg, len - 1);
+	((char *)(rec + 1))[len - 1] = '\0';
+
+	smp_mb();
+	sb->head = end;
 	if (DEBUG)
-		printf("tail:%d\n", G.shbuf->tail);
+		printf("head:%u tail:%u\n", sb->head, sb->tail);
 }
 #else
 void ipcsyslog_cleanup(void);
@@ -523,26 +595,51 @@ void ipcsyslog_init(void);
 void log_to_shmem(const char *msg);
 #endif /* FEATURE_IPC_SYSLOG */
 
-/* Print a message to the log file. */
-static void log_locally(time_t now, char *msg, logFile_t *log_file)
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+# define log_file_watched(f) ((f)->wd)
+/* Watch the dir of a log file, to see it renamed or deleted */
+static int watch_log_dir(const char *path)
+{
+	char *dir = xstrdup(path);
+	char *slash = strrchr(dir, '/');
+	int wd;
+
+	if (slash)
+		*(slash == dir ? slash + 1 : slash) = '\0';
+	wd = inotify_add_watch(G.inotify_fd, slash ? dir : ".",
+			IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+			| IN_DELETE_SELF | IN_MOVE_SELF);
+	free(dir);
+	return wd > 0 ? wd : 0;
+}
+#else
+# define log_file_watched(f) 0
+#endif
+
+/* Write LEN bytes of LINES lines to the log file. */
+static void write_log(logFile_t *log_file, const char *msg, int len,
+		unsigned lines UNUSED_PARAM, time_t now)
 {
 #ifdef SYSLOGD_WRLOCK
 	struct flock fl;
 #endif
-	int len = strlen(msg);
+	ssize_t written;
 
 	if (log_file->fd >= 0) {
 		/* Reopen log file every second. This allows admin
 		 * to delete the file and not worry about restarting us.
 		 * This costs almost nothing since it happens
 		 * _at most_ once a second.
+		 * With inotify, we reopen only when it's really gone.
 		 */
-		if (!now)
-			now = time(NULL);
-		if (G.last_log_time != now) {
-			G.last_log_time = now;
-			close(log_file->fd);
-			goto reopen;
+		if (!log_file_watched(log_file)) {
+			if (!now)
+				now = time(NULL);
+			if (G.last_log_time != now) {
+				G.last_log_time = now;
+				close(log_file->fd);
+				goto reopen;
+			}
 		}
 	} else {
  reopen:
@@ -557,8 +654,13 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 			full_write(fd, msg, len);
 			if (fd != 2)
 				close(fd);
+			IF_FEATURE_SYSLOGD_BATCH(G.stat_dropped += lines;)
 			return;
 		}
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+		if (G.inotify_fd >= 0)
+			log_file->wd = watch_log_dir(log_file->path);
+#endif
 #if ENABLE_FEATURE_ROTATE_LOGFILE
 		{
 			struct stat statf;
@@ -611,15 +713,108 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 		}
 		ftruncate(log_file->fd, 0);
 	}
-	log_file->size +=
 #endif
-			full_write(log_file->fd, msg, len);
+	written = full_write(log_file->fd, msg, len);
+#if ENABLE_FEATURE_ROTATE_LOGFILE
+	log_file->size += written;
+#endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	if (written == len)
+		G.stat_written += lines;
+	else
+		G.stat_dropped += lines;
+#endif
 #ifdef SYSLOGD_WRLOCK
 	fl.l_type = F_UNLCK;
 	fcntl(log_file->fd, F_SETLKW, &fl);
 #endif
 }
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+static void flush_log(logFile_t *log_file)
+{
+	if (log_file->buf_len) {
+		write_log(log_file, log_file->buf, log_file->buf_len, log_file->buf_lines, 0);
+		log_file->buf_len = 0;
+		log_file->buf_lines = 0;
+	}
+}
+
+static void flush_logs(void)
+{
+#if ENABLE_FEATURE_SYSLOGD_CFG
+	logRule_t *rule;
+
+	for (rule = G.log_rules; rule; rule = rule->next)
+		flush_log(rule->file);
+#endif
+	flush_log(&G.logFile);
+	G.log_pending = 0;
+}
+
+/* Close the file if it's (or its dir is) renamed or deleted,
+ * next write will open a new one. WD < 0: all of them */
+static void reopen_log(logFile_t *log_file, int wd, uint32_t mask, const char *name)
+{
+	if (log_file->fd < 0 || (wd >= 0 && log_file->wd != wd))
+		return;
+	if (name && strcmp(name, bb_basename(log_file->path)) != 0)
+		return;
+	if (mask & IN_IGNORED) /* watch is gone */
+		log_file->wd = 0;
+	/* the rest goes to the old file */
+	flush_log(log_file);
+	close(log_file->fd);
+	log_file->fd = -1;
+}
+
+static void read_inotify(void)
+{
+	/* room for at least one event with the longest name */
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1] ALIGNED(sizeof(long));
+	char *p;
+	ssize_t n;
+
+	n = safe_read(G.inotify_fd, buf, sizeof(buf));
+	for (p = buf; p < buf + n; ) {
+		struct inotify_event *ie = (void *)p;
+		const char *name = ie->len ? ie->name : NULL;
+#if ENABLE_FEATURE_SYSLOGD_CFG
+		logRule_t *rule;
+
+		for (rule = G.log_rules; rule; rule = rule->next)
+			reopen_log(rule->file, ie->wd, ie->mask, name);
+#endif
+		reopen_log(&G.logFile, ie->wd, ie->mask, name);
+		p += sizeof(*ie) + ie->len;
+	}
+}
+#endif
+
+/* Print a message to the log file. */
+static void log_locally(time_t now, char *msg, logFile_t *log_file)
+{
+	int len = strlen(msg);
+
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	if (log_file->buf_len + len > LOG_BUF_SIZE)
+		flush_log(log_file);
+	if (len <= LOG_BUF_SIZE) {
+		if (!log_file->buf)
+			log_file->buf = xmalloc(LOG_BUF_SIZE);
+		memcpy(log_file->buf + log_file->buf_len, msg, len);
+		log_file->buf_len += len;
+		log_file->buf_lines++;
+		if (!G.log_pending) {
+			G.log_pending = 1;
+			G.pending_since = monotonic_ms();
+		}
+		return;
+	}
+#endif
+	write_log(log_file, msg, len, 1, now);
+}
+
 static void parse_fac_prio_20(int pri, char *res20)
 {
 	const CODE *c_pri, *c_fac;
@@ -687,6 +882,7 @@ static void timestamp_and_log(int pri, char *msg, int len)
 #if ENABLE_FEATURE_IPC_SYSLOG
 		if ((option_mask32 & OPT_circularlog) && G.shbuf) {
 			log_to_shmem(G.printbuf);
+			IF_FEATURE_SYSLOGD_BATCH(G.stat_written++;)
 			return;
 		}
 #endif
@@ -801,19 +997,129 @@ static int try_to_resolve_remote(remoteHost_t *rh)
 }
 #endif
 
-static void do_syslogd(void) NORETURN;
-static void do_syslogd(void)
+/* Deal with a message in recvbuf[0..sz).
+ * recvbuf must have room for one more byte. */
+static void process_msg(char *recvbuf, int sz)
 {
-	int sock_fd;
 #if ENABLE_FEATURE_REMOTE_LOG
 	llist_t *item;
 #endif
+
+	/* Drop trailing '\n' and NULs (typically there is one NUL) */
+	while (1) {
+		if (sz == 0)
+			return;
+		/* man 3 syslog says: "A trailing newline is added when needed".
+		 * However, neither glibc nor uclibc do this:
+		 * syslog(prio, "test")   sends "test\0" to /dev/log,
+		 * syslog(prio, "test\n") sends "test\n\0".
+		 * IOW: newline is passed verbatim!
+		 * I take it to mean that it's syslogd's job
+		 * to make those look identical in the log files. */
+		if (recvbuf[sz-1] != '\0' && recvbuf[sz-1] != '\n')
+			break;
+		sz--;
+	}
 #if ENABLE_FEATURE_SYSLOGD_DUP
-	int last_sz = -1;
-	char *last_buf;
-	char *recvbuf = G.recvbuf;
-#else
-#define recvbuf (G.recvbuf)
+	if ((option_mask32 & OPT_dup) && (sz == G.last_sz))
+		if (memcmp(G.last_buf, recvbuf, sz) == 0)
+			return;
+	G.last_sz = sz;
+	G.last_buf = recvbuf;
+#endif
+#if ENABLE_FEATURE_REMOTE_LOG
+	/* Stock syslogd sends it '\n'-terminated
+	 * over network, mimic that */
+	recvbuf[sz] = '\n';
+
+	/* We are not modifying log messages in any way before send */
+	/* Remote site cannot trust _us_ anyway and need to do validation again */
+	for (item = G.remoteHosts; item != NULL; item = item->link) {
+		remoteHost_t *rh = (remoteHost_t *)item->data;
+
+		if (rh->remoteFD == -1) {
+			rh->remoteFD = try_to_resolve_remote(rh);
+			if (rh->remoteFD == -1)
+				continue;
+		}
+
+		/* Send message to remote logger.
+		 * On some errors, close and set remoteFD to -1
+		 * so that DNS resolution is retried.
+		 */
+		if (sendto(rh->remoteFD, recvbuf, sz+1,
+				MSG_DONTWAIT | MSG_NOSIGNAL,
+				&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
+		) {
+			switch (errno) {
+			case ECONNRESET:
+			case ENOTCONN: /* paranoia */
+			case EPIPE:
+				close(rh->remoteFD);
+				rh->remoteFD = -1;
+				free(rh->remoteAddr);
+				rh->remoteAddr = NULL;
+			}
+		}
+	}
+#endif
+	if (!ENABLE_FEATURE_REMOTE_LOG || (option_mask32 & OPT_locallog)) {
+		recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
+		split_escape_and_log(recvbuf, sz);
+	}
+}
+
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+static void record_usr1(int sig UNUSED_PARAM)
+{
+	G.want_stats = 1;
+}
+
+static void log_stats(void)
+{
+	char msg[96];
+
+	sprintf(msg, "syslogd: %u messages received, %u written, %u dropped",
+			G.stat_received, G.stat_written, G.stat_dropped);
+	timestamp_and_log_internal(msg);
+}
+
+/* Wait for one message (not if lines are waiting to be flushed),
+ * take all which are there, up to RECV_BATCH */
+static int recv_batch(int fd)
+{
+	int n;
+# if HAVE_RECVMMSG
+	int i;
+
+	n = recvmmsg(fd, G.mmsg, RECV_BATCH,
+			G.log_pending ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+	for (i = 0; i < n; i++)
+		G.recv_len[i] = G.mmsg[i].msg_len;
+# else
+	for (n = 0; n < RECV_BATCH; n++) {
+		ssize_t sz = recv(fd, G.recvbuf + n * MAX_READ, MAX_READ - 1,
+				(n || G.log_pending) ? MSG_DONTWAIT : 0);
+		if (sz < 0) {
+			/* Like recvmmsg, an error after the first message
+			 * just ends the batch */
+			if (n == 0)
+				return sz;
+			break;
+		}
+		G.recv_len[n] = sz;
+	}
+# endif
+	return n;
+}
+#endif
+
+static void do_syslogd(void) NORETURN;
+static void do_syslogd(void)
+{
+	int sock_fd;
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	int i;
 #endif
 
 	/* Set up signal handlers (so that they interrupt read()) */
@@ -824,6 +1130,21 @@ static void do_syslogd(void)
 #ifdef SYSLOGD_MARK
 	signal(SIGALRM, do_mark);
 	alarm(G.markInterval);
+#endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	signal_no_SA_RESTART_empty_mask(SIGUSR1, record_usr1);
+	G.inotify_fd = inotify_init();
+# if HAVE_RECVMMSG
+	for (i = 0; i < RECV_BATCH; i++) {
+		G.iov[i].iov_base = G.recvbuf + i * MAX_READ;
+		G.iov[i].iov_len = MAX_READ - 1;
+		G.mmsg[i].msg_hdr.msg_iov = &G.iov[i];
+		G.mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+# endif
+#endif
+#if ENABLE_FEATURE_SYSLOGD_DUP
+	G.last_sz = -1;
 #endif
 	sock_fd = create_socket();
 
@@ -834,92 +1155,80 @@ static void do_syslogd(void)
 	timestamp_and_log_internal("syslogd started: BusyBox v" BB_VER);
 
 	while (!bb_got_signal) {
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+		int n;
+
+		if (G.want_stats) {
+			G.want_stats = 0;
+			log_stats();
+		}
+		if (G.inotify_fd >= 0) {
+			struct pollfd pfd[2];
+
+			pfd[0].fd = sock_fd;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = G.inotify_fd;
+			pfd[1].events = POLLIN;
+			/* Lines wait in buffers only while more are coming */
+			if (poll(pfd, 2, G.log_pending ? 0 : -1) < 0)
+				continue; /* EINTR: a signal */
+			if (pfd[1].revents)
+				read_inotify();
+			if (!pfd[0].revents) {
+				if (G.log_pending)
+					flush_logs();
+				continue;
+			}
+		}
+		n = recv_batch(sock_fd);
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				flush_logs();
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			bb_perror_msg("read from /dev/log");
+			break;
+		}
+		G.stat_received += n;
+		for (i = 0; i < n; i++)
+			process_msg(G.recvbuf + i * MAX_READ, G.recv_len[i]);
+		if (G.log_pending
+		 && (n < RECV_BATCH || (unsigned)(monotonic_ms() - G.pending_since) >= LOG_FLUSH_MS)
+		) {
+			flush_logs();
+		}
+#else
 		ssize_t sz;
 
-#if ENABLE_FEATURE_SYSLOGD_DUP
-		last_buf = recvbuf;
-		if (recvbuf == G.recvbuf)
-			recvbuf = G.recvbuf + MAX_READ;
-		else
-			recvbuf = G.recvbuf;
-#endif
- read_again:
-		sz = read(sock_fd, recvbuf, MAX_READ - 1);
+		sz = read(sock_fd, G.recvbuf, MAX_READ - 1);
 		if (sz < 0) {
 			if (!bb_got_signal)
 				bb_perror_msg("read from /dev/log");
 			break;
 		}
-
-		/* Drop trailing '\n' and NULs (typically there is one NUL) */
-		while (1) {
-			if (sz == 0)
-				goto read_again;
-			/* man 3 syslog says: "A trailing newline is added when needed".
-			 * However, neither glibc nor uclibc do this:
-			 * syslog(prio, "test")   sends "test\0" to /dev/log,
-			 * syslog(prio, "test\n") sends "test\n\0".
-			 * IOW: newline is passed verbatim!
-			 * I take it to mean that it's syslogd's job
-			 * to make those look identical in the log files. */
-			if (recvbuf[sz-1] != '\0' && recvbuf[sz-1] != '\n')
-				break;
-			sz--;
-		}
-#if ENABLE_FEATURE_SYSLOGD_DUP
-		if ((option_mask32 & OPT_dup) && (sz == last_sz))
-			if (memcmp(last_buf, recvbuf, sz) == 0)
-				continue;
-		last_sz = sz;
+		process_msg(G.recvbuf, sz);
 #endif
-#if ENABLE_FEATURE_REMOTE_LOG
-		/* Stock syslogd sends it '\n'-terminated
-		 * over network, mimic that */
-		recvbuf[sz] = '\n';
-
-		/* We are not modifying log messages in any way before send */
-		/* Remote site cannot trust _us_ anyway and need to do validation again */
-		for (item = G.remoteHosts; item != NULL; item = item->link) {
-			remoteHost_t *rh = (remoteHost_t *)item->data;
-
-			if (rh->remoteFD == -1) {
-				rh->remoteFD = try_to_resolve_remote(rh);
-				if (rh->remoteFD == -1)
-					continue;
-			}
-
-			/* Send message to remote logger.
-			 * On some errors, close and set remoteFD to -1
-			 * so that DNS resolution is retried.
-			 */
-			if (sendto(rh->remoteFD, recvbuf, sz+1,
-					MSG_DONTWAIT | MSG_NOSIGNAL,
-					&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
-			) {
-				switch (errno) {
-				case ECONNRESET:
-				case ENOTCONN: /* paranoia */
-				case EPIPE:
-					close(rh->remoteFD);
-					rh->remoteFD = -1;
-					free(rh->remoteAddr);
-					rh->remoteAddr = NULL;
-				}
-			}
+#if ENABLE_FEATURE_SYSLOGD_DUP
+		/* Next recv overwrites it, keep a copy */
+		if (G.last_sz > 0 && G.last_buf != G.recvbuf + RECV_BATCH * MAX_READ) {
+			G.last_buf = memcpy(G.recvbuf + RECV_BATCH * MAX_READ, G.last_buf, G.last_sz);
 		}
 #endif
-		if (!ENABLE_FEATURE_REMOTE_LOG || (option_mask32 & OPT_locallog)) {
-			recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
-			split_escape_and_log(recvbuf, sz);
-		}
 	} /* while (!bb_got_signal) */
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	log_stats();
+#endif
 	timestamp_and_log_internal("syslogd exiting");
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	flush_logs();
+#endif
 	puts("syslogd exiting");
 	if (ENABLE_FEATURE_IPC_SYSLOG)
 		ipcsyslog_cleanup();
 	kill_myself_with_sig(bb_got_signal);
-#undef recvbuf
 }
 
 int syslogd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
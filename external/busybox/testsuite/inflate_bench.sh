@@ -0,0 +1,113 @@
+#!/bin/bash
+# Throughput benchmark for gunzip's inflate.
+#
+# Usage: inflate_bench.sh BUSYBOX [OLD_BUSYBOX]
+#
+# Generates a fixed corpus (the same on every run and every machine),
+# compresses it with the host's gzip -1/-6/-9 (busybox gzip ignores
+# the level) and reports decompression speed of "BUSYBOX gunzip -c"
+# (and of OLD_BUSYBOX, for comparison - e.g. a build with
+# CONFIG_FEATURE_INFLATE_FAST off). Output is verified against the corpus.
+#
+# Set RUNS to change number of runs per file (best one is reported).
+# Set HOST_GZIP to use another compressor than "gzip" from $PATH.
+
+new=$1
+old=$2
+runs=${RUNS:-5}
+
+if [ -z "$new" ] || [ ! -x "$new" ]; then
+	echo "Usage: $0 BUSYBOX [OLD_BUSYBOX]" >&2
+	exit 1
+fi
+# Not "GZIP": gzip takes options from that environment variable
+host_gzip=${HOST_GZIP:-gzip}
+if ! command -v "$host_gzip" >/dev/null; then
+	echo "$0: $host_gzip not found, set HOST_GZIP" >&2
+	exit 1
+fi
+
+export LC_ALL=C
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+# Text: English-like words, some long repeats
+awk 'BEGIN {
+	split("the of and to in is was that for it with as his on be at by " \
+	      "had are but from or have an they which one you were her all " \
+	      "busybox kernel module device driver buffer socket", w, " ");
+	n = 0; for (i in w) n++;
+	x = 12345;
+	for (line = 0; line < 200000; line++) {
+		s = "";
+		len = 5 + line % 11;
+		for (j = 0; j < len; j++) {
+			x = (x * 69069 + 1) % 4294967296;
+			s = s w[1 + int(x / 65536) % n] " ";
+		}
+		print line % 97 == 0 ? s s : s;
+	}
+}' >"$tmp/text"
+
+# Binary-like: skewed byte distribution, short matches
+awk 'BEGIN {
+	x = 54321;
+	for (i = 0; i < 4000000; i++) {
+		x = (x * 69069 + 1) % 4294967296;
+		v = int(x / 16777216);
+		if (v >= 128) v = v % 16;
+		printf "%c", v;
+	}
+}' >"$tmp/binary"
+
+# Concatenation of both: long distances, switching statistics
+cat "$tmp/text" "$tmp/binary" "$tmp/text" >"$tmp/mixed"
+
+# Prints best time of $runs runs in milliseconds
+best_ms()
+{
+	local best= i t0 t1 ms
+	for i in $(seq $runs); do
+		t0=$(date +%s%N)
+		"$@" >/dev/null || return 1
+		t1=$(date +%s%N)
+		ms=$(( (t1 - t0) / 1000000 ))
+		[ -z "$best" ] || [ $ms -lt $best ] && best=$ms
+	done
+	echo $best
+}
+
+printf "%-12s %10s %10s" "file" "size" "compr"
+printf " %14s" "new MB/s"
+[ -n "$old" ] && printf " %14s %8s" "old MB/s" "speedup"
+echo
+
+for f in text binary mixed; do
+	for level in 1 6 9; do
+		gz="$tmp/$f.$level.gz"
+		"$host_gzip" -$level -n -c "$tmp/$f" >"$gz" || exit 1
+		size=$(wc -c <"$tmp/$f")
+		csize=$(wc -c <"$gz")
+
+		"$new" gunzip -c "$gz" | cmp -s - "$tmp/$f" || {
+			echo "$f -$level: $new gunzip: wrong output" >&2
+			exit 1
+		}
+		t_new=$(best_ms "$new" gunzip -c "$gz")
+		[ $t_new -gt 0 ] || t_new=1
+		printf "%-12s %10s %10s %14s" "$f -$level" $size $csize \
+			$(( size / 1000 / t_new ))
+
+		if [ -n "$old" ]; then
+			"$old" gunzip -c "$gz" | cmp -s - "$tmp/$f" || {
+				echo "$f -$level: $old gunzip: wrong output" >&2
+				exit 1
+			}
+			t_old=$(best_ms "$old" gunzip -c "$gz")
+			[ $t_old -gt 0 ] || t_old=1
+			printf " %14s %8s" $(( size / 1000 / t_old )) \
+				$(( t_old * 100 / t_new ))%
+		fi
+		echo
+	done
+done